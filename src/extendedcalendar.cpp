@@ -38,20 +38,44 @@
 
 #include "extendedcalendar.h"
 #include "sqlitestorage.h"
+#include "geoindex_p.h"
+#include "intervalindex_p.h"
+#include "zoneoffsets_p.h"
 #include "logging_p.h"
 
 #include <KCalendarCore/CalFilter>
 #include <KCalendarCore/Sorting>
 using namespace KCalendarCore;
 
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtCore/QDir>
 #include <QtCore/QFileInfo>
+#include <QtCore/QFuture>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QThread>
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 // #ifdef to control expensive/spammy debug stmts
 #undef DEBUG_EXPANSION
 
+// Minimum number of incidences per thread for parallel expansion.
+#define PARALLEL_EXPANSION_MIN 32
+
+// Maximum window of cached recurrence times, in seconds.
+#define RECURRENCE_TIMES_SPAN (2 * 366 * 86400)
+
+// Extra window of zone transitions around expansion ranges, in seconds.
+#define ZONE_OFFSETS_MARGIN (31 * 86400)
+
+// Spans beyond this many seconds from epoch are considered unbounded
+// when invalidating the day occupancy.
+#define DAY_OCCUPANCY_BOUND (Q_INT64_C(1) << 40)
+
 namespace {
     // QDateTime::toClockTime() has the semantic that the input is first
     // converted to the local system timezone, before having its timezone
@@ -95,16 +119,86 @@ class mKCal::ExtendedCalendar::Private
 {
 public:
     Private()
+        : mParallelExpansion(false)
     {
     }
     ~Private()
     {
     }
-    Incidence::List mGeoIncidences;                  // list of all Geo Incidences
+    GeoIndex mGeoIndex;                              // all Geo Incidences
     QMultiHash<QString, Incidence::Ptr>mAttendeeIncidences; // lists of incidences for attendees
+    IntervalIndex mEventIndex;                       // events by time span
+    IntervalIndex mTodoIndex;                        // todos by time span
+    IntervalIndex mJournalIndex;                     // journals by time span
+    bool mParallelExpansion;
+    QHash<int, QHash<const Incidence*, Incidence::Ptr>> mBuckets; // incidences by bucketKey()
+    QHash<const Incidence*, int> mBucketKeys;        // bucket of each incidence
+    // Incidences with a notebook by duplicateKey(), like Calendar::duplicates().
+    QMultiHash<QPair<qint64, QString>, Incidence::Ptr> mDuplicateIndex;
+    QHash<QString, QMap<QDate, QVector<int>>> mDayOccupancy; // day counts by notebook and month
 
     void addIncidenceToLists(const Incidence::Ptr &incidence);
     void removeIncidenceFromLists(const Incidence::Ptr &incidence);
+    IntervalIndex *intervalIndex(const Incidence::Ptr &incidence);
+
+    /**
+     * Incidences are sorted in buckets by type, completion, date
+     * presence and geo presence, so queries on these properties only
+     * visit the matching incidences.
+     */
+    enum BucketFlag {
+        BucketCompleted = 0x1,
+        BucketDated = 0x2,
+        BucketGeo = 0x4
+    };
+    static int bucketKey(const Incidence::Ptr &incidence);
+
+    /**
+     * The properties compared by Calendar::duplicates(): start time,
+     * or none when invalid, and summary.
+     */
+    static QPair<qint64, QString> duplicateKey(const Incidence::Ptr &incidence);
+    static int bucketKey(Incidence::IncidenceType type, bool completed, bool dated, bool geo);
+
+    /**
+     * Returns the incidences of type T in the buckets matching the
+     * given properties, hasGeo being ignored when negative.
+     */
+    template <typename T>
+    QVector<QSharedPointer<T>> bucket(Incidence::IncidenceType type, bool completed,
+                                      bool dated, int hasGeo) const
+    {
+        QVector<QSharedPointer<T>> list;
+        for (int geo = 0; geo < 2; geo++) {
+            if (hasGeo >= 0 && bool(hasGeo) != bool(geo)) {
+                continue;
+            }
+            const QHash<const Incidence*, Incidence::Ptr> incidences =
+                mBuckets.value(bucketKey(type, completed, dated, geo));
+            list.reserve(list.count() + incidences.count());
+            for (const Incidence::Ptr &incidence : incidences) {
+                list.append(incidence.staticCast<T>());
+            }
+        }
+        return list;
+    }
+
+    template <typename T>
+    static QVector<QSharedPointer<T>> candidates(const IntervalIndex &index,
+                                                 const QDateTime &start, const QDateTime &end,
+                                                 bool endless = false)
+    {
+        QVector<QSharedPointer<T>> list;
+        Incidence::List incidences = index.intersecting(start, end);
+        if (endless) {
+            incidences += index.endlessAfter(end);
+        }
+        list.reserve(incidences.count());
+        for (const Incidence::Ptr &incidence : incidences) {
+            list.append(incidence.staticCast<T>());
+        }
+        return list;
+    }
 
     /**
      * Figure when particular recurrence of an incidence starts.
@@ -131,6 +225,165 @@ public:
     static QDateTime incidenceEndTime(const KCalendarCore::Incidence::Ptr &incidence,
                                       const QDateTime start,
                                       bool endWithinDay);
+
+    /**
+     * Split a list of incidences into parts expanded by different
+     * threads, or keep it whole if parallel expansion is disabled or
+     * not worth it.
+     */
+    template <typename T>
+    QVector<QVector<T>> expansionParts(const QVector<T> &list) const
+    {
+        QVector<QVector<T>> parts;
+        const int count = mParallelExpansion
+            ? qMin(QThread::idealThreadCount(), list.count() / PARALLEL_EXPANSION_MIN) : 1;
+        if (count <= 1) {
+            parts.append(list);
+            return parts;
+        }
+        // Interleave to share recurring incidences evenly.
+        parts.resize(count);
+        for (int i = 0; i < list.count(); i++) {
+            parts[i % count].append(list[i]);
+        }
+        return parts;
+    }
+
+    /**
+     * The expansion of one part of an incidence list.
+     */
+    struct Expansion {
+        ExpandedIncidenceList list;
+        bool limitHit;
+    };
+
+    /**
+     * Recurrence times of an incidence over a window, in seconds
+     * since epoch, for the revision of the incidence they were
+     * computed from.
+     */
+    struct RecurrenceTimes {
+        int revision;
+        qint64 start;
+        qint64 end;
+        DateTimeList times;
+    };
+    QHash<QString, RecurrenceTimes> mRecurrenceTimes; // by instance identifier
+    QMutex mRecurrenceTimesMutex;                    // guards mRecurrenceTimes and mDayOccupancy
+
+    /**
+     * Same as incidence->recurrence()->timesInInterval(start, end), but
+     * remembering the computed times for the next calls. Cached windows
+     * are extended when the requested one is adjacent or overlapping.
+     */
+    DateTimeList recurrenceTimes(const KCalendarCore::Incidence::Ptr &incidence,
+                                 const QDateTime &start, const QDateTime &end);
+    void clearRecurrenceTimes(const KCalendarCore::Incidence::Ptr &incidence);
+
+    /**
+     * What the cached day occupancy depends on, besides the events
+     * themselves: the time zone, the visible notebooks and the
+     * calendar filter.
+     */
+    struct OccupancyState {
+        QTimeZone zone;
+        QStringList visibleNotebooks;
+        bool filtered = false;
+        int criteria = 0;
+        int completedTimeSpan = 0;
+        QStringList categories;
+        QStringList emails;
+
+        bool operator==(const OccupancyState &other) const
+        {
+            return zone == other.zone && visibleNotebooks == other.visibleNotebooks
+                && filtered == other.filtered && criteria == other.criteria
+                && completedTimeSpan == other.completedTimeSpan
+                && categories == other.categories && emails == other.emails;
+        }
+        bool operator!=(const OccupancyState &other) const
+        {
+            return !(*this == other);
+        }
+    };
+    OccupancyState mOccupancyState;                  // state of mDayOccupancy
+    static OccupancyState occupancyState(const ExtendedCalendar &calendar, const QTimeZone &tz);
+
+    /**
+     * Forget the cached day occupancy of the months an event may
+     * cover, in every notebook.
+     */
+    void clearDayOccupancy(const KCalendarCore::Incidence::Ptr &incidence);
+
+    /**
+     * Append the occurrences of one event to eventList, as
+     * done by rawExpandedEvents().
+     */
+    void expandEvent(const KCalendarCore::Event::Ptr &ev, const QDate &start,
+                     const QDateTime &ksdt, const QDateTime &kedt,
+                     bool startInclusive, bool endInclusive,
+                     const QTimeZone &tz, ZoneOffsets *offsets,
+                     ExpandedIncidenceList *eventList);
+
+    /**
+     * Call sink(start, end) with the times of each occurrence of one
+     * event returned by rawExpandedEvents(). The times are given in
+     * seconds since epoch for recurring events, and as date times
+     * in tz otherwise.
+     */
+    template <typename Sink>
+    void expandEventTimes(const KCalendarCore::Event::Ptr &ev, const QDate &start,
+                          const QDateTime &ksdt, const QDateTime &kedt,
+                          bool startInclusive, bool endInclusive,
+                          const QTimeZone &tz, ZoneOffsets *offsets,
+                          Sink sink);
+
+    /**
+     * Occurrence times, in seconds since epoch, with the position
+     * of their event in the expanded list, as collected for
+     * occurrenceTable().
+     */
+    struct OccurrenceRows {
+        QVector<qint64> starts;
+        QVector<qint64> ends;
+        QVector<int> positions;
+
+        void operator()(qint64 tsStart, qint64 tsEnd)
+        {
+            starts.append(tsStart);
+            ends.append(tsEnd);
+            positions.append(current);
+        }
+        void operator()(const QDateTime &tsStartTime, const QDateTime &tsEndTime)
+        {
+            (*this)(tsStartTime.toSecsSinceEpoch(), tsEndTime.toSecsSinceEpoch());
+        }
+        void expandEvent(Private *d, const KCalendarCore::Event::Ptr &ev, int position,
+                         const QDate &start, const QDateTime &ksdt, const QDateTime &kedt,
+                         bool startInclusive, bool endInclusive,
+                         const QTimeZone &tz, ZoneOffsets *offsets)
+        {
+            current = position;
+            d->expandEventTimes<OccurrenceRows &>(ev, start, ksdt, kedt, startInclusive, endInclusive,
+                                                  tz, offsets, *this);
+        }
+
+        int current = -1;
+    };
+
+    /**
+     * Append the occurrences of one incidence to returnList, as
+     * done by expandRecurrences(). The returnList is not sorted.
+     */
+    static void expandIncidence(const KCalendarCore::Incidence::Ptr &incidence,
+                                const QDateTime &dtStart, const QDateTime &dtEnd,
+                                int maxExpand, const QTimeZone &tz,
+                                ExpandedIncidenceList *returnList, bool *expandLimitHit);
+
+    /**
+     * Merge sorted lists of expanded incidences into one sorted list.
+     */
+    static ExpandedIncidenceList mergeExpansions(const QVector<ExpandedIncidenceList> &lists);
 };
 
 ExtendedCalendar::ExtendedCalendar(const QTimeZone &timeZone)
@@ -148,6 +401,16 @@ ExtendedCalendar::~ExtendedCalendar()
     delete d;
 }
 
+void ExtendedCalendar::setParallelExpansion(bool enabled)
+{
+    d->mParallelExpansion = enabled;
+}
+
+bool ExtendedCalendar::parallelExpansion() const
+{
+    return d->mParallelExpansion;
+}
+
 bool ExtendedCalendar::reload()
 {
     // Doesn't belong here.
@@ -162,8 +425,16 @@ bool ExtendedCalendar::save()
 
 void ExtendedCalendar::close()
 {
-    d->mGeoIncidences.clear();
+    d->mGeoIndex.clear();
     d->mAttendeeIncidences.clear();
+    d->mEventIndex.clear();
+    d->mTodoIndex.clear();
+    d->mJournalIndex.clear();
+    d->mBuckets.clear();
+    d->mBucketKeys.clear();
+    d->mDuplicateIndex.clear();
+    d->mRecurrenceTimes.clear();
+    d->mDayOccupancy.clear();
     MemoryCalendar::close();
 }
 
@@ -294,6 +565,42 @@ bool ExtendedCalendar::deleteIncidence(const Incidence::Ptr &incidence)
     return Calendar::deleteIncidence(incidence);
 }
 
+bool ExtendedCalendar::unloadIncidence(const Incidence::Ptr &incidence)
+{
+    const bool modified = isModified();
+    const bool tracking = deletionTracking();
+
+    // Like in MemoryCalendar::close(), observers are only disabled
+    // during the removal, they are enabled otherwise.
+    setObserversEnabled(false);
+    setDeletionTracking(false);
+    const bool removed = deleteIncidence(incidence);
+    setDeletionTracking(tracking);
+    setObserversEnabled(true);
+    setModified(modified);
+
+    return removed;
+}
+
+bool ExtendedCalendar::setNotebook(const Incidence::Ptr &incidence, const QString &notebook)
+{
+    const QString previous = incidence ? this->notebook(incidence) : QString();
+    if (!MemoryCalendar::setNotebook(incidence, notebook)) {
+        return false;
+    }
+
+    d->mDuplicateIndex.remove(Private::duplicateKey(incidence), incidence);
+    if (!notebook.isEmpty()) {
+        d->mDuplicateIndex.insert(Private::duplicateKey(incidence), incidence);
+    }
+    // Added incidences get their first notebook, their months are
+    // already dropped by addIncidenceToLists().
+    if (!previous.isEmpty() && previous != notebook) {
+        d->clearDayOccupancy(incidence);
+    }
+    return true;
+}
+
 bool ExtendedCalendar::addEvent(const Event::Ptr &aEvent)
 {
     return addEvent(aEvent, defaultNotebook());
@@ -401,6 +708,9 @@ void ExtendedCalendar::incidenceUpdated(const QString &uid, const QDateTime &rec
     }
 
     d->addIncidenceToLists(incidence);
+    if (!notebook(incidence).isEmpty()) {
+        d->mDuplicateIndex.insert(Private::duplicateKey(incidence), incidence);
+    }
     MemoryCalendar::incidenceUpdated(uid, recurrenceId);
 }
 
@@ -410,174 +720,353 @@ ExtendedCalendar::ExpandedIncidenceList ExtendedCalendar::rawExpandedEvents(cons
 {
     ExpandedIncidenceList eventList;
 
-    const QTimeZone &tz = timeZone.isValid() ? timeZone : this->timeZone();
+    const QTimeZone tz = timeZone.isValid() ? timeZone : this->timeZone();
     QDateTime ksdt(start, QTime(0, 0, 0), tz);
     QDateTime kedt = QDateTime(end.addDays(1), QTime(0, 0, 0), tz);
 
-    // Iterate over all events. Look for recurring events that occur on this date
-    const Event::List events(rawEvents());
-    for (const Event::Ptr &ev: events) {
-        if (isVisible(ev)) {
-            const bool asClockTime = ev->dtStart().timeSpec() == Qt::LocalTime;
-            const QDateTime startTime = ev->dtStart();
-            const QDateTime endTime = ev->dtEnd();
-            const QDateTime rangeStartTime = (ev->allDay() && asClockTime)
-                                           ? QDateTime(start, QTime()) : ksdt;
-            const QDateTime rangeEndTime = (ev->allDay() && asClockTime)
-                                         ? QDateTime(kedt.date(), QTime()) : kedt;
-            const QDateTime tsRangeStartTime = kdatetimeAsTimeSpec(rangeStartTime, tz);
-            const QDateTime tsRangeEndTime = kdatetimeAsTimeSpec(rangeEndTime, tz);
-            if (ev->recurs()) {
-                int extraDays = (ev->isMultiDay() && !startInclusive)
-                              ? startTime.date().daysTo(endTime.date())
-                              : (ev->allDay() ? 1 : 0);
-                const QDateTime tsAdjustedRangeStartTime(tsRangeStartTime.addDays(-extraDays));
-                const DateTimeList times = ev->recurrence()->timesInInterval(tsAdjustedRangeStartTime, tsRangeEndTime);
-                for (const QDateTime &timeInInterval : times) {
-                    const QDateTime tsStartTime = kdatetimeAsTimeSpec(timeInInterval, tz);
-                    const QDateTime tsEndTime = Duration(startTime, endTime).end(tsStartTime);
-                    if (tsStartTime >= tsRangeEndTime
-                            || tsEndTime <= tsAdjustedRangeStartTime
-                            || (endInclusive && (tsEndTime > tsRangeEndTime))) {
-                        continue;
-                    }
-                    ExpandedIncidenceValidity eiv = {tsStartTime, tsEndTime};
-                    eventList.append(qMakePair(eiv, ev.dynamicCast<Incidence>()));
-                }
-            } else {
-                const QDateTime tsStartTime = kdatetimeAsTimeSpec(startTime, tz);
-                const QDateTime tsEndTime = kdatetimeAsTimeSpec(endTime, tz);
-                if (ev->isMultiDay()) {
-                    if ((startInclusive == false || tsStartTime >= tsRangeStartTime) &&
-                            tsStartTime <= tsRangeEndTime && tsEndTime >= tsRangeStartTime &&
-                            (endInclusive == false || tsEndTime <= tsRangeEndTime)) {
-                        ExpandedIncidenceValidity eiv = {tsStartTime, tsEndTime};
-                        eventList.append(qMakePair(eiv, ev.dynamicCast<Incidence>()));
-                    }
-                } else {
-                    if (tsStartTime >= tsRangeStartTime && tsStartTime <= tsRangeEndTime) {
-                        ExpandedIncidenceValidity eiv = {tsStartTime, tsEndTime};
-                        eventList.append(qMakePair(eiv, ev.dynamicCast<Incidence>()));
-                    }
+    // Iterate over events around this range. Look for recurring events that occur on this date
+    Event::List events(d->candidates<Event>(d->mEventIndex, ksdt, kedt));
+    events.erase(std::remove_if(events.begin(), events.end(),
+                                [this] (const Event::Ptr &ev) {return !isVisible(ev);}),
+                 events.end());
+
+    // Zone transitions over the range, with room for multi day occurrences.
+    ZoneOffsets offsets(ksdt.toSecsSinceEpoch() - ZONE_OFFSETS_MARGIN,
+                        kedt.toSecsSinceEpoch() + ZONE_OFFSETS_MARGIN);
+
+    const QVector<Event::List> parts = d->expansionParts(events);
+    if (parts.count() > 1) {
+        QVector<QFuture<ExpandedIncidenceList>> futures;
+        for (const Event::List &part : parts) {
+            futures.append(QtConcurrent::run([=] () {
+                ExpandedIncidenceList list;
+                ZoneOffsets partOffsets(offsets);
+                for (const Event::Ptr &ev : part) {
+                    d->expandEvent(ev, start, ksdt, kedt, startInclusive, endInclusive, tz,
+                                   &partOffsets, &list);
                 }
-            }
+                return list;
+            }));
+        }
+        for (QFuture<ExpandedIncidenceList> &future : futures) {
+            eventList += future.result();
+        }
+    } else {
+        for (const Event::Ptr &ev: const_cast<const Event::List&>(events)) {
+            d->expandEvent(ev, start, ksdt, kedt, startInclusive, endInclusive, tz,
+                           &offsets, &eventList);
         }
     }
 
     return eventList;
 }
 
-QDate ExtendedCalendar::nextEventsDate(const QDate &date, const QTimeZone &timeZone)
+OccurrenceTable ExtendedCalendar::occurrenceTable(const QDate &start, const QDate &end,
+                                                  bool startInclusive, bool endInclusive,
+                                                  const QTimeZone &timeZone) const
 {
-    const QTimeZone &tz = timeZone.isValid() ? timeZone : this->timeZone();
+    OccurrenceTable table;
 
-    QDateTime kdt(date, QTime(0, 0, 0), tz);
-    QDateTime tomorrow = kdt.addDays(1);
-    QDateTime almostTomorrow = tomorrow.addSecs(-1);
+    const QTimeZone tz = timeZone.isValid() ? timeZone : this->timeZone();
+    QDateTime ksdt(start, QTime(0, 0, 0), tz);
+    QDateTime kedt = QDateTime(end.addDays(1), QTime(0, 0, 0), tz);
+
+    Event::List events(d->candidates<Event>(d->mEventIndex, ksdt, kedt));
+    events.erase(std::remove_if(events.begin(), events.end(),
+                                [this] (const Event::Ptr &ev) {return !isVisible(ev);}),
+                 events.end());
+
+    // The incidence table is filled first, occurrences only refer
+    // to events by their index.
+    QVector<int> indexes;
+    QVector<int> flags;
+    indexes.reserve(events.count());
+    flags.reserve(events.count());
+    for (const Event::Ptr &ev : const_cast<const Event::List&>(events)) {
+        indexes.append(table.addIncidence(ev, notebook(ev)));
+        flags.append((ev->allDay() ? OccurrenceTable::AllDay : 0)
+                     | (ev->recurs() ? OccurrenceTable::Recurring : 0)
+                     | (ev->transparency() == Event::Transparent ? OccurrenceTable::Transparent : 0)
+                     | (ev->status() == Incidence::StatusCanceled ? OccurrenceTable::Cancelled : 0));
+    }
+
+    ZoneOffsets offsets(ksdt.toSecsSinceEpoch() - ZONE_OFFSETS_MARGIN,
+                        kedt.toSecsSinceEpoch() + ZONE_OFFSETS_MARGIN);
+
+    QVector<int> positions;
+    positions.reserve(events.count());
+    for (int i = 0; i < events.count(); i++) {
+        positions.append(i);
+    }
+    const QVector<QVector<int>> parts = d->expansionParts(positions);
+    QVector<Private::OccurrenceRows> rows;
+    if (parts.count() > 1) {
+        QVector<QFuture<Private::OccurrenceRows>> futures;
+        for (const QVector<int> &part : parts) {
+            futures.append(QtConcurrent::run([=] () {
+                Private::OccurrenceRows partRows;
+                ZoneOffsets partOffsets(offsets);
+                for (int position : part) {
+                    partRows.expandEvent(d, events[position], position, start, ksdt, kedt,
+                                         startInclusive, endInclusive, tz, &partOffsets);
+                }
+                return partRows;
+            }));
+        }
+        for (QFuture<Private::OccurrenceRows> &future : futures) {
+            rows.append(future.result());
+        }
+    } else {
+        rows.resize(1);
+        for (int position = 0; position < events.count(); position++) {
+            rows[0].expandEvent(d, events[position], position, start, ksdt, kedt,
+                                startInclusive, endInclusive, tz, &offsets);
+        }
+    }
 
-    QDateTime rv;
+    for (const Private::OccurrenceRows &part : const_cast<const QVector<Private::OccurrenceRows>&>(rows)) {
+        for (int i = 0; i < part.positions.count(); i++) {
+            const int position = part.positions[i];
+            table.append(part.starts[i], part.ends[i], indexes[position], flags[position]);
+        }
+    }
+    table.sort();
 
-    const Event::List &events(rawEvents());
-    for (const Event::Ptr &ev: events) {
-        if (!isVisible(ev)) {
-            continue;
+    return table;
+}
+
+QVector<int> ExtendedCalendar::dayOccupancy(const QDate &start, const QDate &end,
+                                            const QStringList &notebooks,
+                                            const QTimeZone &timeZone) const
+{
+    QVector<int> counts;
+    if (!start.isValid() || !end.isValid() || end < start) {
+        return counts;
+    }
+    counts.fill(0, start.daysTo(end) + 1);
+
+    const QTimeZone tz = timeZone.isValid() ? timeZone : this->timeZone();
+    const Private::OccupancyState state = Private::occupancyState(*this, tz);
+
+    QStringList uids;
+    for (const QString &uid : notebooks.isEmpty() ? this->notebooks() : notebooks) {
+        if (isVisible(uid)) {
+            uids.append(uid);
         }
-        if (ev->recurs()) {
-            if (ev->isMultiDay()) {
-                int extraDays = ev->dtStart().date().daysTo(ev->dtEnd().date());
-                for (int i = 0; i <= extraDays; ++i) {
-                    if (ev->recursOn(date.addDays(1 - i), tz))
-                        return tomorrow.toTimeZone(tz).date();
+    }
+
+    // Work on a copy of the cache, the lock is not kept over the
+    // expansion that may itself need it.
+    QHash<QString, QMap<QDate, QVector<int>>> occupancy;
+    d->mRecurrenceTimesMutex.lock();
+    if (state != d->mOccupancyState) {
+        d->mDayOccupancy.clear();
+        d->mOccupancyState = state;
+    }
+    for (const QString &uid : const_cast<const QStringList&>(uids)) {
+        occupancy.insert(uid, d->mDayOccupancy.value(uid));
+    }
+    d->mRecurrenceTimesMutex.unlock();
+
+    // Fill the months missing in the cache with a single expansion.
+    const QDate firstMonth(start.year(), start.month(), 1);
+    const QDate lastMonth(end.year(), end.month(), 1);
+    QDate missingFirst;
+    QDate missingLast;
+    for (QDate month = firstMonth; month <= lastMonth; month = month.addMonths(1)) {
+        for (const QString &uid : const_cast<const QStringList&>(uids)) {
+            if (!occupancy.value(uid).contains(month)) {
+                if (!missingFirst.isValid()) {
+                    missingFirst = month;
                 }
+                missingLast = month;
+                break;
             }
-
-            QDateTime next = ev->recurrence()->getNextDateTime(almostTomorrow);
-            next.setTime(QTime(0, 0, 0));
-
-            if (!rv.isValid() || next < rv)
-                rv = next;
-        } else if (ev->isMultiDay()) {
-            QDateTime edate = ev->dtStart();
-            edate.setTime(QTime(0, 0, 0));
-            if (edate > kdt) {
-                if (!rv.isValid() || edate < rv)
-                    rv = edate;
-            } else {
-                edate = ev->dtEnd();
-                edate.setTime(QTime(0, 0, 0));
-                if (edate > kdt)
-                    rv = tomorrow;
+        }
+    }
+    if (missingFirst.isValid()) {
+        const QDate missingEnd = missingLast.addMonths(1);
+        const OccurrenceTable table = occurrenceTable(missingFirst, missingEnd.addDays(-1),
+                                                      false, false, tz);
+        QMutexLocker lock(&d->mRecurrenceTimesMutex);
+        // Counts computed while the state changed are not cached.
+        const bool cache = state == d->mOccupancyState;
+        for (const QString &uid : const_cast<const QStringList&>(uids)) {
+            const int notebookIndex = table.notebooks().indexOf(uid);
+            const QVector<int> days = notebookIndex < 0
+                ? QVector<int>(missingFirst.daysTo(missingEnd), 0)
+                : table.dayCounts(missingFirst, missingFirst.daysTo(missingEnd), tz, notebookIndex);
+            QMap<QDate, QVector<int>> &months = occupancy[uid];
+            for (QDate month = missingFirst; month < missingEnd; month = month.addMonths(1)) {
+                if (!months.contains(month)) {
+                    const QVector<int> monthDays = days.mid(missingFirst.daysTo(month), month.daysInMonth());
+                    months.insert(month, monthDays);
+                    if (cache) {
+                        d->mDayOccupancy[uid].insert(month, monthDays);
+                    }
+                }
             }
-        } else {
-            QDateTime edate = ev->dtStart();
-            edate.setTime(QTime(0, 0, 0));
-            if (edate > kdt && (!rv.isValid() || edate < rv))
-                rv = edate;
         }
+    }
 
-        if (rv == tomorrow)
-            break; // Bail early - you can't beat tomorrow
+    for (const QString &uid : const_cast<const QStringList&>(uids)) {
+        const QMap<QDate, QVector<int>> months = occupancy.value(uid);
+        for (QDate month = firstMonth; month <= lastMonth; month = month.addMonths(1)) {
+            const QVector<int> days = months.value(month);
+            for (int i = 0; i < days.count(); i++) {
+                const qint64 day = start.daysTo(month.addDays(i));
+                if (day >= 0 && day < counts.count()) {
+                    counts[day] += days[i];
+                }
+            }
+        }
     }
 
-    if (!rv.isValid())
-        return QDate();
-    else
-        return rv.toTimeZone(tz).date();
+    return counts;
 }
 
-QDate ExtendedCalendar::previousEventsDate(const QDate &date, const QTimeZone &timeZone)
+/**
+  Returns the indexes in @p table of the notebooks in @p notebooks,
+  or of all its notebooks if empty.
+*/
+static QSet<int> notebookIndexes(const OccurrenceTable &table, const QStringList &notebooks)
 {
-    const QTimeZone &tz = timeZone.isValid() ? timeZone : this->timeZone();
+    QSet<int> indexes;
+    for (int i = 0; i < table.notebooks().count(); i++) {
+        if (notebooks.isEmpty() || notebooks.contains(table.notebooks()[i])) {
+            indexes.insert(i);
+        }
+    }
+    return indexes;
+}
 
-    QDateTime kdt(date, QTime(0, 0, 0), tz);
-    QDateTime yesterday = kdt.addDays(-1);
+/**
+  Returns true if the occurrence at @p row of @p table blocks time.
+*/
+static bool isBusy(const OccurrenceTable &table, int row, const QSet<int> &notebookIndexes)
+{
+    return !(table.flags()[row] & (OccurrenceTable::Transparent | OccurrenceTable::Cancelled))
+        && notebookIndexes.contains(table.notebookIndexes()[row]);
+}
 
-    QDateTime rv;
+Period::List ExtendedCalendar::busyIntervals(const QDateTime &start, const QDateTime &end,
+                                             const QStringList &notebooks) const
+{
+    Period::List periods;
+    if (!start.isValid() || !end.isValid() || end <= start) {
+        return periods;
+    }
 
-    const Event::List events(rawEvents());
-    for (const Event::Ptr &ev: events) {
-        if (!isVisible(ev)) {
+    const QTimeZone tz = timeZone();
+    const qint64 rangeStart = start.toSecsSinceEpoch();
+    const qint64 rangeEnd = end.toSecsSinceEpoch();
+    const OccurrenceTable table = occurrenceTable(start.toTimeZone(tz).date(),
+                                                  end.toTimeZone(tz).date(), false, false, tz);
+    const QSet<int> indexes = notebookIndexes(table, notebooks);
+
+    // Sweep over the occurrences sorted by start, merging overlaps.
+    qint64 busyStart = 0;
+    qint64 busyEnd = 0;
+    bool busy = false;
+    for (int row : table.rowsIntersecting(rangeStart, rangeEnd)) {
+        if (!isBusy(table, row, indexes) || table.ends()[row] <= table.starts()[row]) {
+            continue;
+        }
+        const qint64 rowStart = qMax(table.starts()[row], rangeStart);
+        const qint64 rowEnd = qMin(table.ends()[row], rangeEnd);
+        if (busy && rowStart <= busyEnd) {
+            busyEnd = qMax(busyEnd, rowEnd);
             continue;
         }
-        if (ev->recurs()) {
-            QDateTime prev = ev->recurrence()->getPreviousDateTime(kdt);
-            prev.setTime(QTime(0, 0, 0));
+        if (busy) {
+            periods.append(Period(QDateTime::fromSecsSinceEpoch(busyStart, tz),
+                                  QDateTime::fromSecsSinceEpoch(busyEnd, tz)));
+        }
+        busyStart = rowStart;
+        busyEnd = rowEnd;
+        busy = true;
+    }
+    if (busy) {
+        periods.append(Period(QDateTime::fromSecsSinceEpoch(busyStart, tz),
+                              QDateTime::fromSecsSinceEpoch(busyEnd, tz)));
+    }
 
-            if (ev->isMultiDay()) {
-                prev = prev.addDays(ev->dtStart().date().daysTo(ev->dtEnd().date()));
-                if (prev >= kdt)
-                    return yesterday.toTimeZone(tz).date();
-            }
+    return periods;
+}
 
-            if (!rv.isValid() || prev > rv)
-                rv = prev;
-        } else if (ev->isMultiDay()) {
-            QDateTime edate = ev->dtEnd();
-            edate.setTime(QTime(0, 0, 0));
-            if (edate < kdt) {
-                if (!rv.isValid() || edate > rv)
-                    rv = edate;
-            } else {
-                edate = ev->dtStart();
-                edate.setTime(QTime(0, 0, 0));
-                if (edate < kdt)
-                    rv = yesterday;
-            }
-        } else {
-            QDateTime edate = ev->dtStart();
-            edate.setTime(QTime(0, 0, 0));
-            if (edate < kdt && (!rv.isValid() || edate > rv))
-                rv = edate;
+Incidence::List ExtendedCalendar::conflicts(const Event::Ptr &event,
+                                            const QStringList &notebooks) const
+{
+    Incidence::List list;
+    if (!event || !event->dtStart().isValid()) {
+        return list;
+    }
+
+    const QTimeZone tz = timeZone();
+    QDateTime dtStart = kdatetimeAsTimeSpec(event->dtStart(), tz);
+    QDateTime dtEnd = event->hasEndDate() ? kdatetimeAsTimeSpec(event->dtEnd(), tz) : dtStart;
+    if (event->allDay()) {
+        dtStart = QDateTime(dtStart.date(), QTime(0, 0), tz);
+        dtEnd = QDateTime(dtEnd.date().addDays(1), QTime(0, 0), tz);
+    }
+    const qint64 start = dtStart.toSecsSinceEpoch();
+    // Events without duration still conflict with what they start in.
+    const qint64 end = qMax(dtEnd.toSecsSinceEpoch(), start + 1);
+
+    const OccurrenceTable table = occurrenceTable(dtStart.date(), dtEnd.date(), false, false, tz);
+    const QSet<int> indexes = notebookIndexes(table, notebooks);
+    QSet<int> found;
+    for (int row : table.rowsIntersecting(start, end)) {
+        const int incidenceIndex = table.incidenceIndexes()[row];
+        if (!isBusy(table, row, indexes) || found.contains(incidenceIndex)) {
+            continue;
         }
+        const Incidence::Ptr incidence = table.incidences()[incidenceIndex];
+        if (incidence->uid() == event->uid()) {
+            continue;
+        }
+        found.insert(incidenceIndex);
+        list.append(incidence);
+    }
+
+    return list;
+}
+
+QDate ExtendedCalendar::nextEventsDate(const QDate &date, const QTimeZone &timeZone)
+{
+    const QTimeZone &tz = timeZone.isValid() ? timeZone : this->timeZone();
+
+    QDateTime tomorrow(date.addDays(1), QTime(0, 0, 0), tz);
 
-        if (rv == yesterday)
-            break; // Bail early - you can't beat tomorrow
+    // Only the first occurrence overlapping or after tomorrow is needed.
+    OccurrenceIterator it(*this, tomorrow, OccurrenceIterator::Forward, tz);
+    if (!it.hasNext()) {
+        return QDate();
     }
 
-    if (!rv.isValid())
+    const QDate next = it.next().first.dtStart.toTimeZone(tz).date();
+    return next > tomorrow.date() ? next : tomorrow.date();
+}
+
+QDate ExtendedCalendar::previousEventsDate(const QDate &date, const QTimeZone &timeZone)
+{
+    const QTimeZone &tz = timeZone.isValid() ? timeZone : this->timeZone();
+
+    QDateTime kdt(date, QTime(0, 0, 0), tz);
+    QDate yesterday = date.addDays(-1);
+
+    // Only the occurrence ending last before date is needed.
+    OccurrenceIterator it(*this, kdt, OccurrenceIterator::Backward, tz);
+    if (!it.hasNext()) {
         return QDate();
-    else
-        return rv.toTimeZone(tz).date();
+    }
+
+    const ExpandedIncidence previous = it.next();
+    const QDateTime last = previous.first.dtEnd > previous.first.dtStart
+        ? previous.first.dtEnd.addSecs(previous.second->allDay() ? 0 : -1)
+        : previous.first.dtStart;
+    const QDate prev = last.toTimeZone(tz).date();
+    return prev < yesterday ? prev : yesterday;
 }
 
 
@@ -699,26 +1188,13 @@ Incidence::List ExtendedCalendar::attendeeIncidences(const QString &email)
 
 Incidence::List ExtendedCalendar::geoIncidences()
 {
-    return d->mGeoIncidences;
+    return d->mGeoIndex.incidences();
 }
 
 Incidence::List ExtendedCalendar::geoIncidences(float geoLatitude, float geoLongitude,
                                                 float diffLatitude, float diffLongitude)
 {
-    Incidence::List list;
-
-    Incidence::List values = incidences(QString());
-    Incidence::List::const_iterator it;
-    for (it = values.begin(); it != values.end(); ++it) {
-        float lat = (*it)->geoLatitude();
-        float lon = (*it)->geoLongitude();
-
-        if (fabs(lat - geoLatitude) <= diffLatitude &&
-                fabs(lon - geoLongitude) <= diffLongitude) {
-            list.append(*it);
-        }
-    }
-    return list;
+    return d->mGeoIndex.incidences(geoLatitude, geoLongitude, diffLatitude, diffLongitude);
 }
 
 Incidence::List ExtendedCalendar::incidences(const QDate &date,
@@ -808,9 +1284,12 @@ void ExtendedCalendar::Private::addIncidenceToLists(const Incidence::Ptr &incide
     for (it = list.begin(); it != list.end(); ++it) {
         mAttendeeIncidences.insert(it->email(), incidence);
     }
-    if (incidence->hasGeo()) {
-        mGeoIncidences.append(incidence);
-    }
+    mGeoIndex.insert(incidence);
+    intervalIndex(incidence)->insert(incidence);
+    const int key = bucketKey(incidence);
+    mBuckets[key].insert(incidence.data(), incidence);
+    mBucketKeys.insert(incidence.data(), key);
+    clearDayOccupancy(incidence);
 }
 
 void ExtendedCalendar::Private::removeIncidenceFromLists(const Incidence::Ptr &incidence)
@@ -824,8 +1303,67 @@ void ExtendedCalendar::Private::removeIncidenceFromLists(const Incidence::Ptr &i
     for (it = list.begin(); it != list.end(); ++it) {
         mAttendeeIncidences.remove(it->email(), incidence);
     }
-    if (incidence->hasGeo()) {
-        mGeoIncidences.removeAll(incidence);
+    mGeoIndex.remove(incidence);
+    intervalIndex(incidence)->remove(incidence);
+    QHash<const Incidence*, int>::Iterator key = mBucketKeys.find(incidence.data());
+    if (key != mBucketKeys.end()) {
+        mBuckets[*key].remove(incidence.data());
+        mBucketKeys.erase(key);
+    }
+    mDuplicateIndex.remove(duplicateKey(incidence), incidence);
+    clearRecurrenceTimes(incidence);
+    clearDayOccupancy(incidence);
+}
+
+int ExtendedCalendar::Private::bucketKey(const Incidence::Ptr &incidence)
+{
+    bool completed = false;
+    bool dated = false;
+    switch (incidence->type()) {
+    case Incidence::TypeTodo: {
+        const Todo::Ptr todo = incidence.staticCast<Todo>();
+        completed = todo->isCompleted();
+        dated = todo->hasDueDate();
+        break;
+    }
+    case Incidence::TypeEvent: {
+        const Event::Ptr event = incidence.staticCast<Event>();
+        dated = event->dtStart().isValid() && event->dtEnd().isValid();
+        break;
+    }
+    default:
+        dated = incidence->dtStart().isValid();
+        break;
+    }
+    return bucketKey(incidence->type(), completed, dated, incidence->hasGeo());
+}
+
+QPair<qint64, QString> ExtendedCalendar::Private::duplicateKey(const Incidence::Ptr &incidence)
+{
+    const QDateTime dtStart = incidence->dtStart();
+    return qMakePair(dtStart.isValid() ? dtStart.toMSecsSinceEpoch()
+                     : std::numeric_limits<qint64>::min(),
+                     incidence->summary());
+}
+
+int ExtendedCalendar::Private::bucketKey(Incidence::IncidenceType type, bool completed,
+                                         bool dated, bool geo)
+{
+    return (int(type) << 3)
+        | (completed ? BucketCompleted : 0)
+        | (dated ? BucketDated : 0)
+        | (geo ? BucketGeo : 0);
+}
+
+IntervalIndex *ExtendedCalendar::Private::intervalIndex(const Incidence::Ptr &incidence)
+{
+    switch (incidence->type()) {
+    case Incidence::TypeTodo:
+        return &mTodoIndex;
+    case Incidence::TypeJournal:
+        return &mJournalIndex;
+    default:
+        return &mEventIndex;
     }
 }
 
@@ -872,208 +1410,456 @@ QDateTime ExtendedCalendar::Private::incidenceEndTime(const KCalendarCore::Incid
     }
     return r;
 }
-//@endcond
 
-static bool expandedIncidenceSortLessThan(const ExtendedCalendar::ExpandedIncidence &e1,
-                                          const ExtendedCalendar::ExpandedIncidence &e2)
+DateTimeList ExtendedCalendar::Private::recurrenceTimes(const Incidence::Ptr &incidence,
+                                                       const QDateTime &start, const QDateTime &end)
+{
+    // Cache whole days around the requested window, so close
+    // requests in other time zones are also served.
+    const qint64 windowStart = (start.toSecsSinceEpoch() / 86400 - 1) * 86400;
+    const qint64 windowEnd = (end.toSecsSinceEpoch() / 86400 + 2) * 86400 - 1;
+    const Recurrence *recurrence = incidence->recurrence();
+    const QString key = incidence->instanceIdentifier();
+
+    mRecurrenceTimesMutex.lock();
+    RecurrenceTimes cached = mRecurrenceTimes.value(key);
+    const bool found = mRecurrenceTimes.contains(key);
+    mRecurrenceTimesMutex.unlock();
+
+    if (!found || cached.revision != incidence->revision()
+        || windowStart > cached.end + 1 || windowEnd < cached.start - 1
+        || qMax(windowEnd, cached.end) - qMin(windowStart, cached.start) > RECURRENCE_TIMES_SPAN) {
+        cached.revision = incidence->revision();
+        cached.start = windowStart;
+        cached.end = windowEnd;
+        cached.times = recurrence->timesInInterval(QDateTime::fromSecsSinceEpoch(windowStart, Qt::UTC),
+                                                   QDateTime::fromSecsSinceEpoch(windowEnd, Qt::UTC));
+    } else if (windowStart < cached.start || windowEnd > cached.end) {
+        // Only compute the missing parts of the window.
+        if (windowStart < cached.start) {
+            cached.times = recurrence->timesInInterval(QDateTime::fromSecsSinceEpoch(windowStart, Qt::UTC),
+                                                       QDateTime::fromSecsSinceEpoch(cached.start - 1, Qt::UTC))
+                + cached.times;
+            cached.start = windowStart;
+        }
+        if (windowEnd > cached.end) {
+            cached.times += recurrence->timesInInterval(QDateTime::fromSecsSinceEpoch(cached.end + 1, Qt::UTC),
+                                                        QDateTime::fromSecsSinceEpoch(windowEnd, Qt::UTC));
+            cached.end = windowEnd;
+        }
+    }
+
+    mRecurrenceTimesMutex.lock();
+    mRecurrenceTimes.insert(key, cached);
+    mRecurrenceTimesMutex.unlock();
+
+    DateTimeList::ConstIterator first = std::lower_bound(cached.times.constBegin(), cached.times.constEnd(), start);
+    DateTimeList::ConstIterator last = std::upper_bound(first, cached.times.constEnd(), end);
+    DateTimeList times;
+    times.reserve(last - first);
+    std::copy(first, last, std::back_inserter(times));
+    return times;
+}
+
+ExtendedCalendar::Private::OccupancyState
+ExtendedCalendar::Private::occupancyState(const ExtendedCalendar &calendar, const QTimeZone &tz)
 {
-    if (e1.first.dtStart < e2.first.dtStart) {
-        return true;
+    OccupancyState state;
+    state.zone = tz;
+    for (const QString &uid : calendar.notebooks()) {
+        if (calendar.isVisible(uid)) {
+            state.visibleNotebooks.append(uid);
+        }
     }
-    if (e1.first.dtStart > e2.first.dtStart) {
-        return false;
+    state.visibleNotebooks.sort();
+    const CalFilter *filter = calendar.filter();
+    if (filter && filter->isEnabled()) {
+        state.filtered = true;
+        state.criteria = filter->criteria();
+        state.completedTimeSpan = filter->completedTimeSpan();
+        state.categories = filter->categoryList();
+        state.emails = filter->emailList();
     }
-    // e1 == e2 => perform secondary check based on created date
-    return e1.second->created() < e2.second->created();
+    return state;
 }
 
-ExtendedCalendar::ExpandedIncidenceList ExtendedCalendar::expandRecurrences(
-    Incidence::List *incidenceList, const QDateTime &dtStart, const QDateTime &dtEnd, int maxExpand, bool *expandLimitHit)
+void ExtendedCalendar::Private::clearDayOccupancy(const Incidence::Ptr &incidence)
 {
-    ExtendedCalendar::ExpandedIncidenceList returnList;
-    Incidence::List::Iterator iit;
-    QDateTime brokenDtStart = dtStart.addSecs(-1);
-    const QTimeZone &tz = timeZone();
-    ExpandedIncidenceValidity validity;
+    QMutexLocker lock(&mRecurrenceTimesMutex);
+    if (incidence->type() != Incidence::TypeEvent || mDayOccupancy.isEmpty()) {
+        return;
+    }
 
-    // used for comparing with entries that have broken dtEnd => we use
-    // dtStart and compare it against this instead. As this is allocated
-    // only once per iteration, it should result in significan net
-    // savings
+    qint64 start, end;
+    IntervalIndex::span(incidence, &start, &end);
+    // Unbounded spans are kept away from QDateTime overflows.
+    const QDate first = start > -DAY_OCCUPANCY_BOUND
+        ? QDateTime::fromSecsSinceEpoch(start, mOccupancyState.zone).date() : QDate();
+    const QDate last = end < DAY_OCCUPANCY_BOUND
+        ? QDateTime::fromSecsSinceEpoch(end, mOccupancyState.zone).date() : QDate();
 
-//  qCDebug(lcMkcal) << "expandRecurrences"
-//           << incidenceList->size()
-//           << dtStart.toString() << dtStart.isValid()
-//           << dtEnd.toString() << dtEnd.isValid();
+    for (QMap<QDate, QVector<int>> &months : mDayOccupancy) {
+        QMap<QDate, QVector<int>>::Iterator it = first.isValid()
+            ? months.lowerBound(QDate(first.year(), first.month(), 1)) : months.begin();
+        while (it != months.end() && (!last.isValid() || it.key() <= last)) {
+            it = months.erase(it);
+        }
+    }
+}
 
-    if (expandLimitHit)
-        *expandLimitHit = false;
+void ExtendedCalendar::Private::clearRecurrenceTimes(const Incidence::Ptr &incidence)
+{
+    QMutexLocker lock(&mRecurrenceTimesMutex);
+    mRecurrenceTimes.remove(incidence->instanceIdentifier());
+}
 
-    for (iit = incidenceList->begin(); iit != incidenceList->end(); ++iit) {
-        QDateTime dt = (*iit)->dtStart().toTimeSpec(Qt::LocalTime);
-        QDateTime dte = (*iit)->dateTime(IncidenceBase::RoleEndRecurrenceBase);
-        int appended = 0;
-        int skipped = 0;
-        bool brokenEnd = false;
-
-        if ((*iit)->type() == Incidence::TypeTodo) {
-            Todo::Ptr todo = (*iit).staticCast<Todo>();
-            if (todo->hasDueDate()) {
-                dt = todo->dtDue().toTimeSpec(Qt::LocalTime);
+void ExtendedCalendar::Private::expandEvent(const Event::Ptr &ev, const QDate &start,
+                                            const QDateTime &ksdt, const QDateTime &kedt,
+                                            bool startInclusive, bool endInclusive,
+                                            const QTimeZone &tz, ZoneOffsets *offsets,
+                                            ExpandedIncidenceList *eventList)
+{
+    struct ListSink {
+        const Incidence::Ptr incidence;
+        const QTimeZone &tz;
+        ZoneOffsets *offsets;
+        ExpandedIncidenceList *eventList;
+
+        void operator()(qint64 tsStart, qint64 tsEnd) const
+        {
+            (*this)(offsets->toDateTime(tsStart, tz), offsets->toDateTime(tsEnd, tz));
+        }
+        void operator()(const QDateTime &tsStartTime, const QDateTime &tsEndTime) const
+        {
+            ExpandedIncidenceValidity eiv = {tsStartTime, tsEndTime};
+            eventList->append(qMakePair(eiv, incidence));
+        }
+    } sink = {ev, tz, offsets, eventList};
+    expandEventTimes(ev, start, ksdt, kedt, startInclusive, endInclusive, tz, offsets, sink);
+}
+
+template <typename Sink>
+void ExtendedCalendar::Private::expandEventTimes(const Event::Ptr &ev, const QDate &start,
+                                                 const QDateTime &ksdt, const QDateTime &kedt,
+                                                 bool startInclusive, bool endInclusive,
+                                                 const QTimeZone &tz, ZoneOffsets *offsets,
+                                                 Sink sink)
+{
+    const bool asClockTime = ev->dtStart().timeSpec() == Qt::LocalTime;
+    const QDateTime startTime = ev->dtStart();
+    const QDateTime endTime = ev->dtEnd();
+    const QDateTime rangeStartTime = (ev->allDay() && asClockTime)
+                                   ? QDateTime(start, QTime()) : ksdt;
+    const QDateTime rangeEndTime = (ev->allDay() && asClockTime)
+                                 ? QDateTime(kedt.date(), QTime()) : kedt;
+    const QDateTime tsRangeStartTime = kdatetimeAsTimeSpec(rangeStartTime, tz);
+    const QDateTime tsRangeEndTime = kdatetimeAsTimeSpec(rangeEndTime, tz);
+    if (ev->recurs()) {
+        int extraDays = (ev->isMultiDay() && !startInclusive)
+                      ? startTime.date().daysTo(endTime.date())
+                      : (ev->allDay() ? 1 : 0);
+        const QDateTime tsAdjustedRangeStartTime(tsRangeStartTime.addDays(-extraDays));
+        const DateTimeList times = recurrenceTimes(ev, tsAdjustedRangeStartTime, tsRangeEndTime);
+        // Work on seconds since epoch, date times are only built
+        // for the returned occurrences.
+        const Duration duration(startTime, endTime);
+        const qint64 rangeEnd = tsRangeEndTime.toSecsSinceEpoch();
+        const qint64 adjustedRangeStart = tsAdjustedRangeStartTime.toSecsSinceEpoch();
+        for (const QDateTime &timeInInterval : times) {
+            const qint64 tsStart = offsets->toSecsSinceEpoch(timeInInterval, tz);
+            const qint64 tsEnd = duration.isDaily()
+                ? offsets->fromLocal(offsets->toLocal(tsStart, tz) + qint64(duration.asDays()) * 86400, tz)
+                : tsStart + duration.asSeconds();
+            if (tsStart >= rangeEnd
+                    || tsEnd <= adjustedRangeStart
+                    || (endInclusive && (tsEnd > rangeEnd))) {
+                continue;
             }
+            sink(tsStart, tsEnd);
         }
-
-        if (!dt.isValid()) {
-            // Just leave the dateless incidences there (they will be
-            // sorted out)
-            validity.dtStart = dt;
-            validity.dtEnd = d->incidenceEndTime(*iit, dt, true);
-            returnList.append(ExpandedIncidence(validity, *iit));
-            continue;
+    } else {
+        const QDateTime tsStartTime = kdatetimeAsTimeSpec(startTime, tz);
+        const QDateTime tsEndTime = kdatetimeAsTimeSpec(endTime, tz);
+        if (ev->isMultiDay()) {
+            if ((startInclusive == false || tsStartTime >= tsRangeStartTime) &&
+                    tsStartTime <= tsRangeEndTime && tsEndTime >= tsRangeStartTime &&
+                    (endInclusive == false || tsEndTime <= tsRangeEndTime)) {
+                sink(tsStartTime, tsEndTime);
+            }
+        } else {
+            if (tsStartTime >= tsRangeStartTime && tsStartTime <= tsRangeEndTime) {
+                sink(tsStartTime, tsEndTime);
+            }
         }
+    }
+}
+
+void ExtendedCalendar::Private::expandIncidence(const Incidence::Ptr &incidence,
+                                                const QDateTime &dtStart, const QDateTime &dtEnd,
+                                                int maxExpand, const QTimeZone &tz,
+                                                ExpandedIncidenceList *returnList, bool *expandLimitHit)
+{
+    // used for comparing with entries that have broken dtEnd => we use
+    // dtStart and compare it against this instead.
+    QDateTime brokenDtStart = dtStart.addSecs(-1);
+    ExpandedIncidenceValidity validity;
 
-        // Fix the non-valid dte to be dt+1
-        if (dte.isValid() && dte <= dt) {
-            brokenEnd = true;
+    QDateTime dt = incidence->dtStart().toTimeSpec(Qt::LocalTime);
+    QDateTime dte = incidence->dateTime(IncidenceBase::RoleEndRecurrenceBase);
+    int appended = 0;
+    int skipped = 0;
+    bool brokenEnd = false;
+
+    if (incidence->type() == Incidence::TypeTodo) {
+        Todo::Ptr todo = incidence.staticCast<Todo>();
+        if (todo->hasDueDate()) {
+            dt = todo->dtDue().toTimeSpec(Qt::LocalTime);
         }
+    }
+
+    if (!dt.isValid()) {
+        // Just leave the dateless incidences there (they will be
+        // sorted out)
+        validity.dtStart = dt;
+        validity.dtEnd = incidenceEndTime(incidence, dt, true);
+        returnList->append(ExpandedIncidence(validity, incidence));
+        return;
+    }
 
-        // Then insert the current; only if it (partially) fits within
-        // the [dtStart, dtEnd[ window. (note that dtEnd is not really
-        // included; similarly, the last second of events is not
-        // counted as valid. This is because (for example) all-day
-        // events in ical are typically stored as whole day+1 events
-        // (that is, the first second of next day is where it ends),
-        // and due to that otherwise date-specific queries won't work
-        // nicely.
+    // Fix the non-valid dte to be dt+1
+    if (dte.isValid() && dte <= dt) {
+        brokenEnd = true;
+    }
+
+    // Then insert the current; only if it (partially) fits within
+    // the [dtStart, dtEnd[ window. (note that dtEnd is not really
+    // included; similarly, the last second of events is not
+    // counted as valid. This is because (for example) all-day
+    // events in ical are typically stored as whole day+1 events
+    // (that is, the first second of next day is where it ends),
+    // and due to that otherwise date-specific queries won't work
+    // nicely.
 
-        // Mandatory conditions:
-        // [1] dt < dtEnd <> start period early enough iff dtEnd specified
-        // [2] dte > dtStart <> end period late enough iff dte set
+    // Mandatory conditions:
+    // [1] dt < dtEnd <> start period early enough iff dtEnd specified
+    // [2] dte > dtStart <> end period late enough iff dte set
 
-        // Note: This algorithm implies that events that are only
-        // partially within the desired [dtStart, dtEnd] range are
-        // also included.
+    // Note: This algorithm implies that events that are only
+    // partially within the desired [dtStart, dtEnd] range are
+    // also included.
 
-        if ((!dtEnd.isValid() || dt < dtEnd)
-                && (!dte.isValid()
-                    || (!brokenEnd && dte > dtStart)
-                    || (brokenEnd && dt > brokenDtStart))) {
+    if ((!dtEnd.isValid() || dt < dtEnd)
+            && (!dte.isValid()
+                || (!brokenEnd && dte > dtStart)
+                || (brokenEnd && dt > brokenDtStart))) {
 #ifdef DEBUG_EXPANSION
-            qCDebug(lcMkcal) << "---appending" << (*iit)->summary() << dt.toString();
+        qCDebug(lcMkcal) << "---appending" << incidence->summary() << dt.toString();
 #endif /* DEBUG_EXPANSION */
-            if ((*iit)->recurs()) {
-                if (!(*iit)->allDay()) {
-                    if (!(*iit)->recursAt((*iit)->dtStart())) {
+        if (incidence->recurs()) {
+            if (!incidence->allDay()) {
+                if (!incidence->recursAt(incidence->dtStart())) {
 #ifdef DEBUG_EXPANSION
-                        qCDebug(lcMkcal) << "--not recurring at" << (*iit)->dtStart() << (*iit)->summary();
+                    qCDebug(lcMkcal) << "--not recurring at" << incidence->dtStart() << incidence->summary();
 #endif /* DEBUG_EXPANSION */
-                    } else {
-                        validity.dtStart = dt;
-                        validity.dtEnd = d->incidenceEndTime(*iit, dt, true);
-                        returnList.append(ExpandedIncidence(validity, *iit));
-                        appended++;
-                    }
                 } else {
-                    if (!(*iit)->recursOn((*iit)->dtStart().date(), tz)) {
+                    validity.dtStart = dt;
+                    validity.dtEnd = incidenceEndTime(incidence, dt, true);
+                    returnList->append(ExpandedIncidence(validity, incidence));
+                    appended++;
+                }
+            } else {
+                if (!incidence->recursOn(incidence->dtStart().date(), tz)) {
 #ifdef DEBUG_EXPANSION
-                        qCDebug(lcMkcal) << "--not recurring on" << (*iit)->dtStart() << (*iit)->summary();
+                    qCDebug(lcMkcal) << "--not recurring on" << incidence->dtStart() << incidence->summary();
 #endif /* DEBUG_EXPANSION */
-                    } else {
-                        validity.dtStart = dt;
-                        validity.dtEnd = d->incidenceEndTime(*iit, dt, true);
-                        returnList.append(ExpandedIncidence(validity, *iit));
-                        appended++;
-                    }
+                } else {
+                    validity.dtStart = dt;
+                    validity.dtEnd = incidenceEndTime(incidence, dt, true);
+                    returnList->append(ExpandedIncidence(validity, incidence));
+                    appended++;
                 }
-            } else {
-                validity.dtStart = dt;
-                validity.dtEnd = d->incidenceEndTime(*iit, dt, true);
-                returnList.append(ExpandedIncidence(validity, *iit));
-                appended++;
             }
         } else {
+            validity.dtStart = dt;
+            validity.dtEnd = incidenceEndTime(incidence, dt, true);
+            returnList->append(ExpandedIncidence(validity, incidence));
+            appended++;
+        }
+    } else {
 #ifdef DEBUG_EXPANSION
-            qCDebug(lcMkcal) << "-- no match" << dt.toString() << dte.toString() << dte.isValid() << brokenEnd;
+        qCDebug(lcMkcal) << "-- no match" << dt.toString() << dte.toString() << dte.isValid() << brokenEnd;
 #endif /* DEBUG_EXPANSION */
-        }
+    }
 
-        if ((*iit)->recurs()) {
-            QDateTime dtr = dt;
-            QDateTime dtro;
+    if (incidence->recurs()) {
+        QDateTime dtr = dt;
+        QDateTime dtro;
 
-            // If the original entry wasn't part of the time window, try to
-            // get more appropriate first item to add. Else, start the
-            // next-iteration from the 'dt' (=current item).
-            if (!appended) {
-                dtr = (*iit)->recurrence()->getPreviousDateTime(dtStart);
-                if (dtr.isValid()) {
-                    QDateTime dtr2 = (*iit)->recurrence()->getPreviousDateTime(dtr);
-                    if (dtr2.isValid()) {
-                        dtr = dtr2;
-                    }
-                } else {
-                    dtr = dt;
+        // If the original entry wasn't part of the time window, try to
+        // get more appropriate first item to add. Else, start the
+        // next-iteration from the 'dt' (=current item).
+        if (!appended) {
+            dtr = incidence->recurrence()->getPreviousDateTime(dtStart);
+            if (dtr.isValid()) {
+                QDateTime dtr2 = incidence->recurrence()->getPreviousDateTime(dtr);
+                if (dtr2.isValid()) {
+                    dtr = dtr2;
                 }
+            } else {
+                dtr = dt;
             }
+        }
 
-            int duration = 0;
-            if (brokenEnd)
-                duration = 1;
-            else if (dte.isValid())
-                duration = dte.toTime_t() - dt.toTime_t();
-
-            // Old logic had us keeping around [recur-start, recur-end[ > dtStart
-            // As recur-end = recur-start + duration, we can rewrite the conditions
-            // as recur-start[ > dtStart - duration
-            QDateTime dtStartMinusDuration = dtStart.addSecs(-duration);
-
-            while (appended < maxExpand) {
-                dtro = dtr;
-                dtr = (*iit)->recurrence()->getNextDateTime(dtr).toTimeSpec(Qt::LocalTime);
-                if (!dtr.isValid() || (dtEnd.isValid() && dtr >= dtEnd)) {
-                    break;
-                }
+        int duration = 0;
+        if (brokenEnd)
+            duration = 1;
+        else if (dte.isValid())
+            duration = dte.toTime_t() - dt.toTime_t();
+
+        // Old logic had us keeping around [recur-start, recur-end[ > dtStart
+        // As recur-end = recur-start + duration, we can rewrite the conditions
+        // as recur-start[ > dtStart - duration
+        QDateTime dtStartMinusDuration = dtStart.addSecs(-duration);
+
+        while (appended < maxExpand) {
+            dtro = dtr;
+            dtr = incidence->recurrence()->getNextDateTime(dtr).toTimeSpec(Qt::LocalTime);
+            if (!dtr.isValid() || (dtEnd.isValid() && dtr >= dtEnd)) {
+                break;
+            }
 
-                /* If 'next' results in wrong date, give up. We have
-                * to be moving forward. */
-                if (dtr <= dtro) {
-                    qCDebug(lcMkcal) << "--getNextDateTime broken - " << dtr << (*iit);
-                    break;
-                }
+            /* If 'next' results in wrong date, give up. We have
+            * to be moving forward. */
+            if (dtr <= dtro) {
+                qCDebug(lcMkcal) << "--getNextDateTime broken - " << dtr << incidence;
+                break;
+            }
 
-                // As incidences are in sorted order, the [1] condition was
-                // already met as we're still iterating. Have to check [2].
-                if (dtr > dtStartMinusDuration) {
+            // As incidences are in sorted order, the [1] condition was
+            // already met as we're still iterating. Have to check [2].
+            if (dtr > dtStartMinusDuration) {
 #ifdef DEBUG_EXPANSION
-                    qCDebug(lcMkcal) << "---appending(recurrence)"
-                             << (*iit)->summary() << dtr.toString();
+                qCDebug(lcMkcal) << "---appending(recurrence)"
+                         << incidence->summary() << dtr.toString();
 #endif /* DEBUG_EXPANSION */
-                    validity.dtStart = dtr;
-                    validity.dtEnd = d->incidenceEndTime(*iit, dtr, true);
-                    returnList.append(ExpandedIncidence(validity, *iit));
-                    appended++;
-                } else {
+                validity.dtStart = dtr;
+                validity.dtEnd = incidenceEndTime(incidence, dtr, true);
+                returnList->append(ExpandedIncidence(validity, incidence));
+                appended++;
+            } else {
 #ifdef DEBUG_EXPANSION
-                    qCDebug(lcMkcal) << "---skipping(recurrence)"
-                             << skipped << (*iit)->summary()
-                             << duration << dtr.toString();
+                qCDebug(lcMkcal) << "---skipping(recurrence)"
+                         << skipped << incidence->summary()
+                         << duration << dtr.toString();
 #endif /* DEBUG_EXPANSION */
-                    if (skipped++ >= 100) {
-                        qCDebug(lcMkcal) << "--- skip count exceeded, breaking loop";
-                        break;
-                    }
+                if (skipped++ >= 100) {
+                    qCDebug(lcMkcal) << "--- skip count exceeded, breaking loop";
+                    break;
                 }
             }
-            if (appended == maxExpand && expandLimitHit) {
-                qCDebug(lcMkcal) << "!!! HIT LIMIT" << maxExpand;
+        }
+        if (appended == maxExpand && expandLimitHit) {
+            qCDebug(lcMkcal) << "!!! HIT LIMIT" << maxExpand;
+            *expandLimitHit = true;
+        }
+    }
+}
+//@endcond
+
+static bool expandedIncidenceSortLessThan(const ExtendedCalendar::ExpandedIncidence &e1,
+                                          const ExtendedCalendar::ExpandedIncidence &e2)
+{
+    if (e1.first.dtStart < e2.first.dtStart) {
+        return true;
+    }
+    if (e1.first.dtStart > e2.first.dtStart) {
+        return false;
+    }
+    // e1 == e2 => perform secondary check based on created date
+    return e1.second->created() < e2.second->created();
+}
+
+ExtendedCalendar::ExpandedIncidenceList ExtendedCalendar::expandRecurrences(
+    Incidence::List *incidenceList, const QDateTime &dtStart, const QDateTime &dtEnd, int maxExpand, bool *expandLimitHit)
+{
+    ExtendedCalendar::ExpandedIncidenceList returnList;
+    const QTimeZone tz = timeZone();
+
+//  qCDebug(lcMkcal) << "expandRecurrences"
+//           << incidenceList->size()
+//           << dtStart.toString() << dtStart.isValid()
+//           << dtEnd.toString() << dtEnd.isValid();
+
+    if (expandLimitHit)
+        *expandLimitHit = false;
+
+    const QVector<Incidence::List> parts = d->expansionParts(*incidenceList);
+    if (parts.count() > 1) {
+        // Each part is expanded and sorted in its own thread, the
+        // sorted parts are then merged.
+        QVector<QFuture<Private::Expansion>> futures;
+        for (const Incidence::List &part : parts) {
+            futures.append(QtConcurrent::run([=] () {
+                Private::Expansion expansion;
+                expansion.limitHit = false;
+                for (const Incidence::Ptr &incidence : part) {
+                    Private::expandIncidence(incidence, dtStart, dtEnd, maxExpand, tz,
+                                             &expansion.list, &expansion.limitHit);
+                }
+                qSort(expansion.list.begin(), expansion.list.end(), expandedIncidenceSortLessThan);
+                return expansion;
+            }));
+        }
+        QVector<ExpandedIncidenceList> lists;
+        for (QFuture<Private::Expansion> &future : futures) {
+            const Private::Expansion expansion = future.result();
+            lists.append(expansion.list);
+            if (expansion.limitHit && expandLimitHit) {
                 *expandLimitHit = true;
             }
         }
+        return Private::mergeExpansions(lists);
+    }
+
+    for (const Incidence::Ptr &incidence : const_cast<const Incidence::List&>(*incidenceList)) {
+        d->expandIncidence(incidence, dtStart, dtEnd, maxExpand, tz, &returnList, expandLimitHit);
     }
     qSort(returnList.begin(), returnList.end(), expandedIncidenceSortLessThan);
     return returnList;
 }
 
+ExtendedCalendar::ExpandedIncidenceList
+ExtendedCalendar::Private::mergeExpansions(const QVector<ExpandedIncidenceList> &lists)
+{
+    ExpandedIncidenceList returnList;
+    // Heap of (list, position) of the next item of each list.
+    QVector<QPair<int, int>> heap;
+    auto greaterThan = [&lists] (const QPair<int, int> &a, const QPair<int, int> &b) {
+        return expandedIncidenceSortLessThan(lists[b.first][b.second], lists[a.first][a.second]);
+    };
+
+    int count = 0;
+    for (int i = 0; i < lists.count(); i++) {
+        count += lists[i].count();
+        if (!lists[i].isEmpty()) {
+            heap.append(qMakePair(i, 0));
+        }
+    }
+    returnList.reserve(count);
+    std::make_heap(heap.begin(), heap.end(), greaterThan);
+    while (!heap.isEmpty()) {
+        std::pop_heap(heap.begin(), heap.end(), greaterThan);
+        QPair<int, int> &next = heap.last();
+        returnList.append(lists[next.first][next.second]);
+        if (++next.second < lists[next.first].count()) {
+            std::push_heap(heap.begin(), heap.end(), greaterThan);
+        } else {
+            heap.removeLast();
+        }
+    }
+    return returnList;
+}
+
 ExtendedCalendar::ExpandedIncidenceList
 ExtendedCalendar::expandMultiDay(const ExtendedCalendar::ExpandedIncidenceList &list,
                                  const QDate &startDate,
@@ -1146,6 +1932,216 @@ ExtendedCalendar::expandMultiDay(const ExtendedCalendar::ExpandedIncidenceList &
     return returnList;
 }
 
+//@cond PRIVATE
+/**
+  The occurrences of one incidence, computed one at a time.
+  @internal
+*/
+struct OccurrenceStream
+{
+    Incidence::Ptr incidence;
+    QDateTime base;         // occurrence start, as given by the recurrence
+    QDateTime dtStart;      // occurrence start, in the iterator time zone
+    QDateTime dtEnd;        // occurrence end, in the iterator time zone
+    QDateTime limit;        // exclusive end, a day after dtEnd for all day occurrences
+    Duration duration;
+    bool done;
+};
+
+/**
+  Heap ordering of occurrence streams, the top of the heap is the
+  next occurrence to iterate over.
+  @internal
+*/
+struct OccurrenceOrder
+{
+    ExtendedCalendar::OccurrenceIterator::Direction direction;
+
+    bool operator()(const OccurrenceStream &a, const OccurrenceStream &b) const
+    {
+        if (direction == ExtendedCalendar::OccurrenceIterator::Forward) {
+            if (a.dtStart != b.dtStart) {
+                return a.dtStart > b.dtStart;
+            }
+            return a.incidence->created() > b.incidence->created();
+        } else {
+            if (a.limit != b.limit) {
+                return a.limit < b.limit;
+            }
+            return a.dtStart < b.dtStart;
+        }
+    }
+};
+
+class ExtendedCalendar::OccurrenceIterator::Private
+{
+public:
+    Private(const QDateTime &origin, Direction direction, const QTimeZone &timeZone)
+        : mOrigin(origin)
+        , mDirection(direction)
+        , mTimeZone(timeZone)
+        , mOrder{direction}
+    {
+    }
+
+    QDateTime mOrigin;
+    Direction mDirection;
+    QTimeZone mTimeZone;
+    OccurrenceOrder mOrder;
+    QVector<OccurrenceStream> mHeap;
+
+    void addIncidences(const Incidence::List &incidences);
+    void setOccurrence(OccurrenceStream *stream, const QDateTime &base) const;
+    void advance(OccurrenceStream *stream) const;
+    bool accepts(const OccurrenceStream &stream) const;
+};
+
+void ExtendedCalendar::OccurrenceIterator::Private::addIncidences(const Incidence::List &incidences)
+{
+    mHeap.reserve(incidences.count());
+    for (const Incidence::Ptr &incidence : incidences) {
+        OccurrenceStream stream;
+        QDateTime dtStart = incidence->dtStart();
+        QDateTime dtEnd = incidence->dateTime(Incidence::RoleEnd);
+        if (incidence->type() == Incidence::TypeTodo) {
+            const Todo::Ptr todo = incidence.staticCast<Todo>();
+            dtStart = todo->hasStartDate() ? todo->dtStart(true) : todo->dtDue(true);
+            dtEnd = todo->hasDueDate() ? todo->dtDue(true) : dtStart;
+        }
+        if (!dtStart.isValid()) {
+            continue;
+        }
+        if (!dtEnd.isValid() || dtEnd < dtStart) {
+            dtEnd = dtStart;
+        }
+        stream.incidence = incidence;
+        stream.duration = Duration(dtStart, dtEnd);
+        stream.done = false;
+
+        if (incidence->recurs()) {
+            // Start a day away from the origin to be immune to clock time
+            // interpretation, non accepted occurrences are skipped.
+            const qint64 margin = 86400 + dtStart.secsTo(dtEnd) + (incidence->allDay() ? 86400 : 0);
+            if (mDirection == Forward) {
+                stream.base = incidence->recurrence()->getNextDateTime(mOrigin.addSecs(-margin));
+            } else {
+                stream.base = incidence->recurrence()->getPreviousDateTime(mOrigin.addSecs(86400));
+            }
+            if (!stream.base.isValid()) {
+                continue;
+            }
+            setOccurrence(&stream, stream.base);
+            while (!stream.done && !accepts(stream)) {
+                advance(&stream);
+            }
+        } else {
+            setOccurrence(&stream, dtStart);
+            stream.done = !accepts(stream);
+        }
+        if (!stream.done) {
+            mHeap.append(stream);
+        }
+    }
+    std::make_heap(mHeap.begin(), mHeap.end(), mOrder);
+}
+
+void ExtendedCalendar::OccurrenceIterator::Private::setOccurrence(OccurrenceStream *stream,
+                                                                  const QDateTime &base) const
+{
+    stream->base = base;
+    stream->dtStart = kdatetimeAsTimeSpec(base, mTimeZone);
+    stream->dtEnd = stream->duration.end(stream->dtStart);
+    stream->limit = stream->incidence->allDay() ? stream->dtEnd.addDays(1) : stream->dtEnd;
+}
+
+void ExtendedCalendar::OccurrenceIterator::Private::advance(OccurrenceStream *stream) const
+{
+    if (!stream->incidence->recurs()) {
+        stream->done = true;
+        return;
+    }
+    const Recurrence *recurrence = stream->incidence->recurrence();
+    const QDateTime base = mDirection == Forward
+        ? recurrence->getNextDateTime(stream->base)
+        : recurrence->getPreviousDateTime(stream->base);
+    // We have to be moving in the iteration direction.
+    if (!base.isValid()
+        || (mDirection == Forward && base <= stream->base)
+        || (mDirection == Backward && base >= stream->base)) {
+        stream->done = true;
+        return;
+    }
+    setOccurrence(stream, base);
+}
+
+bool ExtendedCalendar::OccurrenceIterator::Private::accepts(const OccurrenceStream &stream) const
+{
+    if (mDirection == Forward) {
+        return stream.limit > mOrigin || stream.dtStart >= mOrigin;
+    } else {
+        return stream.dtStart < mOrigin;
+    }
+}
+//@endcond
+
+ExtendedCalendar::OccurrenceIterator::OccurrenceIterator(const ExtendedCalendar &calendar,
+                                                         const QDateTime &origin,
+                                                         Direction direction,
+                                                         const QTimeZone &timeZone)
+    : d(new Private(origin, direction, timeZone.isValid() ? timeZone : calendar.timeZone()))
+{
+    // Events ending before, or starting after, the origin cannot provide occurrences.
+    const Incidence::List candidates = direction == Forward
+        ? calendar.d->mEventIndex.intersecting(origin, QDateTime())
+        : calendar.d->mEventIndex.intersecting(QDateTime(), origin);
+    Incidence::List visible;
+    visible.reserve(candidates.count());
+    for (const Incidence::Ptr &incidence : candidates) {
+        if (calendar.isVisible(incidence)) {
+            visible.append(incidence);
+        }
+    }
+    d->addIncidences(visible);
+}
+
+ExtendedCalendar::OccurrenceIterator::OccurrenceIterator(const Incidence::List &incidences,
+                                                         const QDateTime &origin,
+                                                         Direction direction,
+                                                         const QTimeZone &timeZone)
+    : d(new Private(origin, direction, timeZone.isValid() ? timeZone : QTimeZone::systemTimeZone()))
+{
+    d->addIncidences(incidences);
+}
+
+ExtendedCalendar::OccurrenceIterator::~OccurrenceIterator()
+{
+    delete d;
+}
+
+bool ExtendedCalendar::OccurrenceIterator::hasNext() const
+{
+    return !d->mHeap.isEmpty();
+}
+
+ExtendedCalendar::ExpandedIncidence ExtendedCalendar::OccurrenceIterator::next()
+{
+    std::pop_heap(d->mHeap.begin(), d->mHeap.end(), d->mOrder);
+    OccurrenceStream &stream = d->mHeap.last();
+    ExpandedIncidenceValidity validity = {stream.dtStart, stream.dtEnd};
+    const ExpandedIncidence occurrence(validity, stream.incidence);
+
+    do {
+        d->advance(&stream);
+    } while (!stream.done && !d->accepts(stream));
+    if (stream.done) {
+        d->mHeap.removeLast();
+    } else {
+        std::push_heap(d->mHeap.begin(), d->mHeap.end(), d->mOrder);
+    }
+
+    return occurrence;
+}
+
 
 Incidence::List ExtendedCalendar::incidences(const QDate &start, const QDate &end)
 {
@@ -1192,14 +2188,10 @@ Todo::List ExtendedCalendar::uncompletedTodos(bool hasDate, int hasGeo)
 {
     Todo::List list;
 
-    const Todo::List todos(rawTodos());
+    const Todo::List todos(d->bucket<Todo>(Incidence::TypeTodo, false, hasDate, hasGeo));
     for (const Todo::Ptr &todo: todos) {
-        if (isVisible(todo) && !todo->isCompleted()) {
-            if ((hasDate && todo->hasDueDate()) || (!hasDate && !todo->hasDueDate())) {
-                if (hasGeo < 0 || (hasGeo && todo->hasGeo()) || (!hasGeo && !todo->hasGeo())) {
-                    list.append(todo);
-                }
-            }
+        if (isVisible(todo)) {
+            list.append(todo);
         }
     }
     return list;
@@ -1224,22 +2216,18 @@ Todo::List ExtendedCalendar::completedTodos(bool hasDate, int hasGeo,
 {
     Todo::List list;
 
-    const Todo::List todos(rawTodos());
+    const Todo::List todos(d->bucket<Todo>(Incidence::TypeTodo, true, hasDate, hasGeo));
     for (const Todo::Ptr &todo: todos) {
-        if (isVisible(todo) && todo->isCompleted()) {
-            if (hasDate && todo->hasDueDate()) {
-                if (hasGeo < 0 || (hasGeo && todo->hasGeo()) || (!hasGeo && !todo->hasGeo())) {
-                    if ((!todo->recurs() && isDateInRange(todo->dtDue(), start, end))
-                        || (todo->recurs() && (todo->recurrence()->duration() == -1
-                                               || isDateInRange(todo->recurrence()->endDateTime(), start, end)))) {
-                        list.append(todo);
-                    }
+        if (isVisible(todo)) {
+            if (hasDate) {
+                if ((!todo->recurs() && isDateInRange(todo->dtDue(), start, end))
+                    || (todo->recurs() && (todo->recurrence()->duration() == -1
+                                           || isDateInRange(todo->recurrence()->endDateTime(), start, end)))) {
+                    list.append(todo);
                 }
-            } else if (!hasDate && !todo->hasDueDate()) {   // todos without due date
-                if (hasGeo < 0 || (hasGeo && todo->hasGeo()) || (!hasGeo && !todo->hasGeo())) {
-                    if (isDateInRange(todo->created(), start, end)) {
-                        list.append(todo);
-                    }
+            } else {   // todos without due date
+                if (isDateInRange(todo->created(), start, end)) {
+                    list.append(todo);
                 }
             }
         }
@@ -1305,19 +2293,27 @@ Incidence::List ExtendedCalendar::incidences(bool hasDate,
 {
     Incidence::List list;
 
-    Todo::List todos = rawTodos();
+    // Dated incidences are only looked for around the range, dateless ones
+    // are selected on their creation date from their buckets. Series
+    // recurring forever are always listed, even when starting after
+    // the range.
+    Todo::List todos = hasDate ? d->candidates<Todo>(d->mTodoIndex, start, end, true)
+        : d->bucket<Todo>(Incidence::TypeTodo, false, false, -1)
+          + d->bucket<Todo>(Incidence::TypeTodo, true, false, -1);
     std::copy_if(todos.constBegin(), todos.constEnd(),
                  std::back_inserter(list),
                  [this, hasDate, start, end] (const Todo::Ptr &todo) {
                      return isVisible(todo) && isTodoInRange(todo, hasDate ? 1 : 0, start, end);});
 
-    Event::List events = rawEvents();
+    Event::List events = hasDate ? d->candidates<Event>(d->mEventIndex, start, end, true)
+        : d->bucket<Event>(Incidence::TypeEvent, false, false, -1);
     std::copy_if(events.constBegin(), events.constEnd(),
                  std::back_inserter(list),
                  [this, hasDate, start, end] (const Event::Ptr &event) {
                      return isVisible(event) && isEventInRange(event, hasDate ? 1 : 0, start, end);});
 
-    Journal::List journals = rawJournals();
+    Journal::List journals = hasDate ? d->candidates<Journal>(d->mJournalIndex, start, end, true)
+        : d->bucket<Journal>(Incidence::TypeJournal, false, false, -1);
     std::copy_if(journals.constBegin(), journals.constEnd(),
                  std::back_inserter(list),
                  [this, hasDate, start, end] (const Journal::Ptr &journal) {
@@ -1332,7 +2328,7 @@ Journal::List ExtendedCalendar::journals(const QDate &start, const QDate &end)
     QDateTime startK(start);
     QDateTime endK(end);
 
-    const Journal::List journals(rawJournals());
+    const Journal::List journals(d->candidates<Journal>(d->mJournalIndex, startK, endK));
     for (const Journal::Ptr &journal: journals) {
         if (!isVisible(journal)) {
             continue;
@@ -1357,7 +2353,8 @@ Incidence::List ExtendedCalendar::geoIncidences(bool hasDate,
 {
     Incidence::List list;
 
-    for (Incidence::Ptr incidence: const_cast<const Incidence::List&>(d->mGeoIncidences)) {
+    const Incidence::List geoIncidences(d->mGeoIndex.incidences());
+    for (const Incidence::Ptr &incidence: geoIncidences) {
         if (incidence->type() == Incidence::TypeTodo) {
             if (isTodoInRange(incidence.staticCast<Todo>(), hasDate ? 1 : 0, start, end)) {
                 list.append(incidence);
@@ -1469,7 +2466,8 @@ Incidence::List ExtendedCalendar::addIncidences(Incidence::List *incidenceList,
     Incidence::List::Iterator dit;
 
     for (iit = incidenceList->begin(); iit != incidenceList->end(); ++iit) {
-        duplicatesList = duplicates(*iit);
+        // Same as duplicates(*iit), without visiting every incidence.
+        duplicatesList = d->mDuplicateIndex.values(Private::duplicateKey(*iit)).toVector();
         if (!duplicatesList.isEmpty()) {
             if (duplicateRemovalEnabled) {
                 for (dit = duplicatesList.begin(); dit != duplicatesList.end(); ++dit) {
@@ -1500,6 +2498,14 @@ void ExtendedCalendar::storageModified(ExtendedStorage *storage, const QString &
     close();
 }
 
+void ExtendedCalendar::doSetTimeZone(const QTimeZone &timeZone)
+{
+    d->mRecurrenceTimesMutex.lock();
+    d->mRecurrenceTimes.clear();
+    d->mRecurrenceTimesMutex.unlock();
+    MemoryCalendar::doSetTimeZone(timeZone);
+}
+
 void ExtendedCalendar::storageProgress(ExtendedStorage *storage, const QString &info)
 {
     Q_UNUSED(storage);
@@ -193,8 +193,10 @@
 #define MKCAL_EXTENDEDCALENDAR_H
 
 #include "mkcal_export.h"
+#include "occurrencetable.h"
 
 #include <KCalendarCore/MemoryCalendar>
+#include <KCalendarCore/Period>
 #include <extendedstorageobserver.h>
 
 namespace mKCal {
@@ -310,6 +312,23 @@ public:
     */
     bool deleteIncidence(const KCalendarCore::Incidence::Ptr &incidence);
 
+    /**
+      Removes @p incidence from memory, without deleting it. Observers
+      are not notified and the incidence is not listed among the
+      deleted ones, so storages do not remove it from the database.
+      It can be loaded again later. ExtendedStorage::evict() reports
+      unloaded incidences to the storage observers instead.
+
+      @return true if the incidence was in the calendar
+    */
+    bool unloadIncidence(const KCalendarCore::Incidence::Ptr &incidence);
+
+    /**
+      @copydoc
+      Calendar::setNotebook()
+    */
+    bool setNotebook(const KCalendarCore::Incidence::Ptr &incidence, const QString &notebook);
+
     // Event Specific Methods //
 
     /**
@@ -533,6 +552,100 @@ public:
     typedef QVector<ExpandedIncidence> ExpandedIncidenceList;
     typedef QVectorIterator<ExpandedIncidence> ExpandedIncidenceIterator;
 
+    /**
+      Pull-based iterator over the occurrences of incidences.
+
+      Occurrences are computed one at a time, when requested, by
+      merging the recurrences of each incidence, so it is cheap to
+      get the first few occurrences after or before a given time, even
+      for calendars with a lot of recurring incidences.
+
+      Iterating Forward returns the occurrences ending after, or
+      starting at, the origin, sorted by start time in ascending
+      order. Iterating Backward returns the occurrences starting
+      before the origin, sorted by end time in descending order.
+      Occurrence times are expressed in the time zone of the iterator,
+      like in rawExpandedEvents().
+
+      @code
+      ExtendedCalendar::OccurrenceIterator it(*calendar, QDateTime::currentDateTime());
+      for (int i = 0; i < 20 && it.hasNext(); i++) {
+          const ExtendedCalendar::ExpandedIncidence occurrence = it.next();
+          ...
+      }
+      @endcode
+    */
+    class MKCAL_EXPORT OccurrenceIterator
+    {
+    public:
+        enum Direction {
+            Forward,
+            Backward
+        };
+
+        /**
+          Iterates over the visible events of @p calendar.
+
+          @param calendar the calendar to get events from
+          @param origin the time to iterate from
+          @param direction the iteration direction
+          @param timeZone the time zone of the occurrences, the calendar one if invalid
+        */
+        OccurrenceIterator(const ExtendedCalendar &calendar, const QDateTime &origin,
+                           Direction direction = Forward,
+                           const QTimeZone &timeZone = QTimeZone());
+
+        /**
+          Iterates over the given incidences.
+
+          @param incidences the incidences to expand
+          @param origin the time to iterate from
+          @param direction the iteration direction
+          @param timeZone the time zone of the occurrences, the system one if invalid
+        */
+        OccurrenceIterator(const KCalendarCore::Incidence::List &incidences,
+                           const QDateTime &origin,
+                           Direction direction = Forward,
+                           const QTimeZone &timeZone = QTimeZone());
+
+        ~OccurrenceIterator();
+
+        /**
+          Returns true if there is a further occurrence.
+        */
+        bool hasNext() const;
+
+        /**
+          Returns the next occurrence and advances the iterator.
+          It must only be called when hasNext() is true.
+        */
+        ExpandedIncidence next();
+
+    private:
+        Q_DISABLE_COPY(OccurrenceIterator)
+        class MKCAL_HIDE Private;
+        Private *const d;
+    };
+
+    /**
+      Enables expanding occurrences in parallel threads in
+      expandRecurrences() and rawExpandedEvents(). It is disabled by
+      default.
+
+      Each incidence is expanded by a single thread, but incidences
+      must not be modified from other threads during the expansion.
+
+      @param enabled true to spread the expansion of large lists of
+      incidences over the available cores
+    */
+    void setParallelExpansion(bool enabled);
+
+    /**
+      Returns true if parallel expansion is enabled.
+      @see setParallelExpansion()
+    */
+    bool parallelExpansion() const;
+
     /**
       Expand recurring incidences in a list.
 
@@ -566,6 +679,71 @@ public:
                                             bool startInclusive = false, bool endInclusive = false,
                                             const QTimeZone &timeZone = QTimeZone()) const;
 
+    /**
+      Returns the same occurrences as rawExpandedEvents(), as an
+      OccurrenceTable sorted by start time. Occurrence times are
+      kept in seconds since epoch, so no date time is built for
+      recurring events.
+
+      @see rawExpandedEvents()
+    */
+    OccurrenceTable occurrenceTable(const QDate &start, const QDate &end,
+                                    bool startInclusive = false, bool endInclusive = false,
+                                    const QTimeZone &timeZone = QTimeZone()) const;
+
+    /**
+      Returns the number of events occurring on each day between
+      start and end inclusive, as needed for month or year grids.
+
+      Counts are computed from occurrence times only and kept per
+      notebook and month. They are invalidated for the months an
+      event may cover when it is added, modified or removed, so
+      repeated queries only expand the months that changed. All
+      counts are dropped when an incidence changes notebook, or
+      when notebook visibility or the calendar filter changed since
+      the last call.
+
+      @param start the first day
+      @param end the last day
+      @param notebooks the uids of the notebooks to count events from,
+      all notebooks if empty. Hidden notebooks are never counted.
+      @param timeZone the time zone defining days, the calendar one if invalid
+
+      @return one count per day, the first one being for start
+    */
+    QVector<int> dayOccupancy(const QDate &start, const QDate &end,
+                              const QStringList &notebooks = QStringList(),
+                              const QTimeZone &timeZone = QTimeZone()) const;
+
+    /**
+      Returns the time intervals between start and end where visible
+      events keep their attendees busy. Overlapping and adjacent
+      occurrences are merged, transparent and cancelled events are
+      ignored.
+
+      @param start the start of the range
+      @param end the end of the range, excluded
+      @param notebooks the uids of the notebooks to take events from,
+      all notebooks if empty
+      @return the busy periods, sorted and disjoint, clipped to the
+      range and expressed in the calendar time zone
+    */
+    KCalendarCore::Period::List busyIntervals(const QDateTime &start, const QDateTime &end,
+                                              const QStringList &notebooks = QStringList()) const;
+
+    /**
+      Returns the visible events with an occurrence overlapping
+      @p event, as found by busyIntervals(). Only the start and end
+      times of @p event are checked, not its further recurrences.
+      Occurrences of @p event itself and of its exceptions are ignored.
+
+      @param event the event to check, which may not be in the calendar
+      @param notebooks the uids of the notebooks to take events from,
+      all notebooks if empty
+    */
+    KCalendarCore::Incidence::List conflicts(const KCalendarCore::Event::Ptr &event,
+                                             const QStringList &notebooks = QStringList()) const;
+
     /**
       Expand multiday incidences in a list.
 
@@ -761,6 +939,13 @@ protected:
     virtual void storageProgress(ExtendedStorage *storage, const QString &info);
     virtual void storageFinished(ExtendedStorage *storage, bool error, const QString &info);
 
+    /**
+      @copydoc
+      Calendar::doSetTimeZone()
+
+      Cached recurrence times are dropped on time zone changes.
+    */
+    virtual void doSetTimeZone(const QTimeZone &timeZone);
 
 private:
     //@cond PRIVATE
@@ -37,8 +37,11 @@
 #include <KCalendarCore/Calendar>
 using namespace KCalendarCore;
 
+#include <QtCore/QMap>
 #include <QtCore/QUuid>
 
+#include <limits>
+
 #if defined(MKCAL_FOR_MEEGO)
 # include <mlocale.h>
 #endif
@@ -65,37 +68,37 @@ class mKCal::ExtendedStorage::Private
 public:
     Private(bool validateNotebooks)
         : mValidateNotebooks(validateNotebooks),
-          mIsUncompletedTodosLoaded(false),
-          mIsCompletedTodosDateLoaded(false),
-          mIsCompletedTodosCreatedLoaded(false),
-          mIsDateLoaded(false),
-          mIsCreatedLoaded(false),
-          mIsFutureDateLoaded(false),
-          mIsGeoDateLoaded(false),
-          mIsGeoCreatedLoaded(false),
-          mIsUnreadIncidencesLoaded(false),
-          mIsInvitationIncidencesLoaded(false),
-          mIsJournalsLoaded(false),
-          mDefaultNotebook(0)
+          mDefaultNotebook(0),
+          mLoadWindow(0),
+          mMaxLoadedIncidences(0),
+          mMonthUse(0)
     {}
 
+    // Rows of a query loaded from position mFrom to position mTo, see
+    // position(). Complete queries have no row after mTo.
+    struct LoadedQuery {
+        qint64 mFrom;
+        qint64 mTo;
+        QDateTime mCursor;
+        bool mComplete;
+    };
+
     bool mValidateNotebooks;
-    QDate mStart;
-    QDate mEnd;
-    bool mIsUncompletedTodosLoaded;
-    bool mIsCompletedTodosDateLoaded;
-    bool mIsCompletedTodosCreatedLoaded;
-    bool mIsDateLoaded;
-    bool mIsCreatedLoaded;
-    bool mIsFutureDateLoaded;
-    bool mIsGeoDateLoaded;
-    bool mIsGeoCreatedLoaded;
-    bool mIsUnreadIncidencesLoaded;
-    bool mIsInvitationIncidencesLoaded;
-    bool mIsJournalsLoaded;
+    QMap<QDate, QDate> mLoadedRanges; // [start, end) loaded, disjoint and not adjacent
+    QHash<QString, LoadedQuery> mLoadedQueries; // query key to loaded rows
     QList<ExtendedStorageObserver *> mObservers;
     QHash<QString, Notebook::Ptr> mNotebooks; // uid to notebook
     Notebook::Ptr mDefaultNotebook;
+    int mLoadWindow;
+    int mMaxLoadedIncidences;
+    QMap<QDate, quint64> mMonthUses; // first day of month to last use
+    quint64 mMonthUse;
+
+    void addLoadedRange(QDate start, QDate end);
+    void removeLoadedRange(QDate start, QDate end);
+    void touchMonths(const QDate &start, const QDate &end);
+    QVector<QPair<QDate, QDate>> unloadedRanges(const QDate &start, const QDate &end) const;
+    static qint64 position(const QDateTime &last, bool ascending);
 
     void setAlarmsForNotebook(const KCalendarCore::Incidence::List &incidences, const QString &nbuid);
 #if defined(TIMED_SUPPORT)
@@ -120,43 +123,25 @@ ExtendedStorage::~ExtendedStorage()
 
 void ExtendedStorage::clearLoaded()
 {
-    d->mStart = QDate();
-    d->mEnd = QDate();
-    d->mIsUncompletedTodosLoaded = false;
-    d->mIsCompletedTodosDateLoaded = false;
-    d->mIsCompletedTodosCreatedLoaded = false;
-    d->mIsDateLoaded = false;
-    d->mIsCreatedLoaded = false;
-    d->mIsFutureDateLoaded = false;
-    d->mIsGeoDateLoaded = false;
-    d->mIsGeoCreatedLoaded = false;
-    d->mIsUnreadIncidencesLoaded  = false;
-    d->mIsInvitationIncidencesLoaded  = false;
-    d->mIsJournalsLoaded = false;
+    d->mLoadedRanges.clear();
+    d->mLoadedQueries.clear();
+    d->mMonthUses.clear();
 }
 
 bool ExtendedStorage::getLoadDates(const QDate &start, const QDate &end,
                                    QDateTime &loadStart, QDateTime &loadEnd)
 {
+    d->touchMonths(start, end);
+
     // Check the need to load from db.
-    if (start.isValid() && d->mStart.isValid() && start >= d->mStart &&
-            end.isValid() && d->mEnd.isValid() && end <= d->mEnd) {
+    const QVector<QPair<QDate, QDate>> ranges = d->unloadedRanges(start, end);
+    if (ranges.isEmpty()) {
         return false;
     }
 
     // Set load dates to load only what's necessary.
-    if (start.isValid() && d->mStart.isValid() && start >= d->mStart) {
-        loadStart.setDate(d->mEnd);
-    } else {
-        loadStart.setDate(start);   // may be null if start is not valid
-    }
-
-    if (end.isValid() && d->mEnd.isValid() && end <= d->mEnd) {
-        loadEnd.setDate(d->mStart);
-    } else {
-        loadEnd.setDate(end);   // may be null if end is not valid
-    }
-
+    loadStart.setDate(ranges.first().first);   // may be null if start is not valid
+    loadEnd.setDate(ranges.last().second);     // may be null if end is not valid
     loadStart.setTimeZone(calendar()->timeZone());
     loadEnd.setTimeZone(calendar()->timeZone());
 
@@ -165,127 +150,328 @@ bool ExtendedStorage::getLoadDates(const QDate &start, const QDate &end,
     return true;
 }
 
+QVector<QPair<QDateTime, QDateTime>> ExtendedStorage::getLoadRanges(const QDate &start,
+                                                                   const QDate &end)
+{
+    QVector<QPair<QDateTime, QDateTime>> ranges;
+
+    d->touchMonths(start, end);
+    for (const QPair<QDate, QDate> &range : d->unloadedRanges(start, end)) {
+        QDateTime loadStart;
+        QDateTime loadEnd;
+        loadStart.setDate(range.first);
+        loadEnd.setDate(range.second);
+        loadStart.setTimeZone(calendar()->timeZone());
+        loadEnd.setTimeZone(calendar()->timeZone());
+        ranges.append(qMakePair(loadStart, loadEnd));
+    }
+
+    qCDebug(lcMkcal) << "get load ranges" << start << end << ranges;
+
+    return ranges;
+}
+
 void ExtendedStorage::setLoadDates(const QDate &start, const QDate &end)
 {
-    // Set dates.
-    if (start.isValid() && (!d->mStart.isValid() || start < d->mStart)) {
-        d->mStart = start;
+    d->addLoadedRange(start, end);
+
+    qCDebug(lcMkcal) << "set load dates" << start << end << "loaded" << d->mLoadedRanges;
+}
+
+//@cond PRIVATE
+// Bounds used for the unbounded ends of the loaded ranges.
+static const QDate LOAD_DATE_MIN(1, 1, 1);
+static const QDate LOAD_DATE_MAX(9999, 12, 31);
+
+void ExtendedStorage::Private::addLoadedRange(QDate start, QDate end)
+{
+    start = start.isValid() ? start : LOAD_DATE_MIN;
+    end = end.isValid() ? end : LOAD_DATE_MAX;
+    if (end < start) {
+        return;
+    }
+
+    // Merge with the overlapping or adjacent ranges.
+    QMap<QDate, QDate>::Iterator it = mLoadedRanges.upperBound(start);
+    if (it != mLoadedRanges.begin()) {
+        QMap<QDate, QDate>::Iterator previous = it - 1;
+        if (previous.value() >= start) {
+            start = previous.key();
+            end = qMax(end, previous.value());
+            mLoadedRanges.erase(previous);
+        }
+    }
+    while (it != mLoadedRanges.end() && it.key() <= end) {
+        end = qMax(end, it.value());
+        it = mLoadedRanges.erase(it);
+    }
+    mLoadedRanges.insert(start, end);
+}
+
+void ExtendedStorage::Private::removeLoadedRange(QDate start, QDate end)
+{
+    start = start.isValid() ? start : LOAD_DATE_MIN;
+    end = end.isValid() ? end : LOAD_DATE_MAX;
+    if (end <= start) {
+        return;
+    }
+
+    // Cut the overlapping ranges, keeping their parts out of [start, end).
+    QDate tail;
+    QMap<QDate, QDate>::Iterator it = mLoadedRanges.lowerBound(start);
+    if (it != mLoadedRanges.begin()) {
+        QMap<QDate, QDate>::Iterator previous = it - 1;
+        if (previous.value() > start) {
+            if (previous.value() > end) {
+                tail = previous.value();
+            }
+            previous.value() = start;
+        }
+    }
+    while (it != mLoadedRanges.end() && it.key() < end) {
+        if (it.value() > end) {
+            tail = it.value();
+        }
+        it = mLoadedRanges.erase(it);
+    }
+    if (tail.isValid()) {
+        mLoadedRanges.insert(end, tail);
+    }
+}
+
+void ExtendedStorage::Private::touchMonths(const QDate &start, const QDate &end)
+{
+    // Unbounded requests are not tracked, evict() works by months.
+    if (!start.isValid() || !end.isValid()) {
+        return;
+    }
+
+    const QDate last = end > start ? end.addDays(-1) : start;
+    mMonthUse += 1;
+    for (QDate month(start.year(), start.month(), 1); month <= last; month = month.addMonths(1)) {
+        mMonthUses.insert(month, mMonthUse);
+    }
+}
+
+QVector<QPair<QDate, QDate>> ExtendedStorage::Private::unloadedRanges(const QDate &start,
+                                                                      const QDate &end) const
+{
+    QVector<QPair<QDate, QDate>> ranges;
+    const QDate last = end.isValid() ? end : LOAD_DATE_MAX;
+    QDate cursor = start.isValid() ? start : LOAD_DATE_MIN;
+
+    QMap<QDate, QDate>::ConstIterator it = mLoadedRanges.upperBound(cursor);
+    if (cursor == last) {
+        // A single date, loaded if inside a range.
+        if (it == mLoadedRanges.constBegin() || (it - 1).value() < cursor) {
+            ranges.append(qMakePair(cursor, last));
+        }
+        return ranges;
+    }
+    if (it != mLoadedRanges.constBegin() && (it - 1).value() > cursor) {
+        cursor = (it - 1).value();
+    }
+    while (cursor < last) {
+        if (it == mLoadedRanges.constEnd() || it.key() >= last) {
+            ranges.append(qMakePair(cursor, last));
+            break;
+        }
+        if (it.key() > cursor) {
+            ranges.append(qMakePair(cursor, it.key()));
+        }
+        cursor = qMax(cursor, it.value());
+        ++it;
+    }
+
+    // Unbounded ends are given back as invalid dates.
+    for (QPair<QDate, QDate> &range : ranges) {
+        if (range.first == LOAD_DATE_MIN) {
+            range.first = QDate();
+        }
+        if (range.second == LOAD_DATE_MAX) {
+            range.second = QDate();
+        }
+    }
+    return ranges;
+}
+//@endcond
+
+//@cond PRIVATE
+// Position of a row in a query sorted by dates. Positions grow along
+// the query, an invalid date is the start of a descending query and
+// the end of an ascending one, like the bounds used by the storage.
+qint64 ExtendedStorage::Private::position(const QDateTime &last, bool ascending)
+{
+    if (!last.isValid()) {
+        return ascending ? std::numeric_limits<qint64>::max() : std::numeric_limits<qint64>::min();
+    }
+    return ascending ? last.toMSecsSinceEpoch() : -last.toMSecsSinceEpoch();
+}
+//@endcond
+
+bool ExtendedStorage::isLoaded(const QString &query, const QDateTime &last, bool ascending) const
+{
+    QHash<QString, Private::LoadedQuery>::ConstIterator it = d->mLoadedQueries.constFind(query);
+    return it != d->mLoadedQueries.constEnd() && it->mComplete
+        && Private::position(last, ascending) >= it->mFrom;
+}
+
+void ExtendedStorage::setLoaded(const QString &query, bool loaded)
+{
+    if (loaded) {
+        Private::LoadedQuery all;
+        all.mFrom = std::numeric_limits<qint64>::min();
+        all.mTo = std::numeric_limits<qint64>::max();
+        all.mComplete = true;
+        d->mLoadedQueries.insert(query, all);
+    } else {
+        d->mLoadedQueries.remove(query);
     }
-    if (end.isValid() && (!d->mEnd.isValid() || end > d->mEnd)) {
-        d->mEnd = end;
+}
+
+QDateTime ExtendedStorage::loadedCursor(const QString &query, const QDateTime &last,
+                                        bool ascending) const
+{
+    QHash<QString, Private::LoadedQuery>::ConstIterator it = d->mLoadedQueries.constFind(query);
+    if (it != d->mLoadedQueries.constEnd() && !it->mComplete) {
+        const qint64 position = Private::position(last, ascending);
+        if (position >= it->mFrom && position < it->mTo) {
+            return it->mCursor;
+        }
     }
+    return last;
+}
 
-    qCDebug(lcMkcal) << "set load dates" << d->mStart << d->mEnd;
+void ExtendedStorage::setLoadedPage(const QString &query, const QDateTime &from, const QDateTime &to,
+                                    bool complete, bool ascending)
+{
+    Private::LoadedQuery page;
+    page.mFrom = Private::position(from, ascending);
+    page.mTo = complete ? std::numeric_limits<qint64>::max() : Private::position(to, ascending);
+    page.mCursor = to;
+    page.mComplete = complete;
+
+    QHash<QString, Private::LoadedQuery>::Iterator it = d->mLoadedQueries.find(query);
+    if (it == d->mLoadedQueries.end()
+        || (page.mFrom <= it->mFrom && page.mTo >= it->mTo)) {
+        d->mLoadedQueries.insert(query, page);
+    } else if (page.mFrom >= it->mFrom && page.mFrom <= it->mTo && page.mTo > it->mTo) {
+        // Contiguous to the rows already loaded, move the cursor.
+        it->mTo = page.mTo;
+        it->mCursor = page.mCursor;
+        it->mComplete = page.mComplete;
+    }
+    // Otherwise keep the rows already loaded, a single range is kept per query.
 }
 
 bool ExtendedStorage::isUncompletedTodosLoaded()
 {
-    return d->mIsUncompletedTodosLoaded;
+    return isLoaded(QStringLiteral("uncompletedTodos"));
 }
 
 void ExtendedStorage::setIsUncompletedTodosLoaded(bool loaded)
 {
-    d->mIsUncompletedTodosLoaded = loaded;
+    setLoaded(QStringLiteral("uncompletedTodos"), loaded);
 }
 
 bool ExtendedStorage::isCompletedTodosDateLoaded()
 {
-    return d->mIsCompletedTodosDateLoaded;
+    return isLoaded(QStringLiteral("completedTodos/date"));
 }
 
 void ExtendedStorage::setIsCompletedTodosDateLoaded(bool loaded)
 {
-    d->mIsCompletedTodosDateLoaded = loaded;
+    setLoaded(QStringLiteral("completedTodos/date"), loaded);
 }
 
 bool ExtendedStorage::isCompletedTodosCreatedLoaded()
 {
-    return d->mIsCompletedTodosCreatedLoaded;
+    return isLoaded(QStringLiteral("completedTodos/created"));
 }
 
 void ExtendedStorage::setIsCompletedTodosCreatedLoaded(bool loaded)
 {
-    d->mIsCompletedTodosCreatedLoaded = loaded;
+    setLoaded(QStringLiteral("completedTodos/created"), loaded);
 }
 
 bool ExtendedStorage::isDateLoaded()
 {
-    return d->mIsDateLoaded;
+    return isLoaded(QStringLiteral("incidences/date"));
 }
 
 void ExtendedStorage::setIsDateLoaded(bool loaded)
 {
-    d->mIsDateLoaded = loaded;
+    setLoaded(QStringLiteral("incidences/date"), loaded);
 }
 
 bool ExtendedStorage::isFutureDateLoaded()
 {
-    return d->mIsFutureDateLoaded;
+    return isLoaded(QStringLiteral("futureIncidences"));
 }
 
 void ExtendedStorage::setIsFutureDateLoaded(bool loaded)
 {
-    d->mIsFutureDateLoaded = loaded;
+    setLoaded(QStringLiteral("futureIncidences"), loaded);
 }
 
 bool ExtendedStorage::isJournalsLoaded()
 {
-    return d->mIsJournalsLoaded;
+    return isLoaded(QStringLiteral("journals"));
 }
 
 void ExtendedStorage::setIsJournalsLoaded(bool loaded)
 {
-    d->mIsJournalsLoaded = loaded;
+    setLoaded(QStringLiteral("journals"), loaded);
 }
 
 bool ExtendedStorage::isCreatedLoaded()
 {
-    return d->mIsCreatedLoaded;
+    return isLoaded(QStringLiteral("incidences/created"));
 }
 
 void ExtendedStorage::setIsCreatedLoaded(bool loaded)
 {
-    d->mIsCreatedLoaded = loaded;
+    setLoaded(QStringLiteral("incidences/created"), loaded);
 }
 
 bool ExtendedStorage::isGeoDateLoaded()
 {
-    return d->mIsGeoDateLoaded;
+    return isLoaded(QStringLiteral("geoIncidences/date"));
 }
 
 void ExtendedStorage::setIsGeoDateLoaded(bool loaded)
 {
-    d->mIsGeoDateLoaded = loaded;
+    setLoaded(QStringLiteral("geoIncidences/date"), loaded);
 }
 
 bool ExtendedStorage::isGeoCreatedLoaded()
 {
-    return d->mIsGeoCreatedLoaded;
+    return isLoaded(QStringLiteral("geoIncidences/created"));
 }
 
 void ExtendedStorage::setIsGeoCreatedLoaded(bool loaded)
 {
-    d->mIsGeoCreatedLoaded = loaded;
+    setLoaded(QStringLiteral("geoIncidences/created"), loaded);
 }
 
 bool ExtendedStorage::isUnreadIncidencesLoaded()
 {
-    return d->mIsUnreadIncidencesLoaded;
+    return isLoaded(QStringLiteral("unreadInvitations"));
 }
 
 void ExtendedStorage::setIsUnreadIncidencesLoaded(bool loaded)
 {
-    d->mIsUnreadIncidencesLoaded = loaded;
+    setLoaded(QStringLiteral("unreadInvitations"), loaded);
 }
 
 bool ExtendedStorage::isInvitationIncidencesLoaded()
 {
-    return d->mIsInvitationIncidencesLoaded;
+    return isLoaded(QStringLiteral("oldInvitations"));
 }
 
 void ExtendedStorage::setIsInvitationIncidencesLoaded(bool loaded)
 {
-    d->mIsInvitationIncidencesLoaded = loaded;
+    setLoaded(QStringLiteral("oldInvitations"), loaded);
 }
 
 #if 0
@@ -312,6 +498,153 @@ void ExtendedStorage::ExtendedStorageObserver::storageFinished(ExtendedStorage *
 }
 #endif
 
+void ExtendedStorage::setLoadWindow(int months)
+{
+    d->mLoadWindow = qMax(months, 0);
+}
+
+int ExtendedStorage::loadWindow() const
+{
+    return d->mLoadWindow;
+}
+
+void ExtendedStorage::setMaxLoadedIncidences(int count)
+{
+    d->mMaxLoadedIncidences = qMax(count, 0);
+}
+
+int ExtendedStorage::maxLoadedIncidences() const
+{
+    return d->mMaxLoadedIncidences;
+}
+
+//@cond PRIVATE
+// Dates covered by an incidence in the calendar time zone, false
+// for the incidences that are never evicted.
+static bool evictionDates(const Incidence::Ptr &incidence, const QTimeZone &timeZone,
+                          QDate *start, QDate *end)
+{
+    if (incidence->recurs() || incidence->hasRecurrenceId()) {
+        return false;
+    }
+
+    QDateTime dtStart = incidence->dtStart();
+    QDateTime dtEnd = incidence->dateTime(Incidence::RoleEnd);
+    if (!dtStart.isValid()) {
+        dtStart = dtEnd;
+    }
+    if (!dtStart.isValid()) {
+        return false;
+    }
+    if (!dtEnd.isValid() || dtEnd < dtStart) {
+        dtEnd = dtStart;
+    }
+    if (incidence->allDay()) {
+        *start = dtStart.date();
+        *end = dtEnd.date();
+    } else {
+        *start = dtStart.toTimeZone(timeZone).date();
+        *end = dtEnd.toTimeZone(timeZone).date();
+    }
+    return true;
+}
+//@endcond
+
+int ExtendedStorage::evict(const QDate &focus)
+{
+    if (!focus.isValid() || (!d->mLoadWindow && !d->mMaxLoadedIncidences)) {
+        return 0;
+    }
+
+    struct Candidate {
+        Incidence::Ptr incidence;
+        QDate start;
+        QDate end;
+    };
+
+    // The incidences of the focus month always stay.
+    const QDate month(focus.year(), focus.month(), 1);
+    const Incidence::List incidences = calendar()->rawIncidences();
+    QVector<Candidate> candidates;
+    Incidence::List unloaded;
+    for (const Incidence::Ptr &incidence : incidences) {
+        Candidate candidate;
+        if (evictionDates(incidence, calendar()->timeZone(), &candidate.start, &candidate.end)
+            && (candidate.start >= month.addMonths(1) || candidate.end < month)) {
+            candidate.incidence = incidence;
+            candidates.append(candidate);
+        }
+    }
+    int count = 0;
+
+    if (d->mLoadWindow) {
+        const QDate keepStart = month.addMonths(-d->mLoadWindow);
+        const QDate keepEnd = month.addMonths(d->mLoadWindow + 1);
+        for (Candidate &candidate : candidates) {
+            if ((candidate.start >= keepEnd || candidate.end < keepStart)
+                && unloadIncidence(candidate.incidence)) {
+                unloaded.append(candidate.incidence);
+                candidate.incidence.clear();
+                count += 1;
+            }
+        }
+        d->removeLoadedRange(QDate(), keepStart);
+        d->removeLoadedRange(keepEnd, QDate());
+        d->mMonthUses.erase(d->mMonthUses.begin(), d->mMonthUses.lowerBound(keepStart));
+        d->mMonthUses.erase(d->mMonthUses.lowerBound(keepEnd), d->mMonthUses.end());
+    }
+
+    if (d->mMaxLoadedIncidences) {
+        QMultiMap<quint64, QDate> months; // last use to month
+        for (QMap<QDate, quint64>::ConstIterator it = d->mMonthUses.constBegin();
+             it != d->mMonthUses.constEnd(); ++it) {
+            if (it.key() != month) {
+                months.insert(it.value(), it.key());
+            }
+        }
+        for (const QDate &first : months) {
+            if (incidences.count() - count <= d->mMaxLoadedIncidences) {
+                break;
+            }
+            // Incidences may span several months, the dates of all of
+            // them are not loaded anymore.
+            const QDate last = first.addMonths(1);
+            QDate unloadStart = first;
+            QDate unloadEnd = last;
+            for (Candidate &candidate : candidates) {
+                if (candidate.incidence && candidate.start < last && candidate.end >= first
+                    && unloadIncidence(candidate.incidence)) {
+                    unloadStart = qMin(unloadStart, candidate.start);
+                    unloadEnd = qMax(unloadEnd, candidate.end.addDays(1));
+                    unloaded.append(candidate.incidence);
+                    candidate.incidence.clear();
+                    count += 1;
+                }
+            }
+            d->removeLoadedRange(unloadStart, unloadEnd);
+            d->mMonthUses.remove(first);
+        }
+    }
+
+    if (count) {
+        // Paged queries may have lost some of their rows.
+        d->mLoadedQueries.clear();
+
+        foreach (ExtendedStorageObserver *observer, d->mObservers) {
+            observer->storageUnloaded(this, unloaded);
+        }
+    }
+    qCDebug(lcMkcal) << "evicted" << count << "incidences around" << focus
+                     << "loaded" << d->mLoadedRanges;
+
+    return count;
+}
+
+bool ExtendedStorage::unloadIncidence(const Incidence::Ptr &incidence)
+{
+    return calendar().staticCast<ExtendedCalendar>()->unloadIncidence(incidence);
+}
+
 void ExtendedStorage::registerObserver(ExtendedStorageObserver *observer)
 {
     if (!d->mObservers.contains(observer)) {
@@ -326,16 +659,9 @@ void ExtendedStorage::unregisterObserver(ExtendedStorageObserver *observer)
 
 void ExtendedStorage::setModified(const QString &info)
 {
-    // Clear all smart loading variables
-    d->mStart = QDate();
-    d->mEnd = QDate();
-    d->mIsUncompletedTodosLoaded = false;
-    d->mIsCompletedTodosDateLoaded = false;
-    d->mIsCompletedTodosCreatedLoaded = false;
-    d->mIsGeoDateLoaded = false;
-    d->mIsGeoCreatedLoaded = false;
-    d->mIsUnreadIncidencesLoaded = false;
-    d->mIsInvitationIncidencesLoaded = false;
+    // Clear all smart loading variables, the changes are unknown.
+    d->mLoadedRanges.clear();
+    d->mLoadedQueries.clear();
 
     foreach (ExtendedStorageObserver *observer, d->mObservers) {
         observer->storageModified(this, info);
@@ -534,6 +860,186 @@ bool ExtendedStorage::isValidNotebook(const QString &notebookUid)
     return true;
 }
 
+bool ExtendedStorage::load(const QDate &start, const QDate &end, LoadProjection projection)
+{
+    Q_UNUSED(projection);
+
+    return load(start, end);
+}
+
+int ExtendedStorage::loadIncidences(bool hasDate, int limit, QByteArray *token)
+{
+    Q_UNUSED(hasDate);
+    Q_UNUSED(limit);
+    Q_UNUSED(token);
+
+    return -1;
+}
+
+int ExtendedStorage::loadCompletedTodos(bool hasDate, int limit, QByteArray *token)
+{
+    Q_UNUSED(hasDate);
+    Q_UNUSED(limit);
+    Q_UNUSED(token);
+
+    return -1;
+}
+
+int ExtendedStorage::loadJournals(int limit, QByteArray *token)
+{
+    Q_UNUSED(limit);
+    Q_UNUSED(token);
+
+    return -1;
+}
+
+int ExtendedStorage::loadOldInvitationIncidences(int limit, QByteArray *token)
+{
+    Q_UNUSED(limit);
+    Q_UNUSED(token);
+
+    return -1;
+}
+
+int ExtendedStorage::loadContactIncidences(const Person &person, int limit, QByteArray *token)
+{
+    Q_UNUSED(person);
+    Q_UNUSED(limit);
+    Q_UNUSED(token);
+
+    return -1;
+}
+
+bool ExtendedStorage::loadNotebooksIncidences(const QStringList &notebookUids)
+{
+    bool success = true;
+    for (const QString &notebookUid : notebookUids) {
+        success = loadNotebookIncidences(notebookUid) && success;
+    }
+    return success;
+}
+
+bool ExtendedStorage::loadNotebooksIncidences(const QStringList &notebookUids,
+                                              const QDate &start, const QDate &end)
+{
+    Q_UNUSED(notebookUids);
+    Q_UNUSED(start);
+    Q_UNUSED(end);
+
+    return false;
+}
+
+bool ExtendedStorage::beginRead()
+{
+    return true;
+}
+
+bool ExtendedStorage::endRead()
+{
+    return true;
+}
+
+bool ExtendedStorage::applyChanges(const QString &notebookUid,
+                                   const Incidence::List &upserts,
+                                   const Incidence::List &deletes,
+                                   DeleteAction deleteAction)
+{
+    if (!isValidNotebook(notebookUid)) {
+        qCWarning(lcMkcal) << "cannot apply changes to notebook" << notebookUid;
+        return false;
+    }
+
+    // Incidences are not moved from, nor deleted from, other notebooks.
+    for (const Incidence::Ptr &incidence : upserts + deletes) {
+        load(incidence->uid(), incidence->recurrenceId());
+        const QString stored = calendar()->notebook(incidence->uid());
+        if (!stored.isEmpty() && stored != notebookUid) {
+            qCWarning(lcMkcal) << "incidence" << incidence->uid() << "is stored in notebook"
+                               << stored << "- not applying changes to" << notebookUid;
+            return false;
+        }
+    }
+
+    for (const Incidence::Ptr &incidence : upserts) {
+        Incidence::Ptr old = calendar()->incidence(incidence->uid(), incidence->recurrenceId());
+        if (old && old->type() == incidence->type()) {
+            if (old != incidence) {
+                // Update the loaded copy in place, observers are notified.
+                static_cast<IncidenceBase &>(*old) = *incidence;
+            }
+            calendar()->setNotebook(old, notebookUid);
+        } else {
+            if (old) {
+                calendar()->deleteIncidence(old);
+            }
+            if (!calendar()->addIncidence(incidence)
+                || !calendar()->setNotebook(incidence, notebookUid)) {
+                qCWarning(lcMkcal) << "cannot add incidence" << incidence->uid() << "to notebook" << notebookUid;
+                return false;
+            }
+        }
+    }
+    for (const Incidence::Ptr &incidence : deletes) {
+        Incidence::Ptr old = calendar()->incidence(incidence->uid(), incidence->recurrenceId());
+        if (old) {
+            calendar()->deleteIncidence(old);
+        }
+    }
+
+    return save(deleteAction);
+}
+
+static ExtendedStorage::ManifestEntry manifestEntry(const Incidence::Ptr &incidence,
+                                                   const QByteArray &propertyName)
+{
+    ExtendedStorage::ManifestEntry entry;
+    entry.uid = incidence->uid();
+    entry.recurrenceId = incidence->recurrenceId();
+    entry.lastModified = incidence->lastModified();
+    entry.revision = incidence->revision();
+    if (!propertyName.isEmpty()) {
+        entry.customPropertyValue = incidence->customProperties().value(propertyName);
+    }
+    return entry;
+}
+
+bool ExtendedStorage::manifest(Manifest *list, const QString &notebookUid,
+                               const QByteArray &propertyName)
+{
+    Incidence::List incidences;
+    if (!list || !allIncidences(&incidences, notebookUid)) {
+        return false;
+    }
+    for (const Incidence::Ptr &incidence : const_cast<const Incidence::List &>(incidences)) {
+        list->append(manifestEntry(incidence, propertyName));
+    }
+    return true;
+}
+
+bool ExtendedStorage::manifestByCustomProperty(Manifest *list, const QByteArray &propertyName,
+                                               const QString &value)
+{
+    Incidence::List incidences;
+    if (!list || propertyName.isEmpty() || !allIncidences(&incidences)) {
+        return false;
+    }
+    for (const Incidence::Ptr &incidence : const_cast<const Incidence::List &>(incidences)) {
+        const QMap<QByteArray, QString> properties = incidence->customProperties();
+        QMap<QByteArray, QString>::ConstIterator it = properties.find(propertyName);
+        if (it != properties.constEnd() && it.value() == value) {
+            list->append(manifestEntry(incidence, propertyName));
+        }
+    }
+    return true;
+}
+
+QIODevice *ExtendedStorage::attachmentData(const Attachment &attachment)
+{
+    Q_UNUSED(attachment);
+
+    return nullptr;
+}
+
 void ExtendedStorage::resetAlarms(const Incidence::Ptr &incidence)
 {
     resetAlarms(Incidence::List(1, incidence));
@@ -569,6 +1075,13 @@ void ExtendedStorage::setAlarms(const Incidence::List &incidences)
 #endif
 }
 
+void ExtendedStorage::setAlarms(const Incidence::List &incidences, const QString &notebookUid)
+{
+    // Contrary to setAlarms(incidences), the incidences are not required
+    // to be loaded into the calendar.
+    d->setAlarmsForNotebook(incidences, notebookUid);
+}
+
 void ExtendedStorage::clearAlarms(const Incidence::Ptr &incidence)
 {
 #if defined(TIMED_SUPPORT)
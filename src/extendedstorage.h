@@ -43,6 +43,7 @@ class Incidence;
 }
 
 class MkcalTool;
+class QIODevice;
 
 namespace mKCal {
 
@@ -86,6 +87,34 @@ public:
         PurgeDeleted
     };
 
+    /**
+      Parts of the incidences read from the storage on load.
+    */
+    enum LoadProjection {
+        FullIncidences,   /**< all incidence data */
+        HeaderOnly        /**< incidence without attendees, alarms, custom
+                               properties and attachments, completed on
+                               notifyOpened() */
+    };
+
+    /**
+      Light weight description of a stored incidence, as returned
+      by manifest(). It is meant to compare the local state with
+      a remote one without decoding the whole incidence.
+    */
+    struct ManifestEntry {
+        QString uid;
+        QDateTime recurrenceId;
+        QDateTime lastModified;
+        int revision = 0;
+        QString customPropertyValue;
+    };
+
+    /**
+      List of manifest entries.
+    */
+    typedef QVector<ManifestEntry> Manifest;
+
     /**
       A shared pointer to a ExtendedStorage
     */
@@ -151,6 +180,24 @@ public:
     */
     virtual bool load(const QDate &start, const QDate &end) = 0;
 
+    /**
+      Load incidences between given dates into the memory, reading
+      only the parts described by @p projection. Views displaying
+      incidences over a period can use HeaderOnly to save reading
+      the data they don't display. The skipped parts are read when
+      calling notifyOpened() on the incidence, or when loading the
+      period again with FullIncidences: only full loads mark the
+      dates as loaded.
+
+      The default implementation ignores @p projection.
+
+      @param start is the starting date
+      @param end is the ending date
+      @param projection the parts of the incidences to read
+      @return true if the load was successful and specific dates wasn't already loaded; false otherwise.
+    */
+    virtual bool load(const QDate &start, const QDate &end, LoadProjection projection);
+
     /**
       Load all incidences sharing the same uid into the memory.
 
@@ -177,6 +224,53 @@ public:
     */
     virtual bool loadNotebookIncidences(const QString &notebookUid) = 0;
 
+    /**
+      Load incidences of several notebooks into the memory.
+
+      Storages may read the notebooks concurrently, incidences are
+      added to the calendar from the calling thread. The default
+      implementation loads them one after another.
+
+      @param notebookUids are uids of notebooks
+      @return true if the load was successful; false otherwise.
+    */
+    virtual bool loadNotebooksIncidences(const QStringList &notebookUids);
+
+    /**
+      Load incidences of several notebooks between start and end dates
+      into the memory, see loadNotebooksIncidences(const QStringList &).
+
+      The range is not marked as loaded, since other notebooks are not.
+      The default implementation returns false.
+
+      @param notebookUids are uids of notebooks
+      @param start is the starting date, invalid for no lower bound
+      @param end is the ending date, invalid for no upper bound
+      @return true if the load was successful; false otherwise.
+    */
+    virtual bool loadNotebooksIncidences(const QStringList &notebookUids,
+                                         const QDate &start, const QDate &end);
+
+    /**
+      Starts a read session. The loads done until the matching endRead()
+      see the same state of the storage, whatever other processes save
+      meanwhile, and skip the locking done for each load otherwise.
+
+      Sessions can be nested, only the outermost one has an effect.
+      Nothing can be saved during a session. The default implementation
+      does nothing.
+
+      @return true if the session has started; false otherwise.
+    */
+    virtual bool beginRead();
+
+    /**
+      Ends a read session started by beginRead().
+
+      @return true if the session has ended; false otherwise.
+    */
+    virtual bool endRead();
+
     /**
       Load journal type entries
     */
@@ -329,6 +423,48 @@ public:
     */
     virtual int loadJournals(int limit, QDateTime *last) = 0;
 
+    /**
+      Load a page of incidences based on start/due date or creation
+      date, in the same order as loadIncidences(bool, int, QDateTime*).
+
+      Pages are delimited by the position of their last incidence, so
+      incidences sharing the same date are neither loaded twice nor
+      skipped, and each page only costs its own size.
+
+      The default implementation returns -1.
+
+      @param hasDate set true to load incidences that have start/due date
+      @param limit the size of the page
+      @param token an opaque continuation token, empty to load the first
+      page, updated to continue after the loaded page
+      @return number of incidences in the page, or -1 on error. Pages
+      smaller than @p limit are the last ones.
+    */
+    virtual int loadIncidences(bool hasDate, int limit, QByteArray *token);
+
+    /**
+      Load a page of completed todos, see loadIncidences(bool, int, QByteArray*).
+    */
+    virtual int loadCompletedTodos(bool hasDate, int limit, QByteArray *token);
+
+    /**
+      Load a page of journals, see loadIncidences(bool, int, QByteArray*).
+    */
+    virtual int loadJournals(int limit, QByteArray *token);
+
+    /**
+      Load a page of incidences related to an invitation, see
+      loadIncidences(bool, int, QByteArray*).
+    */
+    virtual int loadOldInvitationIncidences(int limit, QByteArray *token);
+
+    /**
+      Load a page of incidences that have the specified attendee, see
+      loadIncidences(bool, int, QByteArray*).
+    */
+    virtual int loadContactIncidences(const KCalendarCore::Person &person,
+                                      int limit, QByteArray *token);
+
     /**
       Remove from storage all incidences that have been previously
       marked as deleted and that matches the UID / RecID of the incidences
@@ -360,6 +496,11 @@ public:
       This should be called only if the Incidence has been opened by the user
       and displayed all the contents. Being in a list doesn't qualify for it.
 
+      For incidences loaded with the HeaderOnly projection, the parts
+      that were skipped on load are read from the storage. Such incidences
+      should be opened before modifying their attendees, alarms, custom
+      properties or attachments, otherwise these changes are not saved.
+
       @param incidence The incidence that has been opened
       @return True if sucessful; false otherwise
     */
@@ -476,6 +617,70 @@ public:
                                      const KCalendarCore::Incidence::Ptr &incidence,
                                      const QString &notebookUid = QString()) = 0;
 
+    /**
+      Apply a batch of changes, typically received from a remote server,
+      directly to the storage. Incidences from @p upserts are inserted,
+      or replace the stored incidence with the same UID and recurrence id.
+      Incidences from @p deletes are deleted, only their UID and
+      recurrence id matter. Copies already loaded in the calendar are
+      updated accordingly, other incidences are not loaded. Nothing is
+      applied when an upserted or deleted UID is stored in another
+      notebook.
+
+      The default implementation routes the changes through the calendar
+      and calls save(). Storages should reimplement it to avoid loading
+      each incidence first.
+
+      @param notebookUid notebook the upserted incidences belong to
+      @param upserts incidences to insert or update
+      @param deletes incidences to delete
+      @param deleteAction the action to apply to deleted incidences
+      @return true if successful; false otherwise
+    */
+    virtual bool applyChanges(const QString &notebookUid,
+                              const KCalendarCore::Incidence::List &upserts,
+                              const KCalendarCore::Incidence::List &deletes,
+                              DeleteAction deleteAction = MarkDeleted);
+
+    /**
+      Get the manifest of the stored incidences, without loading them.
+
+      @param list the manifest entries
+      @param notebookUid list only entries of this notebook, all entries
+             if null
+      @param propertyName name of a custom property, like a remote etag,
+             to report in ManifestEntry::customPropertyValue
+      @return true if the operation was successful; false otherwise.
+    */
+    virtual bool manifest(Manifest *list, const QString &notebookUid = QString(),
+                          const QByteArray &propertyName = QByteArray());
+
+    /**
+      Get the manifest entries of the stored incidences having a
+      custom property @p propertyName of value @p value, like a remote
+      identifier.
+
+      @param list the manifest entries
+      @param propertyName name of the custom property
+      @param value value of the custom property
+      @return true if the operation was successful; false otherwise.
+    */
+    virtual bool manifestByCustomProperty(Manifest *list, const QByteArray &propertyName,
+                                          const QString &value);
+
+    /**
+      Open the data of a binary attachment. Storages may load large
+      binary attachments as references to their data, these references
+      are URI attachments specific to the storage. Their data are read
+      on demand from the returned device.
+
+      @param attachment an attachment of a loaded incidence
+      @return a device opened for reading, owned by the caller, or
+              nullptr if @p attachment is not a reference to the storage
+              data. The default implementation returns nullptr.
+    */
+    virtual QIODevice *attachmentData(const KCalendarCore::Attachment &attachment);
+
     /**
       Get deletion time of incidence
 
@@ -505,6 +710,51 @@ public:
     */
     virtual int journalCount() = 0;
 
+    // Eviction Methods //
+
+    /**
+      Sets the number of months kept loaded on each side of the month
+      of the focus date by evict().
+
+      @param months the number of months, 0 to keep everything
+    */
+    void setLoadWindow(int months);
+
+    /**
+      Returns the number of months kept loaded around the focus date.
+    */
+    int loadWindow() const;
+
+    /**
+      Sets the maximum number of incidences that evict() keeps loaded.
+      Above it, the incidences of the months least recently asked for
+      with load() are unloaded first.
+
+      @param count the maximum number of incidences, 0 for no maximum
+    */
+    void setMaxLoadedIncidences(int count);
+
+    /**
+      Returns the maximum number of incidences kept loaded.
+    */
+    int maxLoadedIncidences() const;
+
+    /**
+      Unloads from the calendar the incidences outside of the load
+      window around @p focus, and then the least recently used ones
+      while there are more than maxLoadedIncidences().
+
+      Only dated incidences, neither recurring nor exceptions, and
+      without unsaved changes are unloaded. They are not deleted, the
+      dates they were loaded for are simply marked as not loaded.
+      Storage observers are given the unloaded incidences with
+      ExtendedStorageObserver::storageUnloaded().
+
+      @param focus the date being displayed
+      @return the number of unloaded incidences
+    */
+    int evict(const QDate &focus);
+
     // Observer Specific Methods //
 
     /**
@@ -673,8 +923,27 @@ protected:
     bool getLoadDates(const QDate &start, const QDate &end,
                       QDateTime &loadStart, QDateTime &loadEnd);
 
+    /**
+      Returns the parts of the range between start and end which are
+      not loaded yet, sorted and disjoint. Invalid date times stand
+      for unbounded ends.
+    */
+    QVector<QPair<QDateTime, QDateTime>> getLoadRanges(const QDate &start, const QDate &end);
+
+    /**
+      Marks the range between start and end as loaded, merging it
+      with the ranges already loaded. Invalid dates stand for unbounded ends.
+    */
     void setLoadDates(const QDate &start, const QDate &end);
 
+    /**
+      Removes @p incidence from the calendar memory, for evict().
+      Storages should refuse incidences with unsaved changes.
+
+      @return true if the incidence was unloaded
+    */
+    virtual bool unloadIncidence(const KCalendarCore::Incidence::Ptr &incidence);
+
     void setModified(const QString &info);
     void setProgress(const QString &info);
     void setFinished(bool error, const QString &info);
@@ -686,9 +955,47 @@ protected:
     void clearAlarms(const QString &nname);
     void setAlarms(const KCalendarCore::Incidence::Ptr &incidence);
     void setAlarms(const KCalendarCore::Incidence::List &incidences);
+    void setAlarms(const KCalendarCore::Incidence::List &incidences, const QString &notebookUid);
     void resetAlarms(const KCalendarCore::Incidence::List &incidences);
     void resetAlarms(const KCalendarCore::Incidence::Ptr &incidence);
 
+    /**
+      Returns true if all the rows of @p query are loaded, or for a paged
+      query, all its rows from @p last onwards in the query order.
+      Queries are named by free form keys, made of the query kind and
+      of its parameters.
+
+      @param query the key of the query
+      @param last the row position, invalid for the start of a
+      descending query or the end of an ascending one
+      @param ascending true if the query is sorted by ascending dates
+    */
+    bool isLoaded(const QString &query, const QDateTime &last = QDateTime(),
+                  bool ascending = false) const;
+
+    /**
+      Marks all the rows of @p query as loaded, or forgets about them.
+    */
+    void setLoaded(const QString &query, bool loaded = true);
+
+    /**
+      Returns the position a paged @p query asked from @p last should
+      actually be loaded from: the cursor reached by the previous pages
+      when @p last falls into the rows they loaded, or @p last itself.
+    */
+    QDateTime loadedCursor(const QString &query, const QDateTime &last,
+                           bool ascending = false) const;
+
+    /**
+      Records that the rows of the paged @p query between @p from and
+      @p to are loaded. Pages contiguous to the ones already recorded
+      move the cursor forward.
+
+      @param complete true if no row remains after @p to
+    */
+    void setLoadedPage(const QString &query, const QDateTime &from, const QDateTime &to,
+                       bool complete, bool ascending = false);
+
     bool isUncompletedTodosLoaded();
     void setIsUncompletedTodosLoaded(bool loaded);
 
@@ -33,6 +33,8 @@
 
 #include <QString>
 
+#include <KCalendarCore/Incidence>
+
 
 namespace mKCal {
 class ExtendedStorage;
@@ -79,6 +81,22 @@ public:
        @param info textual information
     */
     virtual void storageFinished(ExtendedStorage *storage, bool error, const QString &info) = 0;
+
+    /**
+       Notify the Observer that incidences have been removed from the
+       calendar memory by ExtendedStorage::evict(). They are not deleted,
+       so the calendar observers are not notified of their removal.
+
+       @param storage is a pointer to the ExtendedStorage object that
+       is being observed.
+       @param incidences the unloaded incidences
+    */
+    virtual void storageUnloaded(ExtendedStorage *storage,
+                                 const KCalendarCore::Incidence::List &incidences)
+    {
+        Q_UNUSED(storage);
+        Q_UNUSED(incidences);
+    }
 };
 
 };
@@ -0,0 +1,156 @@
+/*
+  This file is part of the mkcal library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "geoindex_p.h"
+
+using namespace KCalendarCore;
+
+#include <cmath>
+
+using namespace mKCal;
+
+// Size of the grid cells, in degrees.
+static const float CELL_SIZE = 1.0f;
+
+// Cell coordinates range in [-limit, limit], values out of the valid
+// latitudes and longitudes go to the border cells.
+static const int LATITUDE_CELLS = 90;
+static const int LONGITUDE_CELLS = 180;
+
+GeoIndex::GeoIndex()
+{
+}
+
+void GeoIndex::insert(const Incidence::Ptr &incidence)
+{
+    remove(incidence);
+    if (!incidence->hasGeo()) {
+        return;
+    }
+
+    Entry entry;
+    entry.cell = cellKey(cellCoordinate(incidence->geoLatitude(), LATITUDE_CELLS),
+                         cellCoordinate(incidence->geoLongitude(), LONGITUDE_CELLS));
+    Incidence::List &cell = mCells[entry.cell];
+    entry.cellIndex = cell.count();
+    cell.append(incidence);
+    entry.allIndex = mAll.count();
+    mAll.append(incidence);
+    mEntries.insert(incidence.data(), entry);
+}
+
+void GeoIndex::remove(const Incidence::Ptr &incidence)
+{
+    QHash<const Incidence*, Entry>::Iterator it = mEntries.find(incidence.data());
+    if (it == mEntries.end()) {
+        return;
+    }
+    const Entry entry = *it;
+    mEntries.erase(it);
+
+    removeFromCell(entry.cell, entry.cellIndex);
+    // Move the last entry in place of the removed one.
+    const Incidence::Ptr last = mAll.takeLast();
+    if (entry.allIndex < mAll.count()) {
+        mAll[entry.allIndex] = last;
+        mEntries[last.data()].allIndex = entry.allIndex;
+    }
+}
+
+void GeoIndex::removeFromCell(int key, int cellIndex)
+{
+    QHash<int, Incidence::List>::Iterator cell = mCells.find(key);
+    const Incidence::Ptr last = cell->takeLast();
+    if (cellIndex < cell->count()) {
+        (*cell)[cellIndex] = last;
+        mEntries[last.data()].cellIndex = cellIndex;
+    } else if (cell->isEmpty()) {
+        mCells.erase(cell);
+    }
+}
+
+void GeoIndex::clear()
+{
+    mCells.clear();
+    mAll.clear();
+    mEntries.clear();
+}
+
+Incidence::List GeoIndex::incidences() const
+{
+    return mAll;
+}
+
+Incidence::List GeoIndex::incidences(float latitude, float longitude,
+                                     float diffLatitude, float diffLongitude) const
+{
+    Incidence::List list;
+    if (!(diffLatitude >= 0.f && diffLongitude >= 0.f)) {
+        return list;
+    }
+
+    auto matches = [=] (const Incidence::Ptr &incidence) {
+        return std::fabs(incidence->geoLatitude() - latitude) <= diffLatitude
+            && std::fabs(incidence->geoLongitude() - longitude) <= diffLongitude;
+    };
+
+    const int latitudeMin = cellCoordinate(latitude - diffLatitude, LATITUDE_CELLS);
+    const int latitudeMax = cellCoordinate(latitude + diffLatitude, LATITUDE_CELLS);
+    const int longitudeMin = cellCoordinate(longitude - diffLongitude, LONGITUDE_CELLS);
+    const int longitudeMax = cellCoordinate(longitude + diffLongitude, LONGITUDE_CELLS);
+    const qint64 cells = qint64(latitudeMax - latitudeMin + 1) * (longitudeMax - longitudeMin + 1);
+    if (!std::isfinite(latitude) || !std::isfinite(longitude) || cells >= mCells.count()) {
+        // Visiting the cells would cost more than checking everything.
+        for (const Incidence::Ptr &incidence : mAll) {
+            if (matches(incidence)) {
+                list.append(incidence);
+            }
+        }
+        return list;
+    }
+
+    for (int lat = latitudeMin; lat <= latitudeMax; lat++) {
+        for (int lon = longitudeMin; lon <= longitudeMax; lon++) {
+            QHash<int, Incidence::List>::ConstIterator cell = mCells.constFind(cellKey(lat, lon));
+            if (cell == mCells.constEnd()) {
+                continue;
+            }
+            for (const Incidence::Ptr &incidence : *cell) {
+                if (matches(incidence)) {
+                    list.append(incidence);
+                }
+            }
+        }
+    }
+    return list;
+}
+
+int GeoIndex::cellCoordinate(float degrees, int limit)
+{
+    if (!std::isfinite(degrees)) {
+        return 0;
+    }
+    const float cell = std::floor(degrees / CELL_SIZE);
+    return cell < -limit ? -limit : (cell > limit ? limit : int(cell));
+}
+
+int GeoIndex::cellKey(int latitude, int longitude)
+{
+    return (latitude + LATITUDE_CELLS) * (2 * LONGITUDE_CELLS + 1) + longitude + LONGITUDE_CELLS;
+}
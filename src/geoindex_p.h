@@ -0,0 +1,89 @@
+/*
+  This file is part of the mkcal library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#ifndef MKCAL_GEOINDEX_P_H
+#define MKCAL_GEOINDEX_P_H
+
+#include <KCalendarCore/Incidence>
+
+#include <QtCore/QHash>
+#include <QtCore/QVector>
+
+namespace mKCal {
+
+/**
+  An index of incidences with geographic information, sorted in the
+  cells of a uniform latitude and longitude grid.
+
+  Every entry remembers its position in its cell and in the list of
+  all entries, so that removals are done in constant time by moving
+  the last entry of these lists in place of the removed one. The
+  order of the entries is thus not preserved.
+
+  @internal
+*/
+class GeoIndex
+{
+public:
+    GeoIndex();
+
+    /**
+      Add @p incidence to the index, replacing any previous entry for
+      it. Incidences without geographic information are ignored.
+    */
+    void insert(const KCalendarCore::Incidence::Ptr &incidence);
+
+    /**
+      Remove @p incidence from the index.
+    */
+    void remove(const KCalendarCore::Incidence::Ptr &incidence);
+
+    void clear();
+
+    /**
+      Returns all the indexed incidences.
+    */
+    KCalendarCore::Incidence::List incidences() const;
+
+    /**
+      Returns the incidences with a latitude and a longitude differing
+      at most of @p diffLatitude and @p diffLongitude from the given
+      ones.
+    */
+    KCalendarCore::Incidence::List incidences(float latitude, float longitude,
+                                              float diffLatitude, float diffLongitude) const;
+
+private:
+    struct Entry {
+        int cell;
+        int cellIndex;
+        int allIndex;
+    };
+    static int cellCoordinate(float degrees, int limit);
+    static int cellKey(int latitude, int longitude);
+    void removeFromCell(int cell, int cellIndex);
+
+    QHash<int, KCalendarCore::Incidence::List> mCells;
+    KCalendarCore::Incidence::List mAll;
+    QHash<const KCalendarCore::Incidence*, Entry> mEntries;
+};
+
+}
+
+#endif
@@ -0,0 +1,259 @@
+/*
+  This file is part of the mkcal library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "intervalindex_p.h"
+
+#include <KCalendarCore/Event>
+#include <KCalendarCore/Todo>
+#include <KCalendarCore/Journal>
+using namespace KCalendarCore;
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using namespace mKCal;
+
+// Widening applied to every span, large enough to cover clock time
+// and all day dates interpreted in any time zone.
+static const qint64 SPAN_MARGIN = 2 * 86400;
+
+static const qint64 SPAN_MIN = std::numeric_limits<qint64>::min();
+static const qint64 SPAN_MAX = std::numeric_limits<qint64>::max();
+
+// Minimum number of buffered modifications before rebuilding the tree.
+static const int PENDING_MIN = 32;
+
+IntervalIndex::IntervalIndex()
+{
+}
+
+void IntervalIndex::insert(const Incidence::Ptr &incidence)
+{
+    Entry entry;
+    span(incidence, &entry.start, &entry.end);
+    entry.incidence = incidence;
+
+    QMutexLocker lock(&mLock);
+    drop(incidence.data());
+    mPending.insert(incidence.data(), entry);
+    if (entry.end == SPAN_MAX && entry.start != SPAN_MIN) {
+        mEndless.insert(incidence.data(), entry);
+    }
+}
+
+void IntervalIndex::remove(const Incidence::Ptr &incidence)
+{
+    QMutexLocker lock(&mLock);
+    drop(incidence.data());
+}
+
+// Called with mLock held.
+void IntervalIndex::drop(const Incidence *incidence)
+{
+    if (mIndexed.contains(incidence)) {
+        mRemoved.insert(incidence);
+    }
+    mPending.remove(incidence);
+    mEndless.remove(incidence);
+}
+
+void IntervalIndex::clear()
+{
+    QMutexLocker lock(&mLock);
+    mTree.clear();
+    mMaxEnd.clear();
+    mIndexed.clear();
+    mRemoved.clear();
+    mPending.clear();
+    mEndless.clear();
+}
+
+Incidence::List IntervalIndex::intersecting(const QDateTime &start, const QDateTime &end) const
+{
+    return intersecting(start.isValid() ? start.toSecsSinceEpoch() : SPAN_MIN,
+                        end.isValid() ? end.toSecsSinceEpoch() : SPAN_MAX);
+}
+
+Incidence::List IntervalIndex::intersecting(qint64 start, qint64 end) const
+{
+    Incidence::List list;
+
+    QMutexLocker lock(&mLock);
+    if (mPending.count() + mRemoved.count()
+        > qMax(PENDING_MIN, int(std::sqrt(double(mTree.count()))))) {
+        build();
+    }
+
+    query(0, mTree.count(), start, end, &list);
+    for (const Entry &entry : const_cast<const QHash<const Incidence*, Entry>&>(mPending)) {
+        if (entry.start <= end && entry.end >= start) {
+            list.append(entry.incidence);
+        }
+    }
+
+    return list;
+}
+
+Incidence::List IntervalIndex::endlessAfter(const QDateTime &date) const
+{
+    Incidence::List list;
+
+    const qint64 after = date.isValid() ? date.toSecsSinceEpoch() : SPAN_MAX;
+    QMutexLocker lock(&mLock);
+    for (const Entry &entry : mEndless) {
+        if (entry.start > after) {
+            list.append(entry.incidence);
+        }
+    }
+
+    return list;
+}
+
+void IntervalIndex::span(const Incidence::Ptr &incidence, qint64 *start, qint64 *end)
+{
+    QDateTime dtStart;
+    QDateTime dtEnd;
+
+    switch (incidence->type()) {
+    case Incidence::TypeEvent: {
+        const Event::Ptr event = incidence.staticCast<Event>();
+        dtStart = event->dtStart();
+        dtEnd = event->dtEnd();
+        break;
+    }
+    case Incidence::TypeTodo: {
+        const Todo::Ptr todo = incidence.staticCast<Todo>();
+        dtStart = todo->hasStartDate() ? todo->dtStart(true) : todo->dtDue(true);
+        dtEnd = todo->hasDueDate() ? todo->dtDue(true) : todo->dtStart(true);
+        break;
+    }
+    default:
+        dtStart = incidence->dtStart();
+        break;
+    }
+    if (!dtStart.isValid()) {
+        // Dateless incidences are queried by their creation date.
+        dtStart = incidence->created();
+    }
+    if (!dtStart.isValid()) {
+        *start = SPAN_MIN;
+        *end = SPAN_MAX;
+        return;
+    }
+    if (!dtEnd.isValid()) {
+        dtEnd = dtStart;
+    } else if (dtEnd < dtStart) {
+        // Todos may be due before they start, both dates are covered.
+        std::swap(dtStart, dtEnd);
+    }
+    *start = dtStart.toSecsSinceEpoch();
+    *end = dtEnd.toSecsSinceEpoch();
+
+    if (incidence->recurs()) {
+        const Recurrence *recurrence = incidence->recurrence();
+        const QDateTime last = recurrence->endDateTime();
+        if (recurrence->duration() == -1 || !last.isValid()) {
+            *end = SPAN_MAX;
+        } else {
+            *end = qMax(*end, last.toSecsSinceEpoch() + (*end - *start));
+        }
+        // Additional dates may come before the start.
+        const DateTimeList rDateTimes = recurrence->rDateTimes();
+        if (!rDateTimes.isEmpty() && rDateTimes.first().isValid()) {
+            *start = qMin(*start, rDateTimes.first().toSecsSinceEpoch());
+        }
+        const DateList rDates = recurrence->rDates();
+        if (!rDates.isEmpty() && rDates.first().isValid()) {
+            *start = qMin(*start, QDateTime(rDates.first(), QTime(0, 0)).toSecsSinceEpoch());
+        }
+    }
+
+    *start -= SPAN_MARGIN;
+    if (*end != SPAN_MAX) {
+        *end += SPAN_MARGIN;
+    }
+}
+
+void IntervalIndex::build() const
+{
+    QVector<Entry> entries;
+    entries.reserve(mTree.count() - mRemoved.count() + mPending.count());
+    for (const Entry &entry : const_cast<const QVector<Entry>&>(mTree)) {
+        if (!mRemoved.contains(entry.incidence.data())) {
+            entries.append(entry);
+        }
+    }
+    for (const Entry &entry : const_cast<const QHash<const Incidence*, Entry>&>(mPending)) {
+        entries.append(entry);
+    }
+    std::sort(entries.begin(), entries.end(), [] (const Entry &a, const Entry &b) {
+        return a.start < b.start;
+    });
+
+    mTree = entries;
+    mMaxEnd.resize(mTree.count());
+    buildNode(0, mTree.count());
+    mIndexed.clear();
+    for (const Entry &entry : const_cast<const QVector<Entry>&>(mTree)) {
+        mIndexed.insert(entry.incidence.data());
+    }
+    mRemoved.clear();
+    mPending.clear();
+}
+
+void IntervalIndex::buildNode(int lo, int hi) const
+{
+    if (lo >= hi) {
+        return;
+    }
+    const int mid = lo + (hi - lo) / 2;
+    buildNode(lo, mid);
+    buildNode(mid + 1, hi);
+    qint64 maxEnd = mTree[mid].end;
+    if (lo < mid) {
+        maxEnd = qMax(maxEnd, mMaxEnd[lo + (mid - lo) / 2]);
+    }
+    if (mid + 1 < hi) {
+        maxEnd = qMax(maxEnd, mMaxEnd[mid + 1 + (hi - mid - 1) / 2]);
+    }
+    mMaxEnd[mid] = maxEnd;
+}
+
+void IntervalIndex::query(int lo, int hi, qint64 start, qint64 end, Incidence::List *list) const
+{
+    if (lo >= hi) {
+        return;
+    }
+    const int mid = lo + (hi - lo) / 2;
+    if (mMaxEnd[mid] < start) {
+        // Nothing in this subtree ends after start.
+        return;
+    }
+    query(lo, mid, start, end, list);
+    const Entry &entry = mTree[mid];
+    if (entry.start > end) {
+        // Everything on the right starts even later.
+        return;
+    }
+    if (entry.end >= start && !mRemoved.contains(entry.incidence.data())) {
+        list->append(entry.incidence);
+    }
+    query(mid + 1, hi, start, end, list);
+}
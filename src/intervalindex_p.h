@@ -0,0 +1,114 @@
+/*
+  This file is part of the mkcal library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#ifndef MKCAL_INTERVALINDEX_P_H
+#define MKCAL_INTERVALINDEX_P_H
+
+#include <KCalendarCore/Incidence>
+
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+
+namespace mKCal {
+
+/**
+  An index of incidences by the time span they may cover, used to
+  answer time range queries without visiting every incidence.
+
+  The spans are expressed in seconds since epoch and are conservative:
+  they contain every occurrence of a recurring series, and they are
+  widened to cover any interpretation of clock time or all day dates.
+  The result of intersecting() is thus a list of candidates that must
+  still be checked precisely.
+
+  Entries are stored in an array sorted by start, seen as an implicit
+  balanced tree where each node also records the largest end of its
+  subtree. Modifications are buffered and merged into the tree on the
+  next query when they become too numerous. Queries may thus modify
+  the buffers, they are guarded by a mutex so const methods can be
+  called from several threads.
+
+  @internal
+*/
+class IntervalIndex
+{
+public:
+    IntervalIndex();
+
+    /**
+      Add @p incidence to the index, replacing any previous entry for it.
+    */
+    void insert(const KCalendarCore::Incidence::Ptr &incidence);
+
+    /**
+      Remove @p incidence from the index. It must be called before the
+      incidence is modified, and followed by insert() afterwards.
+    */
+    void remove(const KCalendarCore::Incidence::Ptr &incidence);
+
+    void clear();
+
+    /**
+      Returns the incidences whose span intersects [@p start, @p end].
+      Invalid bounds are unbounded.
+    */
+    KCalendarCore::Incidence::List intersecting(const QDateTime &start,
+                                                const QDateTime &end) const;
+    KCalendarCore::Incidence::List intersecting(qint64 start, qint64 end) const;
+
+    /**
+      Returns the incidences recurring forever whose span starts after
+      @p date, thus not returned by intersecting() for ranges ending
+      before @p date.
+    */
+    KCalendarCore::Incidence::List endlessAfter(const QDateTime &date) const;
+
+    /**
+      Computes the conservative span of @p incidence, in seconds
+      since epoch.
+    */
+    static void span(const KCalendarCore::Incidence::Ptr &incidence,
+                     qint64 *start, qint64 *end);
+
+private:
+    struct Entry {
+        qint64 start;
+        qint64 end;
+        KCalendarCore::Incidence::Ptr incidence;
+    };
+    void drop(const KCalendarCore::Incidence *incidence);
+    void build() const;
+    void buildNode(int lo, int hi) const;
+    void query(int lo, int hi, qint64 start, qint64 end,
+               KCalendarCore::Incidence::List *list) const;
+
+    mutable QMutex mLock;                                    // guards all below
+    mutable QVector<Entry> mTree;
+    mutable QVector<qint64> mMaxEnd;
+    mutable QSet<const KCalendarCore::Incidence*> mIndexed;  // in mTree
+    mutable QSet<const KCalendarCore::Incidence*> mRemoved;  // stale in mTree
+    mutable QHash<const KCalendarCore::Incidence*, Entry> mPending; // not yet in mTree
+    QHash<const KCalendarCore::Incidence*, Entry> mEndless;         // recurring forever
+};
+
+}
+
+#endif
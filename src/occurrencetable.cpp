@@ -0,0 +1,360 @@
+/*
+  This file is part of the mkcal library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+/**
+  @file
+  This file is part of the API for handling calendar data and
+  defines the OccurrenceTable class.
+*/
+
+#include "occurrencetable.h"
+
+#include <QtCore/QHash>
+
+#include <algorithm>
+
+using namespace KCalendarCore;
+using namespace mKCal;
+
+/**
+  Private class that helps to provide binary compatibility between releases.
+  @internal
+*/
+//@cond PRIVATE
+class mKCal::OccurrenceTable::Private
+{
+public:
+    Private()
+        : mSorted(true)
+    {
+    }
+
+    // One entry per occurrence.
+    QVector<qint64> mStarts;
+    QVector<qint64> mEnds;
+    QVector<int> mIncidenceIndexes;
+    QVector<int> mNotebookIndexes;
+    QVector<quint8> mFlags;
+    bool mSorted;
+
+    // One entry per incidence.
+    Incidence::List mIncidences;
+    QVector<int> mIncidenceNotebooks;
+    QHash<const Incidence*, int> mIncidenceIndex;
+
+    // One entry per notebook.
+    QStringList mNotebooks;
+    QHash<QString, int> mNotebookIndex;
+
+    QVector<qint64> dayBoundaries(const QDate &first, int days, const QTimeZone &timeZone) const;
+    bool dayRange(const QVector<qint64> &boundaries, int row, int *first, int *last) const;
+
+    template <typename T>
+    static void permute(QVector<T> *column, const QVector<int> &order)
+    {
+        QVector<T> sorted;
+        sorted.reserve(order.count());
+        for (int row : order) {
+            sorted.append(column->at(row));
+        }
+        *column = sorted;
+    }
+};
+
+QVector<qint64> OccurrenceTable::Private::dayBoundaries(const QDate &first, int days,
+                                                        const QTimeZone &timeZone) const
+{
+    QVector<qint64> boundaries;
+    boundaries.reserve(days + 1);
+    for (int i = 0; i <= days; i++) {
+        boundaries.append(QDateTime(first.addDays(i), QTime(0, 0), timeZone).toSecsSinceEpoch());
+    }
+    return boundaries;
+}
+
+bool OccurrenceTable::Private::dayRange(const QVector<qint64> &boundaries, int row,
+                                        int *first, int *last) const
+{
+    const qint64 start = mStarts[row];
+    // Occurrences without duration still belong to the day they start.
+    const qint64 end = qMax(mEnds[row], start + 1);
+    if (end <= boundaries.first() || start >= boundaries.last()) {
+        return false;
+    }
+    const int days = boundaries.count() - 1;
+    *first = qMax(0, int(std::upper_bound(boundaries.constBegin(), boundaries.constEnd(), start)
+                         - boundaries.constBegin()) - 1);
+    *last = qMin(days - 1, int(std::lower_bound(boundaries.constBegin(), boundaries.constEnd(), end)
+                               - boundaries.constBegin()) - 1);
+    return true;
+}
+//@endcond
+
+OccurrenceTable::OccurrenceTable()
+    : d(new OccurrenceTable::Private)
+{
+}
+
+OccurrenceTable::OccurrenceTable(const OccurrenceTable &other)
+    : d(new OccurrenceTable::Private(*other.d))
+{
+}
+
+OccurrenceTable::~OccurrenceTable()
+{
+    delete d;
+}
+
+OccurrenceTable &OccurrenceTable::operator=(const OccurrenceTable &other)
+{
+    // check for self assignment
+    if (&other == this) {
+        return *this;
+    }
+    *d = *other.d;
+    return *this;
+}
+
+int OccurrenceTable::count() const
+{
+    return d->mStarts.count();
+}
+
+bool OccurrenceTable::isEmpty() const
+{
+    return d->mStarts.isEmpty();
+}
+
+void OccurrenceTable::clear()
+{
+    *d = OccurrenceTable::Private();
+}
+
+int OccurrenceTable::addIncidence(const Incidence::Ptr &incidence, const QString &notebook)
+{
+    QHash<const Incidence*, int>::ConstIterator it = d->mIncidenceIndex.constFind(incidence.data());
+    if (it != d->mIncidenceIndex.constEnd()) {
+        return *it;
+    }
+
+    int notebookIndex = d->mNotebookIndex.value(notebook, -1);
+    if (notebookIndex < 0) {
+        notebookIndex = d->mNotebooks.count();
+        d->mNotebooks.append(notebook);
+        d->mNotebookIndex.insert(notebook, notebookIndex);
+    }
+
+    const int index = d->mIncidences.count();
+    d->mIncidences.append(incidence);
+    d->mIncidenceNotebooks.append(notebookIndex);
+    d->mIncidenceIndex.insert(incidence.data(), index);
+    return index;
+}
+
+void OccurrenceTable::append(qint64 start, qint64 end, int incidenceIndex, int flags)
+{
+    if (!d->mStarts.isEmpty()
+        && (start < d->mStarts.last()
+            || (start == d->mStarts.last() && end < d->mEnds.last()))) {
+        d->mSorted = false;
+    }
+    d->mStarts.append(start);
+    d->mEnds.append(end);
+    d->mIncidenceIndexes.append(incidenceIndex);
+    d->mNotebookIndexes.append(d->mIncidenceNotebooks.value(incidenceIndex, -1));
+    d->mFlags.append(quint8(flags));
+}
+
+void OccurrenceTable::sort()
+{
+    if (d->mSorted) {
+        return;
+    }
+
+    QVector<int> order(count());
+    for (int i = 0; i < order.count(); i++) {
+        order[i] = i;
+    }
+    const QVector<qint64> &starts = d->mStarts;
+    const QVector<qint64> &ends = d->mEnds;
+    std::stable_sort(order.begin(), order.end(), [&starts, &ends] (int a, int b) {
+        return starts[a] < starts[b] || (starts[a] == starts[b] && ends[a] < ends[b]);
+    });
+
+    Private::permute(&d->mStarts, order);
+    Private::permute(&d->mEnds, order);
+    Private::permute(&d->mIncidenceIndexes, order);
+    Private::permute(&d->mNotebookIndexes, order);
+    Private::permute(&d->mFlags, order);
+    d->mSorted = true;
+}
+
+const QVector<qint64> &OccurrenceTable::starts() const
+{
+    return d->mStarts;
+}
+
+const QVector<qint64> &OccurrenceTable::ends() const
+{
+    return d->mEnds;
+}
+
+const QVector<int> &OccurrenceTable::incidenceIndexes() const
+{
+    return d->mIncidenceIndexes;
+}
+
+const QVector<int> &OccurrenceTable::notebookIndexes() const
+{
+    return d->mNotebookIndexes;
+}
+
+const QVector<quint8> &OccurrenceTable::flags() const
+{
+    return d->mFlags;
+}
+
+const Incidence::List &OccurrenceTable::incidences() const
+{
+    return d->mIncidences;
+}
+
+const QStringList &OccurrenceTable::notebooks() const
+{
+    return d->mNotebooks;
+}
+
+Incidence::Ptr OccurrenceTable::incidence(int row) const
+{
+    return d->mIncidences.value(d->mIncidenceIndexes.value(row, -1));
+}
+
+QString OccurrenceTable::notebook(int row) const
+{
+    return d->mNotebooks.value(d->mNotebookIndexes.value(row, -1));
+}
+
+QDateTime OccurrenceTable::startDateTime(int row, const QTimeZone &timeZone) const
+{
+    return QDateTime::fromSecsSinceEpoch(d->mStarts[row], timeZone);
+}
+
+QDateTime OccurrenceTable::endDateTime(int row, const QTimeZone &timeZone) const
+{
+    return QDateTime::fromSecsSinceEpoch(d->mEnds[row], timeZone);
+}
+
+QVector<int> OccurrenceTable::rowsIntersecting(qint64 start, qint64 end) const
+{
+    QVector<int> rows;
+
+    // Sorted rows after the range cannot intersect it.
+    int n = count();
+    if (d->mSorted) {
+        n = int(std::lower_bound(d->mStarts.constBegin(), d->mStarts.constEnd(), end)
+                - d->mStarts.constBegin());
+    }
+
+    // Branch free test over the columns, then compaction.
+    const qint64 *starts = d->mStarts.constData();
+    const qint64 *ends = d->mEnds.constData();
+    QVector<quint8> mask(n);
+    quint8 *m = mask.data();
+    for (int i = 0; i < n; i++) {
+        m[i] = quint8(starts[i] < end) & quint8(qMax(ends[i], starts[i] + 1) > start);
+    }
+    for (int i = 0; i < n; i++) {
+        if (m[i]) {
+            rows.append(i);
+        }
+    }
+
+    return rows;
+}
+
+QVector<int> OccurrenceTable::dayBuckets(const QDate &first, int days, const QTimeZone &timeZone,
+                                         QVector<int> *rows) const
+{
+    QVector<int> offsets(qMax(days, 0) + 1, 0);
+    if (rows) {
+        rows->clear();
+    }
+    if (days <= 0 || !rows) {
+        return offsets;
+    }
+
+    const QVector<qint64> boundaries = d->dayBoundaries(first, days, timeZone);
+
+    // Counting sort: count rows per day, then place them, keeping
+    // the row order inside each day.
+    QVector<int> firstDays(count());
+    QVector<int> lastDays(count());
+    for (int row = 0; row < count(); row++) {
+        if (!d->dayRange(boundaries, row, &firstDays[row], &lastDays[row])) {
+            firstDays[row] = 0;
+            lastDays[row] = -1;
+        }
+        for (int day = firstDays[row]; day <= lastDays[row]; day++) {
+            offsets[day + 1] += 1;
+        }
+    }
+    for (int day = 0; day < days; day++) {
+        offsets[day + 1] += offsets[day];
+    }
+
+    rows->resize(offsets.last());
+    QVector<int> positions(offsets);
+    for (int row = 0; row < count(); row++) {
+        for (int day = firstDays[row]; day <= lastDays[row]; day++) {
+            (*rows)[positions[day]++] = row;
+        }
+    }
+
+    return offsets;
+}
+
+QVector<int> OccurrenceTable::dayCounts(const QDate &first, int days, const QTimeZone &timeZone,
+                                        int notebookIndex) const
+{
+    QVector<int> counts(qMax(days, 0), 0);
+    if (days <= 0) {
+        return counts;
+    }
+
+    const QVector<qint64> boundaries = d->dayBoundaries(first, days, timeZone);
+
+    // Difference array, each row only costs two updates.
+    QVector<int> changes(days + 1, 0);
+    for (int row = 0; row < count(); row++) {
+        if (notebookIndex >= 0 && d->mNotebookIndexes[row] != notebookIndex) {
+            continue;
+        }
+        int firstDay, lastDay;
+        if (d->dayRange(boundaries, row, &firstDay, &lastDay)) {
+            changes[firstDay] += 1;
+            changes[lastDay + 1] -= 1;
+        }
+    }
+    int current = 0;
+    for (int day = 0; day < days; day++) {
+        current += changes[day];
+        counts[day] = current;
+    }
+
+    return counts;
+}
@@ -0,0 +1,215 @@
+/*
+  This file is part of the mkcal library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+/**
+  @file
+  This file is part of the API for handling calendar data and
+  defines the OccurrenceTable class.
+*/
+
+#ifndef MKCAL_OCCURRENCETABLE_H
+#define MKCAL_OCCURRENCETABLE_H
+
+#include "mkcal_export.h"
+
+#include <KCalendarCore/Incidence>
+
+#include <QtCore/QStringList>
+#include <QtCore/QTimeZone>
+#include <QtCore/QVector>
+
+namespace mKCal {
+
+/**
+  @brief
+  A compact, column oriented, list of occurrences.
+
+  Each row describes one occurrence with its start and end times in
+  seconds since epoch, the index of its incidence in incidences(),
+  the index of its notebook in notebooks() and some flags. Every
+  column is stored in its own contiguous array, so views only reading
+  times, like week or month grids, do not have to visit QDateTime
+  objects or incidence pointers.
+
+  Tables are returned by ExtendedCalendar::occurrenceTable(), with
+  rows sorted by start time in ascending order.
+*/
+class MKCAL_EXPORT OccurrenceTable
+{
+public:
+    /**
+      Flags of an occurrence.
+    */
+    enum Flag {
+        AllDay = 0x01,      ///< the occurrence is all day
+        Recurring = 0x02,   ///< the occurrence is part of a recurring series
+        Transparent = 0x04, ///< the occurrence does not block time
+        Cancelled = 0x08    ///< the occurrence is cancelled
+    };
+
+    /**
+      Constructs an empty table.
+    */
+    OccurrenceTable();
+
+    /**
+      Copy constructor.
+    */
+    OccurrenceTable(const OccurrenceTable &other);
+
+    ~OccurrenceTable();
+
+    OccurrenceTable &operator=(const OccurrenceTable &other);
+
+    /**
+      Returns the number of occurrences.
+    */
+    int count() const;
+
+    /**
+      Returns true if there is no occurrence.
+    */
+    bool isEmpty() const;
+
+    /**
+      Removes all occurrences, incidences and notebooks.
+    */
+    void clear();
+
+    /**
+      Adds @p incidence, from @p notebook, to the incidence table,
+      unless it is already there.
+
+      @return the index of the incidence in incidences()
+    */
+    int addIncidence(const KCalendarCore::Incidence::Ptr &incidence, const QString &notebook);
+
+    /**
+      Appends an occurrence of the incidence at @p incidenceIndex.
+
+      @param start start time in seconds since epoch
+      @param end end time in seconds since epoch
+      @param incidenceIndex index of the incidence, as returned by addIncidence()
+      @param flags a combination of Flag values
+    */
+    void append(qint64 start, qint64 end, int incidenceIndex, int flags);
+
+    /**
+      Sorts the occurrences by start time, and then end time, in
+      ascending order.
+    */
+    void sort();
+
+    /**
+      Start times of the occurrences, in seconds since epoch.
+    */
+    const QVector<qint64> &starts() const;
+
+    /**
+      End times of the occurrences, in seconds since epoch.
+    */
+    const QVector<qint64> &ends() const;
+
+    /**
+      Index in incidences() of the incidence of each occurrence.
+    */
+    const QVector<int> &incidenceIndexes() const;
+
+    /**
+      Index in notebooks() of the notebook of each occurrence.
+    */
+    const QVector<int> &notebookIndexes() const;
+
+    /**
+      Flags of the occurrences.
+    */
+    const QVector<quint8> &flags() const;
+
+    /**
+      The incidences referenced by incidenceIndexes().
+    */
+    const KCalendarCore::Incidence::List &incidences() const;
+
+    /**
+      The notebook uids referenced by notebookIndexes().
+    */
+    const QStringList &notebooks() const;
+
+    /**
+      Returns the incidence of the occurrence at @p row.
+    */
+    KCalendarCore::Incidence::Ptr incidence(int row) const;
+
+    /**
+      Returns the notebook uid of the occurrence at @p row.
+    */
+    QString notebook(int row) const;
+
+    /**
+      Returns the start time of the occurrence at @p row in @p timeZone.
+    */
+    QDateTime startDateTime(int row, const QTimeZone &timeZone) const;
+
+    /**
+      Returns the end time of the occurrence at @p row in @p timeZone.
+    */
+    QDateTime endDateTime(int row, const QTimeZone &timeZone) const;
+
+    /**
+      Returns the rows of the occurrences overlapping [@p start, @p end),
+      in seconds since epoch. Occurrences without duration are
+      considered overlapping when they start in the range.
+    */
+    QVector<int> rowsIntersecting(qint64 start, qint64 end) const;
+
+    /**
+      Distributes the occurrences over @p days days starting at
+      @p first in @p timeZone. An occurrence is listed in every day
+      it overlaps.
+
+      @param first the first day
+      @param days the number of days
+      @param timeZone the time zone defining day boundaries
+      @param rows is filled with the rows of each day, day after day
+
+      @return @p days + 1 offsets, the rows of day i being stored in
+      @p rows between offsets[i] included and offsets[i + 1] excluded
+    */
+    QVector<int> dayBuckets(const QDate &first, int days, const QTimeZone &timeZone,
+                            QVector<int> *rows) const;
+
+    /**
+      Returns the number of occurrences overlapping each of the @p days
+      days starting at @p first in @p timeZone.
+
+      @param notebookIndex if not negative, only the occurrences of
+      the notebook at this index in notebooks() are counted
+    */
+    QVector<int> dayCounts(const QDate &first, int days, const QTimeZone &timeZone,
+                           int notebookIndex = -1) const;
+
+private:
+    //@cond PRIVATE
+    class MKCAL_HIDE Private;
+    Private *const d;
+    //@endcond
+};
+
+}
+
+#endif
@@ -33,6 +33,7 @@
 */
 #include "sqliteformat.h"
 #include "sqlitestorage.h"
+#include "sqliterow_p.h"
 #include "logging_p.h"
 
 #include <KCalendarCore/Alarm>
@@ -40,10 +41,24 @@
 #include <KCalendarCore/Person>
 #include <KCalendarCore/Sorting>
 
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSet>
+#include <QUuid>
+
 using namespace KCalendarCore;
 
 #define FLOATING_DATE "FloatingDate"
 
+// A new key for large binary attachment data, see ATTACHMENT_KEY.
+static QByteArray newAttachmentKey()
+{
+    const QByteArray uuid(QUuid::createUuid().toByteArray());
+    return QByteArray(ATTACHMENT_KEY) + uuid.mid(1, uuid.length() - 2);
+}
+
 using namespace mKCal;
 class mKCal::SqliteFormat::Private
 {
@@ -52,12 +67,26 @@ public:
         : mStorage(storage), mDatabase(database)
         , mSelectCalProps(nullptr)
         , mInsertCalProps(nullptr)
+        , mSelectRowId(nullptr)
+        , mSelectAttachmentIds(nullptr)
+        , mDeleteAttachment(nullptr)
+        , mUpdateAttachment(nullptr)
+        , mCopyAttachment(nullptr)
+        , mSelectStoredAttachments(nullptr)
+        , mCountStoredAttachments(nullptr)
     {
     }
     ~Private()
     {
         sqlite3_finalize(mSelectCalProps);
         sqlite3_finalize(mInsertCalProps);
+        sqlite3_finalize(mSelectRowId);
+        sqlite3_finalize(mSelectAttachmentIds);
+        sqlite3_finalize(mDeleteAttachment);
+        sqlite3_finalize(mUpdateAttachment);
+        sqlite3_finalize(mCopyAttachment);
+        sqlite3_finalize(mSelectStoredAttachments);
+        sqlite3_finalize(mCountStoredAttachments);
     }
     SqliteStorage *mStorage;
     sqlite3 *mDatabase;
@@ -65,14 +94,25 @@ public:
     // Cache for various queries.
     sqlite3_stmt *mSelectCalProps;
     sqlite3_stmt *mInsertCalProps;
+    sqlite3_stmt *mSelectRowId;
+    sqlite3_stmt *mSelectAttachmentIds;
+    sqlite3_stmt *mDeleteAttachment;
+    sqlite3_stmt *mUpdateAttachment;
+    sqlite3_stmt *mCopyAttachment;
+    sqlite3_stmt *mSelectStoredAttachments;
+    sqlite3_stmt *mCountStoredAttachments;
+
+    // Uris of stored attachment data that may not be used anymore.
+    QSet<QByteArray> mReleasedContents;
 
-    bool selectCustomproperties(Incidence::Ptr incidence, int rowid, sqlite3_stmt *stmt);
     int selectRowId(Incidence::Ptr incidence);
-    bool selectRecursives(Incidence::Ptr incidence, int rowid, sqlite3_stmt *stmt);
-    bool selectAlarms(Incidence::Ptr incidence, int rowid, sqlite3_stmt *stmt);
-    bool selectAttendees(Incidence::Ptr incidence, int rowid, sqlite3_stmt *stmt);
-    bool selectRdates(Incidence::Ptr incidence, int rowid, sqlite3_stmt *stmt);
-    bool selectAttachments(Incidence::Ptr incidence, int rowid, sqlite3_stmt *stmt);
+    bool selectRows(int rowid, sqlite3_stmt *stmt, QVector<SqliteRow> *rows);
+    void decodeCustomproperties(const Incidence::Ptr &incidence, const QVector<SqliteRow> &rows) const;
+    void decodeRecursives(const Incidence::Ptr &incidence, const QVector<SqliteRow> &rows) const;
+    void decodeAlarms(const Incidence::Ptr &incidence, const QVector<SqliteRow> &rows) const;
+    void decodeAttendees(const Incidence::Ptr &incidence, const QVector<SqliteRow> &rows) const;
+    void decodeRdates(const Incidence::Ptr &incidence, const QVector<SqliteRow> &rows) const;
+    void decodeAttachments(const Incidence::Ptr &incidence, const QVector<SqliteRow> &rows) const;
     bool selectCalendarProperties(Notebook::Ptr notebook);
     bool modifyCustomproperties(Incidence::Ptr incidence, int rowid, DBOperation dbop,
                                 sqlite3_stmt *stmt1, sqlite3_stmt *stmt2);
@@ -84,6 +124,13 @@ public:
                         bool isOrganizer);
     bool modifyAttachments(Incidence::Ptr incidence, int rowid, DBOperation dbop,
                            sqlite3_stmt *deleteStatement, sqlite3_stmt *insertStatement);
+    bool deleteAttachments(int rowid, QMultiHash<QByteArray, sqlite3_int64> *kept);
+    bool modifyAttachmentReference(int rowid, sqlite3_int64 attachmentId,
+                                   int componentId, const QByteArray &key,
+                                   const Attachment &attachment);
+    bool writeAttachmentData(sqlite3_int64 attachmentId, const QByteArray &data);
+    bool releaseStoredAttachments(int rowid);
+    QByteArray storeAttachmentData(const QByteArray &data);
     bool modifyAlarms(Incidence::Ptr incidence, int rowid, DBOperation dbop, sqlite3_stmt *stmt1,
                       sqlite3_stmt *stmt2);
     bool modifyAlarm(int rowid, Alarm::Ptr alarm, DBOperation dbop, sqlite3_stmt *stmt);
@@ -1014,10 +1061,34 @@ bool SqliteFormat::Private::modifyAttachments(Incidence::Ptr incidence,
                                               sqlite3_stmt *insertStatement)
 {
     bool success = true;
+    // Rows of referenced data kept in place, by key.
+    QMultiHash<QByteArray, sqlite3_int64> kept;
 
-    if (dbop == DBUpdate || dbop == DBDelete) {
+    if (dbop == DBUpdate) {
+        // Referenced data of this incidence are kept in place, instead
+        // of being deleted and inserted again.
+        const Attachment::List &list = incidence->attachments();
+        for (Attachment::List::ConstIterator it = list.begin(); it != list.end(); ++it) {
+            int componentId = 0;
+            QByteArray key;
+            if (SqliteFormat::attachmentReference(*it, &componentId, &key) && componentId == rowid) {
+                kept.insert(key, 0);
+            }
+        }
+    }
+
+    if (dbop == DBUpdate && !kept.isEmpty()) {
+        if (!deleteAttachments(rowid, &kept)) {
+            success = false;
+            goto error;
+        }
+    } else if (dbop == DBUpdate || dbop == DBDelete) {
         int rv = 0;
         int index = 1;
+        if (!releaseStoredAttachments(rowid)) {
+            success = false;
+            goto error;
+        }
         // In Update always delete all first then insert all
         // In Delete delete with uid at once
         sqlite3_bind_int(deleteStatement, index, rowid);
@@ -1031,11 +1102,43 @@ bool SqliteFormat::Private::modifyAttachments(Incidence::Ptr incidence,
         for (it = list.begin(); it != list.end(); ++it) {
             int rv = 0;
             int index = 1;
+            bool streamed = false;
+            int componentId = 0;
+            QByteArray key;
+
+            if (SqliteFormat::attachmentReference(*it, &componentId, &key)) {
+                const sqlite3_int64 attachmentId = componentId == rowid ? kept.take(key) : 0;
+                if (!modifyAttachmentReference(rowid, attachmentId, componentId, key, *it)) {
+                    success = false;
+                    goto error;
+                }
+                continue;
+            }
 
             sqlite3_bind_int(insertStatement, index, rowid);
-            if (it->isBinary()) {
-                sqlite3_bind_blob(insertStatement, index, it->decodedData().constData(), it->size(), SQLITE_STATIC);
-                sqlite3_bind_text(insertStatement, index, nullptr, 0, SQLITE_STATIC);
+            const qint64 threshold = mStorage->attachmentStoreThreshold();
+            if (it->isBinary() && threshold > 0 && it->size() > threshold) {
+                // Data are saved in the attachment store, only
+                // their uri is saved in the database.
+                const QByteArray uri = storeAttachmentData(it->decodedData());
+                if (uri.isEmpty()) {
+                    success = false;
+                    goto error;
+                }
+                sqlite3_bind_blob(insertStatement, index, nullptr, 0, SQLITE_STATIC);
+                sqlite3_bind_text(insertStatement, index, uri.constData(), uri.length(), SQLITE_TRANSIENT);
+            } else if (it->isBinary()) {
+                if (it->size() > ATTACHMENT_REFERENCE_SIZE) {
+                    // Large data are written in chunks after insertion,
+                    // and keyed to be referenced.
+                    key = newAttachmentKey();
+                    sqlite3_bind_zeroblob(insertStatement, index, it->size());
+                    sqlite3_bind_text(insertStatement, index, key.constData(), key.length(), SQLITE_STATIC);
+                    streamed = true;
+                } else {
+                    sqlite3_bind_blob(insertStatement, index, it->decodedData().constData(), it->size(), SQLITE_STATIC);
+                    sqlite3_bind_text(insertStatement, index, nullptr, 0, SQLITE_STATIC);
+                }
             } else if (it->isUri()) {
                 const QByteArray uri = it->uri().toUtf8();
                 sqlite3_bind_blob(insertStatement, index, nullptr, 0, SQLITE_STATIC);
@@ -1051,6 +1154,12 @@ bool SqliteFormat::Private::modifyAttachments(Incidence::Ptr incidence,
             sqlite3_bind_int(insertStatement, index, (it->isLocal() ? 1 : 0));
             sqlite3_step(insertStatement);
             sqlite3_reset(insertStatement);
+
+            if (streamed && !writeAttachmentData(sqlite3_last_insert_rowid(mDatabase),
+                                                 it->decodedData())) {
+                success = false;
+                goto error;
+            }
         }
     }
 
@@ -1071,6 +1180,190 @@ error:
     return false;
 }
 
+bool SqliteFormat::Private::deleteAttachments(int rowid, QMultiHash<QByteArray, sqlite3_int64> *kept)
+{
+    int rv = 0;
+    int index = 1;
+    QMultiHash<QByteArray, sqlite3_int64> existing;
+    QList<sqlite3_int64> obsoletes;
+
+    if (!mSelectAttachmentIds) {
+        const char *query = SELECT_ATTACHMENTS_ROWID_BY_ID;
+        int qsize = sizeof(SELECT_ATTACHMENTS_ROWID_BY_ID);
+        sqlite3_prepare_v2(mDatabase, query, qsize, &mSelectAttachmentIds, NULL);
+    }
+    if (!mDeleteAttachment) {
+        const char *query = DELETE_ATTACHMENTS_BY_ROWID;
+        int qsize = sizeof(DELETE_ATTACHMENTS_BY_ROWID);
+        sqlite3_prepare_v2(mDatabase, query, qsize, &mDeleteAttachment, NULL);
+    }
+
+    sqlite3_bind_int(mSelectAttachmentIds, index, rowid);
+    do {
+        sqlite3_step(mSelectAttachmentIds);
+        if (rv == SQLITE_ROW) {
+            const sqlite3_int64 attachmentId = sqlite3_column_int64(mSelectAttachmentIds, 0);
+            const QByteArray uri((const char *)sqlite3_column_text(mSelectAttachmentIds, 1));
+            // Keep as many rows as there are references to them.
+            if (existing.count(uri) < kept->count(uri)) {
+                existing.insert(uri, attachmentId);
+            } else {
+                if (uri.startsWith(ATTACHMENT_STORE)) {
+                    mReleasedContents.insert(uri);
+                }
+                obsoletes.append(attachmentId);
+            }
+        }
+    } while (rv != SQLITE_DONE);
+    sqlite3_reset(mSelectAttachmentIds);
+
+    for (const sqlite3_int64 attachmentId : obsoletes) {
+        index = 1;
+        sqlite3_bind_int64(mDeleteAttachment, index, attachmentId);
+        sqlite3_step(mDeleteAttachment);
+        sqlite3_reset(mDeleteAttachment);
+    }
+
+    // Only references to existing data of this incidence are kept.
+    *kept = existing;
+
+    return true;
+
+error:
+    sqlite3_reset(mSelectAttachmentIds);
+    sqlite3_reset(mDeleteAttachment);
+
+    return false;
+}
+
+bool SqliteFormat::Private::modifyAttachmentReference(int rowid, sqlite3_int64 attachmentId,
+                                                      int componentId, const QByteArray &key,
+                                                      const Attachment &attachment)
+{
+    int rv = 0;
+    int index = 1;
+    sqlite3_stmt *stmt = NULL;
+    const QByteArray mime = attachment.mimeType().toUtf8();
+    const QByteArray label = attachment.label().toUtf8();
+    // Copies of stored data share the same file.
+    const QByteArray copyKey = key.startsWith(ATTACHMENT_STORE) ? key : newAttachmentKey();
+
+    if (attachmentId) {
+        if (!mUpdateAttachment) {
+            const char *query = UPDATE_ATTACHMENTS_BY_ROWID;
+            int qsize = sizeof(UPDATE_ATTACHMENTS_BY_ROWID);
+            sqlite3_prepare_v2(mDatabase, query, qsize, &mUpdateAttachment, NULL);
+        }
+        stmt = mUpdateAttachment;
+    } else {
+        // Data referenced from another incidence, copy them.
+        if (!mCopyAttachment) {
+            const char *query = INSERT_ATTACHMENTS_COPY;
+            int qsize = sizeof(INSERT_ATTACHMENTS_COPY);
+            sqlite3_prepare_v2(mDatabase, query, qsize, &mCopyAttachment, NULL);
+        }
+        stmt = mCopyAttachment;
+        sqlite3_bind_int(stmt, index, rowid);
+        sqlite3_bind_text(stmt, index, copyKey.constData(), copyKey.length(), SQLITE_STATIC);
+    }
+    sqlite3_bind_text(stmt, index, mime.constData(), mime.length(), SQLITE_STATIC);
+    sqlite3_bind_int(stmt, index, (attachment.showInline() ? 1 : 0));
+    sqlite3_bind_text(stmt, index, label.constData(), label.length(), SQLITE_STATIC);
+    sqlite3_bind_int(stmt, index, (attachment.isLocal() ? 1 : 0));
+    if (attachmentId) {
+        sqlite3_bind_int64(stmt, index, attachmentId);
+    } else {
+        sqlite3_bind_int(stmt, index, componentId);
+        sqlite3_bind_text(stmt, index, key.constData(), key.length(), SQLITE_STATIC);
+    }
+    sqlite3_step(stmt);
+    if (!sqlite3_changes(mDatabase)) {
+        qCWarning(lcMkcal) << "referenced attachment" << attachment.uri() << "does not exist anymore";
+    }
+    sqlite3_reset(stmt);
+
+    return true;
+
+error:
+    if (stmt) {
+        sqlite3_reset(stmt);
+    }
+
+    return false;
+}
+
+bool SqliteFormat::Private::writeAttachmentData(sqlite3_int64 attachmentId, const QByteArray &data)
+{
+    sqlite3_blob *blob = NULL;
+    int rv = sqlite3_blob_open(mDatabase, "main", "Attachments", "Data", attachmentId, 1, &blob);
+    for (int offset = 0; !rv && offset < data.size(); offset += ATTACHMENT_REFERENCE_SIZE) {
+        rv = sqlite3_blob_write(blob, data.constData() + offset,
+                                qMin(ATTACHMENT_REFERENCE_SIZE, data.size() - offset), offset);
+    }
+    sqlite3_blob_close(blob);
+    if (rv) {
+        qCWarning(lcMkcal) << "cannot write attachment data:" << rv << sqlite3_errmsg(mDatabase);
+    }
+
+    return !rv;
+}
+
+bool SqliteFormat::Private::releaseStoredAttachments(int rowid)
+{
+    int rv = 0;
+    int index = 1;
+
+    if (!mSelectStoredAttachments) {
+        const char *query = SELECT_ATTACHMENTS_STORED_BY_ID;
+        int qsize = sizeof(SELECT_ATTACHMENTS_STORED_BY_ID);
+        sqlite3_prepare_v2(mDatabase, query, qsize, &mSelectStoredAttachments, NULL);
+    }
+
+    sqlite3_bind_int(mSelectStoredAttachments, index, rowid);
+    do {
+        sqlite3_step(mSelectStoredAttachments);
+        if (rv == SQLITE_ROW) {
+            mReleasedContents.insert(QByteArray((const char *)sqlite3_column_text(mSelectStoredAttachments, 0)));
+        }
+    } while (rv != SQLITE_DONE);
+    sqlite3_reset(mSelectStoredAttachments);
+
+    return true;
+
+error:
+    sqlite3_reset(mSelectStoredAttachments);
+
+    return false;
+}
+
+QByteArray SqliteFormat::Private::storeAttachmentData(const QByteArray &data)
+{
+    const QByteArray hash = QCryptographicHash::hash(data, QCryptographicHash::Sha256).toHex();
+    const QByteArray uri = QByteArray(ATTACHMENT_STORE) + hash;
+    const QString path = mStorage->attachmentStorePath() + QLatin1Char('/') + QString::fromLatin1(hash);
+
+    // Until the transaction is committed, nothing may use the file.
+    mReleasedContents.insert(uri);
+
+    if (QFileInfo(path).size() == data.size()) {
+        // Same content already stored.
+        return uri;
+    }
+    if (!QDir().mkpath(mStorage->attachmentStorePath())) {
+        qCWarning(lcMkcal) << "cannot create attachment store" << mStorage->attachmentStorePath();
+        return QByteArray();
+    }
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(data) != data.size()
+        || !file.commit()) {
+        qCWarning(lcMkcal) << "cannot write attachment data to" << path << file.errorString();
+        return QByteArray();
+    }
+
+    return uri;
+}
+
 bool SqliteFormat::Private::modifyCalendarProperties(Notebook::Ptr notebook, DBOperation dbop)
 {
     QByteArray id(notebook->uid().toUtf8());
@@ -1197,16 +1490,16 @@ error:
     return notebook;
 }
 
-static QDateTime getDateTime(SqliteStorage *storage, sqlite3_stmt *stmt, int index, bool *isDate = 0)
+static QDateTime getDateTime(SqliteStorage *storage, const SqliteRow &row, int index, bool *isDate = 0)
 {
     sqlite3_int64 date;
-    const QByteArray timezone((const char *)sqlite3_column_text(stmt, index + 2));
+    const QByteArray timezone(row.text(index + 2));
     QDateTime dateTime;
 
     if (timezone.isEmpty()) {
         // consider empty timezone as clock time
-        date = sqlite3_column_int64(stmt, index + 1);
-        if (date || sqlite3_column_int64(stmt, index)) {
+        date = row.toInt64(index + 1);
+        if (date || row.toInt64(index)) {
             dateTime = storage->fromOriginTime(date);
         }
         dateTime.setTimeSpec(Qt::LocalTime);
@@ -1220,7 +1513,7 @@ static QDateTime getDateTime(SqliteStorage *storage, sqlite3_stmt *stmt, int ind
                 localTime.second() == 0;
         }
     } else if (timezone == QStringLiteral(FLOATING_DATE)) {
-        date = sqlite3_column_int64(stmt, index + 1);
+        date = row.toInt64(index + 1);
         dateTime = storage->fromOriginTime(date);
         dateTime.setTimeSpec(Qt::LocalTime);
         dateTime.setTime(QTime(0, 0, 0));
@@ -1228,12 +1521,12 @@ static QDateTime getDateTime(SqliteStorage *storage, sqlite3_stmt *stmt, int ind
             *isDate = dateTime.isValid();
         }
     } else {
-        date = sqlite3_column_int64(stmt, index);
+        date = row.toInt64(index);
         dateTime = storage->fromOriginTime(date, timezone);
         if (!dateTime.isValid()) {
             // timezone is specified but invalid?
             // fall back to local seconds from origin as clock time.
-            date = sqlite3_column_int64(stmt, index + 1);
+            date = row.toInt64(index + 1);
             dateTime = storage->fromLocalOriginTime(date);
         }
         if (isDate) {
@@ -1243,244 +1536,345 @@ static QDateTime getDateTime(SqliteStorage *storage, sqlite3_stmt *stmt, int ind
     return dateTime;
 }
 
+bool SqliteFormat::selectComponentDetails(const Incidence::Ptr &incidence,
+                                          sqlite3_stmt *stmt2, sqlite3_stmt *stmt3,
+                                          sqlite3_stmt *stmt4, sqlite3_stmt *attachmentStmt)
+{
+    int rowid = d->selectRowId(incidence);
+    if (!rowid) {
+        qCWarning(lcMkcal) << "failed to select rowid of incidence" << incidence->uid() << incidence->recurrenceId();
+        return false;
+    }
+
+    QVector<SqliteRow> rows;
+    if (stmt2) {
+        if (!d->selectRows(rowid, stmt2, &rows)) {
+            qCWarning(lcMkcal) << "failed to get customproperties for incidence" << incidence->uid();
+            return false;
+        }
+        d->decodeCustomproperties(incidence, rows);
+    }
+    if (stmt3) {
+        if (!d->selectRows(rowid, stmt3, &rows)) {
+            qCWarning(lcMkcal) << "failed to get attendees for incidence" << incidence->uid();
+            return false;
+        }
+        d->decodeAttendees(incidence, rows);
+    }
+    if (stmt4) {
+        if (!d->selectRows(rowid, stmt4, &rows)) {
+            qCWarning(lcMkcal) << "failed to get alarms for incidence" << incidence->uid();
+            return false;
+        }
+        d->decodeAlarms(incidence, rows);
+    }
+    if (attachmentStmt) {
+        if (!d->selectRows(rowid, attachmentStmt, &rows)) {
+            qCWarning(lcMkcal) << "failed to get attachments for incidence" << incidence->uid();
+            return false;
+        }
+        d->decodeAttachments(incidence, rows);
+    }
+
+    return true;
+}
+
+bool SqliteFormat::selectManifestEntry(sqlite3_stmt *stmt, ExtendedStorage::ManifestEntry *entry)
+{
+    int rv = 0;
+    int index = 0;
+
+    sqlite3_step(stmt);
+    if (rv != SQLITE_ROW) {
+        return false;
+    }
+
+    entry->uid = QString::fromUtf8((const char *)sqlite3_column_text(stmt, index++));
+    entry->recurrenceId = getDateTime(d->mStorage, SqliteRow(stmt), index);
+    index += 3;
+    entry->lastModified = d->mStorage->fromOriginTime(sqlite3_column_int64(stmt, index++));
+    entry->revision = sqlite3_column_int(stmt, index++);
+    if (index < sqlite3_column_count(stmt)) {
+        entry->customPropertyValue = QString::fromUtf8((const char *)sqlite3_column_text(stmt, index++));
+    } else {
+        entry->customPropertyValue.clear();
+    }
+
+    return true;
+
+error:
+    return false;
+}
+
 Incidence::Ptr SqliteFormat::selectComponents(sqlite3_stmt *stmt1, sqlite3_stmt *stmt2,
                                               sqlite3_stmt *stmt3, sqlite3_stmt *stmt4,
                                               sqlite3_stmt *stmt5, sqlite3_stmt *stmt6,
                                               sqlite3_stmt *attachmentStmt,
                                               QString &notebook)
+{
+    SqliteComponentRows rows;
+    if (!readComponentRows(stmt1, stmt2, stmt3, stmt4, stmt5, stmt6, attachmentStmt, &rows)) {
+        return Incidence::Ptr();
+    }
+    return decodeComponentRows(rows, &notebook);
+}
+
+bool SqliteFormat::readComponentRows(sqlite3_stmt *stmt1, sqlite3_stmt *stmt2,
+                                     sqlite3_stmt *stmt3, sqlite3_stmt *stmt4,
+                                     sqlite3_stmt *stmt5, sqlite3_stmt *stmt6,
+                                     sqlite3_stmt *attachmentStmt,
+                                     SqliteComponentRows *rows)
 {
     int rv = 0;
-    int index = 0;
-    Incidence::Ptr incidence;
-    QString type;
-    QString timezone;
     int rowid;
 
     sqlite3_step(stmt1);
+    if (rv != SQLITE_ROW) {
+        return false;
+    }
 
-    if (rv == SQLITE_ROW) {
+    *rows = SqliteComponentRows();
+    rows->component = SqliteRow(stmt1);
+    rowid = rows->component.toInt(0);
 
-        QByteArray type((const char *)sqlite3_column_text(stmt1, 2));
-        if (type == "Event") {
-            // Set Event specific data.
-            Event::Ptr event = Event::Ptr(new Event());
-            event->setAllDay(false);
+    if (stmt2 && !d->selectRows(rowid, stmt2, &rows->customProperties)) {
+        qCWarning(lcMkcal) << "failed to get customproperties for component" << rowid;
+    }
+    if (stmt3 && !d->selectRows(rowid, stmt3, &rows->attendees)) {
+        qCWarning(lcMkcal) << "failed to get attendees for component" << rowid;
+    }
+    if (stmt4 && !d->selectRows(rowid, stmt4, &rows->alarms)) {
+        qCWarning(lcMkcal) << "failed to get alarms for component" << rowid;
+    }
+    if (stmt5 && !d->selectRows(rowid, stmt5, &rows->recursives)) {
+        qCWarning(lcMkcal) << "failed to get recursive for component" << rowid;
+    }
+    if (stmt6 && !d->selectRows(rowid, stmt6, &rows->rdates)) {
+        qCWarning(lcMkcal) << "failed to get rdates for component" << rowid;
+    }
+    if (attachmentStmt) {
+        rows->hasAttachments = true;
+        if (!d->selectRows(rowid, attachmentStmt, &rows->attachments)) {
+            qCWarning(lcMkcal) << "failed to get attachments for component" << rowid;
+        }
+    }
 
-            bool startIsDate;
-            QDateTime start = getDateTime(d->mStorage, stmt1, 5, &startIsDate);
-            if (start.isValid()) {
-                event->setDtStart(start);
-            } else {
-                // start date time is mandatory in RFC5545 for VEVENTS.
-                event->setDtStart(d->mStorage->fromOriginTime(0));
-            }
+    return true;
 
-            bool endIsDate;
-            QDateTime end = getDateTime(d->mStorage, stmt1, 9, &endIsDate);
-            if (startIsDate && (!end.isValid() || endIsDate)) {
-                event->setAllDay(true);
-                // Keep backward compatibility with already saved events with end + 1.
-                if (end.isValid()) {
-                    end = end.addDays(-1);
-                    if (end == start) {
-                        end = QDateTime();
-                    }
-                }
-            }
-            if (end.isValid()) {
-                event->setDtEnd(end);
-            }
-            incidence = event;
-        } else if (type == "Todo") {
-            // Set Todo specific data.
-            Todo::Ptr todo = Todo::Ptr(new Todo());
-            todo->setAllDay(false);
-
-            bool startIsDate;
-            QDateTime start = getDateTime(d->mStorage, stmt1, 5, &startIsDate);
-            if (start.isValid()) {
-                todo->setDtStart(start);
-            }
+error:
+    return false;
+}
 
-            bool hasDueDate(sqlite3_column_int(stmt1, 8));
-            bool dueIsDate;
-            QDateTime due = getDateTime(d->mStorage, stmt1, 9, &dueIsDate);
-            if (due.isValid()) {
-                if (start.isValid() && due == start && !hasDueDate) {
-                    due = QDateTime();
-                } else {
-                    todo->setDtDue(due, true);
+Incidence::Ptr SqliteFormat::decodeComponentRows(const SqliteComponentRows &rows,
+                                                 QString *notebook) const
+{
+    const SqliteRow &row = rows.component;
+    int index = 0;
+    Incidence::Ptr incidence;
+
+    const QByteArray type(row.text(2));
+    if (type == "Event") {
+        // Set Event specific data.
+        Event::Ptr event = Event::Ptr(new Event());
+        event->setAllDay(false);
+
+        bool startIsDate;
+        QDateTime start = getDateTime(d->mStorage, row, 5, &startIsDate);
+        if (start.isValid()) {
+            event->setDtStart(start);
+        } else {
+            // start date time is mandatory in RFC5545 for VEVENTS.
+            event->setDtStart(d->mStorage->fromOriginTime(0));
+        }
+
+        bool endIsDate;
+        QDateTime end = getDateTime(d->mStorage, row, 9, &endIsDate);
+        if (startIsDate && (!end.isValid() || endIsDate)) {
+            event->setAllDay(true);
+            // Keep backward compatibility with already saved events with end + 1.
+            if (end.isValid()) {
+                end = end.addDays(-1);
+                if (end == start) {
+                    end = QDateTime();
                 }
             }
+        }
+        if (end.isValid()) {
+            event->setDtEnd(end);
+        }
+        incidence = event;
+    } else if (type == "Todo") {
+        // Set Todo specific data.
+        Todo::Ptr todo = Todo::Ptr(new Todo());
+        todo->setAllDay(false);
+
+        bool startIsDate;
+        QDateTime start = getDateTime(d->mStorage, row, 5, &startIsDate);
+        if (start.isValid()) {
+            todo->setDtStart(start);
+        }
 
-            if (startIsDate && (!due.isValid() || (dueIsDate && due > start))) {
-                todo->setAllDay(true);
+        bool hasDueDate(row.toInt(8));
+        bool dueIsDate;
+        QDateTime due = getDateTime(d->mStorage, row, 9, &dueIsDate);
+        if (due.isValid()) {
+            if (start.isValid() && due == start && !hasDueDate) {
+                due = QDateTime();
+            } else {
+                todo->setDtDue(due, true);
             }
-            incidence = todo;
-        } else if (type == "Journal") {
-            // Set Journal specific data.
-            Journal::Ptr journal = Journal::Ptr(new Journal());
-
-            bool startIsDate;
-            QDateTime start = getDateTime(d->mStorage, stmt1, 5, &startIsDate);
-            journal->setDtStart(start);
-            journal->setAllDay(startIsDate);
-            incidence = journal;
         }
 
-        if (!incidence) {
-            return Incidence::Ptr();
+        if (startIsDate && (!due.isValid() || (dueIsDate && due > start))) {
+            todo->setAllDay(true);
         }
+        incidence = todo;
+    } else if (type == "Journal") {
+        // Set Journal specific data.
+        Journal::Ptr journal = Journal::Ptr(new Journal());
+
+        bool startIsDate;
+        QDateTime start = getDateTime(d->mStorage, row, 5, &startIsDate);
+        journal->setDtStart(start);
+        journal->setAllDay(startIsDate);
+        incidence = journal;
+    }
 
-        // Set common Incidence data.
-        rowid = sqlite3_column_int(stmt1, index++);
+    if (!incidence) {
+        return Incidence::Ptr();
+    }
 
-        notebook = QString::fromUtf8((const char *)sqlite3_column_text(stmt1, index++));
+    // Set common Incidence data.
+    index++; // ComponentId
 
-        index++;
+    if (notebook) {
+        *notebook = row.toString(index);
+    }
+    index++;
 
-        incidence->setSummary(QString::fromUtf8((const char *)sqlite3_column_text(stmt1, index++)));
+    index++;
 
-        incidence->setCategories(QString::fromUtf8((const char *)sqlite3_column_text(stmt1, index++)));
+    incidence->setSummary(row.toString(index++));
 
-        index++;
-        index++;
-        index++;
-        index++;
-        index++;
-        index++;
-        index++;
+    incidence->setCategories(row.toString(index++));
 
-        int duration = sqlite3_column_int(stmt1, index++);
-        if (duration != 0) {
-            incidence->setDuration(Duration(duration, Duration::Seconds));
-        }
-        incidence->setSecrecy(
-            (Incidence::Secrecy)sqlite3_column_int(stmt1, index++));
+    index++;
+    index++;
+    index++;
+    index++;
+    index++;
+    index++;
+    index++;
 
-        incidence->setLocation(
-            QString::fromUtf8((const char *)sqlite3_column_text(stmt1, index++)));
+    int duration = row.toInt(index++);
+    if (duration != 0) {
+        incidence->setDuration(Duration(duration, Duration::Seconds));
+    }
+    incidence->setSecrecy((Incidence::Secrecy)row.toInt(index++));
 
-        incidence->setDescription(
-            QString::fromUtf8((const char *)sqlite3_column_text(stmt1, index++)));
+    incidence->setLocation(row.toString(index++));
 
-        incidence->setStatus(
-            (Incidence::Status)sqlite3_column_int(stmt1, index++));
+    incidence->setDescription(row.toString(index++));
 
-        incidence->setGeoLatitude(sqlite3_column_double(stmt1, index++));
-        incidence->setGeoLongitude(sqlite3_column_double(stmt1, index++));
-        if (incidence->geoLatitude() != INVALID_LATLON) {
-            incidence->setHasGeo(true);
-        }
+    incidence->setStatus((Incidence::Status)row.toInt(index++));
 
-        incidence->setPriority(sqlite3_column_int(stmt1, index++));
+    incidence->setGeoLatitude(row.toDouble(index++));
+    incidence->setGeoLongitude(row.toDouble(index++));
+    if (incidence->geoLatitude() != INVALID_LATLON) {
+        incidence->setHasGeo(true);
+    }
 
-        QString Resources = QString::fromUtf8((const char *)sqlite3_column_text(stmt1, index++));
-        incidence->setResources(Resources.split(' '));
+    incidence->setPriority(row.toInt(index++));
 
-        incidence->setCreated(d->mStorage->fromOriginTime(
-                                  sqlite3_column_int64(stmt1, index++)));
+    QString Resources = row.toString(index++);
+    incidence->setResources(Resources.split(' '));
 
-        QDateTime dtstamp = d->mStorage->fromOriginTime(sqlite3_column_int64(stmt1, index++));
+    incidence->setCreated(d->mStorage->fromOriginTime(row.toInt64(index++)));
 
-        incidence->setLastModified(
-            d->mStorage->fromOriginTime(sqlite3_column_int64(stmt1, index++)));
+    QDateTime dtstamp = d->mStorage->fromOriginTime(row.toInt64(index++));
 
-        incidence->setRevision(sqlite3_column_int(stmt1, index++));
+    incidence->setLastModified(d->mStorage->fromOriginTime(row.toInt64(index++)));
 
-        QString Comment = QString::fromUtf8((const char *) sqlite3_column_text(stmt1, index++));
-        if (!Comment.isEmpty()) {
-            QStringList CommL = Comment.split(' ');
-            for (QStringList::Iterator it = CommL.begin(); it != CommL.end(); ++it) {
-                incidence->addComment(*it);
-            }
+    incidence->setRevision(row.toInt(index++));
+
+    QString Comment = row.toString(index++);
+    if (!Comment.isEmpty()) {
+        QStringList CommL = Comment.split(' ');
+        for (QStringList::Iterator it = CommL.begin(); it != CommL.end(); ++it) {
+            incidence->addComment(*it);
         }
+    }
 
-        // Old way to store attachment, deprecated.
-        QString Att = QString::fromUtf8((const char *) sqlite3_column_text(stmt1, index++));
+    // Old way to store attachment, deprecated.
+    QString Att = row.toString(index++);
 
-        incidence->addContact(
-            QString::fromUtf8((const char *) sqlite3_column_text(stmt1, index++)));
+    incidence->addContact(row.toString(index++));
 
-        //Invitation status (removed but still on DB)
-        ++index;
+    //Invitation status (removed but still on DB)
+    ++index;
 
-        QDateTime rid = getDateTime(d->mStorage, stmt1, index);
-        if (rid.isValid()) {
-            incidence->setRecurrenceId(rid);
-        } else {
-            incidence->setRecurrenceId(QDateTime());
-        }
-        index += 3;
+    QDateTime rid = getDateTime(d->mStorage, row, index);
+    if (rid.isValid()) {
+        incidence->setRecurrenceId(rid);
+    } else {
+        incidence->setRecurrenceId(QDateTime());
+    }
+    index += 3;
 
-        QString relatedtouid = QString::fromUtf8((const char *) sqlite3_column_text(stmt1, index++));
-        incidence->setRelatedTo(relatedtouid);
+    QString relatedtouid = row.toString(index++);
+    incidence->setRelatedTo(relatedtouid);
 
-        QUrl url(QString::fromUtf8((const char *)sqlite3_column_text(stmt1, index++)));
-        if (url.isValid()) {
-            incidence->setUrl(url);
-        }
+    QUrl url(row.toString(index++));
+    if (url.isValid()) {
+        incidence->setUrl(url);
+    }
 
-        // set the real uid to uid
-        incidence->setUid(QString::fromUtf8((const char *) sqlite3_column_text(stmt1, index++)));
+    // set the real uid to uid
+    incidence->setUid(row.toString(index++));
 
-        if (incidence->type() == Incidence::TypeEvent) {
-            Event::Ptr event = incidence.staticCast<Event>();
-            int transparency = sqlite3_column_int(stmt1, index);
-            event->setTransparency((Event::Transparency) transparency);
-        }
+    if (incidence->type() == Incidence::TypeEvent) {
+        Event::Ptr event = incidence.staticCast<Event>();
+        int transparency = row.toInt(index);
+        event->setTransparency((Event::Transparency) transparency);
+    }
 
-        index++;
+    index++;
 
-        incidence->setLocalOnly(sqlite3_column_int(stmt1, index++)); //LocalOnly
+    incidence->setLocalOnly(row.toInt(index++)); //LocalOnly
 
-        if (incidence->type() == Incidence::TypeTodo) {
-            Todo::Ptr todo = incidence.staticCast<Todo>();
-            todo->setPercentComplete(sqlite3_column_int(stmt1, index++));
-            QDateTime completed = getDateTime(d->mStorage, stmt1, index);
-            if (completed.isValid())
-                todo->setCompleted(completed);
-            index += 3;
-        } else {
-            index += 4;
-        }
+    if (incidence->type() == Incidence::TypeTodo) {
+        Todo::Ptr todo = incidence.staticCast<Todo>();
+        todo->setPercentComplete(row.toInt(index++));
+        QDateTime completed = getDateTime(d->mStorage, row, index);
+        if (completed.isValid())
+            todo->setCompleted(completed);
+        index += 3;
+    } else {
+        index += 4;
+    }
 
-        index++; //DateDeleted
+    index++; //DateDeleted
 
-        QString colorstr = QString::fromUtf8((const char *) sqlite3_column_text(stmt1, index++));
-        if (!colorstr.isEmpty()) {
-            incidence->setColor(colorstr);
-        }
+    QString colorstr = row.toString(index++);
+    if (!colorstr.isEmpty()) {
+        incidence->setColor(colorstr);
+    }
 //    kDebug() << "loaded component for incidence" << incidence->uid() << "notebook" << notebook;
 
-        if (stmt2 && !d->selectCustomproperties(incidence, rowid, stmt2)) {
-            qCWarning(lcMkcal) << "failed to get customproperties for incidence" << incidence->uid() << "notebook" << notebook;
-        }
-        if (stmt3 && !d->selectAttendees(incidence, rowid, stmt3)) {
-            qCWarning(lcMkcal) << "failed to get attendees for incidence" << incidence->uid() << "notebook" << notebook;
-        }
-        if (stmt4 && !d->selectAlarms(incidence, rowid, stmt4)) {
-            qCWarning(lcMkcal) << "failed to get alarms for incidence" << incidence->uid() << "notebook" << notebook;
-        }
-        if (stmt5 && !d->selectRecursives(incidence, rowid, stmt5)) {
-            qCWarning(lcMkcal) << "failed to get recursive for incidence" << incidence->uid() << "notebook" << notebook;
-        }
-        if (stmt6 && !d->selectRdates(incidence, rowid, stmt6)) {
-            qCWarning(lcMkcal) << "failed to get rdates for incidence" << incidence->uid() << "notebook" << notebook;
-        }
-        if (attachmentStmt && !d->selectAttachments(incidence, rowid, attachmentStmt)) {
-            qCWarning(lcMkcal) << "failed to get attachments for incidence" << incidence->uid() << "notebook" << notebook;
-        }
-        // Backward compatibility with the old attachment storage.
-        if (!Att.isEmpty() && incidence->attachments().isEmpty()) {
-            QStringList AttL = Att.split(' ');
-            for (QStringList::Iterator it = AttL.begin(); it != AttL.end(); ++it) {
-                incidence->addAttachment(Attachment(*it));
-            }
+    d->decodeCustomproperties(incidence, rows.customProperties);
+    d->decodeAttendees(incidence, rows.attendees);
+    d->decodeAlarms(incidence, rows.alarms);
+    d->decodeRecursives(incidence, rows.recursives);
+    d->decodeRdates(incidence, rows.rdates);
+    d->decodeAttachments(incidence, rows.attachments);
+    // Backward compatibility with the old attachment storage.
+    if (rows.hasAttachments && !Att.isEmpty() && incidence->attachments().isEmpty()) {
+        QStringList AttL = Att.split(' ');
+        for (QStringList::Iterator it = AttL.begin(); it != AttL.end(); ++it) {
+            incidence->addAttachment(Attachment(*it));
         }
     }
 
-error:
     return incidence;
 }
 
@@ -1491,62 +1885,53 @@ int SqliteFormat::Private::selectRowId(Incidence::Ptr incidence)
     int index = 1;
     const char *query = NULL;
     int qsize = 0;
-    sqlite3_stmt *stmt = NULL;
-    const char *tail = NULL;
 
     QByteArray u;
     qint64 secsRecurId;
     int rowid = 0;
 
-    query = SELECT_ROWID_FROM_COMPONENTS_BY_UID_AND_RECURID;
-    qsize = sizeof(SELECT_ROWID_FROM_COMPONENTS_BY_UID_AND_RECURID);
+    if (!mSelectRowId) {
+        query = SELECT_ROWID_FROM_COMPONENTS_BY_UID_AND_RECURID;
+        qsize = sizeof(SELECT_ROWID_FROM_COMPONENTS_BY_UID_AND_RECURID);
 
-    sqlite3_prepare_v2(mDatabase, query, qsize, &stmt, &tail);
+        sqlite3_prepare_v2(mDatabase, query, qsize, &mSelectRowId, NULL);
+    }
     u = incidence->uid().toUtf8();
-    sqlite3_bind_text(stmt, index, u.constData(), u.length(), SQLITE_STATIC);
+    sqlite3_bind_text(mSelectRowId, index, u.constData(), u.length(), SQLITE_STATIC);
     if (incidence->recurrenceId().isValid()) {
         secsRecurId = mStorage->toOriginTime(incidence->recurrenceId());
-        sqlite3_bind_int64(stmt, index, secsRecurId);
+        sqlite3_bind_int64(mSelectRowId, index, secsRecurId);
     } else {
-        sqlite3_bind_int64(stmt, index, 0);
+        sqlite3_bind_int64(mSelectRowId, index, 0);
     }
 
-    sqlite3_step(stmt);
+    sqlite3_step(mSelectRowId);
 
     if (rv == SQLITE_ROW) {
-        rowid = sqlite3_column_int(stmt, 0);
+        rowid = sqlite3_column_int(mSelectRowId, 0);
     }
 
 error:
-    sqlite3_reset(stmt);
-    sqlite3_finalize(stmt);
+    sqlite3_reset(mSelectRowId);
 
     return rowid;
 }
 
-bool SqliteFormat::Private::selectCustomproperties(Incidence::Ptr incidence, int rowid,
-                                                   sqlite3_stmt *stmt)
+bool SqliteFormat::Private::selectRows(int rowid, sqlite3_stmt *stmt, QVector<SqliteRow> *rows)
 {
     int rv = 0;
     int index = 1;
-    QMap<QByteArray, QString> map;
 
-    sqlite3_bind_int(stmt, index, rowid);
+    rows->clear();
 
-    map.clear();
+    sqlite3_bind_int(stmt, index, rowid);
 
     do {
         sqlite3_step(stmt);
 
         if (rv == SQLITE_ROW) {
-            // Set Incidence data customproperties
-
-            QByteArray name = (const char *)sqlite3_column_text(stmt, 1);
-            QString value = QString::fromUtf8((const char *)sqlite3_column_text(stmt, 2));
-            QString parameters = QString::fromUtf8((const char *)sqlite3_column_text(stmt, 3));
-            incidence->setNonKDECustomProperty(name, value, parameters);
+            rows->append(SqliteRow(stmt));
         }
-
     } while (rv != SQLITE_DONE);
 
     return true;
@@ -1555,134 +1940,124 @@ error:
     return false;
 }
 
-bool SqliteFormat::Private::selectRdates(Incidence::Ptr incidence, int rowid, sqlite3_stmt *stmt)
+void SqliteFormat::Private::decodeCustomproperties(const Incidence::Ptr &incidence,
+                                                   const QVector<SqliteRow> &rows) const
 {
-    int rv = 0;
-    int index = 1;
-    QString   timezone;
-    QDateTime kdt;
+    for (const SqliteRow &row : rows) {
+        // Set Incidence data customproperties
 
-    sqlite3_bind_int(stmt, index, rowid);
+        QByteArray name = row.text(1);
+        QString value = row.toString(2);
+        QString parameters = row.toString(3);
+        incidence->setNonKDECustomProperty(name, value, parameters);
+    }
+}
 
-    do {
-        sqlite3_step(stmt);
+void SqliteFormat::Private::decodeRdates(const Incidence::Ptr &incidence,
+                                         const QVector<SqliteRow> &rows) const
+{
+    QDateTime kdt;
 
-        if (rv == SQLITE_ROW) {
-            // Set Incidence data rdates
-            int type = sqlite3_column_int(stmt, 1);
-            kdt = getDateTime(mStorage, stmt, 2);
-            if (kdt.isValid()) {
-                if (type == SqliteFormat::RDate || type == SqliteFormat::XDate) {
-                    if (type == SqliteFormat::RDate)
-                        incidence->recurrence()->addRDate(kdt.date());
-                    else
-                        incidence->recurrence()->addExDate(kdt.date());
-                } else {
-                    if (type == SqliteFormat::RDateTime)
-                        incidence->recurrence()->addRDateTime(kdt);
-                    else
-                        incidence->recurrence()->addExDateTime(kdt);
-                }
+    for (const SqliteRow &row : rows) {
+        // Set Incidence data rdates
+        int type = row.toInt(1);
+        kdt = getDateTime(mStorage, row, 2);
+        if (kdt.isValid()) {
+            if (type == SqliteFormat::RDate || type == SqliteFormat::XDate) {
+                if (type == SqliteFormat::RDate)
+                    incidence->recurrence()->addRDate(kdt.date());
+                else
+                    incidence->recurrence()->addExDate(kdt.date());
+            } else {
+                if (type == SqliteFormat::RDateTime)
+                    incidence->recurrence()->addRDateTime(kdt);
+                else
+                    incidence->recurrence()->addExDateTime(kdt);
             }
         }
-
-    } while (rv != SQLITE_DONE);
-
-    return true;
-
-error:
-    return false;
+    }
 }
 
-bool SqliteFormat::Private::selectRecursives(Incidence::Ptr incidence, int rowid,
-                                             sqlite3_stmt *stmt)
+void SqliteFormat::Private::decodeRecursives(const Incidence::Ptr &incidence,
+                                             const QVector<SqliteRow> &rows) const
 {
-    int  rv = 0;
-    int  index = 1;
-    QString   timezone;
     QDateTime kdt;
-    QDateTime dt;
-
-    sqlite3_bind_int(stmt, index, rowid);
 
-    do {
-        sqlite3_step(stmt);
+    for (const SqliteRow &row : rows) {
+        // Set Incidence data from recursive
 
-        if (rv == SQLITE_ROW) {
-            // Set Incidence data from recursive
-
-            // all BY*
-            QList<int> byList;
-            QList<int> byList2;
-            QStringList byL;
-            QStringList byL2;
-            QString by;
-            QString by2;
-            RecurrenceRule *recurrule = new RecurrenceRule();
-
-            if (incidence->dtStart().isValid())
-                recurrule->setStartDt(incidence->dtStart());
-            else {
-                if (incidence->type() == Incidence::TypeTodo) {
-                    Todo::Ptr todo = incidence.staticCast<Todo>();
-                    recurrule->setStartDt(todo->dtDue(true));
-                }
+        // all BY*
+        QList<int> byList;
+        QList<int> byList2;
+        QStringList byL;
+        QStringList byL2;
+        QString by;
+        QString by2;
+        RecurrenceRule *recurrule = new RecurrenceRule();
+
+        if (incidence->dtStart().isValid())
+            recurrule->setStartDt(incidence->dtStart());
+        else {
+            if (incidence->type() == Incidence::TypeTodo) {
+                Todo::Ptr todo = incidence.staticCast<Todo>();
+                recurrule->setStartDt(todo->dtDue(true));
             }
+        }
 
-            // Generate the RRULE string
-            if (sqlite3_column_int(stmt, 1) == 1)   // ruletype
-                recurrule->setRRule(QString("RRULE"));
-            else
-                recurrule->setRRule(QString("EXRULE"));
-
-            switch (sqlite3_column_int(stmt, 2)) {    // frequency
-            case 1:
-                recurrule->setRecurrenceType(RecurrenceRule::rSecondly);
-                break;
-            case 2:
-                recurrule->setRecurrenceType(RecurrenceRule::rMinutely);
-                break;
-            case 3:
-                recurrule->setRecurrenceType(RecurrenceRule::rHourly);
-                break;
-            case 4:
-                recurrule->setRecurrenceType(RecurrenceRule::rDaily);
-                break;
-            case 5:
-                recurrule->setRecurrenceType(RecurrenceRule::rWeekly);
-                break;
-            case 6:
-                recurrule->setRecurrenceType(RecurrenceRule::rMonthly);
-                break;
-            case 7:
-                recurrule->setRecurrenceType(RecurrenceRule::rYearly);
-                break;
-            default:
-                recurrule->setRecurrenceType(RecurrenceRule::rNone);
-            }
+        // Generate the RRULE string
+        if (row.toInt(1) == 1)   // ruletype
+            recurrule->setRRule(QString("RRULE"));
+        else
+            recurrule->setRRule(QString("EXRULE"));
 
-            // Duration & End Date
-            bool isAllDay;
-            QDateTime until = getDateTime(mStorage, stmt, 3, &isAllDay);
-            recurrule->setEndDt(until);
-            incidence->recurrence()->setAllDay(until.isValid() ? isAllDay : incidence->allDay());
-
-            int duration = sqlite3_column_int(stmt, 6);  // count
-            if (duration == 0 && !recurrule->endDt().isValid()) {
-                duration = -1; // work around invalid recurrence state: recurring infinitely but having invalid end date
-            } else if (duration > 0) {
-                // Ensure that no endDt is saved if duration is provided.
-                // This guarantees that the operator== returns true for
-                // rRule(withDuration) == savedRRule(withDuration)
-                recurrule->setEndDt(QDateTime());
-            }
-            recurrule->setDuration(duration);
-            // Frequency
-            recurrule->setFrequency(sqlite3_column_int(stmt, 7)); // interval-field
+        switch (row.toInt(2)) {    // frequency
+        case 1:
+            recurrule->setRecurrenceType(RecurrenceRule::rSecondly);
+            break;
+        case 2:
+            recurrule->setRecurrenceType(RecurrenceRule::rMinutely);
+            break;
+        case 3:
+            recurrule->setRecurrenceType(RecurrenceRule::rHourly);
+            break;
+        case 4:
+            recurrule->setRecurrenceType(RecurrenceRule::rDaily);
+            break;
+        case 5:
+            recurrule->setRecurrenceType(RecurrenceRule::rWeekly);
+            break;
+        case 6:
+            recurrule->setRecurrenceType(RecurrenceRule::rMonthly);
+            break;
+        case 7:
+            recurrule->setRecurrenceType(RecurrenceRule::rYearly);
+            break;
+        default:
+            recurrule->setRecurrenceType(RecurrenceRule::rNone);
+        }
+
+        // Duration & End Date
+        bool isAllDay;
+        QDateTime until = getDateTime(mStorage, row, 3, &isAllDay);
+        recurrule->setEndDt(until);
+        incidence->recurrence()->setAllDay(until.isValid() ? isAllDay : incidence->allDay());
+
+        int duration = row.toInt(6);  // count
+        if (duration == 0 && !recurrule->endDt().isValid()) {
+            duration = -1; // work around invalid recurrence state: recurring infinitely but having invalid end date
+        } else if (duration > 0) {
+            // Ensure that no endDt is saved if duration is provided.
+            // This guarantees that the operator== returns true for
+            // rRule(withDuration) == savedRRule(withDuration)
+            recurrule->setEndDt(QDateTime());
+        }
+        recurrule->setDuration(duration);
+        // Frequency
+        recurrule->setFrequency(row.toInt(7)); // interval-field
 
 
 #define readSetByList( field, setfunc )                 \
-      by = QString::fromUtf8((const char *)sqlite3_column_text(stmt, field)); \
+      by = row.toString(field);                 \
       if (!by.isEmpty()) {                      \
         byList.clear();                         \
         byL = by.split(' ');                        \
@@ -1692,263 +2067,276 @@ bool SqliteFormat::Private::selectRecursives(Incidence::Ptr incidence, int rowid
           recurrule->setfunc(byList);                   \
       }
 
-            // BYSECOND, MINUTE and HOUR, MONTHDAY, YEARDAY, WEEKNUMBER, MONTH
-            // and SETPOS are standard int lists, so we can treat them with the
-            // same macro
-            readSetByList(8, setBySeconds);
-            readSetByList(9, setByMinutes);
-            readSetByList(10, setByHours);
-            readSetByList(13, setByMonthDays);
-            readSetByList(14, setByYearDays);
-            readSetByList(15, setByWeekNumbers);
-            readSetByList(16, setByMonths);
-            readSetByList(17, setBySetPos);
+        // BYSECOND, MINUTE and HOUR, MONTHDAY, YEARDAY, WEEKNUMBER, MONTH
+        // and SETPOS are standard int lists, so we can treat them with the
+        // same macro
+        readSetByList(8, setBySeconds);
+        readSetByList(9, setByMinutes);
+        readSetByList(10, setByHours);
+        readSetByList(13, setByMonthDays);
+        readSetByList(14, setByYearDays);
+        readSetByList(15, setByWeekNumbers);
+        readSetByList(16, setByMonths);
+        readSetByList(17, setBySetPos);
 
 #undef readSetByList
 
-            // BYDAY is a special case, since it's not an int list
-            QList<RecurrenceRule::WDayPos> wdList;
-            RecurrenceRule::WDayPos pos;
-            wdList.clear();
-            byList.clear();
-            by = QString::fromUtf8((const char *)sqlite3_column_text(stmt, 11));
-            by2 = QString::fromUtf8((const char *)sqlite3_column_text(stmt, 12));
-            if (!by.isEmpty()) {
-                byL = by.split(' ');
-                if (!by2.isEmpty())
-                    byL2 = by2.split(' ');
-                for (int i = 0; i < byL.size(); ++i) {
-                    if (!by2.isEmpty()) {
-                        pos.setDay(byL.at(i).toInt());
-                        pos.setPos(byL2.at(i).toInt());
-                        wdList.append(pos);
-                    } else {
-                        pos.setDay(byL.at(i).toInt());
-                        wdList.append(pos);
-                    }
+        // BYDAY is a special case, since it's not an int list
+        QList<RecurrenceRule::WDayPos> wdList;
+        RecurrenceRule::WDayPos pos;
+        wdList.clear();
+        byList.clear();
+        by = row.toString(11);
+        by2 = row.toString(12);
+        if (!by.isEmpty()) {
+            byL = by.split(' ');
+            if (!by2.isEmpty())
+                byL2 = by2.split(' ');
+            for (int i = 0; i < byL.size(); ++i) {
+                if (!by2.isEmpty()) {
+                    pos.setDay(byL.at(i).toInt());
+                    pos.setPos(byL2.at(i).toInt());
+                    wdList.append(pos);
+                } else {
+                    pos.setDay(byL.at(i).toInt());
+                    wdList.append(pos);
                 }
-                if (!wdList.isEmpty())
-                    recurrule->setByDays(wdList);
             }
-
-            // Week start setting
-            recurrule->setWeekStart(sqlite3_column_int(stmt, 18));
-
-            if (recurrule->rrule() == "RRULE")
-                incidence->recurrence()->addRRule(recurrule);
-            else
-                incidence->recurrence()->addExRule(recurrule);
+            if (!wdList.isEmpty())
+                recurrule->setByDays(wdList);
         }
 
-    } while (rv != SQLITE_DONE);
-
-    return true;
+        // Week start setting
+        recurrule->setWeekStart(row.toInt(18));
 
-error:
-    return false;
+        if (recurrule->rrule() == "RRULE")
+            incidence->recurrence()->addRRule(recurrule);
+        else
+            incidence->recurrence()->addExRule(recurrule);
+    }
 }
 
-bool SqliteFormat::Private::selectAlarms(Incidence::Ptr incidence, int rowid, sqlite3_stmt *stmt)
+void SqliteFormat::Private::decodeAlarms(const Incidence::Ptr &incidence,
+                                         const QVector<SqliteRow> &rows) const
 {
-    int rv = 0;
-    int index = 1;
     int offset;
-    QString   timezone;
     QDateTime kdt;
-    QDateTime dt;
 
-    sqlite3_bind_int(stmt, index, rowid);
+    for (const SqliteRow &row : rows) {
+        // Set Incidence data from alarm
 
-    do {
-        sqlite3_step(stmt);
+        Alarm::Ptr ialarm = incidence->newAlarm();
 
-        if (rv == SQLITE_ROW) {
-            // Set Incidence data from alarm
-
-            Alarm::Ptr ialarm = incidence->newAlarm();
-
-            // Determine the alarm's action type
-            int action = sqlite3_column_int(stmt, 1);
-            Alarm::Type type = Alarm::Invalid;
-
-            switch (action) {
-            case 1: //ICAL_ACTION_DISPLAY
-                type = Alarm::Display;
-                break;
-            case 2: //ICAL_ACTION_PROCEDURE
-                type = Alarm::Procedure;
-                break;
-            case 3: //ICAL_ACTION_EMAIL
-                type = Alarm::Email;
-                break;
-            case 4: //ICAL_ACTION_AUDIO
-                type = Alarm::Audio;
-                break;
-            default:
-                break;
-            }
+        // Determine the alarm's action type
+        int action = row.toInt(1);
+        Alarm::Type type = Alarm::Invalid;
+
+        switch (action) {
+        case 1: //ICAL_ACTION_DISPLAY
+            type = Alarm::Display;
+            break;
+        case 2: //ICAL_ACTION_PROCEDURE
+            type = Alarm::Procedure;
+            break;
+        case 3: //ICAL_ACTION_EMAIL
+            type = Alarm::Email;
+            break;
+        case 4: //ICAL_ACTION_AUDIO
+            type = Alarm::Audio;
+            break;
+        default:
+            break;
+        }
 
-            ialarm->setType(type);
+        ialarm->setType(type);
 
-            if (sqlite3_column_int(stmt, 2) > 0)
-                ialarm->setRepeatCount(sqlite3_column_int(stmt, 2));
-            if (sqlite3_column_int(stmt, 3) > 0)
-                ialarm->setSnoozeTime(Duration(sqlite3_column_int(stmt, 3), Duration::Seconds));
+        if (row.toInt(2) > 0)
+            ialarm->setRepeatCount(row.toInt(2));
+        if (row.toInt(3) > 0)
+            ialarm->setSnoozeTime(Duration(row.toInt(3), Duration::Seconds));
 
-            offset = sqlite3_column_int(stmt, 4);
-            QString relation = QString::fromUtf8((const char *)sqlite3_column_text(stmt, 5));
+        offset = row.toInt(4);
+        QString relation = row.toString(5);
 
-            kdt = getDateTime(mStorage, stmt, 6);
-            if (kdt.isValid())
-                ialarm->setTime(kdt);
+        kdt = getDateTime(mStorage, row, 6);
+        if (kdt.isValid())
+            ialarm->setTime(kdt);
 
-            if (!ialarm->hasTime()) {
-                if (relation.contains("startTriggerRelation")) {
-                    ialarm->setStartOffset(Duration(offset, Duration::Seconds));
-                } else if (relation.contains("endTriggerRelation")) {
-                    ialarm->setEndOffset(Duration(offset, Duration::Seconds));
-                }
+        if (!ialarm->hasTime()) {
+            if (relation.contains("startTriggerRelation")) {
+                ialarm->setStartOffset(Duration(offset, Duration::Seconds));
+            } else if (relation.contains("endTriggerRelation")) {
+                ialarm->setEndOffset(Duration(offset, Duration::Seconds));
             }
+        }
 
-            QString description =  QString::fromUtf8((const char *)sqlite3_column_text(stmt, 9));
-            QString attachments =  QString::fromUtf8((const char *)sqlite3_column_text(stmt, 10));
-            QString summary = QString::fromUtf8((const char *)sqlite3_column_text(stmt, 11));
-            QString addresses = QString::fromUtf8((const char *)sqlite3_column_text(stmt, 12));
-
-            switch (ialarm->type()) {
-            case Alarm::Display:
-                ialarm->setText(description);
-                break;
-            case Alarm::Procedure:
-                ialarm->setProgramFile(attachments);
-                ialarm->setProgramArguments(description);
-                break;
-            case Alarm::Email:
-                ialarm->setMailSubject(summary);
-                ialarm->setMailText(description);
-                if (!attachments.isEmpty())
-                    ialarm->setMailAttachments(attachments.split(','));
-                if (!addresses.isEmpty()) {
-                    Person::List persons;
-                    QStringList emails = addresses.split(',');
-                    for (int i = 0; i < emails.size(); i++) {
-                        persons.append(Person(QString(), emails.at(i)));
-                    }
-                    ialarm->setMailAddresses(persons);
+        QString description =  row.toString(9);
+        QString attachments =  row.toString(10);
+        QString summary = row.toString(11);
+        QString addresses = row.toString(12);
+
+        switch (ialarm->type()) {
+        case Alarm::Display:
+            ialarm->setText(description);
+            break;
+        case Alarm::Procedure:
+            ialarm->setProgramFile(attachments);
+            ialarm->setProgramArguments(description);
+            break;
+        case Alarm::Email:
+            ialarm->setMailSubject(summary);
+            ialarm->setMailText(description);
+            if (!attachments.isEmpty())
+                ialarm->setMailAttachments(attachments.split(','));
+            if (!addresses.isEmpty()) {
+                Person::List persons;
+                QStringList emails = addresses.split(',');
+                for (int i = 0; i < emails.size(); i++) {
+                    persons.append(Person(QString(), emails.at(i)));
                 }
-                break;
-            case Alarm::Audio:
-                ialarm->setAudioFile(attachments);
-                break;
-            default:
-                break;
+                ialarm->setMailAddresses(persons);
             }
+            break;
+        case Alarm::Audio:
+            ialarm->setAudioFile(attachments);
+            break;
+        default:
+            break;
+        }
 
-            QString properties = QString::fromUtf8((const char *)sqlite3_column_text(stmt, 13));
-            if (!properties.isEmpty()) {
-                QMap<QByteArray, QString> customProperties;
-                QStringList list = properties.split("\r\n");
-                for (int i = 0; i < list.size(); i += 2) {
-                    QByteArray key;
-                    QString value;
-                    key = list.at(i).toUtf8();
-                    if ((i + 1) < list.size()) {
-                        value = list.at(i + 1);
-                        customProperties[key] = value;
-                    }
-                }
-                ialarm->setCustomProperties(customProperties);
-                QString locationRadius = ialarm->nonKDECustomProperty("X-LOCATION-RADIUS");
-                if (!locationRadius.isEmpty()) {
-                    ialarm->setLocationRadius(locationRadius.toInt());
-                    ialarm->setHasLocationRadius(true);
+        QString properties = row.toString(13);
+        if (!properties.isEmpty()) {
+            QMap<QByteArray, QString> customProperties;
+            QStringList list = properties.split("\r\n");
+            for (int i = 0; i < list.size(); i += 2) {
+                QByteArray key;
+                QString value;
+                key = list.at(i).toUtf8();
+                if ((i + 1) < list.size()) {
+                    value = list.at(i + 1);
+                    customProperties[key] = value;
                 }
             }
-
-            ialarm->setEnabled((bool)sqlite3_column_int(stmt, 14));
+            ialarm->setCustomProperties(customProperties);
+            QString locationRadius = ialarm->nonKDECustomProperty("X-LOCATION-RADIUS");
+            if (!locationRadius.isEmpty()) {
+                ialarm->setLocationRadius(locationRadius.toInt());
+                ialarm->setHasLocationRadius(true);
+            }
         }
 
-    } while (rv != SQLITE_DONE);
-
-    return true;
-
-error:
-    return false;
+        ialarm->setEnabled((bool)row.toInt(14));
+    }
 }
 
-bool SqliteFormat::Private::selectAttendees(Incidence::Ptr incidence, int rowid,
-                                            sqlite3_stmt *stmt)
+void SqliteFormat::Private::decodeAttendees(const Incidence::Ptr &incidence,
+                                            const QVector<SqliteRow> &rows) const
 {
-    int rv = 0;
-    int index = 1;
-
-    sqlite3_bind_int(stmt, index, rowid);
-
-    do {
-        sqlite3_step(stmt);
+    for (const SqliteRow &row : rows) {
+        QString email = row.toString(1);
+        QString name = row.toString(2);
+        bool isOrganizer = (bool)row.toInt(3);
+        Attendee::Role role = (Attendee::Role)row.toInt(4);
+        Attendee::PartStat status = (Attendee::PartStat)row.toInt(5);
+        bool rsvp = (bool)row.toInt(6);
+        if (isOrganizer) {
+            incidence->setOrganizer(Person(name, email));
+        }
+        Attendee attendee(name, email, rsvp, status, role);
+        attendee.setDelegate(row.toString(7));
+        attendee.setDelegator(row.toString(8));
+        incidence->addAttendee(attendee, false);
+    }
+}
 
-        if (rv == SQLITE_ROW) {
-            QString email = QString::fromUtf8((const char *)sqlite3_column_text(stmt, 1));
-            QString name = QString::fromUtf8((const char *)sqlite3_column_text(stmt, 2));
-            bool isOrganizer = (bool)sqlite3_column_int(stmt, 3);
-            Attendee::Role role = (Attendee::Role)sqlite3_column_int(stmt, 4);
-            Attendee::PartStat status = (Attendee::PartStat)sqlite3_column_int(stmt, 5);
-            bool rsvp = (bool)sqlite3_column_int(stmt, 6);
-            if (isOrganizer) {
-                incidence->setOrganizer(Person(name, email));
+void SqliteFormat::Private::decodeAttachments(const Incidence::Ptr &incidence,
+                                              const QVector<SqliteRow> &rows) const
+{
+    for (const SqliteRow &row : rows) {
+        Attachment attach;
+
+        QByteArray data = row.text(1);
+        QString uri = row.toString(2);
+        const bool stored = uri.startsWith(QLatin1String(ATTACHMENT_STORE));
+        if (!data.isEmpty()) {
+            attach.setDecodedData(data);
+        } else if (row.toInt(7) && (stored || uri.startsWith(QLatin1String(ATTACHMENT_KEY)))) {
+            // Large or stored data are not read on load, only referenced.
+            attach.setUri(QString::fromLatin1(ATTACHMENT_REFERENCE)
+                          + QString::number(row.toInt(0)) + QLatin1Char('/') + uri);
+        } else if (stored) {
+            QFile file(mStorage->attachmentStorePath() + QLatin1Char('/')
+                       + uri.mid(sizeof(ATTACHMENT_STORE) - 1));
+            if (file.open(QIODevice::ReadOnly)) {
+                attach.setDecodedData(file.readAll());
+            } else {
+                qCWarning(lcMkcal) << "cannot read attachment data" << file.fileName() << file.errorString();
             }
-            Attendee attendee(name, email, rsvp, status, role);
-            attendee.setDelegate(QString::fromUtf8((const char *)sqlite3_column_text(stmt, 7)));
-            attendee.setDelegator(QString::fromUtf8((const char *)sqlite3_column_text(stmt, 8)));
-            incidence->addAttendee(attendee, false);
+        } else if (!uri.isEmpty()) {
+            attach.setUri(uri);
         }
-    } while (rv != SQLITE_DONE);
-
-    return true;
-
-error:
-    return false;
+        if (!attach.isEmpty()) {
+            attach.setMimeType(row.toString(3));
+            attach.setShowInline(row.toInt(4) != 0);
+            attach.setLabel(row.toString(5));
+            attach.setLocal(row.toInt(6) != 0);
+            incidence->addAttachment(attach);
+        } else {
+            qCWarning(lcMkcal) << "Empty attachment for incidence" << incidence->instanceIdentifier();
+        }
+    }
 }
 
-bool SqliteFormat::Private::selectAttachments(Incidence::Ptr incidence, int rowid, sqlite3_stmt *stmt)
+void SqliteFormat::purgeAttachmentStore()
 {
     int rv = 0;
-    int index = 1;
-
-    sqlite3_bind_int(stmt, index, rowid);
+    int index;
 
-    do {
-        sqlite3_step(stmt);
+    if (d->mReleasedContents.isEmpty()) {
+        return;
+    }
 
-        if (rv == SQLITE_ROW) {
-            Attachment attach;
+    if (!d->mCountStoredAttachments) {
+        const char *query = SELECT_ATTACHMENTS_COUNT_BY_URI;
+        int qsize = sizeof(SELECT_ATTACHMENTS_COUNT_BY_URI);
+        sqlite3_prepare_v2(d->mDatabase, query, qsize, &d->mCountStoredAttachments, NULL);
+    }
 
-            QByteArray data = QByteArray((const char *)sqlite3_column_blob(stmt, 1),
-                                         sqlite3_column_bytes(stmt, 1));
-            if (!data.isEmpty()) {
-                attach.setDecodedData(data);
-            } else {
-                QString uri = QString::fromUtf8((const char *)sqlite3_column_text(stmt, 2));
-                if (!uri.isEmpty()) {
-                    attach.setUri(uri);
-                }
-            }
-            if (!attach.isEmpty()) {
-                attach.setMimeType(QString::fromUtf8((const char *)sqlite3_column_text(stmt, 3)));
-                attach.setShowInline(sqlite3_column_int(stmt, 4) != 0);
-                attach.setLabel(QString::fromUtf8((const char *)sqlite3_column_text(stmt, 5)));
-                attach.setLocal(sqlite3_column_int(stmt, 6) != 0);
-                incidence->addAttachment(attach);
-            } else {
-                qCWarning(lcMkcal) << "Empty attachment for incidence" << incidence->instanceIdentifier();
-            }
+    for (const QByteArray &uri : const_cast<const QSet<QByteArray> &>(d->mReleasedContents)) {
+        index = 1;
+        sqlite3_bind_text(d->mCountStoredAttachments, index, uri.constData(), uri.length(), SQLITE_STATIC);
+        sqlite3_step(d->mCountStoredAttachments);
+        if (rv == SQLITE_ROW && sqlite3_column_int(d->mCountStoredAttachments, 0) == 0) {
+            const QString path = d->mStorage->attachmentStorePath() + QLatin1Char('/')
+                + QString::fromLatin1(uri.mid(sizeof(ATTACHMENT_STORE) - 1));
+            qCDebug(lcMkcal) << "removing unused attachment data" << path;
+            QFile::remove(path);
         }
-    } while (rv != SQLITE_DONE);
+        sqlite3_reset(d->mCountStoredAttachments);
+    }
+    d->mReleasedContents.clear();
 
-    return true;
+    return;
 
 error:
-    return false;
+    sqlite3_reset(d->mCountStoredAttachments);
+    // Keep the released contents for a next try.
+}
+
+bool SqliteFormat::attachmentReference(const Attachment &attachment,
+                                       int *componentId, QByteArray *key)
+{
+    if (!attachment.isUri()
+        || !attachment.uri().startsWith(QLatin1String(ATTACHMENT_REFERENCE))) {
+        return false;
+    }
+
+    const QString reference = attachment.uri().mid(sizeof(ATTACHMENT_REFERENCE) - 1);
+    const int separator = reference.indexOf(QLatin1Char('/'));
+    bool ok = false;
+    *componentId = reference.leftRef(separator).toInt(&ok);
+    *key = reference.mid(separator + 1).toUtf8();
+    return ok && separator > 0 && !key->isEmpty();
 }
 
 Person::List SqliteFormat::selectContacts(sqlite3_stmt *stmt)
@@ -42,6 +42,7 @@
 namespace mKCal {
 
 class SqliteStorage;
+struct SqliteComponentRows;
 
 /**
   @brief
@@ -138,6 +139,87 @@ public:
                                               sqlite3_stmt *attachmentStmt,
                                               QString &notebook);
 
+    /**
+      Select the rows describing an incidence, from Components table
+      and the children tables, without decoding them.
+
+      The values are copied, so they stay valid after the statements
+      moved on and can be decoded later with decodeComponentRows().
+
+      @param stmt1 prepared sqlite statement for components table
+      @param stmt2 prepared sqlite statement for customproperties table
+      @param stmt3 prepared sqlite statement for attendee table
+      @param stmt4 prepared sqlite statement for alarm table
+      @param stmt5 prepared sqlite statement for recursive table
+      @param stmt6 prepared sqlite statement for rdates table
+      @param attachmentStmt prepared sqlite statement for attachments table
+      @param rows the rows to fill
+      @return true if a component was selected; false otherwise.
+    */
+    bool readComponentRows(sqlite3_stmt *stmt1, sqlite3_stmt *stmt2,
+                           sqlite3_stmt *stmt3, sqlite3_stmt *stmt4,
+                           sqlite3_stmt *stmt5, sqlite3_stmt *stmt6,
+                           sqlite3_stmt *attachmentStmt,
+                           SqliteComponentRows *rows);
+
+    /**
+      Build the incidence described by rows read with readComponentRows().
+
+      It does not access the database and can be called from any thread,
+      concurrently with other calls.
+
+      @param rows the rows describing the incidence
+      @param notebook if not null, set to the notebook of the incidence
+      @return the incidence, null if the component type is unknown.
+    */
+    KCalendarCore::Incidence::Ptr decodeComponentRows(const SqliteComponentRows &rows,
+                                                      QString *notebook) const;
+
+    /**
+      Select the incidence data stored in the children tables, for an
+      incidence selected from Components table without them.
+
+      @param incidence incidence to complete
+      @param stmt2 prepared sqlite statement for customproperties table
+      @param stmt3 prepared sqlite statement for attendee table
+      @param stmt4 prepared sqlite statement for alarm table
+      @param attachmentStmt prepared sqlite statement for attachments table
+      @return true if the operation was successful; false otherwise.
+    */
+    bool selectComponentDetails(const KCalendarCore::Incidence::Ptr &incidence,
+                                sqlite3_stmt *stmt2, sqlite3_stmt *stmt3,
+                                sqlite3_stmt *stmt4, sqlite3_stmt *attachmentStmt);
+
+    /**
+      Select a manifest entry from Components table.
+
+      @param stmt prepared sqlite statement for components table, selecting
+             uid, recurrence id, last modification date, revision and
+             optionally a custom property value
+      @param entry the manifest entry to fill
+      @return true if a row was selected; false otherwise.
+    */
+    bool selectManifestEntry(sqlite3_stmt *stmt, ExtendedStorage::ManifestEntry *entry);
+
+    /**
+      Get the attachment data an attachment refers to, when its data
+      were not read on load.
+
+      @param attachment an attachment loaded from the Attachments table
+      @param componentId the ComponentId of the referenced data
+      @param key the value of the Uri column of the referenced data
+      @return true if @p attachment is a reference; false otherwise.
+    */
+    static bool attachmentReference(const KCalendarCore::Attachment &attachment,
+                                    int *componentId, QByteArray *key);
+
+    /**
+      Remove the files of the attachment store that are not used anymore
+      by attachments released since the last call. It should be called
+      after transactions modifying attachments are finished.
+    */
+    void purgeAttachmentStore();
+
     /**
       Select contacts and order them by appearances.
 
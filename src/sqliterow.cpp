@@ -0,0 +1,127 @@
+/*
+  This file is part of the mkcal library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "sqliterow_p.h"
+
+using namespace mKCal;
+
+SqliteRow::SqliteRow()
+{
+}
+
+SqliteRow::SqliteRow(sqlite3_stmt *stmt)
+{
+    const int count = sqlite3_column_count(stmt);
+    mValues.resize(count);
+    for (int i = 0; i < count; i++) {
+        Value &value = mValues[i];
+        value.type = sqlite3_column_type(stmt, i);
+        value.integer = 0;
+        switch (value.type) {
+        case SQLITE_INTEGER:
+            value.integer = sqlite3_column_int64(stmt, i);
+            break;
+        case SQLITE_FLOAT:
+            value.real = sqlite3_column_double(stmt, i);
+            break;
+        case SQLITE_TEXT:
+            value.bytes = QByteArray((const char *)sqlite3_column_text(stmt, i),
+                                     sqlite3_column_bytes(stmt, i));
+            break;
+        case SQLITE_BLOB:
+            value.bytes = QByteArray((const char *)sqlite3_column_blob(stmt, i),
+                                     sqlite3_column_bytes(stmt, i));
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+bool SqliteRow::isEmpty() const
+{
+    return mValues.isEmpty();
+}
+
+int SqliteRow::toInt(int column) const
+{
+    return int(toInt64(column));
+}
+
+qint64 SqliteRow::toInt64(int column) const
+{
+    if (column < 0 || column >= mValues.count()) {
+        return 0;
+    }
+    const Value &value = mValues[column];
+    switch (value.type) {
+    case SQLITE_INTEGER:
+        return value.integer;
+    case SQLITE_FLOAT:
+        return qint64(value.real);
+    case SQLITE_TEXT:
+    case SQLITE_BLOB:
+        return value.bytes.toLongLong();
+    default:
+        return 0;
+    }
+}
+
+double SqliteRow::toDouble(int column) const
+{
+    if (column < 0 || column >= mValues.count()) {
+        return 0.;
+    }
+    const Value &value = mValues[column];
+    switch (value.type) {
+    case SQLITE_INTEGER:
+        return double(value.integer);
+    case SQLITE_FLOAT:
+        return value.real;
+    case SQLITE_TEXT:
+    case SQLITE_BLOB:
+        return value.bytes.toDouble();
+    default:
+        return 0.;
+    }
+}
+
+QByteArray SqliteRow::text(int column) const
+{
+    if (column < 0 || column >= mValues.count()) {
+        return QByteArray();
+    }
+    const Value &value = mValues[column];
+    switch (value.type) {
+    case SQLITE_INTEGER:
+        return QByteArray::number(value.integer);
+    case SQLITE_FLOAT:
+        return QByteArray::number(value.real, 'g', 15);
+    case SQLITE_TEXT:
+    case SQLITE_BLOB:
+        return value.bytes;
+    default:
+        return QByteArray();
+    }
+}
+
+QString SqliteRow::toString(int column) const
+{
+    return QString::fromUtf8(text(column));
+}
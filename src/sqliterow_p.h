@@ -0,0 +1,97 @@
+/*
+  This file is part of the mkcal library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#ifndef MKCAL_SQLITEROW_P_H
+#define MKCAL_SQLITEROW_P_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+#include <sqlite3.h>
+
+namespace mKCal {
+
+/**
+  The values of a result row, copied out of its statement so they
+  can be decoded after the statement moved to the next row, without
+  holding the database lock and from any thread.
+
+  Values are converted on access like sqlite3_column_*() do.
+
+  @internal
+*/
+class SqliteRow
+{
+public:
+    SqliteRow();
+
+    /**
+      Copies the current row of @p stmt.
+    */
+    explicit SqliteRow(sqlite3_stmt *stmt);
+
+    bool isEmpty() const;
+
+    int toInt(int column) const;
+    qint64 toInt64(int column) const;
+    double toDouble(int column) const;
+
+    /**
+      Returns the column as text or as blob, it is null for NULL values.
+    */
+    QByteArray text(int column) const;
+
+    /**
+      Returns the column as UTF-8 decoded text.
+    */
+    QString toString(int column) const;
+
+private:
+    struct Value {
+        int type;
+        union {
+            qint64 integer;
+            double real;
+        };
+        QByteArray bytes;
+    };
+    QVector<Value> mValues;
+};
+
+/**
+  The rows describing one incidence, its component row and the rows
+  of its details in the other tables, as read from the database.
+
+  @internal
+*/
+struct SqliteComponentRows {
+    SqliteRow component;
+    QVector<SqliteRow> customProperties;
+    QVector<SqliteRow> attendees;
+    QVector<SqliteRow> alarms;
+    QVector<SqliteRow> recursives;
+    QVector<SqliteRow> rdates;
+    QVector<SqliteRow> attachments;
+    bool hasAttachments = false; // the attachments table was read
+};
+
+}
+
+#endif
@@ -33,6 +33,7 @@
 */
 #include "sqlitestorage.h"
 #include "sqliteformat.h"
+#include "sqliterow_p.h"
 #include "logging_p.h"
 
 #include <KCalendarCore/MemoryCalendar>
@@ -40,12 +41,18 @@
 using namespace KCalendarCore;
 
 #include <QFileSystemWatcher>
+#include <QtConcurrent/QtConcurrentRun>
 
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
+#include <QtCore/QFuture>
+#include <QtCore/QMutex>
+#include <QtCore/QPointer>
+#include <QtCore/QThread>
 #include <QtCore/QUuid>
 
 #include <iostream>
+#include <limits>
 using namespace std;
 
 #ifdef Q_OS_UNIX
@@ -57,6 +64,105 @@ using namespace std;
 using namespace mKCal;
 
 const QString gChanged(QLatin1String(".changed"));
+
+//@cond PRIVATE
+/**
+  Read only device on the data of an attachment, reading them in place
+  with the sqlite incremental blob API.
+  @internal
+*/
+class AttachmentDevice : public QIODevice
+{
+public:
+    AttachmentDevice(sqlite3 *database, int componentId, const QByteArray &key, qint64 size)
+        : mDatabase(database), mComponentId(componentId), mKey(key), mSize(size)
+    {
+    }
+
+    bool isSequential() const
+    {
+        return false;
+    }
+
+    qint64 size() const
+    {
+        return mSize;
+    }
+
+    // The database is going to be closed.
+    void invalidate()
+    {
+        mDatabase = nullptr;
+        close();
+    }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize)
+    {
+        if (!mDatabase) {
+            return -1;
+        }
+        const qint64 length = qMin(maxSize, mSize - pos());
+        if (length <= 0) {
+            return 0;
+        }
+
+        // Don't keep the blob opened between reads, it would keep
+        // a read transaction opened on the database. The rowid is
+        // looked up again for each read, while the select statement
+        // keeps the row in place.
+        sqlite3_stmt *stmt = nullptr;
+        sqlite3_blob *blob = nullptr;
+        int rv = (sqlite3_prepare_v2)(mDatabase, SELECT_ATTACHMENTS_BY_REFERENCE,
+                                      sizeof(SELECT_ATTACHMENTS_BY_REFERENCE), &stmt, nullptr);
+        if (!rv) {
+            (sqlite3_bind_int)(stmt, 1, mComponentId);
+            (sqlite3_bind_text)(stmt, 2, mKey.constData(), mKey.length(), SQLITE_STATIC);
+            rv = (sqlite3_step)(stmt);
+            rv = rv == SQLITE_ROW ? SQLITE_OK : SQLITE_NOTFOUND;
+        }
+        if (!rv) {
+            rv = sqlite3_blob_open(mDatabase, "main", "Attachments", "Data",
+                                   sqlite3_column_int64(stmt, 0), 0, &blob);
+        }
+        // Blob offsets and lengths are int, read in chunks and refuse
+        // offsets that sqlite cannot address.
+        qint64 offset = pos();
+        qint64 remaining = length;
+        while (!rv && remaining > 0) {
+            if (offset > std::numeric_limits<int>::max()) {
+                rv = SQLITE_TOOBIG;
+                break;
+            }
+            const int chunk = int(qMin(remaining, qint64(std::numeric_limits<int>::max())));
+            rv = sqlite3_blob_read(blob, data, chunk, int(offset));
+            data += chunk;
+            offset += chunk;
+            remaining -= chunk;
+        }
+        sqlite3_blob_close(blob);
+        sqlite3_finalize(stmt);
+        if (rv) {
+            qCWarning(lcMkcal) << "cannot read attachment data:" << rv << sqlite3_errmsg(mDatabase);
+            return -1;
+        }
+        return length;
+    }
+
+    qint64 writeData(const char *data, qint64 maxSize)
+    {
+        Q_UNUSED(data);
+        Q_UNUSED(maxSize);
+        return -1;
+    }
+
+private:
+    sqlite3 *mDatabase;
+    int mComponentId;
+    QByteArray mKey;
+    qint64 mSize;
+};
+//@endcond
 /**
   Private class that helps to provide binary compatibility between releases.
   @internal
@@ -82,7 +188,11 @@ public:
           mFormat(0),
           mIsLoading(false),
           mIsOpened(false),
-          mIsSaved(false)
+          mIsSaved(false),
+          mReadOnly(false),
+          mReadSession(0),
+          mAttachmentStoreThreshold(0),
+          mAttachmentReferences(false)
     {}
     ~Private()
     {
@@ -104,18 +214,62 @@ public:
     QMultiHash<QString, Incidence::Ptr> mIncidencesToInsert;
     QMultiHash<QString, Incidence::Ptr> mIncidencesToUpdate;
     QMultiHash<QString, Incidence::Ptr> mIncidencesToDelete;
+    // Incidences loaded without their children tables.
+    QMultiHash<QString, Incidence::Ptr> mPartialIncidences;
+    // Opened devices on attachment data.
+    QList<QPointer<AttachmentDevice>> mAttachmentDevices;
     QHash<QString, QString> mUidMappings;
     bool mIsLoading;
     bool mIsOpened;
     bool mIsSaved;
+    // Opened with openReadOnly().
+    bool mReadOnly;
+    // Nesting level of beginRead().
+    int mReadSession;
+    qint64 mAttachmentStoreThreshold;
+    bool mAttachmentReferences;
     QDateTime mOriginTime;
     QDateTime mPreWatcherDbTime;
     QString mSparql;
 
-    bool addIncidence(const Incidence::Ptr &incidence, const QString &notebookUid);
+    // Read-only connections of the threads other than the storage one.
+    struct Connection {
+        sqlite3 *mDatabase;
+        SqliteFormat *mFormat;
+        QMetaObject::Connection mFinished;
+    };
+    QMutex mConnectionsLock;
+    QHash<QThread *, Connection> mConnections;
+
+    // Read-only storages do not take the inter-process lock, they
+    // only rely on sqlite for reading consistent data. Neither do
+    // loads during a read session, they use its transaction.
+    bool lock()
+    {
+        return mReadOnly || (mReadSession > 0 && isStorageThread()) || mSem.acquire();
+    }
+    bool unlock()
+    {
+        return mReadOnly || (mReadSession > 0 && isStorageThread()) || mSem.release();
+    }
+    bool isWritable() const;
+
+    bool isStorageThread() const;
+    bool threadConnection(sqlite3 **database, SqliteFormat **format);
+    void closeConnection(QThread *thread);
+    void closeConnections();
+
+    bool addIncidence(const Incidence::Ptr &incidence, const QString &notebookUid,
+                      bool headerOnly = false);
+    // With a token, the key of the last row read is stored in it and
+    // the number of rows read is returned.
     int loadIncidences(sqlite3_stmt *stmt1,
                        int limit = -1, QDateTime *last = NULL, bool useDate = false,
-                       bool ignoreEnd = false);
+                       bool ignoreEnd = false, bool headerOnly = false,
+                       QByteArray *token = NULL, bool attachmentReferences = false);
+    bool loadIncidenceDetails(const Incidence::Ptr &incidence);
+    bool loadNotebooks(const QStringList &notebookUids,
+                       const QDateTime &start, const QDateTime &end);
     bool saveIncidences(QHash<QString, Incidence::Ptr> &list, DBOperation dbop,
                         const char *query1, int qsize1, const char *query2, int qsize2,
                         const char *query3, int qsize3, const char *query4, int qsize4,
@@ -129,7 +283,17 @@ public:
                           DBOperation dbop, const QDateTime &after,
                           const QString &notebookUid, const QString &summary = QString());
     int selectCount(const char *query, int qsize);
+    bool selectManifest(Manifest *list, const char *query, int qsize,
+                        const QByteArray &propertyName, const QString &value,
+                        const QString &notebookUid);
+    bool applyChanges(const QString &notebookUid,
+                      const Incidence::List &upserts, const Incidence::List &deletes,
+                      DBOperation deleteOperation);
+    void updateLoadedIncidences(const QString &notebookUid,
+                                const Incidence::List &upserts, const Incidence::List &deletes);
     bool checkVersion();
+    bool createTables();
+    bool writeAheadLog(const char *query);
     bool saveTimezones();
     bool loadTimezones();
 };
@@ -168,12 +332,17 @@ bool SqliteStorage::open()
         return false;
     }
 
-    if (!d->mSem.acquire()) {
+    if (!d->lock()) {
         qCWarning(lcMkcal) << "cannot lock" << d->mDatabaseName << "error" << d->mSem.errorString();
         return false;
     }
 
-    rv = sqlite3_open(d->mDatabaseName.toUtf8(), &d->mDatabase);
+    if (d->mReadOnly) {
+        rv = sqlite3_open_v2(d->mDatabaseName.toUtf8(), &d->mDatabase,
+                             SQLITE_OPEN_READONLY, nullptr);
+    } else {
+        rv = sqlite3_open(d->mDatabaseName.toUtf8(), &d->mDatabase);
+    }
     if (rv) {
         qCWarning(lcMkcal) << "sqlite3_open error:" << rv << "on database" << d->mDatabaseName;
         qCWarning(lcMkcal) << sqlite3_errmsg(d->mDatabase);
@@ -187,81 +356,25 @@ bool SqliteStorage::open()
     // Set one and half second busy timeout for waiting for internal sqlite locks
     sqlite3_busy_timeout(d->mDatabase, 1500);
 
-    /* Create Calendars, Components, etc. tables */
-    query = CREATE_VERSION;
-    sqlite3_exec(d->mDatabase);
-
-    query = CREATE_TIMEZONES;
-    sqlite3_exec(d->mDatabase);
-    // Create a global empty entry.
-    query = INSERT_TIMEZONES;
-    sqlite3_exec(d->mDatabase);
-
-    query = CREATE_CALENDARS;
-    sqlite3_exec(d->mDatabase);
-
-    query = CREATE_COMPONENTS;
-    sqlite3_exec(d->mDatabase);
-
-    query = CREATE_RDATES;
-    sqlite3_exec(d->mDatabase);
-
-    query = CREATE_CUSTOMPROPERTIES;
-    sqlite3_exec(d->mDatabase);
-
-    query = CREATE_RECURSIVE;
-    sqlite3_exec(d->mDatabase);
-
-    query = CREATE_ALARM;
-    sqlite3_exec(d->mDatabase);
-
-    query = CREATE_ATTENDEE;
-    sqlite3_exec(d->mDatabase);
-
-    query = CREATE_ATTACHMENTS;
-    sqlite3_exec(d->mDatabase);
-
-    query = CREATE_CALENDARPROPERTIES;
-    sqlite3_exec(d->mDatabase);
-
-    /* Create index on frequently used columns */
-    query = INDEX_CALENDAR;
-    sqlite3_exec(d->mDatabase);
-
-    query = INDEX_COMPONENT;
-    sqlite3_exec(d->mDatabase);
-
-    query = INDEX_COMPONENT_UID;
-    sqlite3_exec(d->mDatabase);
-
-    query = INDEX_COMPONENT_NOTEBOOK;
-    sqlite3_exec(d->mDatabase);
-
-    query = INDEX_RDATES;
-    sqlite3_exec(d->mDatabase);
-
-    query = INDEX_CUSTOMPROPERTIES;
-    sqlite3_exec(d->mDatabase);
-
-    query = INDEX_RECURSIVE;
-    sqlite3_exec(d->mDatabase);
-
-    query = INDEX_ALARM;
-    sqlite3_exec(d->mDatabase);
-
-    query = INDEX_ATTENDEE;
-    sqlite3_exec(d->mDatabase);
-
-    query = INDEX_ATTACHMENTS;
-    sqlite3_exec(d->mDatabase);
-
-    query = INDEX_CALENDARPROPERTIES;
-    sqlite3_exec(d->mDatabase);
+    if (d->mReadOnly) {
+        // Tables are created and upgraded by the writers.
+        query = "PRAGMA query_only = ON";
+        sqlite3_exec(d->mDatabase);
+    } else if (!d->createTables()) {
+        goto error;
+    }
 
     query = "PRAGMA foreign_keys = ON";
     sqlite3_exec(d->mDatabase);
 
-    if (!d->mChanged.open(QIODevice::Append)) {
+    // Readers do not block writers, nor are blocked by them, see
+    // loadNotebooksIncidences().
+    if (!d->mReadOnly && !d->writeAheadLog("PRAGMA journal_mode = WAL")) {
+        qCWarning(lcMkcal) << "cannot use write ahead log on" << d->mDatabaseName;
+    }
+
+    // Read-only storages are only notified of changes.
+    if (!d->mReadOnly && !d->mChanged.open(QIODevice::Append)) {
         qCWarning(lcMkcal) << "cannot open changed file for" << d->mDatabaseName;
         goto error;
     }
@@ -277,7 +390,7 @@ bool SqliteStorage::open()
         goto error;
     }
 
-    if (!d->mSem.release()) {
+    if (!d->unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << d->mDatabaseName << "error" << d->mSem.errorString();
         goto error;
     }
@@ -293,14 +406,14 @@ bool SqliteStorage::open()
     }
 
     list = notebooks();
-    if (list.isEmpty()) {
+    if (list.isEmpty() && !d->mReadOnly) {
         initializeDatabase();
     }
 
     return true;
 
 error:
-    if (!d->mSem.release()) {
+    if (!d->unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << d->mDatabaseName << "error" << d->mSem.errorString();
     }
     close();
@@ -429,6 +542,11 @@ bool SqliteStorage::load(const QDate &date)
 }
 
 bool SqliteStorage::load(const QDate &start, const QDate &end)
+{
+    return load(start, end, FullIncidences);
+}
+
+bool SqliteStorage::load(const QDate &start, const QDate &end, LoadProjection projection)
 {
     if (!d->mIsOpened) {
         return false;
@@ -438,10 +556,15 @@ bool SqliteStorage::load(const QDate &start, const QDate &end)
     int count = -1;
     QDateTime loadStart;
     QDateTime loadEnd;
+    // Only query the gaps between the ranges already loaded.
+    const QVector<QPair<QDateTime, QDateTime>> ranges = getLoadRanges(start, end);
 
     d->mIsLoading = true;
 
-    if (getLoadDates(start, end, loadStart, loadEnd)) {
+    if (!ranges.isEmpty()) {
+        count = 0;
+    }
+    for (const QPair<QDateTime, QDateTime> &range : ranges) {
         const char *query1 = NULL;
         int qsize1 = 0;
 
@@ -450,6 +573,10 @@ bool SqliteStorage::load(const QDate &start, const QDate &end)
         int index = 1;
         qint64 secsStart;
         qint64 secsEnd;
+        int rangeCount;
+
+        loadStart = range.first;
+        loadEnd = range.second;
 
         // Incidences to insert
         if (loadStart.isValid() && loadEnd.isValid()) {
@@ -477,22 +604,29 @@ bool SqliteStorage::load(const QDate &start, const QDate &end)
             qsize1 = sizeof(SELECT_COMPONENTS_ALL);
             sqlite3_prepare_v2(d->mDatabase, query1, qsize1, &stmt1, &tail1);
         }
-        count = d->loadIncidences(stmt1);
+        rangeCount = d->loadIncidences(stmt1, -1, NULL, false, false,
+                                       projection == HeaderOnly, NULL,
+                                       d->mAttachmentReferences);
+        if (rangeCount < 0) {
+            count = -1;
+            break;
+        }
+        count += rangeCount;
 
-        if (count > 0) {
-            if (loadStart.isValid() && loadEnd.isValid()) {
-                setLoadDates(loadStart.date(), loadEnd.date());
-            } else if (loadStart.isValid()) {
-                setLoadDates(loadStart.date(), QDate(9999, 12, 31));     // 9999-12-31
-            } else if (loadEnd.isValid()) {
-                setLoadDates(QDate(1, 1, 1), loadEnd.date());     // 0001-01-01
-            }
+        // Empty ranges are loaded as well, they are not queried again.
+        // Header only ranges are, to complete their incidences.
+        if (projection == FullIncidences) {
+            setLoadDates(loadStart.date(), loadEnd.date());
         }
     }
-error:
     d->mIsLoading = false;
 
     return count >= 0;
+
+error:
+    d->mIsLoading = false;
+
+    return false;
 }
 
 bool SqliteStorage::loadNotebookIncidences(const QString &notebookUid)
@@ -529,6 +663,95 @@ error:
     return count >= 0;
 }
 
+bool SqliteStorage::loadNotebooksIncidences(const QStringList &notebookUids)
+{
+    if (!d->mIsOpened) {
+        return false;
+    }
+
+    // There is nothing to run concurrently with a single notebook.
+    if (notebookUids.count() < 2) {
+        return ExtendedStorage::loadNotebooksIncidences(notebookUids);
+    }
+
+    return d->loadNotebooks(notebookUids, QDateTime(), QDateTime());
+}
+
+bool SqliteStorage::loadNotebooksIncidences(const QStringList &notebookUids,
+                                            const QDate &start, const QDate &end)
+{
+    if (!d->mIsOpened) {
+        return false;
+    }
+
+    QDateTime loadStart;
+    QDateTime loadEnd;
+    if (start.isValid()) {
+        loadStart = QDateTime(start, QTime(0, 0), calendar()->timeZone());
+    }
+    if (end.isValid()) {
+        loadEnd = QDateTime(end, QTime(0, 0), calendar()->timeZone());
+    }
+
+    return d->loadNotebooks(notebookUids, loadStart, loadEnd);
+}
+
+bool SqliteStorage::beginRead()
+{
+    int rv = 0;
+    char *errmsg = NULL;
+    const char *query = BEGIN_READ_TRANSACTION;
+
+    if (!d->mIsOpened || !d->isStorageThread()) {
+        return false;
+    }
+
+    if (d->mReadSession > 0) {
+        d->mReadSession += 1;
+        return true;
+    }
+
+    // The session does not hold the inter-process lock, its snapshot
+    // is enough for consistency, but without the write ahead log it
+    // keeps writers out until endRead().
+    if (!d->writeAheadLog("PRAGMA journal_mode")) {
+        qCWarning(lcMkcal) << "read session on" << d->mDatabaseName
+                           << "without write ahead log, writers wait until its end";
+    }
+
+    sqlite3_exec(d->mDatabase);
+    d->mReadSession = 1;
+
+    return true;
+
+error:
+    return false;
+}
+
+bool SqliteStorage::endRead()
+{
+    int rv = 0;
+    char *errmsg = NULL;
+    const char *query = COMMIT_TRANSACTION;
+
+    if (d->mReadSession <= 0 || !d->isStorageThread()) {
+        return false;
+    }
+
+    d->mReadSession -= 1;
+    if (d->mReadSession > 0) {
+        return true;
+    }
+
+    sqlite3_exec(d->mDatabase);
+
+    return true;
+
+error:
+    (sqlite3_exec)(d->mDatabase, ROLLBACK_TRANSACTION, NULL, 0, NULL);
+    return false;
+}
+
 bool SqliteStorage::loadIncidenceInstance(const QString &instanceIdentifier)
 {
     QString uid;
@@ -743,7 +966,7 @@ int SqliteStorage::loadUncompletedTodos()
         return -1;
     }
 
-    if (isUncompletedTodosLoaded()) {
+    if (isLoaded(QStringLiteral("uncompletedTodos"))) {
         return 0;
     }
 
@@ -764,7 +987,9 @@ int SqliteStorage::loadUncompletedTodos()
 
     count = d->loadIncidences(stmt1);
 
-    setIsUncompletedTodosLoaded(count >= 0);
+    if (count >= 0) {
+        setLoaded(QStringLiteral("uncompletedTodos"));
+    }
 
 error:
     d->mIsLoading = false;
@@ -778,14 +1003,10 @@ int SqliteStorage::loadCompletedTodos(bool hasDate, int limit, QDateTime *last)
         return -1;
     }
 
-    if (hasDate) {
-        if (isCompletedTodosDateLoaded()) {
-            return 0;
-        }
-    } else {
-        if (isCompletedTodosCreatedLoaded()) {
-            return 0;
-        }
+    const QString key = hasDate ? QStringLiteral("completedTodos/date")
+        : QStringLiteral("completedTodos/created");
+    if (isLoaded(key, *last)) {
+        return 0;
     }
     int rv = 0;
     int count = 0;
@@ -799,8 +1020,11 @@ int SqliteStorage::loadCompletedTodos(bool hasDate, int limit, QDateTime *last)
     int index = 1;
     qint64 secsStart;
 
-    if (last->isValid()) {
-        secsStart = toOriginTime(*last);
+    // Skip the rows already loaded by the previous pages.
+    const QDateTime start = *last;
+    const QDateTime from = loadedCursor(key, start);
+    if (from.isValid()) {
+        secsStart = toOriginTime(from);
     } else {
         secsStart = LLONG_MAX; // largest time
     }
@@ -817,12 +1041,8 @@ int SqliteStorage::loadCompletedTodos(bool hasDate, int limit, QDateTime *last)
 
     count = d->loadIncidences(stmt1, limit, last, hasDate);
 
-    if (count >= 0 && count < limit) {
-        if (hasDate) {
-            setIsCompletedTodosDateLoaded(true);
-        } else {
-            setIsCompletedTodosCreatedLoaded(true);
-        }
+    if (count >= 0) {
+        setLoadedPage(key, start, *last, limit <= 0 || count < limit);
     }
 
 error:
@@ -835,8 +1055,10 @@ int SqliteStorage::loadJournals(int limit, QDateTime *last)
     if (!d->mIsOpened || !last)
         return -1;
 
-    if (isJournalsLoaded())
+    const QString key = QStringLiteral("journals");
+    if (isLoaded(key, *last)) {
         return 0;
+    }
 
     int rv = 0;
     int count = 0;
@@ -850,10 +1072,14 @@ int SqliteStorage::loadJournals(int limit, QDateTime *last)
     int index = 1;
     qint64 secsStart;
 
-    if (last->isValid())
-        secsStart = toOriginTime(*last);
-    else
+    // Skip the rows already loaded by the previous pages.
+    const QDateTime start = *last;
+    const QDateTime from = loadedCursor(key, start);
+    if (from.isValid()) {
+        secsStart = toOriginTime(from);
+    } else {
         secsStart = LLONG_MAX; // largest time
+    }
 
     query1 = SELECT_COMPONENTS_BY_JOURNAL_DATE;
     qsize1 = sizeof(SELECT_COMPONENTS_BY_JOURNAL_DATE);
@@ -863,8 +1089,8 @@ int SqliteStorage::loadJournals(int limit, QDateTime *last)
 
     count = d->loadIncidences(stmt1, limit, last, true);
 
-    if (count >= 0 && count < limit) {
-        setIsJournalsLoaded(true);
+    if (count >= 0) {
+        setLoadedPage(key, start, *last, limit <= 0 || count < limit);
     }
 error:
     d->mIsLoading = false;
@@ -878,14 +1104,10 @@ int SqliteStorage::loadIncidences(bool hasDate, int limit, QDateTime *last)
         return -1;
     }
 
-    if (hasDate) {
-        if (isDateLoaded()) {
-            return 0;
-        }
-    } else {
-        if (isCreatedLoaded()) {
-            return 0;
-        }
+    const QString key = hasDate ? QStringLiteral("incidences/date")
+        : QStringLiteral("incidences/created");
+    if (isLoaded(key, *last)) {
+        return 0;
     }
     int rv = 0;
     int count = 0;
@@ -899,8 +1121,11 @@ int SqliteStorage::loadIncidences(bool hasDate, int limit, QDateTime *last)
     int index = 1;
     qint64 secsStart;
 
-    if (last->isValid()) {
-        secsStart = toOriginTime(*last);
+    // Skip the rows already loaded by the previous pages.
+    const QDateTime start = *last;
+    const QDateTime from = loadedCursor(key, start);
+    if (from.isValid()) {
+        secsStart = toOriginTime(from);
     } else {
         secsStart = LLONG_MAX; // largest time
     }
@@ -916,12 +1141,8 @@ int SqliteStorage::loadIncidences(bool hasDate, int limit, QDateTime *last)
 
     count = d->loadIncidences(stmt1, limit, last, hasDate);
 
-    if (count >= 0 && count < limit) {
-        if (hasDate) {
-            setIsDateLoaded(true);
-        } else {
-            setIsCreatedLoaded(true);
-        }
+    if (count >= 0) {
+        setLoadedPage(key, start, *last, limit <= 0 || count < limit);
     }
 
 error:
@@ -937,7 +1158,8 @@ int SqliteStorage::loadFutureIncidences(int limit, QDateTime *last)
         return -1;
     }
 
-    if (isFutureDateLoaded()) {
+    const QString key = QStringLiteral("futureIncidences");
+    if (isLoaded(key, *last, true)) {
         return 0;
     }
     int rv = 0;
@@ -952,8 +1174,11 @@ int SqliteStorage::loadFutureIncidences(int limit, QDateTime *last)
     int index = 1;
     qint64 secsStart;
 
-    if (last->isValid()) {
-        secsStart = toOriginTime(*last);
+    // Skip the rows already loaded by the previous pages.
+    const QDateTime start = *last;
+    const QDateTime from = loadedCursor(key, start, true);
+    if (from.isValid()) {
+        secsStart = toOriginTime(from);
     } else {
         secsStart = LLONG_MAX; // largest time
     }
@@ -965,8 +1190,8 @@ int SqliteStorage::loadFutureIncidences(int limit, QDateTime *last)
 
     count = d->loadIncidences(stmt1, limit, last, true, true);
 
-    if (count >= 0 && count < limit) {
-        setIsFutureDateLoaded(true);
+    if (count >= 0) {
+        setLoadedPage(key, start, *last, limit <= 0 || count < limit, true);
     }
 
 error:
@@ -981,14 +1206,10 @@ int SqliteStorage::loadGeoIncidences(bool hasDate, int limit, QDateTime *last)
         return -1;
     }
 
-    if (hasDate) {
-        if (isGeoDateLoaded()) {
-            return 0;
-        }
-    } else {
-        if (isGeoCreatedLoaded()) {
-            return 0;
-        }
+    const QString key = hasDate ? QStringLiteral("geoIncidences/date")
+        : QStringLiteral("geoIncidences/created");
+    if (isLoaded(key, *last)) {
+        return 0;
     }
     int rv = 0;
     int count = 0;
@@ -1002,8 +1223,11 @@ int SqliteStorage::loadGeoIncidences(bool hasDate, int limit, QDateTime *last)
     int index = 1;
     qint64 secsStart;
 
-    if (last->isValid()) {
-        secsStart = toOriginTime(*last);
+    // Skip the rows already loaded by the previous pages.
+    const QDateTime start = *last;
+    const QDateTime from = loadedCursor(key, start);
+    if (from.isValid()) {
+        secsStart = toOriginTime(from);
     } else {
         secsStart = LLONG_MAX; // largest time
     }
@@ -1019,12 +1243,8 @@ int SqliteStorage::loadGeoIncidences(bool hasDate, int limit, QDateTime *last)
 
     count = d->loadIncidences(stmt1, limit, last, hasDate);
 
-    if (count >= 0 && count < limit) {
-        if (hasDate) {
-            setIsGeoDateLoaded(true);
-        } else {
-            setIsGeoCreatedLoaded(true);
-        }
+    if (count >= 0) {
+        setLoadedPage(key, start, *last, limit <= 0 || count < limit);
     }
 
 error:
@@ -1039,7 +1259,7 @@ int SqliteStorage::loadUnreadInvitationIncidences()
         return false;
     }
 
-    if (isUnreadIncidencesLoaded()) {
+    if (isLoaded(QStringLiteral("unreadInvitations"))) {
         return 0;
     }
 
@@ -1060,7 +1280,9 @@ int SqliteStorage::loadUnreadInvitationIncidences()
 
     count = d->loadIncidences(stmt1);
 
-    setIsUnreadIncidencesLoaded(count >= 0);
+    if (count >= 0) {
+        setLoaded(QStringLiteral("unreadInvitations"));
+    }
 
 error:
     d->mIsLoading = false;
@@ -1074,7 +1296,8 @@ int SqliteStorage::loadOldInvitationIncidences(int limit, QDateTime *last)
         return -1;
     }
 
-    if (isInvitationIncidencesLoaded()) {
+    const QString key = QStringLiteral("oldInvitations");
+    if (isLoaded(key, *last)) {
         return 0;
     }
 
@@ -1092,8 +1315,11 @@ int SqliteStorage::loadOldInvitationIncidences(int limit, QDateTime *last)
 
     query1 = SELECT_COMPONENTS_BY_INVITATION_AND_CREATED;
     qsize1 = sizeof(SELECT_COMPONENTS_BY_INVITATION_AND_CREATED);
-    if (last->isValid()) {
-        secsStart = toOriginTime(*last);
+    // Skip the rows already loaded by the previous pages.
+    const QDateTime start = *last;
+    const QDateTime from = loadedCursor(key, start);
+    if (from.isValid()) {
+        secsStart = toOriginTime(from);
     } else {
         secsStart = LLONG_MAX; // largest time
     }
@@ -1102,8 +1328,8 @@ int SqliteStorage::loadOldInvitationIncidences(int limit, QDateTime *last)
 
     count = d->loadIncidences(stmt1, limit, last, false);
 
-    if (count >= 0 && count < limit) {
-        setIsInvitationIncidencesLoaded(true);
+    if (count >= 0) {
+        setLoadedPage(key, start, *last, limit <= 0 || count < limit);
     }
 
 error:
@@ -1121,7 +1347,8 @@ Person::List SqliteStorage::loadContacts()
     }
 
     int rv = 0;
-    d->mIsLoading = true;
+    sqlite3 *database = NULL;
+    SqliteFormat *format = NULL;
 
     const char *query1 = NULL;
     int qsize1 = 0;
@@ -1129,16 +1356,18 @@ Person::List SqliteStorage::loadContacts()
     sqlite3_stmt *stmt1 = NULL;
     const char *tail1 = NULL;
 
+    if (!d->threadConnection(&database, &format)) {
+        return list;
+    }
+
     query1 = SELECT_ATTENDEE_AND_COUNT;
     qsize1 = sizeof(SELECT_ATTENDEE_AND_COUNT);
 
-    sqlite3_prepare_v2(d->mDatabase, query1, qsize1, &stmt1, &tail1);
+    sqlite3_prepare_v2(database, query1, qsize1, &stmt1, &tail1);
 
-    list = d->mFormat->selectContacts(stmt1);
+    list = format->selectContacts(stmt1);
 
 error:
-    d->mIsLoading = false;
-
     return list;
 }
 
@@ -1187,16 +1416,246 @@ error:
     return count;
 }
 
-bool SqliteStorage::notifyOpened(const Incidence::Ptr &incidence)
-{
-    Q_UNUSED(incidence);
-    return false;
-}
+//@cond PRIVATE
+// Columns of the continuation tokens of the keyset paged loads.
+enum PageKey {
+    PageKeyDateStart,
+    PageKeyDateEndDue,
+    PageKeyDateCreated,
+    PageKeyComponentId,
+    PageKeyCount
+};
 
-static bool isContaining(const QMultiHash<QString, Incidence::Ptr> &list, const Incidence::Ptr &incidence)
+static bool pageKey(const QByteArray &token, qint64 *key)
 {
-    QMultiHash<QString, Incidence::Ptr>::ConstIterator it = list.find(incidence->uid());
-    for (; it != list.constEnd(); ++it) {
+    if (token.isEmpty()) {
+        // Before the first row.
+        for (int i = 0; i < PageKeyCount; i++) {
+            key[i] = LLONG_MAX;
+        }
+        return true;
+    }
+
+    const QList<QByteArray> values = token.split(',');
+    if (values.count() != PageKeyCount) {
+        qCWarning(lcMkcal) << "invalid continuation token" << token;
+        return false;
+    }
+    for (int i = 0; i < PageKeyCount; i++) {
+        bool ok;
+        key[i] = values[i].toLongLong(&ok);
+        if (!ok) {
+            qCWarning(lcMkcal) << "invalid continuation token" << token;
+            return false;
+        }
+    }
+    return true;
+}
+//@endcond
+
+int SqliteStorage::loadIncidences(bool hasDate, int limit, QByteArray *token)
+{
+    qint64 key[PageKeyCount];
+    if (!d->mIsOpened || !token || limit <= 0 || !pageKey(*token, key)) {
+        return -1;
+    }
+
+    int rv = 0;
+    int count = -1;
+    d->mIsLoading = true;
+
+    const char *query1 = NULL;
+    int qsize1 = 0;
+
+    sqlite3_stmt *stmt1 = NULL;
+    const char *tail1 = NULL;
+    int index = 1;
+
+    if (hasDate) {
+        query1 = SELECT_COMPONENTS_BY_DATE_KEYSET;
+        qsize1 = sizeof(SELECT_COMPONENTS_BY_DATE_KEYSET);
+        sqlite3_prepare_v2(d->mDatabase, query1, qsize1, &stmt1, &tail1);
+        sqlite3_bind_int64(stmt1, index, key[PageKeyDateEndDue]);
+    } else {
+        query1 = SELECT_COMPONENTS_BY_CREATED_KEYSET;
+        qsize1 = sizeof(SELECT_COMPONENTS_BY_CREATED_KEYSET);
+        sqlite3_prepare_v2(d->mDatabase, query1, qsize1, &stmt1, &tail1);
+    }
+    sqlite3_bind_int64(stmt1, index, key[PageKeyDateCreated]);
+    sqlite3_bind_int64(stmt1, index, key[PageKeyComponentId]);
+    sqlite3_bind_int(stmt1, index, limit);
+
+    count = d->loadIncidences(stmt1, -1, NULL, hasDate, false, false, token);
+
+error:
+    d->mIsLoading = false;
+
+    return count;
+}
+
+int SqliteStorage::loadCompletedTodos(bool hasDate, int limit, QByteArray *token)
+{
+    qint64 key[PageKeyCount];
+    if (!d->mIsOpened || !token || limit <= 0 || !pageKey(*token, key)) {
+        return -1;
+    }
+
+    int rv = 0;
+    int count = -1;
+    d->mIsLoading = true;
+
+    const char *query1 = NULL;
+    int qsize1 = 0;
+
+    sqlite3_stmt *stmt1 = NULL;
+    const char *tail1 = NULL;
+    int index = 1;
+
+    if (hasDate) {
+        query1 = SELECT_COMPONENTS_BY_COMPLETED_TODOS_AND_DATE_KEYSET;
+        qsize1 = sizeof(SELECT_COMPONENTS_BY_COMPLETED_TODOS_AND_DATE_KEYSET);
+        sqlite3_prepare_v2(d->mDatabase, query1, qsize1, &stmt1, &tail1);
+        sqlite3_bind_int64(stmt1, index, key[PageKeyDateEndDue]);
+    } else {
+        query1 = SELECT_COMPONENTS_BY_COMPLETED_TODOS_AND_CREATED_KEYSET;
+        qsize1 = sizeof(SELECT_COMPONENTS_BY_COMPLETED_TODOS_AND_CREATED_KEYSET);
+        sqlite3_prepare_v2(d->mDatabase, query1, qsize1, &stmt1, &tail1);
+    }
+    sqlite3_bind_int64(stmt1, index, key[PageKeyDateCreated]);
+    sqlite3_bind_int64(stmt1, index, key[PageKeyComponentId]);
+    sqlite3_bind_int(stmt1, index, limit);
+
+    count = d->loadIncidences(stmt1, -1, NULL, hasDate, false, false, token);
+
+error:
+    d->mIsLoading = false;
+
+    return count;
+}
+
+int SqliteStorage::loadJournals(int limit, QByteArray *token)
+{
+    qint64 key[PageKeyCount];
+    if (!d->mIsOpened || !token || limit <= 0 || !pageKey(*token, key)) {
+        return -1;
+    }
+
+    int rv = 0;
+    int count = -1;
+    d->mIsLoading = true;
+
+    const char *query1 = NULL;
+    int qsize1 = 0;
+
+    sqlite3_stmt *stmt1 = NULL;
+    const char *tail1 = NULL;
+    int index = 1;
+
+    query1 = SELECT_COMPONENTS_BY_JOURNAL_DATE_KEYSET;
+    qsize1 = sizeof(SELECT_COMPONENTS_BY_JOURNAL_DATE_KEYSET);
+    sqlite3_prepare_v2(d->mDatabase, query1, qsize1, &stmt1, &tail1);
+    sqlite3_bind_int64(stmt1, index, key[PageKeyDateStart]);
+    sqlite3_bind_int64(stmt1, index, key[PageKeyDateCreated]);
+    sqlite3_bind_int64(stmt1, index, key[PageKeyComponentId]);
+    sqlite3_bind_int(stmt1, index, limit);
+
+    count = d->loadIncidences(stmt1, -1, NULL, true, false, false, token);
+
+error:
+    d->mIsLoading = false;
+
+    return count;
+}
+
+int SqliteStorage::loadOldInvitationIncidences(int limit, QByteArray *token)
+{
+    qint64 key[PageKeyCount];
+    if (!d->mIsOpened || !token || limit <= 0 || !pageKey(*token, key)) {
+        return -1;
+    }
+
+    int rv = 0;
+    int count = -1;
+    d->mIsLoading = true;
+
+    const char *query1 = NULL;
+    int qsize1 = 0;
+
+    sqlite3_stmt *stmt1 = NULL;
+    const char *tail1 = NULL;
+    int index = 1;
+
+    query1 = SELECT_COMPONENTS_BY_INVITATION_AND_CREATED_KEYSET;
+    qsize1 = sizeof(SELECT_COMPONENTS_BY_INVITATION_AND_CREATED_KEYSET);
+    sqlite3_prepare_v2(d->mDatabase, query1, qsize1, &stmt1, &tail1);
+    sqlite3_bind_int64(stmt1, index, key[PageKeyDateCreated]);
+    sqlite3_bind_int64(stmt1, index, key[PageKeyComponentId]);
+    sqlite3_bind_int(stmt1, index, limit);
+
+    count = d->loadIncidences(stmt1, -1, NULL, false, false, false, token);
+
+error:
+    d->mIsLoading = false;
+
+    return count;
+}
+
+int SqliteStorage::loadContactIncidences(const Person &person, int limit, QByteArray *token)
+{
+    qint64 key[PageKeyCount];
+    if (!d->mIsOpened || !token || limit <= 0 || !pageKey(*token, key)) {
+        return -1;
+    }
+
+    int rv = 0;
+    int count = -1;
+    d->mIsLoading = true;
+
+    const char *query1 = NULL;
+    int qsize1 = 0;
+
+    sqlite3_stmt *stmt1 = NULL;
+    const char *tail1 = NULL;
+    int index = 1;
+    QByteArray email;
+
+    if (!person.isEmpty()) {
+        email = person.email().toUtf8();
+        query1 = SELECT_COMPONENTS_BY_ATTENDEE_EMAIL_AND_CREATED_KEYSET;
+        qsize1 = sizeof(SELECT_COMPONENTS_BY_ATTENDEE_EMAIL_AND_CREATED_KEYSET);
+        sqlite3_prepare_v2(d->mDatabase, query1, qsize1, &stmt1, &tail1);
+        sqlite3_bind_text(stmt1, index, email, email.length(), SQLITE_STATIC);
+    } else {
+        query1 = SELECT_COMPONENTS_BY_ATTENDEE_AND_CREATED_KEYSET;
+        qsize1 = sizeof(SELECT_COMPONENTS_BY_ATTENDEE_AND_CREATED_KEYSET);
+        sqlite3_prepare_v2(d->mDatabase, query1, qsize1, &stmt1, &tail1);
+    }
+    sqlite3_bind_int64(stmt1, index, key[PageKeyDateCreated]);
+    sqlite3_bind_int64(stmt1, index, key[PageKeyComponentId]);
+    sqlite3_bind_int(stmt1, index, limit);
+
+    count = d->loadIncidences(stmt1, -1, NULL, false, false, false, token);
+
+error:
+    d->mIsLoading = false;
+
+    return count;
+}
+
+bool SqliteStorage::notifyOpened(const Incidence::Ptr &incidence)
+{
+    if (!d->mIsOpened || !incidence
+        || !d->mPartialIncidences.contains(incidence->uid(), incidence)) {
+        return false;
+    }
+
+    return d->loadIncidenceDetails(incidence);
+}
+
+static bool isContaining(const QMultiHash<QString, Incidence::Ptr> &list, const Incidence::Ptr &incidence)
+{
+    QMultiHash<QString, Incidence::Ptr>::ConstIterator it = list.find(incidence->uid());
+    for (; it != list.constEnd(); ++it) {
         if ((*it)->recurrenceId() == incidence->recurrenceId()) {
             return true;
         }
@@ -1204,7 +1663,8 @@ static bool isContaining(const QMultiHash<QString, Incidence::Ptr> &list, const
     return false;
 }
 
-bool SqliteStorage::Private::addIncidence(const Incidence::Ptr &incidence, const QString &notebookUid)
+bool SqliteStorage::Private::addIncidence(const Incidence::Ptr &incidence, const QString &notebookUid,
+                                          bool headerOnly)
 {
     bool added = true;
     bool hasNotebook = mCalendar->hasValidNotebook(notebookUid);
@@ -1222,7 +1682,8 @@ bool SqliteStorage::Private::addIncidence(const Incidence::Ptr &incidence, const
     } else {
         Incidence::Ptr old(mCalendar->incidence(incidence->uid(), incidence->recurrenceId()));
         if (old) {
-            if (incidence->revision() > old->revision()) {
+            if (incidence->revision() > old->revision()
+                || (!headerOnly && mPartialIncidences.contains(old->uid(), old))) {
                 mCalendar->deleteIncidence(old);   // move old to deleted
                 // and replace it with the new one.
             } else {
@@ -1238,13 +1699,51 @@ bool SqliteStorage::Private::addIncidence(const Incidence::Ptr &incidence, const
     return added;
 }
 
+// Number of components decoded together by a worker when loading.
+static const int DECODING_BATCH = 64;
+
+typedef QVector<QPair<Incidence::Ptr, QString> > DecodedIncidences;
+
+static DecodedIncidences decodeComponents(const SqliteFormat *format,
+                                          const QVector<SqliteComponentRows> &batch)
+{
+    DecodedIncidences incidences;
+    incidences.reserve(batch.count());
+    for (const SqliteComponentRows &rows : batch) {
+        QString notebookUid;
+        const Incidence::Ptr incidence = format->decodeComponentRows(rows, &notebookUid);
+        if (incidence) {
+            incidences.append(qMakePair(incidence, notebookUid));
+        }
+    }
+    return incidences;
+}
+
+static QDateTime loadDate(const Incidence::Ptr &incidence, bool useDate, bool ignoreEnd)
+{
+    const QDateTime endDateTime(incidence->dateTime(Incidence::RoleEnd));
+    if (useDate && endDateTime.isValid()
+        && (!ignoreEnd || incidence->type() != Incidence::TypeEvent)) {
+        return endDateTime;
+    } else if (useDate && incidence->dtStart().isValid()) {
+        return incidence->dtStart();
+    } else {
+        return incidence->created();
+    }
+}
+
 int SqliteStorage::Private::loadIncidences(sqlite3_stmt *stmt1,
                                            int limit, QDateTime *last,
                                            bool useDate,
-                                           bool ignoreEnd)
+                                           bool ignoreEnd,
+                                           bool headerOnly,
+                                           QByteArray *token,
+                                           bool attachmentReferences)
 {
     int rv = 0;
     int count = 0;
+    int rows = 0;
+    QByteArray key;
     sqlite3_stmt *stmt2 = NULL;
     sqlite3_stmt *stmt3 = NULL;
     sqlite3_stmt *stmt4 = NULL;
@@ -1254,6 +1753,8 @@ int SqliteStorage::Private::loadIncidences(sqlite3_stmt *stmt1,
     Incidence::Ptr incidence;
     QDateTime previous, date;
     QString notebookUid;
+    QVector<SqliteComponentRows> batch;
+    QList<QFuture<DecodedIncidences> > decoding;
 
     const char *query2 = SELECT_CUSTOMPROPERTIES_BY_ID;
     int qsize2 = sizeof(SELECT_CUSTOMPROPERTIES_BY_ID);
@@ -1272,57 +1773,98 @@ int SqliteStorage::Private::loadIncidences(sqlite3_stmt *stmt1,
 
     const char *query7 = SELECT_ATTACHMENTS_BY_ID;
     int qsize7 = sizeof(SELECT_ATTACHMENTS_BY_ID);
+    if (attachmentReferences) {
+        query7 = SELECT_ATTACHMENTS_REFERENCES_BY_ID;
+        qsize7 = sizeof(SELECT_ATTACHMENTS_REFERENCES_BY_ID);
+    }
 
-    if (!mSem.acquire()) {
+    if (!lock()) {
         qCWarning(lcMkcal) << "cannot lock" << mDatabaseName << "error" << mSem.errorString();
         return false;
     }
 
-    sqlite3_prepare_v2(mDatabase, query2, qsize2, &stmt2, nullptr);
-    sqlite3_prepare_v2(mDatabase, query3, qsize3, &stmt3, nullptr);
-    sqlite3_prepare_v2(mDatabase, query4, qsize4, &stmt4, nullptr);
+    // Without statements for the children tables that are not
+    // needed to display an incidence, selectComponents() skips them.
+    if (!headerOnly) {
+        sqlite3_prepare_v2(mDatabase, query2, qsize2, &stmt2, nullptr);
+        sqlite3_prepare_v2(mDatabase, query3, qsize3, &stmt3, nullptr);
+        sqlite3_prepare_v2(mDatabase, query4, qsize4, &stmt4, nullptr);
+    }
     sqlite3_prepare_v2(mDatabase, query5, qsize5, &stmt5, nullptr);
     sqlite3_prepare_v2(mDatabase, query6, qsize6, &stmt6, nullptr);
-    sqlite3_prepare_v2(mDatabase, query7, qsize7, &stmt7, nullptr);
+    if (!headerOnly) {
+        sqlite3_prepare_v2(mDatabase, query7, qsize7, &stmt7, nullptr);
+    }
 
-    while ((incidence =
-                mFormat->selectComponents(stmt1, stmt2, stmt3, stmt4, stmt5, stmt6, stmt7, notebookUid))) {
-        sqlite3_reset(stmt2);
-        sqlite3_reset(stmt3);
-        sqlite3_reset(stmt4);
-        sqlite3_reset(stmt5);
-        sqlite3_reset(stmt6);
-        sqlite3_reset(stmt7);
+    if (limit > 0) {
+        // Pages end on a date change, incidences are decoded one by one
+        // to find it.
+        while ((incidence =
+                    mFormat->selectComponents(stmt1, stmt2, stmt3, stmt4, stmt5, stmt6, stmt7, notebookUid))) {
+            sqlite3_reset(stmt2);
+            sqlite3_reset(stmt3);
+            sqlite3_reset(stmt4);
+            sqlite3_reset(stmt5);
+            sqlite3_reset(stmt6);
+            sqlite3_reset(stmt7);
 
-        const QDateTime endDateTime(incidence->dateTime(Incidence::RoleEnd));
-        if (useDate && endDateTime.isValid()
-            && (!ignoreEnd || incidence->type() != Incidence::TypeEvent)) {
-            date = endDateTime;
-        } else if (useDate && incidence->dtStart().isValid()) {
-            date = incidence->dtStart();
-        } else {
-            date = incidence->created();
+            date = loadDate(incidence, useDate, ignoreEnd);
+            if (previous != date) {
+                if (!previous.isValid() || count <= limit) {
+                    // If we don't have previous date, or we're within limits,
+                    // we can just set the 'previous' and move onward
+                    previous = date;
+                } else {
+                    // Move back to old date
+                    date = previous;
+                    break;
+                }
+            }
+            if (addIncidence(incidence, notebookUid, headerOnly)) {
+                // qCDebug(lcMkcal) << "updating incidence" << incidence->uid()
+                //                  << incidence->dtStart() << date
+                //                  << "in calendar";
+                if (headerOnly) {
+                    mPartialIncidences.insert(incidence->uid(), incidence);
+                }
+                count += 1;
+            }
         }
-        if (previous != date) {
-            if (!previous.isValid() || limit <= 0 || count <= limit) {
-                // If we don't have previous date, or we're within limits,
-                // we can just set the 'previous' and move onward
-                previous = date;
-            } else {
-                // Move back to old date
-                date = previous;
-                break;
+    } else {
+        // All rows are loaded: they are only copied while the database
+        // is locked, and decoded by batches in worker threads meanwhile.
+        SqliteComponentRows componentRows;
+        while (mFormat->readComponentRows(stmt1, stmt2, stmt3, stmt4, stmt5, stmt6, stmt7,
+                                          &componentRows)) {
+            sqlite3_reset(stmt2);
+            sqlite3_reset(stmt3);
+            sqlite3_reset(stmt4);
+            sqlite3_reset(stmt5);
+            sqlite3_reset(stmt6);
+            sqlite3_reset(stmt7);
+
+            if (token) {
+                const SqliteRow &row = componentRows.component;
+                key = QByteArray::number(row.toInt64(5)) + ','
+                    + QByteArray::number(row.toInt64(9)) + ','
+                    + QByteArray::number(row.toInt64(21)) + ','
+                    + QByteArray::number(row.toInt64(0));
+                rows += 1;
+            }
+
+            batch.append(componentRows);
+            if (batch.count() == DECODING_BATCH) {
+                decoding.append(QtConcurrent::run(decodeComponents, mFormat, batch));
+                batch.clear();
             }
         }
-        if (addIncidence(incidence, notebookUid)) {
-            // qCDebug(lcMkcal) << "updating incidence" << incidence->uid()
-            //                  << incidence->dtStart() << endDateTime
-            //                  << "in calendar";
-            count += 1;
+        if (!batch.isEmpty()) {
+            decoding.append(QtConcurrent::run(decodeComponents, mFormat, batch));
+            batch.clear();
         }
     }
-    if (last) {
-        *last = date;
+    if (token && !key.isEmpty()) {
+        *token = key;
     }
 
     sqlite3_finalize(stmt1);
@@ -1333,30 +1875,262 @@ int SqliteStorage::Private::loadIncidences(sqlite3_stmt *stmt1,
     sqlite3_finalize(stmt6);
     sqlite3_finalize(stmt7);
 
-    if (!mSem.release()) {
+    if (!unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << mDatabaseName << "error" << mSem.errorString();
     }
+
+    // Decoded batches are added in the order their rows were read.
+    for (QFuture<DecodedIncidences> &future : decoding) {
+        const DecodedIncidences incidences = future.result();
+        for (const QPair<Incidence::Ptr, QString> &decoded : incidences) {
+            date = loadDate(decoded.first, useDate, ignoreEnd);
+            if (addIncidence(decoded.first, decoded.second, headerOnly)) {
+                if (headerOnly) {
+                    mPartialIncidences.insert(decoded.first->uid(), decoded.first);
+                }
+                count += 1;
+            }
+        }
+    }
+    if (last) {
+        *last = date;
+    }
     mStorage->setFinished(false, "load completed");
 
-    return count;
+    return token ? rows : count;
 
 error:
-    if (!mSem.release()) {
+    if (!unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << mDatabaseName << "error" << mSem.errorString();
     }
+    for (QFuture<DecodedIncidences> &future : decoding) {
+        future.waitForFinished();
+    }
     mStorage->setFinished(true, "error loading incidences");
 
     return -1;
 }
+
+// A notebook read by a worker thread.
+struct NotebookLoad {
+    QString notebookUid;
+    QDateTime start;
+    QDateTime end;
+    bool success;
+    DecodedIncidences incidences;
+};
+
+// Reads and decodes the incidences of a notebook with its own read-only
+// connection. The process mutex is not taken, it would serialize the
+// workers, and the select statement reads from a single snapshot of the
+// database anyway.
+static NotebookLoad readNotebook(SqliteStorage *storage, const QString &databaseName,
+                                 NotebookLoad load)
+{
+    int rv = 0;
+    int index = 1;
+    sqlite3 *database = NULL;
+    SqliteFormat *format = NULL;
+    sqlite3_stmt *stmt1 = NULL;
+    sqlite3_stmt *stmt2 = NULL;
+    sqlite3_stmt *stmt3 = NULL;
+    sqlite3_stmt *stmt4 = NULL;
+    sqlite3_stmt *stmt5 = NULL;
+    sqlite3_stmt *stmt6 = NULL;
+    sqlite3_stmt *stmt7 = NULL;
+    const char *query1 = NULL;
+    int qsize1 = 0;
+    const QByteArray u(load.notebookUid.toUtf8());
+    SqliteComponentRows rows;
+
+    load.success = false;
+
+    rv = sqlite3_open_v2(databaseName.toUtf8(), &database,
+                         SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+    if (rv) {
+        qCWarning(lcMkcal) << "sqlite3_open_v2 error:" << rv << "on database" << databaseName;
+        goto error;
+    }
+    sqlite3_busy_timeout(database, 1500);
+
+    if (load.start.isValid() && load.end.isValid()) {
+        query1 = SELECT_COMPONENTS_BY_NOTEBOOKUID_AND_DATE_BOTH;
+        qsize1 = sizeof(SELECT_COMPONENTS_BY_NOTEBOOKUID_AND_DATE_BOTH);
+    } else if (load.start.isValid()) {
+        query1 = SELECT_COMPONENTS_BY_NOTEBOOKUID_AND_DATE_START;
+        qsize1 = sizeof(SELECT_COMPONENTS_BY_NOTEBOOKUID_AND_DATE_START);
+    } else if (load.end.isValid()) {
+        query1 = SELECT_COMPONENTS_BY_NOTEBOOKUID_AND_DATE_END;
+        qsize1 = sizeof(SELECT_COMPONENTS_BY_NOTEBOOKUID_AND_DATE_END);
+    } else {
+        query1 = SELECT_COMPONENTS_BY_NOTEBOOKUID;
+        qsize1 = sizeof(SELECT_COMPONENTS_BY_NOTEBOOKUID);
+    }
+    sqlite3_prepare_v2(database, query1, qsize1, &stmt1, nullptr);
+    sqlite3_bind_text(stmt1, index, u.constData(), u.length(), SQLITE_STATIC);
+    if (load.end.isValid()) {
+        sqlite3_bind_int64(stmt1, index, storage->toOriginTime(load.end));
+    }
+    if (load.start.isValid()) {
+        sqlite3_bind_int64(stmt1, index, storage->toOriginTime(load.start));
+    }
+
+    sqlite3_prepare_v2(database, SELECT_CUSTOMPROPERTIES_BY_ID,
+                       sizeof(SELECT_CUSTOMPROPERTIES_BY_ID), &stmt2, nullptr);
+    sqlite3_prepare_v2(database, SELECT_ATTENDEE_BY_ID,
+                       sizeof(SELECT_ATTENDEE_BY_ID), &stmt3, nullptr);
+    sqlite3_prepare_v2(database, SELECT_ALARM_BY_ID,
+                       sizeof(SELECT_ALARM_BY_ID), &stmt4, nullptr);
+    sqlite3_prepare_v2(database, SELECT_RECURSIVE_BY_ID,
+                       sizeof(SELECT_RECURSIVE_BY_ID), &stmt5, nullptr);
+    sqlite3_prepare_v2(database, SELECT_RDATES_BY_ID,
+                       sizeof(SELECT_RDATES_BY_ID), &stmt6, nullptr);
+    sqlite3_prepare_v2(database, SELECT_ATTACHMENTS_BY_ID,
+                       sizeof(SELECT_ATTACHMENTS_BY_ID), &stmt7, nullptr);
+
+    format = new SqliteFormat(storage, database);
+    while (format->readComponentRows(stmt1, stmt2, stmt3, stmt4, stmt5, stmt6, stmt7, &rows)) {
+        sqlite3_reset(stmt2);
+        sqlite3_reset(stmt3);
+        sqlite3_reset(stmt4);
+        sqlite3_reset(stmt5);
+        sqlite3_reset(stmt6);
+        sqlite3_reset(stmt7);
+
+        QString notebookUid;
+        const Incidence::Ptr incidence = format->decodeComponentRows(rows, &notebookUid);
+        if (incidence) {
+            load.incidences.append(qMakePair(incidence, notebookUid));
+        }
+    }
+    load.success = true;
+
+error:
+    sqlite3_finalize(stmt1);
+    sqlite3_finalize(stmt2);
+    sqlite3_finalize(stmt3);
+    sqlite3_finalize(stmt4);
+    sqlite3_finalize(stmt5);
+    sqlite3_finalize(stmt6);
+    sqlite3_finalize(stmt7);
+    delete format;
+    sqlite3_close(database);
+
+    return load;
+}
+
+bool SqliteStorage::Private::loadNotebooks(const QStringList &notebookUids,
+                                           const QDateTime &start, const QDateTime &end)
+{
+    bool success = true;
+    QList<QFuture<NotebookLoad> > loads;
+
+    for (const QString &notebookUid : notebookUids) {
+        if (notebookUid.isEmpty()) {
+            continue;
+        }
+        NotebookLoad load;
+        load.notebookUid = notebookUid;
+        load.start = start;
+        load.end = end;
+        load.success = false;
+        loads.append(QtConcurrent::run(readNotebook, mStorage, mDatabaseName, load));
+    }
+
+    // The calendar is only modified from this thread, notebooks are
+    // added in the order they were asked for.
+    mIsLoading = true;
+    for (QFuture<NotebookLoad> &future : loads) {
+        const NotebookLoad load = future.result();
+        if (!load.success) {
+            qCWarning(lcMkcal) << "cannot load notebook" << load.notebookUid;
+            success = false;
+            continue;
+        }
+        for (const QPair<Incidence::Ptr, QString> &decoded : load.incidences) {
+            addIncidence(decoded.first, decoded.second);
+        }
+    }
+    mIsLoading = false;
+
+    if (success) {
+        mStorage->setFinished(false, "load completed");
+    } else {
+        mStorage->setFinished(true, "error loading incidences");
+    }
+
+    return success;
+}
+
+bool SqliteStorage::Private::loadIncidenceDetails(const Incidence::Ptr &incidence)
+{
+    int rv = 0;
+    bool success;
+    sqlite3_stmt *stmt2 = NULL;
+    sqlite3_stmt *stmt3 = NULL;
+    sqlite3_stmt *stmt4 = NULL;
+    sqlite3_stmt *stmt7 = NULL;
+    const QDateTime lastModified = incidence->lastModified();
+
+    if (!lock()) {
+        qCWarning(lcMkcal) << "cannot lock" << mDatabaseName << "error" << mSem.errorString();
+        return false;
+    }
+
+    sqlite3_prepare_v2(mDatabase, SELECT_CUSTOMPROPERTIES_BY_ID,
+                       sizeof(SELECT_CUSTOMPROPERTIES_BY_ID), &stmt2, nullptr);
+    sqlite3_prepare_v2(mDatabase, SELECT_ATTENDEE_BY_ID,
+                       sizeof(SELECT_ATTENDEE_BY_ID), &stmt3, nullptr);
+    sqlite3_prepare_v2(mDatabase, SELECT_ALARM_BY_ID,
+                       sizeof(SELECT_ALARM_BY_ID), &stmt4, nullptr);
+    sqlite3_prepare_v2(mDatabase, SELECT_ATTACHMENTS_BY_ID,
+                       sizeof(SELECT_ATTACHMENTS_BY_ID), &stmt7, nullptr);
+
+    // Completing the incidence is not a modification to be saved.
+    mIsLoading = true;
+    incidence->startUpdates();
+    success = mFormat->selectComponentDetails(incidence, stmt2, stmt3, stmt4, stmt7);
+    incidence->endUpdates();
+    // The calendar has bumped lastModified while observing the
+    // update, restore the stored value.
+    incidence->setLastModified(lastModified);
+    mIsLoading = false;
+
+    sqlite3_finalize(stmt2);
+    sqlite3_finalize(stmt3);
+    sqlite3_finalize(stmt4);
+    sqlite3_finalize(stmt7);
+
+    if (!unlock()) {
+        qCWarning(lcMkcal) << "cannot release lock" << mDatabaseName << "error" << mSem.errorString();
+    }
+
+    if (success) {
+        mPartialIncidences.remove(incidence->uid(), incidence);
+    }
+
+    return success;
+
+error:
+    sqlite3_finalize(stmt2);
+    sqlite3_finalize(stmt3);
+    sqlite3_finalize(stmt4);
+    sqlite3_finalize(stmt7);
+    if (!unlock()) {
+        qCWarning(lcMkcal) << "cannot release lock" << mDatabaseName << "error" << mSem.errorString();
+    }
+
+    return false;
+}
 //@endcond
 
 bool SqliteStorage::purgeDeletedIncidences(const KCalendarCore::Incidence::List &list)
 {
-    if (!d->mIsOpened) {
+    if (!d->mIsOpened || !d->isWritable()) {
         return false;
     }
 
-    if (!d->mSem.acquire()) {
+    if (!d->lock()) {
         qCWarning(lcMkcal) << "cannot lock" << d->mDatabaseName << "error" << d->mSem.errorString();
         return false;
     }
@@ -1427,7 +2201,9 @@ bool SqliteStorage::purgeDeletedIncidences(const KCalendarCore::Incidence::List
     sqlite3_exec(d->mDatabase);
 
  error:
-    if (!d->mSem.release()) {
+    d->mFormat->purgeAttachmentStore();
+
+    if (!d->unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << d->mDatabaseName << "error" << d->mSem.errorString();
     }
     return error == 0;
@@ -1442,11 +2218,11 @@ bool SqliteStorage::save(ExtendedStorage::DeleteAction deleteAction)
 {
     d->mIsSaved = false;
 
-    if (!d->mIsOpened) {
+    if (!d->mIsOpened || !d->isWritable()) {
         return false;
     }
 
-    if (!d->mSem.acquire()) {
+    if (!d->lock()) {
         qCWarning(lcMkcal) << "cannot lock" << d->mDatabaseName << "error" << d->mSem.errorString();
         return false;
     }
@@ -1597,7 +2373,9 @@ bool SqliteStorage::save(ExtendedStorage::DeleteAction deleteAction)
         }
     }
 
-    if (!d->mSem.release()) {
+    d->mFormat->purgeAttachmentStore();
+
+    if (!d->unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << d->mDatabaseName << "error" << d->mSem.errorString();
     }
 
@@ -1653,6 +2431,7 @@ bool SqliteStorage::Private::saveIncidences(QHash<QString, Incidence::Ptr> &list
     sqlite3_stmt *stmt26 = NULL;
     sqlite3_stmt *stmt27 = NULL;
     sqlite3_stmt *stmt28 = NULL;
+    sqlite3_stmt *alarmStmt = NULL;
     const char *tail1 = NULL;
     const char *tail2 = NULL;
     const char *tail3 = NULL;
@@ -1670,11 +2449,16 @@ bool SqliteStorage::Private::saveIncidences(QHash<QString, Incidence::Ptr> &list
     char *errmsg = NULL;
     const char *query = NULL;
     QVector<Incidence::Ptr> validIncidences;
+    QHash<QString, Incidence::List> partialIncidences;
 
     query = BEGIN_TRANSACTION;
     sqlite3_exec(mDatabase);
 
     sqlite3_prepare_v2(mDatabase, query1, qsize1, &stmt1, &tail1);
+    if (dbop == DBUpdate && !mPartialIncidences.isEmpty()) {
+        sqlite3_prepare_v2(mDatabase, SELECT_ALARM_BY_ID, sizeof(SELECT_ALARM_BY_ID),
+                           &alarmStmt, nullptr);
+    }
     if (query2) {
         sqlite3_prepare_v2(mDatabase, query2, qsize2, &stmt2, &tail2);
     }
@@ -1741,10 +2525,13 @@ bool SqliteStorage::Private::saveIncidences(QHash<QString, Incidence::Ptr> &list
 
     for (it = list.constBegin(); it != list.constEnd(); ++it) {
         QString notebookUid = mCalendar->notebook(*it);
+        // Children tables not loaded for partial incidences are kept as is.
+        const bool partial = (dbop == DBUpdate && mPartialIncidences.contains((*it)->uid(), *it));
         if (!mStorage->isValidNotebook(notebookUid)) {
             qCWarning(lcMkcal) << "invalid notebook - not saving incidence" << (*it)->uid();
             continue;
-        } else {
+        } else if (!partial) {
+            // Alarms of partial incidences are not loaded, see below.
             validIncidences << *it;
         }
 
@@ -1757,10 +2544,24 @@ bool SqliteStorage::Private::saveIncidences(QHash<QString, Incidence::Ptr> &list
             (*it)->setLastModified(QDateTime::currentDateTimeUtc());
         }
         qCDebug(lcMkcal) << operation << "incidence" << (*it)->uid() << "notebook" << notebookUid;
-        if (!mFormat->modifyComponents(*it, notebookUid, dbop, stmt1, stmt2, stmt3, stmt4,
-                                       stmt5, stmt6, stmt7, stmt8, stmt9, stmt10, stmt11, stmt12, stmt13)) {
+        if (!mFormat->modifyComponents(*it, notebookUid, dbop, stmt1,
+                                       partial ? NULL : stmt2, partial ? NULL : stmt3,
+                                       partial ? NULL : stmt4, partial ? NULL : stmt5,
+                                       partial ? NULL : stmt6, partial ? NULL : stmt7,
+                                       stmt8, stmt9, stmt10, stmt11,
+                                       partial ? NULL : stmt12, partial ? NULL : stmt13)) {
             qCWarning(lcMkcal) << sqlite3_errmsg(mDatabase) << "for incidence" << (*it)->uid();
             errors++;
+        } else if (partial) {
+            // Alarms of partial incidences are rescheduled from the stored
+            // ones, read into a copy not to complete the loaded incidence.
+            Incidence::Ptr copy((*it)->clone());
+            if (mFormat->selectComponentDetails(copy, NULL, NULL, alarmStmt, NULL)) {
+                partialIncidences[notebookUid] << copy;
+            } else {
+                qCWarning(lcMkcal) << "cannot read alarms of incidence" << (*it)->uid();
+            }
+            sqlite3_reset(alarmStmt);
         } else  if (dbop == DBInsert) {
             // Don't leave deleted events with the same UID/recID.
             if (!mFormat->purgeDeletedComponents(*it,
@@ -1804,6 +2605,11 @@ bool SqliteStorage::Private::saveIncidences(QHash<QString, Incidence::Ptr> &list
     } else {
         // Reset all alarms.
         mStorage->resetAlarms(validIncidences);
+        for (QHash<QString, Incidence::List>::ConstIterator partialIt = partialIncidences.constBegin();
+             partialIt != partialIncidences.constEnd(); ++partialIt) {
+            mStorage->clearAlarms(partialIt.value());
+            mStorage->setAlarms(partialIt.value(), partialIt.key());
+        }
     }
 
     list.clear();
@@ -1845,6 +2651,7 @@ bool SqliteStorage::Private::saveIncidences(QHash<QString, Incidence::Ptr> &list
         sqlite3_finalize(stmt27);
         sqlite3_finalize(stmt28);
     }
+    sqlite3_finalize(alarmStmt);
 
     query = COMMIT_TRANSACTION;
     sqlite3_exec(mDatabase);
@@ -1866,6 +2673,11 @@ bool SqliteStorage::cancel()
 bool SqliteStorage::close()
 {
     if (d->mIsOpened) {
+        if (d->mReadSession > 0) {
+            qCWarning(lcMkcal) << "closing" << d->mDatabaseName << "during a read session";
+            d->mReadSession = 1;
+            endRead();
+        }
         if (d->mWatcher) {
             d->mWatcher->removePaths(d->mWatcher->files());
             // This should work, as storage should be closed before
@@ -1874,15 +2686,49 @@ bool SqliteStorage::close()
             d->mWatcher = NULL;
         }
         d->mChanged.close();
+        for (const QPointer<AttachmentDevice> &device : d->mAttachmentDevices) {
+            if (device) {
+                device->invalidate();
+            }
+        }
+        d->mAttachmentDevices.clear();
+        d->closeConnections();
         delete d->mFormat;
         d->mFormat = 0;
         sqlite3_close(d->mDatabase);
         d->mDatabase = 0;
         d->mIsOpened = false;
+        d->mReadOnly = false;
+    }
+    return true;
+}
+
+void SqliteStorage::closeThreadConnection()
+{
+    if (!d->isStorageThread()) {
+        d->closeConnection(QThread::currentThread());
+    }
+}
+
+bool SqliteStorage::openReadOnly()
+{
+    if (d->mIsOpened) {
+        return false;
+    }
+
+    d->mReadOnly = true;
+    if (!open()) {
+        d->mReadOnly = false;
+        return false;
     }
     return true;
 }
 
+bool SqliteStorage::isReadOnly() const
+{
+    return d->mReadOnly;
+}
+
 void SqliteStorage::calendarModified(bool modified, Calendar *calendar)
 {
     Q_UNUSED(calendar);
@@ -1929,6 +2775,8 @@ void SqliteStorage::calendarIncidenceDeleted(const Incidence::Ptr &incidence, co
 {
     Q_UNUSED(calendar);
 
+    d->mPartialIncidences.remove(incidence->uid(), incidence);
+
     if (d->mIncidencesToInsert.contains(incidence->uid(), incidence) &&
             !d->mIsLoading) {
         qCDebug(lcMkcal) << "removing incidence from inserted" << incidence->uid();
@@ -1942,6 +2790,22 @@ void SqliteStorage::calendarIncidenceDeleted(const Incidence::Ptr &incidence, co
     }
 }
 
+bool SqliteStorage::unloadIncidence(const Incidence::Ptr &incidence)
+{
+    // Unsaved changes would be lost.
+    if (d->mIncidencesToInsert.contains(incidence->uid(), incidence)
+        || d->mIncidencesToUpdate.contains(incidence->uid(), incidence)
+        || d->mIncidencesToDelete.contains(incidence->uid(), incidence)) {
+        return false;
+    }
+
+    if (!ExtendedStorage::unloadIncidence(incidence)) {
+        return false;
+    }
+    d->mPartialIncidences.remove(incidence->uid(), incidence);
+    return true;
+}
+
 void SqliteStorage::calendarIncidenceAdditionCanceled(const Incidence::Ptr &incidence)
 {
     if (d->mIncidencesToInsert.contains(incidence->uid()) && !d->mIsLoading) {
@@ -1970,6 +2834,8 @@ bool SqliteStorage::Private::selectIncidences(Incidence::List *list,
     Incidence::Ptr incidence;
     sqlite3_int64 secs;
     QString nbook;
+    sqlite3 *database = NULL;
+    SqliteFormat *format = NULL;
 
     const char *query2 = SELECT_CUSTOMPROPERTIES_BY_ID;
     int qsize2 = sizeof(SELECT_CUSTOMPROPERTIES_BY_ID);
@@ -1989,12 +2855,16 @@ bool SqliteStorage::Private::selectIncidences(Incidence::List *list,
     const char *query7 = SELECT_ATTACHMENTS_BY_ID;
     int qsize7 = sizeof(SELECT_ATTACHMENTS_BY_ID);
 
-    if (!mSem.acquire()) {
+    if (!threadConnection(&database, &format)) {
+        return false;
+    }
+
+    if (!lock()) {
         qCWarning(lcMkcal) << "cannot lock" << mDatabaseName << "error" << mSem.errorString();
         return false;
     }
 
-    sqlite3_prepare_v2(mDatabase, query1, qsize1, &stmt1, nullptr);
+    sqlite3_prepare_v2(database, query1, qsize1, &stmt1, nullptr);
 
     qCDebug(lcMkcal) << "incidences"
              << (dbop == DBInsert ? "inserted" :
@@ -2049,15 +2919,15 @@ bool SqliteStorage::Private::selectIncidences(Incidence::List *list,
             }
         }
     }
-    sqlite3_prepare_v2(mDatabase, query2, qsize2, &stmt2, nullptr);
-    sqlite3_prepare_v2(mDatabase, query3, qsize3, &stmt3, nullptr);
-    sqlite3_prepare_v2(mDatabase, query4, qsize4, &stmt4, nullptr);
-    sqlite3_prepare_v2(mDatabase, query5, qsize5, &stmt5, nullptr);
-    sqlite3_prepare_v2(mDatabase, query6, qsize6, &stmt6, nullptr);
-    sqlite3_prepare_v2(mDatabase, query7, qsize7, &stmt7, nullptr);
+    sqlite3_prepare_v2(database, query2, qsize2, &stmt2, nullptr);
+    sqlite3_prepare_v2(database, query3, qsize3, &stmt3, nullptr);
+    sqlite3_prepare_v2(database, query4, qsize4, &stmt4, nullptr);
+    sqlite3_prepare_v2(database, query5, qsize5, &stmt5, nullptr);
+    sqlite3_prepare_v2(database, query6, qsize6, &stmt6, nullptr);
+    sqlite3_prepare_v2(database, query7, qsize7, &stmt7, nullptr);
 
     while ((incidence =
-                mFormat->selectComponents(stmt1, stmt2, stmt3, stmt4, stmt5, stmt6, stmt7, nbook))) {
+                format->selectComponents(stmt1, stmt2, stmt3, stmt4, stmt5, stmt6, stmt7, nbook))) {
         qCDebug(lcMkcal) << "adding incidence" << incidence->uid() << "into list"
                  << incidence->created() << incidence->lastModified();
         list->append(incidence);
@@ -2076,17 +2946,21 @@ bool SqliteStorage::Private::selectIncidences(Incidence::List *list,
     sqlite3_finalize(stmt6);
     sqlite3_finalize(stmt7);
 
-    if (!mSem.release()) {
+    if (!unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << mDatabaseName << "error" << mSem.errorString();
     }
-    mStorage->setFinished(false, "select completed");
+    if (isStorageThread()) {
+        mStorage->setFinished(false, "select completed");
+    }
     return true;
 
 error:
-    if (!mSem.release()) {
+    if (!unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << mDatabaseName << "error" << mSem.errorString();
     }
-    mStorage->setFinished(true, "error selecting incidences");
+    if (isStorageThread()) {
+        mStorage->setFinished(true, "error selecting incidences");
+    }
     return false;
 }
 //@endcond
@@ -2213,6 +3087,176 @@ bool SqliteStorage::duplicateIncidences(Incidence::List *list, const Incidence::
 
 }
 
+bool SqliteStorage::manifest(Manifest *list, const QString &notebookUid,
+                             const QByteArray &propertyName)
+{
+    if (d->mIsOpened && list) {
+        const char *query = NULL;
+        int qsize = 0;
+
+        if (!propertyName.isEmpty()) {
+            if (!notebookUid.isNull()) {
+                query = SELECT_MANIFEST_WITH_PROPERTY_BY_NOTEBOOK;
+                qsize = sizeof(SELECT_MANIFEST_WITH_PROPERTY_BY_NOTEBOOK);
+            } else {
+                query = SELECT_MANIFEST_WITH_PROPERTY_ALL;
+                qsize = sizeof(SELECT_MANIFEST_WITH_PROPERTY_ALL);
+            }
+        } else {
+            if (!notebookUid.isNull()) {
+                query = SELECT_MANIFEST_BY_NOTEBOOK;
+                qsize = sizeof(SELECT_MANIFEST_BY_NOTEBOOK);
+            } else {
+                query = SELECT_MANIFEST_ALL;
+                qsize = sizeof(SELECT_MANIFEST_ALL);
+            }
+        }
+
+        return d->selectManifest(list, query, qsize, propertyName, QString(), notebookUid);
+    }
+    return false;
+}
+
+bool SqliteStorage::manifestByCustomProperty(Manifest *list, const QByteArray &propertyName,
+                                             const QString &value)
+{
+    if (d->mIsOpened && list && !propertyName.isEmpty()) {
+        return d->selectManifest(list, SELECT_MANIFEST_BY_PROPERTY,
+                                 sizeof(SELECT_MANIFEST_BY_PROPERTY),
+                                 propertyName, value.isNull() ? QString::fromLatin1("") : value,
+                                 QString());
+    }
+    return false;
+}
+
+bool SqliteStorage::applyChanges(const QString &notebookUid,
+                                 const Incidence::List &upserts,
+                                 const Incidence::List &deletes,
+                                 ExtendedStorage::DeleteAction deleteAction)
+{
+    if (!d->mIsOpened || !d->isWritable()) {
+        return false;
+    }
+
+    if (!isValidNotebook(notebookUid)) {
+        qCWarning(lcMkcal) << "invalid notebook - not applying changes to" << notebookUid;
+        return false;
+    }
+
+    if (upserts.isEmpty() && deletes.isEmpty()) {
+        return true;
+    }
+
+    if (!d->lock()) {
+        qCWarning(lcMkcal) << "cannot lock" << d->mDatabaseName << "error" << d->mSem.errorString();
+        return false;
+    }
+
+    bool success = d->applyChanges(notebookUid, upserts, deletes,
+                                   deleteAction == ExtendedStorage::PurgeDeleted
+                                   ? DBDelete : DBMarkDeleted);
+    d->mFormat->purgeAttachmentStore();
+
+    if (!d->unlock()) {
+        qCWarning(lcMkcal) << "cannot release lock" << d->mDatabaseName << "error" << d->mSem.errorString();
+    }
+
+    if (success) {
+        d->updateLoadedIncidences(notebookUid, upserts, deletes);
+
+        clearAlarms(deletes);
+        clearAlarms(upserts);
+        setAlarms(upserts, notebookUid);
+
+        d->mChanged.resize(0);   // make a change to create signal
+        setFinished(false, "apply changes completed");
+    } else {
+        setFinished(true, "error applying changes");
+    }
+
+    return success;
+}
+
+QIODevice *SqliteStorage::attachmentData(const Attachment &attachment)
+{
+    int componentId = 0;
+    QByteArray key;
+    if (!d->mIsOpened || !SqliteFormat::attachmentReference(attachment, &componentId, &key)) {
+        return nullptr;
+    }
+
+    int rv = 0;
+    int index = 1;
+    qint64 size = -1;
+    sqlite3_stmt *stmt = NULL;
+    const char *query = SELECT_ATTACHMENTS_BY_REFERENCE;
+    int qsize = sizeof(SELECT_ATTACHMENTS_BY_REFERENCE);
+    AttachmentDevice *device;
+
+    sqlite3_prepare_v2(d->mDatabase, query, qsize, &stmt, NULL);
+    sqlite3_bind_int(stmt, index, componentId);
+    sqlite3_bind_text(stmt, index, key.constData(), key.length(), SQLITE_STATIC);
+    sqlite3_step(stmt);
+    if (rv == SQLITE_ROW) {
+        size = sqlite3_column_type(stmt, 1) == SQLITE_NULL ? 0 : sqlite3_column_int64(stmt, 1);
+    }
+    sqlite3_finalize(stmt);
+
+    if (size < 0) {
+        qCWarning(lcMkcal) << "no data for attachment" << attachment.uri();
+        return nullptr;
+    }
+
+    if (key.startsWith(ATTACHMENT_STORE)) {
+        // Callers can map the file to read the data without copy.
+        QFile *file = new QFile(attachmentStorePath() + QLatin1Char('/')
+                                + QString::fromLatin1(key.mid(sizeof(ATTACHMENT_STORE) - 1)));
+        if (!file->open(QIODevice::ReadOnly)) {
+            qCWarning(lcMkcal) << "cannot open attachment data" << file->fileName() << file->errorString();
+            delete file;
+            return nullptr;
+        }
+        return file;
+    }
+
+    device = new AttachmentDevice(d->mDatabase, componentId, key, size);
+    device->open(QIODevice::ReadOnly);
+    d->mAttachmentDevices.removeAll(QPointer<AttachmentDevice>());
+    d->mAttachmentDevices.append(device);
+
+    return device;
+
+error:
+    sqlite3_finalize(stmt);
+
+    return nullptr;
+}
+
+void SqliteStorage::setAttachmentReferences(bool enabled)
+{
+    d->mAttachmentReferences = enabled;
+}
+
+bool SqliteStorage::attachmentReferences() const
+{
+    return d->mAttachmentReferences;
+}
+
+void SqliteStorage::setAttachmentStoreThreshold(qint64 size)
+{
+    d->mAttachmentStoreThreshold = size;
+}
+
+qint64 SqliteStorage::attachmentStoreThreshold() const
+{
+    return d->mAttachmentStoreThreshold;
+}
+
+QString SqliteStorage::attachmentStorePath() const
+{
+    return d->mDatabaseName + QLatin1String(".attachments");
+}
+
 QDateTime SqliteStorage::incidenceDeletedDate(const Incidence::Ptr &incidence)
 {
     int index;
@@ -2237,7 +3281,7 @@ QDateTime SqliteStorage::incidenceDeletedDate(const Incidence::Ptr &incidence)
         sqlite3_bind_int64(stmt, index, 0);
     }
 
-    if (!d->mSem.acquire()) {
+    if (!d->lock()) {
         qCWarning(lcMkcal) << "cannot lock" << d->mDatabaseName << "error" << d->mSem.errorString();
         return deletionDate;
     }
@@ -2252,26 +3296,366 @@ error:
     sqlite3_reset(stmt);
     sqlite3_finalize(stmt);
 
-    if (!d->mSem.release()) {
+    if (!d->unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << d->mDatabaseName << "error" << d->mSem.errorString();
     }
     return deletionDate;
 }
 
 //@cond PRIVATE
+bool SqliteStorage::Private::selectManifest(Manifest *list, const char *query, int qsize,
+                                            const QByteArray &propertyName, const QString &value,
+                                            const QString &notebookUid)
+{
+    int rv = 0;
+    int index = 1;
+    sqlite3_stmt *stmt = NULL;
+    QByteArray n;
+    QByteArray v;
+    ExtendedStorage::ManifestEntry entry;
+    sqlite3 *database = NULL;
+    SqliteFormat *format = NULL;
+
+    if (!threadConnection(&database, &format)) {
+        return false;
+    }
+
+    if (!lock()) {
+        qCWarning(lcMkcal) << "cannot lock" << mDatabaseName << "error" << mSem.errorString();
+        return false;
+    }
+
+    sqlite3_prepare_v2(database, query, qsize, &stmt, nullptr);
+    if (!propertyName.isEmpty()) {
+        sqlite3_bind_text(stmt, index, propertyName.constData(), propertyName.length(), SQLITE_STATIC);
+    }
+    if (!value.isNull()) {
+        v = value.toUtf8();
+        sqlite3_bind_text(stmt, index, v.constData(), v.length(), SQLITE_STATIC);
+    }
+    if (!notebookUid.isNull()) {
+        n = notebookUid.toUtf8();
+        sqlite3_bind_text(stmt, index, n.constData(), n.length(), SQLITE_STATIC);
+    }
+
+    while (format->selectManifestEntry(stmt, &entry)) {
+        list->append(entry);
+    }
+    sqlite3_finalize(stmt);
+
+    if (!unlock()) {
+        qCWarning(lcMkcal) << "cannot release lock" << mDatabaseName << "error" << mSem.errorString();
+    }
+    return true;
+
+error:
+    sqlite3_finalize(stmt);
+    if (!unlock()) {
+        qCWarning(lcMkcal) << "cannot release lock" << mDatabaseName << "error" << mSem.errorString();
+    }
+    return false;
+}
+
+static void removeFromList(QMultiHash<QString, Incidence::Ptr> &list, const Incidence::Ptr &incidence)
+{
+    QMultiHash<QString, Incidence::Ptr>::Iterator it = list.find(incidence->uid());
+    while (it != list.end() && it.key() == incidence->uid()) {
+        if ((*it)->recurrenceId() == incidence->recurrenceId()) {
+            it = list.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool SqliteStorage::Private::applyChanges(const QString &notebookUid,
+                                          const Incidence::List &upserts,
+                                          const Incidence::List &deletes,
+                                          DBOperation deleteOperation)
+{
+    // Statements for the children tables, by pairs of delete and insert,
+    // as expected by SqliteFormat::modifyComponents().
+    static const char *const childQueries[] = {
+        DELETE_CUSTOMPROPERTIES, INSERT_CUSTOMPROPERTIES,
+        DELETE_ATTENDEE, INSERT_ATTENDEE,
+        DELETE_ALARM, INSERT_ALARM,
+        DELETE_RECURSIVE, INSERT_RECURSIVE,
+        DELETE_RDATES, INSERT_RDATES,
+        DELETE_ATTACHMENTS, INSERT_ATTACHMENTS
+    };
+    // Statements to remove marked as deleted rows on insertion,
+    // as expected by SqliteFormat::purgeDeletedComponents().
+    static const char *const purgeQueries[] = {
+        SELECT_COMPONENTS_BY_UID_RECID_AND_DELETED, DELETE_COMPONENTS,
+        DELETE_CUSTOMPROPERTIES, DELETE_ALARM, DELETE_ATTENDEE,
+        DELETE_RECURSIVE, DELETE_RDATES, DELETE_ATTACHMENTS
+    };
+    const int childCount = sizeof(childQueries) / sizeof(childQueries[0]);
+    const int purgeCount = sizeof(purgeQueries) / sizeof(purgeQueries[0]);
+
+    int rv = 0;
+    int index = 1;
+    int errors = 0;
+    char *errmsg = NULL;
+    const char *query = NULL;
+    bool inTransaction = false;
+    sqlite3_stmt *selectStmt = NULL;
+    sqlite3_stmt *notebookStmt = NULL;
+    sqlite3_stmt *insertStmt = NULL;
+    sqlite3_stmt *updateStmt = NULL;
+    sqlite3_stmt *deleteStmt = NULL;
+    sqlite3_stmt *childStmts[childCount] = {};
+    sqlite3_stmt *purgeStmts[purgeCount] = {};
+    const QDateTime now = QDateTime::currentDateTimeUtc();
+    QByteArray u;
+    const QByteArray n(notebookUid.toUtf8());
+    qint64 secsRecurId;
+    DBOperation dbop;
+
+    query = BEGIN_TRANSACTION;
+    sqlite3_exec(mDatabase);
+    inTransaction = true;
+
+    sqlite3_prepare_v2(mDatabase, SELECT_ROWID_FROM_COMPONENTS_BY_UID_AND_RECURID,
+                       sizeof(SELECT_ROWID_FROM_COMPONENTS_BY_UID_AND_RECURID), &selectStmt, NULL);
+    sqlite3_prepare_v2(mDatabase, SELECT_NOTEBOOK_FROM_COMPONENTS_BY_UID_AND_OTHER_NOTEBOOK,
+                       sizeof(SELECT_NOTEBOOK_FROM_COMPONENTS_BY_UID_AND_OTHER_NOTEBOOK),
+                       &notebookStmt, NULL);
+    if (!upserts.isEmpty()) {
+        sqlite3_prepare_v2(mDatabase, INSERT_COMPONENTS, sizeof(INSERT_COMPONENTS), &insertStmt, NULL);
+        sqlite3_prepare_v2(mDatabase, UPDATE_COMPONENTS, sizeof(UPDATE_COMPONENTS), &updateStmt, NULL);
+        for (int i = 0; i < purgeCount; i++) {
+            sqlite3_prepare_v2(mDatabase, purgeQueries[i], -1, &purgeStmts[i], NULL);
+        }
+    }
+    if (!deletes.isEmpty()) {
+        if (deleteOperation == DBDelete) {
+            sqlite3_prepare_v2(mDatabase, DELETE_COMPONENTS, sizeof(DELETE_COMPONENTS), &deleteStmt, NULL);
+        } else {
+            sqlite3_prepare_v2(mDatabase, UPDATE_COMPONENTS_AS_DELETED,
+                               sizeof(UPDATE_COMPONENTS_AS_DELETED), &deleteStmt, NULL);
+        }
+    }
+    for (int i = 0; i < childCount; i++) {
+        sqlite3_prepare_v2(mDatabase, childQueries[i], -1, &childStmts[i], NULL);
+    }
+
+    for (const Incidence::Ptr &incidence : upserts) {
+        // Incidences are not moved from other notebooks.
+        index = 1;
+        u = incidence->uid().toUtf8();
+        sqlite3_bind_text(notebookStmt, index, u.constData(), u.length(), SQLITE_STATIC);
+        sqlite3_bind_text(notebookStmt, index, n.constData(), n.length(), SQLITE_STATIC);
+        sqlite3_step(notebookStmt);
+        if (rv == SQLITE_ROW) {
+            qCWarning(lcMkcal) << "incidence" << incidence->uid() << "is stored in notebook"
+                               << QString::fromUtf8((const char *)sqlite3_column_text(notebookStmt, 0))
+                               << "- not applying it to" << notebookUid;
+            sqlite3_reset(notebookStmt);
+            errors++;
+            continue;
+        }
+        sqlite3_reset(notebookStmt);
+
+        // Resolve the existing row, if any, from UID and recurrence id.
+        index = 1;
+        sqlite3_bind_text(selectStmt, index, u.constData(), u.length(), SQLITE_STATIC);
+        secsRecurId = incidence->hasRecurrenceId()
+            ? mStorage->toOriginTime(incidence->recurrenceId()) : 0;
+        sqlite3_bind_int64(selectStmt, index, secsRecurId);
+        sqlite3_step(selectStmt);
+        dbop = (rv == SQLITE_ROW) ? DBUpdate : DBInsert;
+        sqlite3_reset(selectStmt);
+
+        if (!incidence->lastModified().isValid()) {
+            incidence->setLastModified(now);
+        }
+        qCDebug(lcMkcal) << (dbop == DBInsert ? "inserting" : "updating")
+                         << "incidence" << incidence->uid() << "notebook" << notebookUid;
+        if (!mFormat->modifyComponents(incidence, notebookUid, dbop,
+                                       dbop == DBInsert ? insertStmt : updateStmt,
+                                       childStmts[0], childStmts[1], childStmts[2],
+                                       childStmts[3], childStmts[4], childStmts[5],
+                                       childStmts[6], childStmts[7], childStmts[8],
+                                       childStmts[9], childStmts[10], childStmts[11])) {
+            qCWarning(lcMkcal) << sqlite3_errmsg(mDatabase) << "for incidence" << incidence->uid();
+            errors++;
+        } else if (dbop == DBInsert
+                   && !mFormat->purgeDeletedComponents(incidence,
+                                                       purgeStmts[0], purgeStmts[1],
+                                                       purgeStmts[2], purgeStmts[3],
+                                                       purgeStmts[4], purgeStmts[5],
+                                                       purgeStmts[6], purgeStmts[7])) {
+            qCWarning(lcMkcal) << "cannot purge deleted components on insertion.";
+            errors++;
+        }
+
+        sqlite3_reset(insertStmt);
+        sqlite3_reset(updateStmt);
+        for (int i = 0; i < childCount; i++) {
+            sqlite3_reset(childStmts[i]);
+        }
+    }
+
+    for (const Incidence::Ptr &incidence : deletes) {
+        // Neither are incidences of other notebooks deleted.
+        index = 1;
+        u = incidence->uid().toUtf8();
+        sqlite3_bind_text(notebookStmt, index, u.constData(), u.length(), SQLITE_STATIC);
+        sqlite3_bind_text(notebookStmt, index, n.constData(), n.length(), SQLITE_STATIC);
+        sqlite3_step(notebookStmt);
+        if (rv == SQLITE_ROW) {
+            qCWarning(lcMkcal) << "incidence" << incidence->uid() << "is stored in notebook"
+                               << QString::fromUtf8((const char *)sqlite3_column_text(notebookStmt, 0))
+                               << "- not deleting it from" << notebookUid;
+            sqlite3_reset(notebookStmt);
+            errors++;
+            continue;
+        }
+        sqlite3_reset(notebookStmt);
+
+        index = 1;
+        sqlite3_bind_text(selectStmt, index, u.constData(), u.length(), SQLITE_STATIC);
+        secsRecurId = incidence->hasRecurrenceId()
+            ? mStorage->toOriginTime(incidence->recurrenceId()) : 0;
+        sqlite3_bind_int64(selectStmt, index, secsRecurId);
+        sqlite3_step(selectStmt);
+        dbop = (rv == SQLITE_ROW) ? deleteOperation : DBNone;
+        sqlite3_reset(selectStmt);
+
+        if (dbop == DBNone) {
+            qCDebug(lcMkcal) << "incidence" << incidence->uid() << "already deleted";
+            continue;
+        }
+        qCDebug(lcMkcal) << "deleting incidence" << incidence->uid() << "notebook" << notebookUid;
+        if (!mFormat->modifyComponents(incidence, notebookUid, dbop, deleteStmt,
+                                       dbop == DBDelete ? childStmts[0] : NULL, NULL,
+                                       dbop == DBDelete ? childStmts[2] : NULL, NULL,
+                                       dbop == DBDelete ? childStmts[4] : NULL, NULL,
+                                       dbop == DBDelete ? childStmts[6] : NULL, NULL,
+                                       dbop == DBDelete ? childStmts[8] : NULL, NULL,
+                                       dbop == DBDelete ? childStmts[10] : NULL, NULL)) {
+            qCWarning(lcMkcal) << sqlite3_errmsg(mDatabase) << "for incidence" << incidence->uid();
+            errors++;
+        }
+
+        sqlite3_reset(deleteStmt);
+        for (int i = 0; i < childCount; i++) {
+            sqlite3_reset(childStmts[i]);
+        }
+    }
+
+    sqlite3_finalize(selectStmt);
+    sqlite3_finalize(notebookStmt);
+    sqlite3_finalize(insertStmt);
+    sqlite3_finalize(updateStmt);
+    sqlite3_finalize(deleteStmt);
+    for (int i = 0; i < childCount; i++) {
+        sqlite3_finalize(childStmts[i]);
+    }
+    for (int i = 0; i < purgeCount; i++) {
+        sqlite3_finalize(purgeStmts[i]);
+    }
+
+    if (errors) {
+        // Contrary to save(), changes are applied all or nothing.
+        qCWarning(lcMkcal) << "cannot apply changes to notebook" << notebookUid << ", rolling back";
+        (sqlite3_exec)(mDatabase, ROLLBACK_TRANSACTION, NULL, 0, NULL);
+        return false;
+    }
+
+    query = COMMIT_TRANSACTION;
+    sqlite3_exec(mDatabase);
+
+    return true;
+
+error:
+    sqlite3_finalize(selectStmt);
+    sqlite3_finalize(notebookStmt);
+    sqlite3_finalize(insertStmt);
+    sqlite3_finalize(updateStmt);
+    sqlite3_finalize(deleteStmt);
+    for (int i = 0; i < childCount; i++) {
+        sqlite3_finalize(childStmts[i]);
+    }
+    for (int i = 0; i < purgeCount; i++) {
+        sqlite3_finalize(purgeStmts[i]);
+    }
+    if (inTransaction) {
+        (sqlite3_exec)(mDatabase, ROLLBACK_TRANSACTION, NULL, 0, NULL);
+    }
+
+    return false;
+}
+
+void SqliteStorage::Private::updateLoadedIncidences(const QString &notebookUid,
+                                                    const Incidence::List &upserts,
+                                                    const Incidence::List &deletes)
+{
+    // Changes are already in the database, don't queue them for the
+    // next save() while updating the calendar.
+    mIsLoading = true;
+
+    for (const Incidence::Ptr &incidence : upserts) {
+        removeFromList(mIncidencesToInsert, incidence);
+        removeFromList(mIncidencesToUpdate, incidence);
+        removeFromList(mIncidencesToDelete, incidence);
+
+        Incidence::Ptr old = mCalendar->incidence(incidence->uid(), incidence->recurrenceId());
+        if (!old) {
+            // Not loaded, nothing to update.
+            continue;
+        }
+        if (old->type() != incidence->type()) {
+            mCalendar->deleteIncidence(old);
+            mCalendar->addIncidence(incidence, notebookUid);
+            continue;
+        }
+        if (old != incidence) {
+            static_cast<IncidenceBase &>(*old) = *incidence;
+            // The calendar has bumped lastModified while observing the
+            // update, restore the stored value.
+            old->setLastModified(incidence->lastModified());
+            mPartialIncidences.remove(old->uid(), old);
+        }
+        if (mCalendar->notebook(old) != notebookUid) {
+            mCalendar->setNotebook(old, notebookUid);
+        }
+    }
+
+    for (const Incidence::Ptr &incidence : deletes) {
+        removeFromList(mIncidencesToInsert, incidence);
+        removeFromList(mIncidencesToUpdate, incidence);
+        removeFromList(mIncidencesToDelete, incidence);
+
+        Incidence::Ptr old = mCalendar->incidence(incidence->uid(), incidence->recurrenceId());
+        if (old) {
+            mCalendar->deleteIncidence(old);
+        }
+    }
+
+    mIsLoading = false;
+}
+
 int SqliteStorage::Private::selectCount(const char *query, int qsize)
 {
     int rv = 0;
     int count = 0;
     sqlite3_stmt *stmt = NULL;
     const char *tail = NULL;
+    sqlite3 *database = NULL;
+    SqliteFormat *format = NULL;
+
+    if (!threadConnection(&database, &format)) {
+        return count;
+    }
 
-    if (!mSem.acquire()) {
+    if (!lock()) {
         qCWarning(lcMkcal) << "cannot lock" << mDatabaseName << "error" << mSem.errorString();
         return count;
     }
 
-    sqlite3_prepare_v2(mDatabase, query, qsize, &stmt, &tail);
+    sqlite3_prepare_v2(database, query, qsize, &stmt, &tail);
     sqlite3_step(stmt);
     if ((rv == SQLITE_ROW) || (rv == SQLITE_OK)) {
         count = sqlite3_column_int(stmt, 0);
@@ -2281,11 +3665,89 @@ error:
     sqlite3_reset(stmt);
     sqlite3_finalize(stmt);
 
-    if (!mSem.release()) {
+    if (!unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << mDatabaseName << "error" << mSem.errorString();
     }
     return count;
 }
+
+bool SqliteStorage::Private::isWritable() const
+{
+    if (mReadOnly) {
+        qCWarning(lcMkcal) << "database" << mDatabaseName << "is opened read-only";
+        return false;
+    }
+    if (mReadSession > 0) {
+        qCWarning(lcMkcal) << "cannot write to" << mDatabaseName << "during a read session";
+        return false;
+    }
+    return true;
+}
+
+bool SqliteStorage::Private::isStorageThread() const
+{
+    return QThread::currentThread() == mStorage->thread();
+}
+
+bool SqliteStorage::Private::threadConnection(sqlite3 **database, SqliteFormat **format)
+{
+    QThread *thread = QThread::currentThread();
+    if (thread == mStorage->thread()) {
+        *database = mDatabase;
+        *format = mFormat;
+        return mDatabase != NULL;
+    }
+
+    QMutexLocker locker(&mConnectionsLock);
+    QHash<QThread *, Connection>::ConstIterator it = mConnections.constFind(thread);
+    if (it == mConnections.constEnd()) {
+        Connection connection;
+        connection.mDatabase = NULL;
+        int rv = sqlite3_open_v2(mDatabaseName.toUtf8(), &connection.mDatabase,
+                                 SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, NULL);
+        if (rv) {
+            qCWarning(lcMkcal) << "sqlite3_open_v2 error:" << rv << "on database" << mDatabaseName;
+            sqlite3_close(connection.mDatabase);
+            return false;
+        }
+        sqlite3_busy_timeout(connection.mDatabase, 1500);
+        connection.mFormat = new SqliteFormat(mStorage, connection.mDatabase);
+        it = mConnections.insert(thread, connection);
+        // The connection is not used anymore once its thread is finished.
+        it->mFinished = QObject::connect(thread, &QThread::finished, mStorage, [this, thread] {
+            closeConnection(thread);
+        }, Qt::DirectConnection);
+        qCDebug(lcMkcal) << "opened connection for thread" << thread;
+    }
+    *database = it->mDatabase;
+    *format = it->mFormat;
+
+    return true;
+}
+
+void SqliteStorage::Private::closeConnection(QThread *thread)
+{
+    QMutexLocker locker(&mConnectionsLock);
+    QHash<QThread *, Connection>::Iterator it = mConnections.find(thread);
+    if (it != mConnections.end()) {
+        QObject::disconnect(it->mFinished);
+        delete it->mFormat;
+        sqlite3_close(it->mDatabase);
+        mConnections.erase(it);
+        qCDebug(lcMkcal) << "closed connection for thread" << thread;
+    }
+}
+
+void SqliteStorage::Private::closeConnections()
+{
+    QMutexLocker locker(&mConnectionsLock);
+    for (const Connection &connection : mConnections) {
+        QObject::disconnect(connection.mFinished);
+        delete connection.mFormat;
+        sqlite3_close(connection.mDatabase);
+    }
+    mConnections.clear();
+}
 //@endcond
 
 int SqliteStorage::eventCount()
@@ -2323,7 +3785,7 @@ bool SqliteStorage::loadNotebooks()
 
     Notebook::Ptr nb;
 
-    if (!d->mSem.acquire()) {
+    if (!d->lock()) {
         qCWarning(lcMkcal) << "cannot lock" << d->mDatabaseName << "error" << d->mSem.errorString();
         return false;
     }
@@ -2348,14 +3810,14 @@ bool SqliteStorage::loadNotebooks()
     sqlite3_reset(stmt);
     sqlite3_finalize(stmt);
 
-    if (!d->mSem.release()) {
+    if (!d->unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << d->mDatabaseName << "error" << d->mSem.errorString();
     }
     d->mIsLoading = false;
     return true;
 
 error:
-    if (!d->mSem.release()) {
+    if (!d->unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << d->mDatabaseName << "error" << d->mSem.errorString();
     }
     d->mIsLoading = false;
@@ -2387,6 +3849,10 @@ bool SqliteStorage::modifyNotebook(const Notebook::Ptr &nb, DBOperation dbop, bo
                             (dbop == DBUpdate) ? "updating" : "deleting";
 
     if (!d->mIsLoading) {
+        if (!d->isWritable()) {
+            return false;
+        }
+
         // Execute database operation.
         if (dbop == DBInsert) {
             query = INSERT_CALENDARS;
@@ -2402,7 +3868,7 @@ bool SqliteStorage::modifyNotebook(const Notebook::Ptr &nb, DBOperation dbop, bo
             return false;
         }
 
-        if (!d->mSem.acquire()) {
+        if (!d->lock()) {
             qCWarning(lcMkcal) << "cannot lock" << d->mDatabaseName << "error" << d->mSem.errorString();
             return false;
         }
@@ -2416,7 +3882,7 @@ bool SqliteStorage::modifyNotebook(const Notebook::Ptr &nb, DBOperation dbop, bo
         sqlite3_reset(stmt);
         sqlite3_finalize(stmt);
 
-        if (!d->mSem.release()) {
+        if (!d->unlock()) {
             qCWarning(lcMkcal) << "cannot release lock" << d->mDatabaseName << "error" << d->mSem.errorString();
         }
     }
@@ -2428,12 +3894,129 @@ bool SqliteStorage::modifyNotebook(const Notebook::Ptr &nb, DBOperation dbop, bo
     return success;
 
 error:
-    if (!d->mSem.release()) {
+    if (!d->unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << d->mDatabaseName << "error" << d->mSem.errorString();
     }
     return false;
 }
 
+bool SqliteStorage::Private::createTables()
+{
+    int rv = 0;
+    char *errmsg = NULL;
+    const char *query = NULL;
+
+    /* Create Calendars, Components, etc. tables */
+    query = CREATE_VERSION;
+    sqlite3_exec(mDatabase);
+
+    query = CREATE_TIMEZONES;
+    sqlite3_exec(mDatabase);
+    // Create a global empty entry.
+    query = INSERT_TIMEZONES;
+    sqlite3_exec(mDatabase);
+
+    query = CREATE_CALENDARS;
+    sqlite3_exec(mDatabase);
+
+    query = CREATE_COMPONENTS;
+    sqlite3_exec(mDatabase);
+
+    query = CREATE_RDATES;
+    sqlite3_exec(mDatabase);
+
+    query = CREATE_CUSTOMPROPERTIES;
+    sqlite3_exec(mDatabase);
+
+    query = CREATE_RECURSIVE;
+    sqlite3_exec(mDatabase);
+
+    query = CREATE_ALARM;
+    sqlite3_exec(mDatabase);
+
+    query = CREATE_ATTENDEE;
+    sqlite3_exec(mDatabase);
+
+    query = CREATE_ATTACHMENTS;
+    sqlite3_exec(mDatabase);
+
+    query = CREATE_CALENDARPROPERTIES;
+    sqlite3_exec(mDatabase);
+
+    /* Create index on frequently used columns */
+    query = INDEX_CALENDAR;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_COMPONENT;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_COMPONENT_UID;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_COMPONENT_NOTEBOOK;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_COMPONENT_DUPLICATE;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_COMPONENT_DATEENDDUE;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_COMPONENT_DATECREATED;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_RDATES;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_CUSTOMPROPERTIES;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_CUSTOMPROPERTIES_NAME;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_RECURSIVE;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_ALARM;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_ATTENDEE;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_ATTACHMENTS;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_ATTACHMENTS_URI;
+    sqlite3_exec(mDatabase);
+
+    query = INDEX_CALENDARPROPERTIES;
+    sqlite3_exec(mDatabase);
+
+    return true;
+
+error:
+    return false;
+}
+
+bool SqliteStorage::Private::writeAheadLog(const char *query)
+{
+    int rv = 0;
+    sqlite3_stmt *stmt = NULL;
+    bool enabled = false;
+
+    sqlite3_prepare_v2(mDatabase, query, -1, &stmt, nullptr);
+    sqlite3_step(stmt);
+    if (rv == SQLITE_ROW) {
+        // The pragma returns the journal mode actually in use.
+        enabled = !qstricmp((const char *)sqlite3_column_text(stmt, 0), "wal");
+    }
+
+error:
+    sqlite3_finalize(stmt);
+
+    return enabled;
+}
+
 bool SqliteStorage::Private::checkVersion()
 {
     int rv = 0;
@@ -2455,7 +4038,10 @@ bool SqliteStorage::Private::checkVersion()
     sqlite3_reset(stmt);
     sqlite3_finalize(stmt);
 
-    if (major == 0) {
+    if (major == 0 && mReadOnly) {
+        qCWarning(lcMkcal) << "database" << mDatabaseName << "is not initialized";
+        return false;
+    } else if (major == 0) {
         major = VersionMajor;
         minor = VersionMinor;
         query = INSERT_VERSION;
@@ -2531,7 +4117,7 @@ bool SqliteStorage::Private::loadTimezones()
 
     sqlite3_prepare_v2(mDatabase, query, qsize, &stmt, &tail);
 
-    if (!mSem.acquire()) {
+    if (!lock()) {
         qCWarning(lcMkcal) << "cannot lock" << mDatabaseName << "error" << mSem.errorString();
         return false;
     }
@@ -2557,7 +4143,7 @@ error:
     sqlite3_reset(stmt);
     sqlite3_finalize(stmt);
 
-    if (!mSem.release()) {
+    if (!unlock()) {
         qCWarning(lcMkcal) << "cannot release lock" << mDatabaseName << "error" << mSem.errorString();
     }
     return success;
@@ -48,6 +48,25 @@ const int VersionMinor = 0; // Minor version, if different than stored in databa
   @brief
   This class provides a calendar storage as an sqlite database.
 
+  @par Threading
+  A storage belongs to the thread that created it, like its calendar.
+  Opening, closing, loading into the calendar, saving and notebook
+  changes are done from that thread, and observers as well as
+  modifications made by other processes are notified in it, from its
+  event loop.
+
+  The queries that only return data, insertedIncidences(),
+  modifiedIncidences(), deletedIncidences(), allIncidences(),
+  duplicateIncidences(), manifest(), manifestByCustomProperty(),
+  loadContacts(), eventCount(), todoCount() and journalCount(), can
+  also be called from other threads while the storage is opened. Each
+  of these threads uses its own read-only connection, opened on its
+  first query and closed when the thread finishes, when it calls
+  closeThreadConnection() or when the storage is closed. Such queries
+  take the same inter-process lock as the storage thread, if any, do
+  not notify observers, and must be finished before the storage is
+  closed.
+
   @warning When saving Attendees, the CustomProperties are not saved.
 */
 class MKCAL_EXPORT SqliteStorage : public ExtendedStorage
@@ -90,6 +109,29 @@ public:
     */
     bool open();
 
+    /**
+      Opens the database for reading only, for processes that never
+      modify the calendar, like widgets or alarm daemons.
+
+      The database must have been created by a read-write storage
+      before. Tables are neither created nor upgraded, no default
+      notebook is added, the inter-process lock is not taken and
+      the connection is in query only mode, so opening and loading
+      never wait for writers. Modifications done by other processes
+      are still notified.
+
+      Saving, purging, applying changes and modifying notebooks fail
+      until the storage is closed and opened again with open().
+
+      @return true if the database has been opened
+    */
+    bool openReadOnly();
+
+    /**
+      Returns true if the storage has been opened with openReadOnly().
+    */
+    bool isReadOnly() const;
+
     /**
       @copydoc
       CalStorage::load()
@@ -114,6 +156,12 @@ public:
     */
     bool load(const QDate &start, const QDate &end);
 
+    /**
+      @copydoc
+      ExtendedStorage::load(const QDate &, const QDate &, LoadProjection)
+    */
+    bool load(const QDate &start, const QDate &end, LoadProjection projection);
+
     /**
       @copydoc
       ExtendedStorage::loadSeries(const QString &)
@@ -132,6 +180,41 @@ public:
     */
     bool loadNotebookIncidences(const QString &notebookUid);
 
+    /**
+      @copydoc
+      ExtendedStorage::loadNotebooksIncidences(const QStringList &)
+    */
+    bool loadNotebooksIncidences(const QStringList &notebookUids);
+
+    /**
+      @copydoc
+      ExtendedStorage::loadNotebooksIncidences(const QStringList &, const QDate &, const QDate &)
+    */
+    bool loadNotebooksIncidences(const QStringList &notebookUids,
+                                 const QDate &start, const QDate &end);
+
+    /**
+      @copydoc
+      ExtendedStorage::beginRead()
+
+      The session is a deferred read transaction on the storage
+      connection, its snapshot is taken by the first load. Neither
+      the session nor the loads it contains take the inter-process
+      lock: other threads and processes keep reading and saving
+      meanwhile, thanks to the write ahead log enabled by open().
+      Without it, the transaction is a plain one and saves wait until
+      endRead(). Queries from other threads and
+      loadNotebooksIncidences() use their own connections and are
+      not part of the session.
+    */
+    bool beginRead();
+
+    /**
+      @copydoc
+      ExtendedStorage::endRead()
+    */
+    bool endRead();
+
     /**
       @copydoc
       ExtendedStorage::loadJournals()
@@ -229,6 +312,36 @@ public:
     */
     int loadJournals(int limit, QDateTime *last);
 
+    /**
+      @copydoc
+      ExtendedStorage::loadIncidences(bool, int, QByteArray*)
+    */
+    int loadIncidences(bool hasDate, int limit, QByteArray *token);
+
+    /**
+      @copydoc
+      ExtendedStorage::loadCompletedTodos(bool, int, QByteArray*)
+    */
+    int loadCompletedTodos(bool hasDate, int limit, QByteArray *token);
+
+    /**
+      @copydoc
+      ExtendedStorage::loadJournals(int, QByteArray*)
+    */
+    int loadJournals(int limit, QByteArray *token);
+
+    /**
+      @copydoc
+      ExtendedStorage::loadOldInvitationIncidences(int, QByteArray*)
+    */
+    int loadOldInvitationIncidences(int limit, QByteArray *token);
+
+    /**
+      @copydoc
+      ExtendedStorage::loadContactIncidences(const KCalendarCore::Person &, int, QByteArray*)
+    */
+    int loadContactIncidences(const KCalendarCore::Person &person, int limit, QByteArray *token);
+
     /**
       @copydoc
       ExtendedStorage::notifyOpened( const KCalendarCore::Incidence::Ptr & )
@@ -265,6 +378,14 @@ public:
     */
     bool close();
 
+    /**
+      Close the read-only connection of the calling thread, if any, see
+      the threading notes of the class. Threads of a QThreadPool are
+      kept idle instead of finishing, tasks querying the storage from
+      such threads should call it when done with the storage.
+    */
+    void closeThreadConnection();
+
     /**
       @copydoc
       Calendar::CalendarObserver::calendarModified()
@@ -337,6 +458,93 @@ public:
                              const KCalendarCore::Incidence::Ptr &incidence,
                              const QString &notebookUid = QString());
 
+    /**
+      @copydoc
+      ExtendedStorage::applyChanges()
+    */
+    bool applyChanges(const QString &notebookUid,
+                      const KCalendarCore::Incidence::List &upserts,
+                      const KCalendarCore::Incidence::List &deletes,
+                      ExtendedStorage::DeleteAction deleteAction = ExtendedStorage::MarkDeleted);
+
+    /**
+      @copydoc
+      ExtendedStorage::manifest()
+    */
+    bool manifest(Manifest *list, const QString &notebookUid = QString(),
+                  const QByteArray &propertyName = QByteArray());
+
+    /**
+      @copydoc
+      ExtendedStorage::manifestByCustomProperty()
+    */
+    bool manifestByCustomProperty(Manifest *list, const QByteArray &propertyName,
+                                  const QString &value);
+
+    /**
+      @copydoc
+      ExtendedStorage::attachmentData()
+
+      Attachments are only loaded as references by range loads, when
+      setAttachmentReferences() is enabled. The returned device reads
+      the data in place from the database, without keeping a read
+      transaction open between reads. For data saved as files, see
+      setAttachmentStoreThreshold(), the device is a QFile, that can be
+      mapped in memory with QFile::map() to access the data without copy.
+    */
+    QIODevice *attachmentData(const KCalendarCore::Attachment &attachment);
+
+    /**
+      Set if load(const QDate &, const QDate &) loads binary attachments
+      larger than 64 KiB, and those saved as files, as references to
+      their data, read on demand with attachmentData(). Other loads and
+      queries always read the data, so exported or synchronised
+      incidences are complete.
+
+      References are URI attachments specific to this storage. Saving
+      an incidence with references keeps or copies the referenced data.
+
+      @param enabled true to load references, false by default
+    */
+    void setAttachmentReferences(bool enabled);
+
+    /**
+      Get if range loads load large attachments as references, see
+      setAttachmentReferences().
+    */
+    bool attachmentReferences() const;
+
+    /**
+      Set the size above which the data of binary attachments are saved
+      as files in a directory next to the database, instead of inside it.
+      Files are named after the hash of their content, so identical data
+      are stored only once, and they are removed when no attachment uses
+      them anymore. When loaded as references, see
+      setAttachmentReferences(), attachmentData() opens the file, otherwise
+      the file is read into the attachment.
+
+      @param size the size in bytes, 0 or negative to store all data
+             inside the database, which is the default
+    */
+    void setAttachmentStoreThreshold(qint64 size);
+
+    /**
+      Get the size above which the data of binary attachments are saved
+      as files.
+
+      @return the size in bytes, 0 or negative if data are stored inside
+              the database.
+    */
+    qint64 attachmentStoreThreshold() const;
+
+    /**
+      Get the directory where the data of binary attachments are saved
+      as files, see setAttachmentStoreThreshold().
+
+      @return the path of the directory.
+    */
+    QString attachmentStorePath() const;
+
     /**
       @copydoc
       ExtendedStorage::incidenceDeletedDate()
@@ -421,6 +629,12 @@ protected:
     bool reloadNotebooks();
     bool modifyNotebook(const Notebook::Ptr &nb, DBOperation dbop, bool signal = true);
 
+    /**
+      @copydoc
+      ExtendedStorage::unloadIncidence()
+    */
+    bool unloadIncidence(const KCalendarCore::Incidence::Ptr &incidence);
+
 private:
     //@cond PRIVATE
     Q_DISABLE_COPY(SqliteStorage)
@@ -486,6 +700,16 @@ public Q_SLOTS:
   index++;                                                            \
 }
 
+#define sqlite3_bind_zeroblob( stmt, index, size )                    \
+{                                                                     \
+  rv = sqlite3_bind_zeroblob( (stmt), (index), (size) );              \
+  if ( rv ) {                                                         \
+    qCWarning(lcMkcal) << "sqlite3_bind_zeroblob error:" << rv << "on index and size:" << index << size; \
+    goto error;                                                       \
+  }                                                                   \
+  index++;                                                            \
+}
+
 #define sqlite3_bind_int( stmt, index, value )                        \
 {                                                                     \
   rv = sqlite3_bind_int( (stmt), (index), (value) );                  \
@@ -527,6 +751,20 @@ public Q_SLOTS:
   }                                                     \
 }
 
+// Binary attachments larger than this size may be loaded as references,
+// see SqliteStorage::setAttachmentReferences().
+#define ATTACHMENT_REFERENCE_SIZE 65536
+#define ATTACHMENT_REFERENCE "mkcal-attachment:"
+// Key saved in the Uri column of binary attachments larger than
+// ATTACHMENT_REFERENCE_SIZE. References are made of the ComponentId
+// and of this key, both stable, unlike the rowid.
+#define ATTACHMENT_KEY "mkcal-data:"
+#define ATTACHMENT_STRING(value) #value
+#define ATTACHMENT_SIZE_STRING(size) ATTACHMENT_STRING(size)
+// Binary attachment data stored as files, see
+// SqliteStorage::setAttachmentStoreThreshold().
+#define ATTACHMENT_STORE "mkcal-store:"
+
 #define CREATE_VERSION \
   "CREATE TABLE IF NOT EXISTS Version(Major INTEGER, Minor INTEGER)"
 #define CREATE_TIMEZONES \
@@ -569,10 +807,18 @@ public Q_SLOTS:
 "CREATE UNIQUE INDEX IF NOT EXISTS IDX_COMPONENT_UID on Components(UID, RecurId, DateDeleted)"
 #define INDEX_COMPONENT_NOTEBOOK \
 "CREATE INDEX IF NOT EXISTS IDX_COMPONENT_NOTEBOOK on Components(Notebook)"
+#define INDEX_COMPONENT_DUPLICATE \
+"CREATE INDEX IF NOT EXISTS IDX_COMPONENT_DUPLICATE on Components(DateStart, Summary)"
+#define INDEX_COMPONENT_DATEENDDUE \
+"CREATE INDEX IF NOT EXISTS IDX_COMPONENT_DATEENDDUE on Components(DateEndDue, DateCreated)"
+#define INDEX_COMPONENT_DATECREATED \
+"CREATE INDEX IF NOT EXISTS IDX_COMPONENT_DATECREATED on Components(DateCreated)"
 #define INDEX_RDATES \
 "CREATE INDEX IF NOT EXISTS IDX_RDATES on Rdates(ComponentId)"
 #define INDEX_CUSTOMPROPERTIES \
 "CREATE INDEX IF NOT EXISTS IDX_CUSTOMPROPERTIES on Customproperties(ComponentId)"
+#define INDEX_CUSTOMPROPERTIES_NAME \
+"CREATE INDEX IF NOT EXISTS IDX_CUSTOMPROPERTIES_NAME on Customproperties(Name, Value)"
 #define INDEX_RECURSIVE \
 "CREATE INDEX IF NOT EXISTS IDX_RECURSIVE on Recursive(ComponentId)"
 #define INDEX_ALARM \
@@ -581,6 +827,8 @@ public Q_SLOTS:
 "CREATE UNIQUE INDEX IF NOT EXISTS IDX_ATTENDEE on Attendee(ComponentId, Email)"
 #define INDEX_ATTACHMENTS \
 "CREATE INDEX IF NOT EXISTS IDX_ATTACHMENTS on Attachments(ComponentId)"
+#define INDEX_ATTACHMENTS_URI \
+"CREATE INDEX IF NOT EXISTS IDX_ATTACHMENTS_URI on Attachments(Uri)"
 #define INDEX_CALENDARPROPERTIES \
 "CREATE INDEX IF NOT EXISTS IDX_CALENDARPROPERTIES on Calendarproperties(CalendarId)"
 
@@ -608,7 +856,11 @@ public Q_SLOTS:
 "insert into Attendee values (?, ?, ?, ?, ?, ?, ?, ?, ?)"
 #define INSERT_ATTACHMENTS \
 "insert into Attachments values (?, ?, ?, ?, ?, ?, ?)"
+#define INSERT_ATTACHMENTS_COPY \
+"insert into Attachments select ?, Data, ?, ?, ?, ?, ? from Attachments where ComponentId=? and Uri=? limit 1"
 
+#define UPDATE_ATTACHMENTS_BY_ROWID \
+"update Attachments set MimeType=?, ShowInLine=?, Label=?, Local=? where rowid=?"
 #define UPDATE_TIMEZONES \
 "update Timezones set ICalData=? where TzId=1"
 #define UPDATE_CALENDARS \
@@ -641,6 +893,8 @@ public Q_SLOTS:
 "delete from Attendee where ComponentId=?"
 #define DELETE_ATTACHMENTS \
 "delete from Attachments where ComponentId=?"
+#define DELETE_ATTACHMENTS_BY_ROWID \
+"delete from Attachments where rowid=?"
 
 #define SELECT_VERSION \
 "select * from Version"
@@ -684,8 +938,26 @@ public Q_SLOTS:
 "select * from Components where UID=? and DateDeleted=0"
 #define SELECT_COMPONENTS_BY_NOTEBOOKUID \
 "select * from Components where Notebook=? and DateDeleted=0"
+#define SELECT_COMPONENTS_BY_NOTEBOOKUID_AND_DATE_BOTH \
+"select * from Components where Notebook=? and DateStart<=? and (DateEndDue>=? or DateEndDue=0) and DateDeleted=0"
+#define SELECT_COMPONENTS_BY_NOTEBOOKUID_AND_DATE_START \
+"select * from Components where Notebook=? and DateEndDue>=? and DateDeleted=0"
+#define SELECT_COMPONENTS_BY_NOTEBOOKUID_AND_DATE_END \
+"select * from Components where Notebook=? and DateStart<=? and DateDeleted=0"
 #define SELECT_ROWID_FROM_COMPONENTS_BY_UID_AND_RECURID \
 "select ComponentId from Components where UID=? and RecurId=? and DateDeleted=0"
+#define SELECT_NOTEBOOK_FROM_COMPONENTS_BY_UID_AND_OTHER_NOTEBOOK \
+"select Notebook from Components where UID=? and Notebook<>? and DateDeleted=0 limit 1"
+#define SELECT_MANIFEST_ALL \
+"select UID, RecurId, RecurIdLocal, RecurIdTimeZone, DateLastModified, Sequence from Components where DateDeleted=0"
+#define SELECT_MANIFEST_BY_NOTEBOOK \
+"select UID, RecurId, RecurIdLocal, RecurIdTimeZone, DateLastModified, Sequence from Components where Notebook=? and DateDeleted=0"
+#define SELECT_MANIFEST_WITH_PROPERTY_ALL \
+"select Components.UID, Components.RecurId, Components.RecurIdLocal, Components.RecurIdTimeZone, Components.DateLastModified, Components.Sequence, Customproperties.Value from Components left join Customproperties on Customproperties.ComponentId=Components.ComponentId and Customproperties.Name=? where Components.DateDeleted=0"
+#define SELECT_MANIFEST_WITH_PROPERTY_BY_NOTEBOOK \
+"select Components.UID, Components.RecurId, Components.RecurIdLocal, Components.RecurIdTimeZone, Components.DateLastModified, Components.Sequence, Customproperties.Value from Components left join Customproperties on Customproperties.ComponentId=Components.ComponentId and Customproperties.Name=? where Components.Notebook=? and Components.DateDeleted=0"
+#define SELECT_MANIFEST_BY_PROPERTY \
+"select Components.UID, Components.RecurId, Components.RecurIdLocal, Components.RecurIdTimeZone, Components.DateLastModified, Components.Sequence, Customproperties.Value from Customproperties join Components on Components.ComponentId=Customproperties.ComponentId where Customproperties.Name=? and Customproperties.Value=? and Components.DateDeleted=0"
 #define SELECT_COMPONENTS_BY_UNCOMPLETED_TODOS \
 "select * from Components where Type='Todo' and DateCompleted=0 and DateDeleted=0"
 #define SELECT_COMPONENTS_BY_COMPLETED_TODOS_AND_DATE \
@@ -716,6 +988,25 @@ public Q_SLOTS:
 "select * from Components where ComponentId in (select distinct ComponentId from Attendee where email=?) and DateCreated<=? and DateDeleted=0 order by DateCreated desc"
 #define SELECT_COMPONENTS_BY_ATTENDEE_AND_CREATED \
 "select * from Components where ComponentId in (select distinct ComponentId from Attendee) and DateCreated<=? and DateDeleted=0 order by DateCreated desc"
+
+// Keyset paged queries, rows strictly after the (date, DateCreated,
+// ComponentId) key of the last row of the previous page.
+#define SELECT_COMPONENTS_BY_COMPLETED_TODOS_AND_DATE_KEYSET \
+"select * from Components where Type='Todo' and DateCompleted<>0 and DateEndDue<>0 and DateDeleted=0 and (DateEndDue, DateCreated, ComponentId)<(?, ?, ?) order by DateEndDue desc, DateCreated desc, ComponentId desc limit ?"
+#define SELECT_COMPONENTS_BY_COMPLETED_TODOS_AND_CREATED_KEYSET \
+"select * from Components where Type='Todo' and DateCompleted<>0 and DateEndDue=0 and DateDeleted=0 and (DateCreated, ComponentId)<(?, ?) order by DateCreated desc, ComponentId desc limit ?"
+#define SELECT_COMPONENTS_BY_DATE_KEYSET \
+"select * from Components where DateEndDue<>0 and DateDeleted=0 and (DateEndDue, DateCreated, ComponentId)<(?, ?, ?) order by DateEndDue desc, DateCreated desc, ComponentId desc limit ?"
+#define SELECT_COMPONENTS_BY_CREATED_KEYSET \
+"select * from Components where DateEndDue=0 and DateDeleted=0 and (DateCreated, ComponentId)<(?, ?) order by DateCreated desc, ComponentId desc limit ?"
+#define SELECT_COMPONENTS_BY_JOURNAL_DATE_KEYSET \
+"select * from Components where Type='Journal' and DateDeleted=0 and (DateStart, DateCreated, ComponentId)<(?, ?, ?) order by DateStart desc, DateCreated desc, ComponentId desc limit ?"
+#define SELECT_COMPONENTS_BY_INVITATION_AND_CREATED_KEYSET \
+"select * from Components where InvitationStatus>1 and DateDeleted=0 and (DateCreated, ComponentId)<(?, ?) order by DateCreated desc, ComponentId desc limit ?"
+#define SELECT_COMPONENTS_BY_ATTENDEE_EMAIL_AND_CREATED_KEYSET \
+"select * from Components where ComponentId in (select distinct ComponentId from Attendee where email=?) and DateDeleted=0 and (DateCreated, ComponentId)<(?, ?) order by DateCreated desc, ComponentId desc limit ?"
+#define SELECT_COMPONENTS_BY_ATTENDEE_AND_CREATED_KEYSET \
+"select * from Components where ComponentId in (select distinct ComponentId from Attendee) and DateDeleted=0 and (DateCreated, ComponentId)<(?, ?) order by DateCreated desc, ComponentId desc limit ?"
 #define SELECT_RDATES_BY_ID \
 "select * from Rdates where ComponentId=?"
 #define SELECT_CUSTOMPROPERTIES_BY_ID \
@@ -726,8 +1017,19 @@ public Q_SLOTS:
 "select * from Alarm where ComponentId=?"
 #define SELECT_ATTENDEE_BY_ID \
 "select * from Attendee where ComponentId=?"
+// The last column tells if large and stored data are only referenced.
 #define SELECT_ATTACHMENTS_BY_ID \
-"select * from Attachments where ComponentId=?"
+"select ComponentId, Data, Uri, MimeType, ShowInLine, Label, Local, 0 from Attachments where ComponentId=?"
+#define SELECT_ATTACHMENTS_REFERENCES_BY_ID \
+"select ComponentId, case when length(Data) > " ATTACHMENT_SIZE_STRING(ATTACHMENT_REFERENCE_SIZE) " and Uri like '" ATTACHMENT_KEY "%' then NULL else Data end, Uri, MimeType, ShowInLine, Label, Local, 1 from Attachments where ComponentId=?"
+#define SELECT_ATTACHMENTS_ROWID_BY_ID \
+"select rowid, Uri from Attachments where ComponentId=?"
+#define SELECT_ATTACHMENTS_BY_REFERENCE \
+"select rowid, length(Data) from Attachments where ComponentId=? and Uri=? limit 1"
+#define SELECT_ATTACHMENTS_STORED_BY_ID \
+"select Uri from Attachments where ComponentId=? and Data is NULL and Uri like 'mkcal-store:%'"
+#define SELECT_ATTACHMENTS_COUNT_BY_URI \
+"select count(*) from Attachments where Uri=?"
 #define SELECT_CALENDARPROPERTIES_BY_ID \
 "select * from Calendarproperties where CalendarId=?"
 #define SELECT_COMPONENTS_BY_DUPLICATE \
@@ -759,8 +1061,12 @@ public Q_SLOTS:
 
 #define BEGIN_TRANSACTION \
 "BEGIN IMMEDIATE;"
+#define BEGIN_READ_TRANSACTION \
+"BEGIN DEFERRED;"
 #define COMMIT_TRANSACTION \
 "END;"
+#define ROLLBACK_TRANSACTION \
+"ROLLBACK;"
 
 }
 
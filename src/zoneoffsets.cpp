@@ -0,0 +1,124 @@
+/*
+  This file is part of the mkcal library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#include "zoneoffsets_p.h"
+
+#include <algorithm>
+
+using namespace mKCal;
+
+// Julian day of 1970-01-01.
+static const qint64 EPOCH_JULIAN_DAY = 2440588;
+
+ZoneOffsets::ZoneOffsets(qint64 start, qint64 end)
+    : mStart(start)
+    , mEnd(end)
+{
+}
+
+const ZoneOffsets::Transitions &ZoneOffsets::transitions(const QTimeZone &zone)
+{
+    QHash<QByteArray, Transitions>::ConstIterator it = mZones.constFind(zone.id());
+    if (it != mZones.constEnd()) {
+        return *it;
+    }
+
+    Transitions transitions;
+    const QDateTime start = QDateTime::fromSecsSinceEpoch(mStart, Qt::UTC);
+    transitions.starts.append(mStart);
+    transitions.offsets.append(zone.offsetFromUtc(start));
+    if (zone.hasTransitions()) {
+        const QTimeZone::OffsetDataList list =
+            zone.transitions(start.addSecs(1), QDateTime::fromSecsSinceEpoch(mEnd, Qt::UTC));
+        for (const QTimeZone::OffsetData &data : list) {
+            transitions.starts.append(data.atUtc.toSecsSinceEpoch());
+            transitions.offsets.append(data.offsetFromUtc);
+        }
+    }
+    return *mZones.insert(zone.id(), transitions);
+}
+
+int ZoneOffsets::intervalAt(const Transitions &transitions, qint64 utc) const
+{
+    if (utc < mStart || utc > mEnd) {
+        return -1;
+    }
+    return int(std::upper_bound(transitions.starts.constBegin(), transitions.starts.constEnd(), utc)
+               - transitions.starts.constBegin()) - 1;
+}
+
+int ZoneOffsets::offsetFromUtc(qint64 utc, const QTimeZone &zone)
+{
+    const Transitions &list = transitions(zone);
+    const int i = intervalAt(list, utc);
+    if (i < 0) {
+        return zone.offsetFromUtc(QDateTime::fromSecsSinceEpoch(utc, Qt::UTC));
+    }
+    return list.offsets[i];
+}
+
+qint64 ZoneOffsets::fromLocal(qint64 local, const QTimeZone &zone)
+{
+    const Transitions &list = transitions(zone);
+    // Look for the intervals around the local time where it is valid.
+    const int around = intervalAt(list, local - list.offsets[0]);
+    if (around >= 0) {
+        int solutions = 0;
+        qint64 utc = 0;
+        for (int i = qMax(0, around - 1); i <= qMin(list.starts.count() - 1, around + 1); i++) {
+            const qint64 candidate = local - list.offsets[i];
+            if (candidate >= list.starts[i] && candidate <= mEnd
+                && (i + 1 == list.starts.count() || candidate < list.starts[i + 1])) {
+                solutions += 1;
+                utc = candidate;
+            }
+        }
+        if (solutions == 1) {
+            return utc;
+        }
+    }
+    // Gaps, overlaps and times out of the window.
+    const QDateTime dt = QDateTime::fromSecsSinceEpoch(local, Qt::UTC);
+    return QDateTime(dt.date(), dt.time(), zone).toSecsSinceEpoch();
+}
+
+qint64 ZoneOffsets::toSecsSinceEpoch(const QDateTime &dateTime, const QTimeZone &zone)
+{
+    if (dateTime.timeSpec() == Qt::LocalTime) {
+        return fromLocal(localSecs(dateTime), zone);
+    }
+    // Other date times already know their offset.
+    return dateTime.toSecsSinceEpoch();
+}
+
+qint64 ZoneOffsets::toLocal(qint64 utc, const QTimeZone &zone)
+{
+    return utc + offsetFromUtc(utc, zone);
+}
+
+QDateTime ZoneOffsets::toDateTime(qint64 utc, const QTimeZone &zone) const
+{
+    return QDateTime::fromSecsSinceEpoch(utc, zone);
+}
+
+qint64 ZoneOffsets::localSecs(const QDateTime &dateTime)
+{
+    return (dateTime.date().toJulianDay() - EPOCH_JULIAN_DAY) * 86400
+        + dateTime.time().msecsSinceStartOfDay() / 1000;
+}
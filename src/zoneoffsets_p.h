@@ -0,0 +1,102 @@
+/*
+  This file is part of the mkcal library.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Library General Public
+  License as published by the Free Software Foundation; either
+  version 2 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Library General Public License for more details.
+
+  You should have received a copy of the GNU Library General Public License
+  along with this library; see the file COPYING.LIB.  If not, write to
+  the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+  Boston, MA 02110-1301, USA.
+*/
+
+#ifndef MKCAL_ZONEOFFSETS_P_H
+#define MKCAL_ZONEOFFSETS_P_H
+
+#include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QTimeZone>
+#include <QtCore/QVector>
+
+namespace mKCal {
+
+/**
+  Converts date times to and from seconds since epoch, using the
+  UTC offset transitions of the time zones over an active window,
+  read once per zone.
+
+  Offsets inside the window are found by a binary search over the
+  transitions. Outside the window, or for local times in a transition
+  gap or overlap, the conversion falls back to QDateTime, so results
+  are always the same as QDateTime ones.
+
+  It is not thread safe, each thread should use its own copy.
+
+  @internal
+*/
+class ZoneOffsets
+{
+public:
+    /**
+      Creates a cache for the window [@p start, @p end], in seconds
+      since epoch.
+    */
+    ZoneOffsets(qint64 start, qint64 end);
+
+    /**
+      Returns the UTC offset of @p zone at @p utc seconds since epoch.
+    */
+    int offsetFromUtc(qint64 utc, const QTimeZone &zone);
+
+    /**
+      Returns the seconds since epoch of a local time in @p zone,
+      itself expressed as seconds since epoch as if it was UTC.
+    */
+    qint64 fromLocal(qint64 local, const QTimeZone &zone);
+
+    /**
+      Returns the seconds since epoch of @p dateTime. Clock times
+      are read in @p zone, like kdatetimeAsTimeSpec() does.
+    */
+    qint64 toSecsSinceEpoch(const QDateTime &dateTime, const QTimeZone &zone);
+
+    /**
+      Returns the local time in @p zone of @p utc, expressed as
+      seconds since epoch as if it was UTC.
+    */
+    qint64 toLocal(qint64 utc, const QTimeZone &zone);
+
+    /**
+      Builds the date time in @p zone for @p utc seconds since epoch.
+    */
+    QDateTime toDateTime(qint64 utc, const QTimeZone &zone) const;
+
+    /**
+      Returns the date and time of @p dateTime as seconds since epoch,
+      as if they were UTC.
+    */
+    static qint64 localSecs(const QDateTime &dateTime);
+
+private:
+    struct Transitions {
+        QVector<qint64> starts;
+        QVector<int> offsets;
+    };
+    const Transitions &transitions(const QTimeZone &zone);
+    int intervalAt(const Transitions &transitions, qint64 utc) const;
+
+    qint64 mStart;
+    qint64 mEnd;
+    QHash<QByteArray, Transitions> mZones;
+};
+
+}
+
+#endif
@@ -20,8 +20,13 @@
 
 #include <QTest>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
 #include <QTimeZone>
+#include <QtConcurrent/QtConcurrentRun>
 
+#include <KCalendarCore/CalFilter>
 #include <KCalendarCore/ICalFormat>
 
 #include "tst_storage.h"
@@ -1969,6 +1974,1467 @@ void tst_storage::tst_attachments()
     QVERIFY(fetched->attachments().isEmpty());
 }
 
+void tst_storage::tst_applyChanges()
+{
+    auto event = KCalendarCore::Event::Ptr(new KCalendarCore::Event);
+    event->setSummary("testing applyChanges(), updated.");
+    event->setDtStart(QDateTime(QDate(2022, 3, 1), QTime(10, 0), Qt::UTC));
+    QVERIFY(m_calendar->addIncidence(event, NotebookId));
+
+    auto obsolete = KCalendarCore::Event::Ptr(new KCalendarCore::Event);
+    obsolete->setSummary("testing applyChanges(), deleted.");
+    obsolete->setDtStart(QDateTime(QDate(2022, 3, 2), QTime(10, 0), Qt::UTC));
+    QVERIFY(m_calendar->addIncidence(obsolete, NotebookId));
+
+    m_storage->save();
+    reloadDb();
+
+    KCalendarCore::Incidence::Ptr loaded = m_calendar->incidence(event->uid());
+    QVERIFY(loaded);
+
+    KCalendarCore::Incidence::Ptr update(event->clone());
+    update->setSummary("testing applyChanges(), new summary.");
+    auto insert = KCalendarCore::Event::Ptr(new KCalendarCore::Event);
+    insert->setSummary("testing applyChanges(), inserted.");
+    insert->setDtStart(QDateTime(QDate(2022, 3, 3), QTime(10, 0), Qt::UTC));
+
+    QVERIFY(m_storage->applyChanges(NotebookId,
+                                    KCalendarCore::Incidence::List() << update << insert,
+                                    KCalendarCore::Incidence::List() << obsolete));
+
+    // Loaded copies are updated in place, others are not loaded.
+    QCOMPARE(m_calendar->incidence(event->uid()), loaded);
+    QCOMPARE(loaded->summary(), update->summary());
+    QVERIFY(!m_calendar->incidence(insert->uid()));
+    QVERIFY(!m_calendar->incidence(obsolete->uid()));
+
+    reloadDb();
+
+    KCalendarCore::Incidence::Ptr fetched = m_calendar->incidence(event->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->summary(), update->summary());
+    fetched = m_calendar->incidence(insert->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->summary(), insert->summary());
+    QVERIFY(!m_calendar->incidence(obsolete->uid()));
+    QVERIFY(m_storage->incidenceDeletedDate(obsolete).isValid());
+
+    // Incidences stored in another notebook are not moved.
+    Notebook::Ptr other(new Notebook(QStringLiteral("applyChanges other"), QString()));
+    QVERIFY(m_storage->addNotebook(other));
+    update->setSummary("testing applyChanges(), other notebook.");
+    QVERIFY(!m_storage->applyChanges(other->uid(), KCalendarCore::Incidence::List() << update,
+                                     KCalendarCore::Incidence::List()));
+    reloadDb();
+    fetched = m_calendar->incidence(event->uid());
+    QVERIFY(fetched);
+    QCOMPARE(m_calendar->notebook(fetched), QString::fromLatin1(NotebookId));
+    QCOMPARE(fetched->summary(), QString::fromLatin1("testing applyChanges(), new summary."));
+
+    // Nor are they deleted from another notebook.
+    QVERIFY(!m_storage->applyChanges(other->uid(), KCalendarCore::Incidence::List(),
+                                     KCalendarCore::Incidence::List() << update));
+    reloadDb();
+    fetched = m_calendar->incidence(event->uid());
+    QVERIFY(fetched);
+    QCOMPARE(m_calendar->notebook(fetched), QString::fromLatin1(NotebookId));
+    QVERIFY(!m_storage->incidenceDeletedDate(fetched).isValid());
+    QVERIFY(m_storage->deleteNotebook(m_storage->notebook(other->uid())));
+}
+
+void tst_storage::tst_manifest()
+{
+    const QByteArray etagName("X-TEST-ETAG");
+
+    auto event = KCalendarCore::Event::Ptr(new KCalendarCore::Event);
+    event->setSummary("testing manifest.");
+    event->setDtStart(QDateTime(QDate(2022, 4, 1), QTime(10, 0), Qt::UTC));
+    event->recurrence()->setDaily(1);
+    event->setNonKDECustomProperty(etagName, QString::fromLatin1("etag-1"));
+    event->setRevision(3);
+    QVERIFY(m_calendar->addIncidence(event, NotebookId));
+
+    KCalendarCore::Incidence::Ptr exception(event->clone());
+    exception->clearRecurrence();
+    exception->setRecurrenceId(event->dtStart().addDays(1));
+    exception->setDtStart(exception->recurrenceId().addSecs(3600));
+    exception->removeNonKDECustomProperty(etagName);
+    QVERIFY(m_calendar->addIncidence(exception, NotebookId));
+
+    m_storage->save();
+    reloadDb();
+
+    mKCal::ExtendedStorage::Manifest manifest;
+    QVERIFY(m_storage->manifest(&manifest, NotebookId, etagName));
+    QCOMPARE(manifest.count(), 2);
+    for (const mKCal::ExtendedStorage::ManifestEntry &entry : manifest) {
+        KCalendarCore::Incidence::Ptr fetched = m_calendar->incidence(entry.uid, entry.recurrenceId);
+        QVERIFY(fetched);
+        QCOMPARE(entry.lastModified, fetched->lastModified());
+        QCOMPARE(entry.revision, fetched->revision());
+        QCOMPARE(entry.customPropertyValue, fetched->nonKDECustomProperty(etagName));
+    }
+
+    manifest.clear();
+    QVERIFY(m_storage->manifestByCustomProperty(&manifest, etagName, QString::fromLatin1("etag-1")));
+    QCOMPARE(manifest.count(), 1);
+    QCOMPARE(manifest[0].uid, event->uid());
+    QVERIFY(!manifest[0].recurrenceId.isValid());
+    QCOMPARE(manifest[0].revision, 3);
+    QCOMPARE(manifest[0].customPropertyValue, QString::fromLatin1("etag-1"));
+}
+
+void tst_storage::tst_loadHeaderOnly()
+{
+    auto event = KCalendarCore::Event::Ptr(new KCalendarCore::Event);
+    event->setSummary("testing header only load.");
+    event->setDtStart(QDateTime(QDate(2022, 5, 10), QTime(10, 0), Qt::UTC));
+    event->setNonKDECustomProperty("X-TEST-PROPERTY", QString::fromLatin1("value"));
+    event->addAttendee(KCalendarCore::Attendee(QString::fromLatin1("Alice"),
+                                               QString::fromLatin1("alice@example.org")));
+    KCalendarCore::Alarm::Ptr alarm = event->newAlarm();
+    alarm->setDisplayAlarm(QString::fromLatin1("testing header only load."));
+    alarm->setStartOffset(KCalendarCore::Duration(-600));
+    alarm->setEnabled(true);
+    QVERIFY(m_calendar->addIncidence(event, NotebookId));
+    m_storage->save();
+
+    m_storage.clear();
+    m_calendar.clear();
+    m_calendar = ExtendedCalendar::Ptr(new ExtendedCalendar(QTimeZone::systemTimeZone()));
+    m_storage = m_calendar->defaultStorage(m_calendar);
+    QVERIFY(m_storage->open());
+    QVERIFY(m_storage->load(QDate(2022, 5, 1), QDate(2022, 6, 1),
+                            mKCal::ExtendedStorage::HeaderOnly));
+
+    KCalendarCore::Incidence::Ptr fetched = m_calendar->incidence(event->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->summary(), event->summary());
+    QCOMPARE(fetched->dtStart(), event->dtStart());
+    QVERIFY(fetched->attendees().isEmpty());
+    QVERIFY(fetched->alarms().isEmpty());
+    QVERIFY(fetched->customProperties().isEmpty());
+
+    // Saving a partial incidence keeps the data that were not loaded.
+    fetched->setSummary("testing header only load, updated.");
+    QVERIFY(m_storage->save());
+
+    const QDateTime lastModified = fetched->lastModified();
+    QVERIFY(m_storage->notifyOpened(fetched));
+    QCOMPARE(m_calendar->incidence(event->uid()), fetched);
+    QCOMPARE(fetched->lastModified(), lastModified);
+    QCOMPARE(fetched->attendees().count(), 1);
+    QCOMPARE(fetched->alarms().count(), 1);
+    QCOMPARE(fetched->nonKDECustomProperty("X-TEST-PROPERTY"), QString::fromLatin1("value"));
+    QVERIFY(!m_storage->notifyOpened(fetched));
+
+    reloadDb();
+    fetched = m_calendar->incidence(event->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->summary(), QString::fromLatin1("testing header only load, updated."));
+    QCOMPARE(fetched->attendees().count(), 1);
+    QCOMPARE(fetched->alarms().count(), 1);
+    QCOMPARE(fetched->nonKDECustomProperty("X-TEST-PROPERTY"), QString::fromLatin1("value"));
+
+    // A header only load does not prevent a later full load of the range.
+    m_storage.clear();
+    m_calendar.clear();
+    m_calendar = ExtendedCalendar::Ptr(new ExtendedCalendar(QTimeZone::systemTimeZone()));
+    m_storage = m_calendar->defaultStorage(m_calendar);
+    QVERIFY(m_storage->open());
+    QVERIFY(m_storage->load(QDate(2022, 5, 1), QDate(2022, 6, 1),
+                            mKCal::ExtendedStorage::HeaderOnly));
+    QVERIFY(m_calendar->incidence(event->uid())->attendees().isEmpty());
+    QVERIFY(m_storage->load(QDate(2022, 5, 1), QDate(2022, 6, 1)));
+    fetched = m_calendar->incidence(event->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->attendees().count(), 1);
+    QCOMPARE(fetched->alarms().count(), 1);
+}
+
+void tst_storage::tst_headerOnlyAlarms()
+{
+    Notebook::Ptr notebook = Notebook::Ptr(new Notebook(QStringLiteral("Notebook for header only alarms"), QString()));
+    QVERIFY(m_storage->addNotebook(notebook));
+    const QString uid = notebook->uid();
+
+    const QDateTime dt(QDate::currentDate().addDays(2), QTime(10, 0), Qt::UTC);
+    KCalendarCore::Event::Ptr event = KCalendarCore::Event::Ptr(new KCalendarCore::Event);
+    event->setSummary("testing header only alarms.");
+    event->setDtStart(dt);
+    KCalendarCore::Alarm::Ptr alarm = event->newAlarm();
+    alarm->setDisplayAlarm(QLatin1String("Testing alarm"));
+    alarm->setStartOffset(KCalendarCore::Duration(-600));
+    alarm->setEnabled(true);
+    QVERIFY(m_calendar->addEvent(event, uid));
+    QVERIFY(m_storage->save());
+
+    m_storage.clear();
+    m_calendar.clear();
+    m_calendar = ExtendedCalendar::Ptr(new ExtendedCalendar(QTimeZone::systemTimeZone()));
+    m_storage = m_calendar->defaultStorage(m_calendar);
+    QVERIFY(m_storage->open());
+    QVERIFY(m_storage->load(dt.date().addDays(-1), dt.date().addDays(2),
+                            mKCal::ExtendedStorage::HeaderOnly));
+
+    KCalendarCore::Incidence::Ptr fetched = m_calendar->incidence(event->uid());
+    QVERIFY(fetched);
+    QVERIFY(fetched->alarms().isEmpty());
+
+    // Moving a partial incidence reschedules its stored alarms.
+    const QDateTime moved = dt.addSecs(7200);
+    fetched->setDtStart(moved);
+    QVERIFY(m_storage->save());
+    QVERIFY(fetched->alarms().isEmpty());
+
+#if defined(TIMED_SUPPORT)
+    QMap<QString, QVariant> map;
+    map["APPLICATION"] = "libextendedkcal";
+    map["notebook"] = uid;
+    map["uid"] = event->uid();
+
+    Timed::Interface timed;
+    QVERIFY(timed.isValid());
+    QDBusReply<QList<QVariant> > reply = timed.query_sync(map);
+    QVERIFY(reply.isValid());
+    QCOMPARE(reply.value().size(), 1);
+
+    map["startDate"] = moved.toTimeSpec(Qt::OffsetFromUTC).toString(Qt::ISODate);
+    reply = timed.query_sync(map);
+    QVERIFY(reply.isValid());
+    QCOMPARE(reply.value().size(), 1);
+#endif
+
+    reloadDb(dt.date().addDays(-1), dt.date().addDays(2));
+    fetched = m_calendar->incidence(event->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->dtStart(), moved);
+    QCOMPARE(fetched->alarms().count(), 1);
+
+    QVERIFY(m_storage->deleteNotebook(m_storage->notebook(uid)));
+}
+
+void tst_storage::tst_largeAttachments()
+{
+    QByteArray data(200000, 'a');
+    for (int i = 0; i < data.size(); i += 7) {
+        data[i] = char('a' + (i % 26));
+    }
+    const QDate date(2024, 11, 4);
+    auto event = KCalendarCore::Event::Ptr(new KCalendarCore::Event);
+    event->setSummary("testing large attachments.");
+    event->setDtStart(QDateTime(date, QTime(10, 0), QTimeZone::systemTimeZone()));
+    KCalendarCore::Attachment binAttach(data.toBase64(), QString::fromUtf8("video/ogg"));
+    binAttach.setLabel(QString::fromUtf8("Large video"));
+    event->addAttachment(binAttach);
+    QVERIFY(m_calendar->addIncidence(event, NotebookId));
+    m_storage->save();
+
+    // Data are read by default.
+    reloadDb();
+    KCalendarCore::Incidence::Ptr fetched = m_calendar->incidence(event->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->attachments().length(), 1);
+    QVERIFY(fetched->attachments()[0].isBinary());
+    QCOMPARE(fetched->attachments()[0].decodedData(), data);
+
+    reloadDb(QDate(2000, 1, 1), QDate(2000, 1, 2));
+    m_storage.staticCast<SqliteStorage>()->setAttachmentReferences(true);
+    QVERIFY(m_storage->load(date));
+    fetched = m_calendar->incidence(event->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->attachments().length(), 1);
+    KCalendarCore::Attachment reference = fetched->attachments()[0];
+    QVERIFY(reference.isUri());
+    QCOMPARE(reference.mimeType(), binAttach.mimeType());
+    QCOMPARE(reference.label(), binAttach.label());
+
+    QScopedPointer<QIODevice> device(m_storage->attachmentData(reference));
+    QVERIFY(!device.isNull());
+    QCOMPARE(device->size(), qint64(data.size()));
+    QCOMPARE(device->read(10), data.left(10));
+    QVERIFY(device->seek(100000));
+    QCOMPARE(device->readAll(), data.mid(100000));
+    QVERIFY(!m_storage->attachmentData(binAttach));
+
+    // Data are kept when saving references.
+    fetched->setSummary("testing large attachments, updated.");
+    m_storage->save();
+    reloadDb(QDate(2000, 1, 1), QDate(2000, 1, 2));
+    m_storage.staticCast<SqliteStorage>()->setAttachmentReferences(true);
+    QVERIFY(m_storage->load(date));
+    fetched = m_calendar->incidence(event->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->attachments().length(), 1);
+    device.reset(m_storage->attachmentData(fetched->attachments()[0]));
+    QVERIFY(!device.isNull());
+    QCOMPARE(device->readAll(), data);
+
+    // Data are copied when referenced from another incidence.
+    KCalendarCore::Incidence::Ptr copy(fetched->clone());
+    copy->setUid(KCalendarCore::CalFormat::createUniqueId());
+    QVERIFY(m_calendar->addIncidence(copy, NotebookId));
+    m_storage->save();
+    reloadDb();
+    fetched = m_calendar->incidence(copy->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->attachments().length(), 1);
+    QCOMPARE(fetched->attachments()[0].decodedData(), data);
+    QCOMPARE(m_calendar->incidence(event->uid())->attachments()[0].decodedData(), data);
+}
+
+void tst_storage::tst_attachmentStore()
+{
+    QByteArray data(5000, 'b');
+    for (int i = 0; i < data.size(); i += 3) {
+        data[i] = char('a' + (i % 26));
+    }
+    const QDate date(2024, 11, 5);
+    KCalendarCore::Attachment binAttach(data.toBase64(), QString::fromUtf8("image/png"));
+    auto event1 = KCalendarCore::Event::Ptr(new KCalendarCore::Event);
+    event1->setSummary("testing attachment store.");
+    event1->setDtStart(QDateTime(date, QTime(10, 0), QTimeZone::systemTimeZone()));
+    event1->addAttachment(binAttach);
+    QVERIFY(m_calendar->addIncidence(event1, NotebookId));
+    auto event2 = KCalendarCore::Event::Ptr(new KCalendarCore::Event);
+    event2->setSummary("testing attachment store, again.");
+    event2->addAttachment(binAttach);
+    QVERIFY(m_calendar->addIncidence(event2, NotebookId));
+
+    QSharedPointer<SqliteStorage> storage = m_storage.staticCast<SqliteStorage>();
+    storage->setAttachmentStoreThreshold(1000);
+    QCOMPARE(storage->attachmentStoreThreshold(), qint64(1000));
+    QVERIFY(m_storage->save());
+    QDir store(storage->attachmentStorePath());
+    QCOMPARE(store.entryList(QDir::Files).count(), 1);
+    storage.clear();
+
+    // Stored data are read from their file by default.
+    reloadDb();
+    KCalendarCore::Incidence::Ptr fetched = m_calendar->incidence(event2->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->attachments().length(), 1);
+    QVERIFY(fetched->attachments()[0].isBinary());
+    QCOMPARE(fetched->attachments()[0].decodedData(), data);
+
+    reloadDb(QDate(2000, 1, 1), QDate(2000, 1, 2));
+    m_storage.staticCast<SqliteStorage>()->setAttachmentReferences(true);
+    QVERIFY(m_storage->load(date));
+    fetched = m_calendar->incidence(event1->uid());
+    QVERIFY(fetched);
+    QCOMPARE(fetched->attachments().length(), 1);
+    QVERIFY(fetched->attachments()[0].isUri());
+    QCOMPARE(fetched->attachments()[0].mimeType(), binAttach.mimeType());
+    QScopedPointer<QIODevice> device(m_storage->attachmentData(fetched->attachments()[0]));
+    QVERIFY(!device.isNull());
+    QCOMPARE(device->size(), qint64(data.size()));
+    QCOMPARE(device->readAll(), data);
+    // Stored data can be accessed without copy.
+    QFile *file = qobject_cast<QFile *>(device.data());
+    QVERIFY(file);
+    const uchar *mapped = file->map(0, file->size());
+    QVERIFY(mapped);
+    QCOMPARE(QByteArray::fromRawData(reinterpret_cast<const char *>(mapped), data.size()), data);
+    device.reset();
+
+    // Stored data are kept as long as one attachment uses them.
+    QVERIFY(m_calendar->deleteIncidence(fetched));
+    QVERIFY(m_storage->save(ExtendedStorage::PurgeDeleted));
+    QCOMPARE(store.entryList(QDir::Files).count(), 1);
+    QVERIFY(m_storage->load(event2->uid()));
+    fetched = m_calendar->incidence(event2->uid());
+    QVERIFY(fetched);
+    QVERIFY(m_calendar->deleteIncidence(fetched));
+    QVERIFY(m_storage->save(ExtendedStorage::PurgeDeleted));
+    QCOMPARE(store.entryList(QDir::Files).count(), 0);
+}
+
+void tst_storage::tst_intervalIndex()
+{
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(QTimeZone::utc()));
+    const QString notebook = QStringLiteral("interval-index");
+    QVERIFY(calendar->addNotebook(notebook, true));
+
+    // Enough events to have some indexed and others pending.
+    const QDateTime origin(QDate(2021, 3, 1), QTime(10, 0), Qt::UTC);
+    for (int i = 0; i < 100; i++) {
+        KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+        event->setDtStart(origin.addDays(7 * i));
+        event->setDtEnd(origin.addDays(7 * i).addSecs(3600));
+        QVERIFY(calendar->addEvent(event, notebook));
+    }
+    QCOMPARE(calendar->rawExpandedEvents(origin.date(), origin.date().addDays(6)).count(), 1);
+
+    KCalendarCore::Event::Ptr recurring(new KCalendarCore::Event);
+    recurring->setDtStart(origin.addDays(-100).addSecs(7200));
+    recurring->setDtEnd(origin.addDays(-100).addSecs(9000));
+    recurring->recurrence()->setDaily(1);
+    QVERIFY(calendar->addEvent(recurring, notebook));
+    KCalendarCore::Event::Ptr moved(new KCalendarCore::Event);
+    moved->setDtStart(origin.addDays(-50));
+    moved->setDtEnd(origin.addDays(-50).addSecs(3600));
+    QVERIFY(calendar->addEvent(moved, notebook));
+    KCalendarCore::Journal::Ptr journal(new KCalendarCore::Journal);
+    journal->setDtStart(origin.addDays(3));
+    QVERIFY(calendar->addJournal(journal, notebook));
+
+    mKCal::ExtendedCalendar::ExpandedIncidenceList events
+        = calendar->rawExpandedEvents(origin.date(), origin.date().addDays(6));
+    QCOMPARE(events.count(), 1 + 7);
+    QCOMPARE(calendar->incidences(true, origin, origin.addDays(6)).count(), 1 + 1 + 1);
+    QCOMPARE(calendar->journals(origin.date(), origin.date().addDays(6)).count(), 1);
+    // Series recurring forever are listed even before they start.
+    QCOMPARE(calendar->incidences(true, origin.addDays(-300), origin.addDays(-299)),
+             KCalendarCore::Incidence::List() << recurring);
+
+    // Modified incidences are found at their new position only.
+    moved->setDtStart(origin.addDays(1));
+    moved->setDtEnd(origin.addDays(1).addSecs(3600));
+    recurring->recurrence()->setDuration(100);
+    events = calendar->rawExpandedEvents(origin.date(), origin.date().addDays(6));
+    QCOMPARE(events.count(), 1 + 1);
+    QVERIFY(calendar->rawExpandedEvents(origin.date().addDays(-50), origin.date().addDays(-50)).count() == 1);
+    QCOMPARE(calendar->nextEventsDate(origin.date()), origin.date().addDays(1));
+    QCOMPARE(calendar->previousEventsDate(origin.date().addDays(1)), origin.date());
+
+    QVERIFY(calendar->deleteEvent(moved));
+    QCOMPARE(calendar->rawExpandedEvents(origin.date(), origin.date().addDays(6)).count(), 1);
+    QCOMPARE(calendar->rawExpandedEvents(origin.date().addDays(693), origin.date().addDays(699)).count(), 1);
+
+    // Todos due before their start are found at their due date.
+    KCalendarCore::Todo::Ptr todo(new KCalendarCore::Todo);
+    todo->setDtStart(origin.addDays(-200));
+    todo->setDtDue(origin.addDays(-210));
+    QVERIFY(calendar->addTodo(todo, notebook));
+    QCOMPARE(calendar->incidences(true, origin.addDays(-211), origin.addDays(-209)).count(), 1);
+}
+
+void tst_storage::tst_occurrenceIterator()
+{
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(QTimeZone::utc()));
+    const QString notebook = QStringLiteral("occurrence-iterator");
+    QVERIFY(calendar->addNotebook(notebook, true));
+
+    const QDateTime origin(QDate(2021, 6, 1), QTime(12, 0), Qt::UTC);
+    KCalendarCore::Event::Ptr daily(new KCalendarCore::Event);
+    daily->setDtStart(origin.addDays(-1000).addSecs(3600));
+    daily->setDtEnd(origin.addDays(-1000).addSecs(7200));
+    daily->recurrence()->setDaily(1);
+    QVERIFY(calendar->addEvent(daily, notebook));
+    KCalendarCore::Event::Ptr weekly(new KCalendarCore::Event);
+    weekly->setDtStart(origin.addDays(-500).addSecs(1800));
+    weekly->setDtEnd(origin.addDays(-500).addSecs(2 * 3600));
+    weekly->recurrence()->setWeekly(1);
+    QVERIFY(calendar->addEvent(weekly, notebook));
+    KCalendarCore::Event::Ptr ongoing(new KCalendarCore::Event);
+    ongoing->setDtStart(origin.addSecs(-600));
+    ongoing->setDtEnd(origin.addSecs(600));
+    QVERIFY(calendar->addEvent(ongoing, notebook));
+    KCalendarCore::Event::Ptr past(new KCalendarCore::Event);
+    past->setDtStart(origin.addDays(-2));
+    past->setDtEnd(origin.addDays(-2).addSecs(600));
+    QVERIFY(calendar->addEvent(past, notebook));
+
+    // Occurrences are returned in start order, including the ongoing one.
+    const KCalendarCore::Incidence::Ptr expectedForward[] = {ongoing, daily, daily, daily, daily, weekly, daily};
+    const QDateTime forwardStarts[] = {origin.addSecs(-600), origin.addSecs(3600),
+                                       origin.addDays(1).addSecs(3600), origin.addDays(2).addSecs(3600),
+                                       origin.addDays(3).addSecs(3600), origin.addDays(4).addSecs(1800),
+                                       origin.addDays(4).addSecs(3600)};
+    ExtendedCalendar::OccurrenceIterator forward(*calendar, origin);
+    for (int i = 0; i < 7; i++) {
+        QVERIFY(forward.hasNext());
+        const ExtendedCalendar::ExpandedIncidence occurrence = forward.next();
+        QCOMPARE(occurrence.second, expectedForward[i]);
+        QCOMPARE(occurrence.first.dtStart, forwardStarts[i]);
+    }
+    QVERIFY(forward.hasNext());
+
+    // Backward, occurrences are returned in end order.
+    const KCalendarCore::Incidence::Ptr expectedBackward[] = {ongoing, daily, daily, past, daily, weekly};
+    const QDateTime backwardEnds[] = {origin.addSecs(600), origin.addDays(-1).addSecs(7200),
+                                      origin.addDays(-2).addSecs(7200), origin.addDays(-2).addSecs(600),
+                                      origin.addDays(-3).addSecs(7200), origin.addDays(-3).addSecs(7200)};
+    ExtendedCalendar::OccurrenceIterator backward(*calendar, origin,
+                                                  ExtendedCalendar::OccurrenceIterator::Backward);
+    for (int i = 0; i < 6; i++) {
+        QVERIFY(backward.hasNext());
+        const ExtendedCalendar::ExpandedIncidence occurrence = backward.next();
+        QCOMPARE(occurrence.second, expectedBackward[i]);
+        QCOMPARE(occurrence.first.dtEnd, backwardEnds[i]);
+    }
+
+    // Iteration ends with the last occurrence.
+    ExtendedCalendar::OccurrenceIterator list(KCalendarCore::Incidence::List() << past << ongoing,
+                                              origin, ExtendedCalendar::OccurrenceIterator::Forward,
+                                              QTimeZone::utc());
+    QVERIFY(list.hasNext());
+    QCOMPARE(list.next().second, ongoing.staticCast<KCalendarCore::Incidence>());
+    QVERIFY(!list.hasNext());
+
+    QCOMPARE(calendar->nextEventsDate(origin.date()), origin.date().addDays(1));
+    QCOMPARE(calendar->previousEventsDate(origin.date()), origin.date().addDays(-1));
+}
+
+void tst_storage::tst_parallelExpansion()
+{
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(QTimeZone::utc()));
+    const QString notebook = QStringLiteral("parallel-expansion");
+    QVERIFY(calendar->addNotebook(notebook, true));
+    QVERIFY(!calendar->parallelExpansion());
+
+    const QDateTime origin(QDate(2021, 1, 1), QTime(0, 0), Qt::UTC);
+    for (int i = 0; i < 500; i++) {
+        KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+        event->setDtStart(origin.addSecs(60 * i));
+        event->setDtEnd(origin.addSecs(60 * i + 1800));
+        if (i % 2) {
+            event->recurrence()->setDaily(1 + i % 5);
+        }
+        QVERIFY(calendar->addEvent(event, notebook));
+    }
+    KCalendarCore::Incidence::List incidences = calendar->incidences();
+
+    bool serialLimitHit = false;
+    const ExtendedCalendar::ExpandedIncidenceList serial =
+        calendar->expandRecurrences(&incidences, origin.addDays(10), origin.addDays(40), 10, &serialLimitHit);
+    const ExtendedCalendar::ExpandedIncidenceList serialRaw =
+        calendar->rawExpandedEvents(origin.date().addDays(10), origin.date().addDays(40));
+
+    calendar->setParallelExpansion(true);
+    QVERIFY(calendar->parallelExpansion());
+    bool parallelLimitHit = false;
+    const ExtendedCalendar::ExpandedIncidenceList parallel =
+        calendar->expandRecurrences(&incidences, origin.addDays(10), origin.addDays(40), 10, &parallelLimitHit);
+    const ExtendedCalendar::ExpandedIncidenceList parallelRaw =
+        calendar->rawExpandedEvents(origin.date().addDays(10), origin.date().addDays(40));
+
+    QVERIFY(!serial.isEmpty());
+    QCOMPARE(parallel.count(), serial.count());
+    QCOMPARE(parallelLimitHit, serialLimitHit);
+    for (int i = 0; i < serial.count(); i++) {
+        QCOMPARE(parallel[i].first.dtStart, serial[i].first.dtStart);
+        QCOMPARE(parallel[i].second, serial[i].second);
+    }
+
+    QVERIFY(!serialRaw.isEmpty());
+    QCOMPARE(parallelRaw.count(), serialRaw.count());
+    QSet<QPair<QString, qint64>> serialSet;
+    for (const ExtendedCalendar::ExpandedIncidence &occurrence : serialRaw) {
+        serialSet.insert(qMakePair(occurrence.second->uid(), occurrence.first.dtStart.toSecsSinceEpoch()));
+    }
+    for (const ExtendedCalendar::ExpandedIncidence &occurrence : parallelRaw) {
+        QVERIFY(serialSet.contains(qMakePair(occurrence.second->uid(),
+                                             occurrence.first.dtStart.toSecsSinceEpoch())));
+    }
+}
+
+void tst_storage::tst_recurrenceTimesCache()
+{
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(QTimeZone::utc()));
+    const QString notebook = QStringLiteral("recurrence-times-cache");
+    QVERIFY(calendar->addNotebook(notebook, true));
+
+    const QDateTime origin(QDate(2021, 1, 4), QTime(9, 0), Qt::UTC);
+    KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+    event->setDtStart(origin);
+    event->setDtEnd(origin.addSecs(3600));
+    event->recurrence()->setDaily(1);
+    QVERIFY(calendar->addEvent(event, notebook));
+
+    // Adjacent and overlapping windows, back and forth.
+    const QDate january(2021, 1, 1);
+    QCOMPARE(calendar->rawExpandedEvents(january, january.addMonths(1).addDays(-1)).count(), 28);
+    QCOMPARE(calendar->rawExpandedEvents(january.addMonths(1), january.addMonths(2).addDays(-1)).count(), 28);
+    QCOMPARE(calendar->rawExpandedEvents(january, january.addMonths(1).addDays(-1)).count(), 28);
+    QCOMPARE(calendar->rawExpandedEvents(january.addMonths(-1), january.addDays(-1)).count(), 0);
+    QCOMPARE(calendar->rawExpandedEvents(january.addDays(10), january.addDays(50)).count(), 41);
+
+    // Modifications are taken into account.
+    event->recurrence()->addExDateTime(origin.addDays(10));
+    QCOMPARE(calendar->rawExpandedEvents(january, january.addMonths(1).addDays(-1)).count(), 27);
+    event->recurrence()->setDuration(7);
+    QCOMPARE(calendar->rawExpandedEvents(january, january.addMonths(1).addDays(-1)).count(), 7);
+    QCOMPARE(calendar->rawExpandedEvents(january.addMonths(1), january.addMonths(2).addDays(-1)).count(), 0);
+
+    // Also for time zone changes.
+    calendar->setTimeZone(QTimeZone("Europe/Helsinki"));
+    QCOMPARE(calendar->rawExpandedEvents(january, january.addMonths(1).addDays(-1)).count(), 7);
+
+    QVERIFY(calendar->deleteEvent(event));
+    QCOMPARE(calendar->rawExpandedEvents(january, january.addMonths(1).addDays(-1)).count(), 0);
+}
+
+void tst_storage::tst_expansionAcrossTransitions()
+{
+    const QTimeZone helsinki("Europe/Helsinki");
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(helsinki));
+    const QString notebook = QStringLiteral("expansion-transitions");
+    QVERIFY(calendar->addNotebook(notebook, true));
+
+    // Clock time events, read in the expansion time zone.
+    KCalendarCore::Event::Ptr floating(new KCalendarCore::Event);
+    floating->setDtStart(QDateTime(QDate(2021, 3, 20), QTime(9, 0), Qt::LocalTime));
+    floating->setDtEnd(QDateTime(QDate(2021, 3, 20), QTime(10, 0), Qt::LocalTime));
+    floating->recurrence()->setDaily(1);
+    QVERIFY(calendar->addEvent(floating, notebook));
+    // Day long events, keeping their local time over the transition.
+    KCalendarCore::Event::Ptr daily(new KCalendarCore::Event);
+    daily->setDtStart(QDateTime(QDate(2021, 3, 20), QTime(12, 0), helsinki));
+    daily->setDtEnd(QDateTime(QDate(2021, 3, 21), QTime(12, 0), helsinki));
+    daily->recurrence()->setDaily(1);
+    QVERIFY(calendar->addEvent(daily, notebook));
+
+    const ExtendedCalendar::ExpandedIncidenceList events =
+        calendar->rawExpandedEvents(QDate(2021, 3, 25), QDate(2021, 3, 31), false, false, helsinki);
+    int floatingCount = 0;
+    for (const ExtendedCalendar::ExpandedIncidence &occurrence : events) {
+        const QDateTime start = occurrence.first.dtStart.toTimeZone(helsinki);
+        const QDateTime end = occurrence.first.dtEnd.toTimeZone(helsinki);
+        if (occurrence.second == floating) {
+            floatingCount += 1;
+            QCOMPARE(start.time(), QTime(9, 0));
+            QCOMPARE(end.time(), QTime(10, 0));
+        } else {
+            QCOMPARE(start.time(), QTime(12, 0));
+            QCOMPARE(end.time(), QTime(12, 0));
+            QCOMPARE(start.daysTo(end), qint64(1));
+        }
+    }
+    QCOMPARE(floatingCount, 7);
+    QCOMPARE(events.count(), 7 + 8);
+}
+
+void tst_storage::tst_occurrenceTable()
+{
+    const QTimeZone tz("Europe/Helsinki");
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(tz));
+    const QString notebookA = QStringLiteral("occurrence-table-a");
+    const QString notebookB = QStringLiteral("occurrence-table-b");
+    QVERIFY(calendar->addNotebook(notebookA, true));
+    QVERIFY(calendar->addNotebook(notebookB, true));
+
+    // A daily meeting, a two days transparent event and an all day event.
+    KCalendarCore::Event::Ptr daily(new KCalendarCore::Event);
+    daily->setDtStart(QDateTime(QDate(2022, 5, 1), QTime(10, 0), tz));
+    daily->setDtEnd(QDateTime(QDate(2022, 5, 1), QTime(11, 0), tz));
+    daily->recurrence()->setDaily(1);
+    QVERIFY(calendar->addEvent(daily, notebookA));
+    KCalendarCore::Event::Ptr trip(new KCalendarCore::Event);
+    trip->setDtStart(QDateTime(QDate(2022, 5, 3), QTime(18, 0), tz));
+    trip->setDtEnd(QDateTime(QDate(2022, 5, 5), QTime(8, 0), tz));
+    trip->setTransparency(KCalendarCore::Event::Transparent);
+    QVERIFY(calendar->addEvent(trip, notebookB));
+    KCalendarCore::Event::Ptr holiday(new KCalendarCore::Event);
+    holiday->setDtStart(QDateTime(QDate(2022, 5, 6), QTime(0, 0), tz));
+    holiday->setDtEnd(QDateTime(QDate(2022, 5, 6), QTime(0, 0), tz));
+    holiday->setAllDay(true);
+    QVERIFY(calendar->addEvent(holiday, notebookB));
+
+    const QDate first(2022, 5, 2);
+    const QDate last(2022, 5, 8);
+    const ExtendedCalendar::ExpandedIncidenceList events =
+        calendar->rawExpandedEvents(first, last, false, false, tz);
+    const OccurrenceTable table = calendar->occurrenceTable(first, last, false, false, tz);
+    QCOMPARE(table.count(), events.count());
+    QCOMPARE(table.count(), 7 + 1 + 1);
+    QCOMPARE(table.incidences().count(), 3);
+    QCOMPARE(table.notebooks().count(), 2);
+
+    // Rows are sorted and match the expanded events.
+    for (int row = 0; row < table.count(); row++) {
+        if (row > 0) {
+            QVERIFY(table.starts()[row - 1] <= table.starts()[row]);
+        }
+        bool found = false;
+        for (const ExtendedCalendar::ExpandedIncidence &event : events) {
+            found = found || (event.second == table.incidence(row)
+                              && event.first.dtStart == table.startDateTime(row, tz)
+                              && event.first.dtEnd == table.endDateTime(row, tz));
+        }
+        QVERIFY(found);
+        QCOMPARE(table.notebook(row), calendar->notebook(table.incidence(row)));
+        const quint8 flags = table.flags()[row];
+        QCOMPARE(bool(flags & OccurrenceTable::Recurring), table.incidence(row) == daily);
+        QCOMPARE(bool(flags & OccurrenceTable::Transparent), table.incidence(row) == trip);
+        QCOMPARE(bool(flags & OccurrenceTable::AllDay), table.incidence(row) == holiday);
+    }
+
+    // Range filter over the 4th of May.
+    const qint64 dayStart = QDateTime(QDate(2022, 5, 4), QTime(0, 0), tz).toSecsSinceEpoch();
+    const QVector<int> rows = table.rowsIntersecting(dayStart, dayStart + 86400);
+    QCOMPARE(rows.count(), 2);
+    QCOMPARE(table.incidence(rows[0]), KCalendarCore::Incidence::Ptr(trip));
+    QCOMPARE(table.incidence(rows[1]), KCalendarCore::Incidence::Ptr(daily));
+
+    // Day buckets, the trip overlaps three days.
+    QVector<int> bucketRows;
+    const QVector<int> offsets = table.dayBuckets(first, 7, tz, &bucketRows);
+    const QVector<int> counts = table.dayCounts(first, 7, tz);
+    const QVector<int> expected = {1, 2, 2, 2, 2, 1, 1};
+    QCOMPARE(offsets.count(), 8);
+    QCOMPARE(counts, expected);
+    for (int day = 0; day < 7; day++) {
+        QCOMPARE(offsets[day + 1] - offsets[day], expected[day]);
+    }
+    QCOMPARE(bucketRows.count(), offsets.last());
+}
+
+void tst_storage::tst_dayOccupancy()
+{
+    const QTimeZone tz("Europe/Helsinki");
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(tz));
+    const QString work = QStringLiteral("occupancy-work");
+    const QString home = QStringLiteral("occupancy-home");
+    QVERIFY(calendar->addNotebook(work, true));
+    QVERIFY(calendar->addNotebook(home, true));
+
+    // Weekly on Mondays in work, a two days event in home.
+    KCalendarCore::Event::Ptr weekly(new KCalendarCore::Event);
+    weekly->setDtStart(QDateTime(QDate(2023, 1, 2), QTime(9, 0), tz));
+    weekly->setDtEnd(QDateTime(QDate(2023, 1, 2), QTime(10, 0), tz));
+    weekly->recurrence()->setWeekly(1);
+    QVERIFY(calendar->addEvent(weekly, work));
+    KCalendarCore::Event::Ptr weekend(new KCalendarCore::Event);
+    weekend->setDtStart(QDateTime(QDate(2023, 1, 31), QTime(12, 0), tz));
+    weekend->setDtEnd(QDateTime(QDate(2023, 2, 1), QTime(12, 0), tz));
+    QVERIFY(calendar->addEvent(weekend, home));
+
+    const QDate start(2023, 1, 1);
+    const QDate end(2023, 2, 28);
+    QVector<int> counts = calendar->dayOccupancy(start, end);
+    QCOMPARE(counts.count(), 59);
+    for (int i = 0; i < counts.count(); i++) {
+        const QDate day = start.addDays(i);
+        const int expected = (day.dayOfWeek() == 1 ? 1 : 0)
+            + ((day == QDate(2023, 1, 31) || day == QDate(2023, 2, 1)) ? 1 : 0);
+        QCOMPARE(counts[i], expected);
+    }
+
+    // Per notebook counts.
+    counts = calendar->dayOccupancy(start, end, QStringList() << home);
+    QCOMPARE(counts[start.daysTo(QDate(2023, 1, 2))], 0);
+    QCOMPARE(counts[start.daysTo(QDate(2023, 1, 31))], 1);
+    QCOMPARE(counts[start.daysTo(QDate(2023, 2, 1))], 1);
+
+    // Modifications invalidate the cached months.
+    KCalendarCore::Event::Ptr extra(new KCalendarCore::Event);
+    extra->setDtStart(QDateTime(QDate(2023, 2, 14), QTime(18, 0), tz));
+    extra->setDtEnd(QDateTime(QDate(2023, 2, 14), QTime(20, 0), tz));
+    QVERIFY(calendar->addEvent(extra, home));
+    QCOMPARE(calendar->dayOccupancy(QDate(2023, 2, 14), QDate(2023, 2, 14)), QVector<int>() << 1);
+    weekend->setDtStart(QDateTime(QDate(2023, 2, 14), QTime(12, 0), tz));
+    weekend->setDtEnd(QDateTime(QDate(2023, 2, 14), QTime(13, 0), tz));
+    QCOMPARE(calendar->dayOccupancy(QDate(2023, 2, 14), QDate(2023, 2, 14)), QVector<int>() << 2);
+    QCOMPARE(calendar->dayOccupancy(QDate(2023, 1, 31), QDate(2023, 1, 31)), QVector<int>() << 0);
+    QVERIFY(calendar->deleteEvent(extra));
+    QCOMPARE(calendar->dayOccupancy(QDate(2023, 2, 14), QDate(2023, 2, 14)), QVector<int>() << 1);
+
+    // Hidden notebooks are not counted.
+    QVERIFY(calendar->updateNotebook(work, false));
+    QCOMPARE(calendar->dayOccupancy(QDate(2023, 2, 13), QDate(2023, 2, 14)), QVector<int>() << 0 << 1);
+
+    // Notebook moves, visibility and filter changes drop the cache.
+    QVERIFY(calendar->setNotebook(weekend, work));
+    QCOMPARE(calendar->dayOccupancy(QDate(2023, 2, 13), QDate(2023, 2, 14)), QVector<int>() << 0 << 0);
+    QVERIFY(calendar->updateNotebook(work, true));
+    QCOMPARE(calendar->dayOccupancy(QDate(2023, 2, 13), QDate(2023, 2, 14)), QVector<int>() << 1 << 1);
+    KCalendarCore::CalFilter filter;
+    filter.setCriteria(KCalendarCore::CalFilter::ShowCategories);
+    filter.setCategoryList(QStringList() << QStringLiteral("occupancy"));
+    weekend->setCategories(QStringList() << QStringLiteral("occupancy"));
+    calendar->setFilter(&filter);
+    QCOMPARE(calendar->dayOccupancy(QDate(2023, 2, 13), QDate(2023, 2, 14)), QVector<int>() << 0 << 1);
+    calendar->setFilter(nullptr);
+    QCOMPARE(calendar->dayOccupancy(QDate(2023, 2, 13), QDate(2023, 2, 14)), QVector<int>() << 1 << 1);
+}
+
+void tst_storage::tst_busyIntervals()
+{
+    const QTimeZone tz("Europe/Helsinki");
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(tz));
+    const QString work = QStringLiteral("busy-work");
+    const QString home = QStringLiteral("busy-home");
+    QVERIFY(calendar->addNotebook(work, true));
+    QVERIFY(calendar->addNotebook(home, true));
+
+    const QDate day(2023, 6, 12);
+    auto addEvent = [&] (const QTime &start, const QTime &end, const QString &notebook)
+        -> KCalendarCore::Event::Ptr {
+        KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+        event->setDtStart(QDateTime(day, start, tz));
+        event->setDtEnd(QDateTime(day, end, tz));
+        calendar->addEvent(event, notebook);
+        return event;
+    };
+    // Two overlapping meetings, an adjacent one, a free one,
+    // a cancelled one and an evening event in another notebook.
+    const KCalendarCore::Event::Ptr standup = addEvent(QTime(9, 0), QTime(10, 0), work);
+    addEvent(QTime(9, 30), QTime(11, 0), work);
+    addEvent(QTime(11, 0), QTime(11, 30), work);
+    addEvent(QTime(13, 0), QTime(14, 0), work)->setTransparency(KCalendarCore::Event::Transparent);
+    addEvent(QTime(15, 0), QTime(16, 0), work)->setStatus(KCalendarCore::Incidence::StatusCanceled);
+    const KCalendarCore::Event::Ptr dinner = addEvent(QTime(18, 0), QTime(20, 0), home);
+
+    const QDateTime start(day, QTime(8, 0), tz);
+    const QDateTime end(day, QTime(19, 0), tz);
+    KCalendarCore::Period::List periods = calendar->busyIntervals(start, end);
+    QCOMPARE(periods.count(), 2);
+    QCOMPARE(periods[0].start(), QDateTime(day, QTime(9, 0), tz));
+    QCOMPARE(periods[0].end(), QDateTime(day, QTime(11, 30), tz));
+    QCOMPARE(periods[1].start(), QDateTime(day, QTime(18, 0), tz));
+    QCOMPARE(periods[1].end(), end);
+
+    periods = calendar->busyIntervals(start, end, QStringList() << home);
+    QCOMPARE(periods.count(), 1);
+    QCOMPARE(periods[0].start(), QDateTime(day, QTime(18, 0), tz));
+
+    // Conflicts of a new event, moved along the day.
+    KCalendarCore::Event::Ptr meeting(new KCalendarCore::Event);
+    meeting->setDtStart(QDateTime(day, QTime(8, 0), tz));
+    meeting->setDtEnd(QDateTime(day, QTime(9, 0), tz));
+    QVERIFY(calendar->conflicts(meeting).isEmpty());
+    meeting->setDtStart(QDateTime(day, QTime(9, 45), tz));
+    meeting->setDtEnd(QDateTime(day, QTime(10, 15), tz));
+    QCOMPARE(calendar->conflicts(meeting).count(), 2);
+    meeting->setDtStart(QDateTime(day, QTime(13, 0), tz));
+    meeting->setDtEnd(QDateTime(day, QTime(16, 0), tz));
+    QVERIFY(calendar->conflicts(meeting).isEmpty());
+    meeting->setDtStart(QDateTime(day, QTime(19, 0), tz));
+    meeting->setDtEnd(QDateTime(day, QTime(21, 0), tz));
+    QCOMPARE(calendar->conflicts(meeting), KCalendarCore::Incidence::List() << dinner);
+    QVERIFY(calendar->conflicts(meeting, QStringList() << work).isEmpty());
+
+    // An event does not conflict with itself.
+    QVERIFY(calendar->conflicts(dinner).isEmpty());
+    QCOMPARE(calendar->conflicts(standup).count(), 1);
+}
+
+void tst_storage::tst_todoBuckets()
+{
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(QTimeZone::utc()));
+    const QString notebook = QStringLiteral("todo-buckets");
+    QVERIFY(calendar->addNotebook(notebook, true));
+
+    const QDateTime due(QDate(2023, 3, 1), QTime(12, 0), Qt::UTC);
+    KCalendarCore::Todo::Ptr open(new KCalendarCore::Todo);
+    open->setDtDue(due);
+    QVERIFY(calendar->addTodo(open, notebook));
+    KCalendarCore::Todo::Ptr undated(new KCalendarCore::Todo);
+    QVERIFY(calendar->addTodo(undated, notebook));
+    KCalendarCore::Todo::Ptr located(new KCalendarCore::Todo);
+    located->setDtDue(due);
+    located->setHasGeo(true);
+    located->setGeoLatitude(60.17f);
+    located->setGeoLongitude(24.94f);
+    QVERIFY(calendar->addTodo(located, notebook));
+    KCalendarCore::Todo::Ptr done(new KCalendarCore::Todo);
+    done->setDtDue(due);
+    done->setCompleted(due);
+    QVERIFY(calendar->addTodo(done, notebook));
+
+    QCOMPARE(calendar->uncompletedTodos(true, -1).count(), 2);
+    QCOMPARE(calendar->uncompletedTodos(true, 0), KCalendarCore::Todo::List() << open);
+    QCOMPARE(calendar->uncompletedTodos(true, 1), KCalendarCore::Todo::List() << located);
+    QCOMPARE(calendar->uncompletedTodos(false, -1), KCalendarCore::Todo::List() << undated);
+    QCOMPARE(calendar->completedTodos(true, -1), KCalendarCore::Todo::List() << done);
+    QVERIFY(calendar->completedTodos(false, -1).isEmpty());
+
+    // Modifications move todos between buckets.
+    open->setCompleted(due);
+    QCOMPARE(calendar->uncompletedTodos(true, -1), KCalendarCore::Todo::List() << located);
+    QCOMPARE(calendar->completedTodos(true, -1).count(), 2);
+    undated->setDtDue(due);
+    QVERIFY(calendar->uncompletedTodos(false, -1).isEmpty());
+    QCOMPARE(calendar->uncompletedTodos(true, -1).count(), 2);
+    located->setHasGeo(false);
+    QCOMPARE(calendar->uncompletedTodos(true, 0).count(), 2);
+    QVERIFY(calendar->uncompletedTodos(true, 1).isEmpty());
+
+    // Dateless incidences, selected on their creation date.
+    KCalendarCore::Todo::Ptr note(new KCalendarCore::Todo);
+    note->setCreated(due);
+    QVERIFY(calendar->addTodo(note, notebook));
+    QCOMPARE(calendar->incidences(false, due.addDays(-1), due.addDays(1)),
+             KCalendarCore::Incidence::List() << note);
+    QVERIFY(calendar->incidences(false, due.addDays(1), due.addDays(2)).isEmpty());
+
+    QVERIFY(calendar->deleteTodo(located));
+    QCOMPARE(calendar->uncompletedTodos(true, -1), KCalendarCore::Todo::List() << undated);
+    calendar->close();
+    QVERIFY(calendar->uncompletedTodos(true, -1).isEmpty());
+}
+
+void tst_storage::tst_geoIndex()
+{
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(QTimeZone::utc()));
+    const QString notebook = QStringLiteral("geo-index");
+    QVERIFY(calendar->addNotebook(notebook, true));
+
+    // A mesh of events every 0.5 degree around Helsinki.
+    KCalendarCore::Event::List events;
+    for (int i = 0; i < 20; i++) {
+        for (int j = 0; j < 20; j++) {
+            KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+            event->setDtStart(QDateTime(QDate(2023, 1, 1), QTime(12, 0), Qt::UTC));
+            event->setHasGeo(true);
+            event->setGeoLatitude(55.f + 0.5f * i);
+            event->setGeoLongitude(20.f + 0.5f * j);
+            QVERIFY(calendar->addEvent(event, notebook));
+            events.append(event);
+        }
+    }
+    KCalendarCore::Event::Ptr nowhere(new KCalendarCore::Event);
+    nowhere->setDtStart(QDateTime(QDate(2023, 1, 1), QTime(12, 0), Qt::UTC));
+    QVERIFY(calendar->addEvent(nowhere, notebook));
+    QCOMPARE(calendar->geoIncidences().count(), 400);
+
+    auto check = [&] (float latitude, float longitude, float diffLatitude, float diffLongitude)
+        -> bool {
+        int expected = 0;
+        for (const KCalendarCore::Event::Ptr &event : events) {
+            if (event->hasGeo()
+                && qAbs(event->geoLatitude() - latitude) <= diffLatitude
+                && qAbs(event->geoLongitude() - longitude) <= diffLongitude) {
+                expected += 1;
+            }
+        }
+        return calendar->geoIncidences(latitude, longitude, diffLatitude, diffLongitude).count() == expected;
+    };
+    QVERIFY(check(60.f, 25.f, 1.f, 1.f));
+    QVERIFY(check(60.2f, 24.9f, 0.3f, 0.6f));
+    QVERIFY(check(0.f, 0.f, 1.f, 1.f));
+    QVERIFY(check(60.f, 25.f, 90.f, 180.f));
+    QCOMPARE(calendar->geoIncidences(60.f, 25.f, 0.f, 0.f).count(), 1);
+
+    // Removals and moves keep the index consistent.
+    for (int i = 0; i < events.count(); i += 2) {
+        QVERIFY(calendar->deleteEvent(events[i]));
+    }
+    events[1]->setGeoLatitude(0.f);
+    events[1]->setGeoLongitude(0.f);
+    events[3]->setHasGeo(false);
+    QCOMPARE(calendar->geoIncidences().count(), 199);
+    for (int i = 0; i < events.count(); i += 2) {
+        events[i]->setHasGeo(false);
+    }
+    QVERIFY(check(60.f, 25.f, 1.f, 1.f));
+    QVERIFY(check(0.f, 0.f, 1.f, 1.f));
+    QCOMPARE(calendar->geoIncidences(0.f, 0.f, 0.f, 0.f), KCalendarCore::Incidence::List() << events[1]);
+}
+
+void tst_storage::tst_duplicateIndex()
+{
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(QTimeZone::utc()));
+    const QString notebook = QStringLiteral("duplicate-index");
+    QVERIFY(calendar->addNotebook(notebook, true));
+
+    const QDateTime dt(QDate(2023, 4, 1), QTime(10, 0), Qt::UTC);
+    auto event = [&] (const QString &summary, const QDateTime &start) -> KCalendarCore::Incidence::Ptr {
+        KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+        event->setSummary(summary);
+        event->setDtStart(start);
+        return event;
+    };
+    KCalendarCore::Incidence::List list;
+    list << event(QStringLiteral("Breakfast"), dt)
+         << event(QStringLiteral("Lunch"), dt.addSecs(3 * 3600))
+         << event(QStringLiteral("Dinner"), dt.addSecs(9 * 3600));
+    QCOMPARE(calendar->addIncidences(&list, notebook, true).count(), 3);
+
+    // The same summary and start time in another time zone is a duplicate.
+    KCalendarCore::Incidence::List imported;
+    imported << event(QStringLiteral("Breakfast"), dt.toTimeZone(QTimeZone("Europe/Helsinki")))
+             << event(QStringLiteral("Lunch"), dt)
+             << event(QStringLiteral("Snack"), dt.addSecs(6 * 3600));
+    QCOMPARE(calendar->addIncidences(&imported, notebook, false),
+             KCalendarCore::Incidence::List() << imported[1] << imported[2]);
+    QCOMPARE(calendar->rawEvents().count(), 5);
+
+    // Duplicates are replaced when removal is enabled, even after a change.
+    list[2]->setSummary(QStringLiteral("Supper"));
+    imported.clear();
+    imported << event(QStringLiteral("Supper"), dt.addSecs(9 * 3600));
+    QCOMPARE(calendar->addIncidences(&imported, notebook, true).count(), 1);
+    QCOMPARE(calendar->rawEvents().count(), 5);
+    QVERIFY(!calendar->event(list[2]->uid()));
+    QVERIFY(calendar->event(imported[0]->uid()));
+}
+
+void tst_storage::tst_loadedRanges()
+{
+    const QDate january(2024, 1, 10);
+    const QDate march(2024, 3, 10);
+    const QDate june(2024, 6, 10);
+    QStringList uids;
+    for (const QDate &date : {january, march, june}) {
+        KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+        event->setSummary(QStringLiteral("loaded ranges"));
+        event->setDtStart(QDateTime(date, QTime(12, 0)));
+        event->setDtEnd(QDateTime(date, QTime(13, 0)));
+        QVERIFY(m_calendar->addEvent(event, NotebookId));
+        uids.append(event->uid());
+    }
+    QVERIFY(m_storage->save());
+
+    reloadDb(QDate(2024, 1, 1), QDate(2024, 2, 1));
+    QVERIFY(m_storage->load(QDate(2024, 6, 1), QDate(2024, 7, 1)));
+    QVERIFY(m_calendar->event(uids[0]));
+    QVERIFY(!m_calendar->event(uids[1]));
+    QVERIFY(m_calendar->event(uids[2]));
+
+    // The gap between January and June is still to be loaded,
+    // and nothing is left to load afterwards.
+    QVERIFY(m_storage->load(QDate(2024, 1, 1), QDate(2024, 7, 1)));
+    QVERIFY(m_calendar->event(uids[1]));
+    QVERIFY(!m_storage->load(QDate(2024, 2, 1), QDate(2024, 6, 15)));
+
+    for (const QString &uid : uids) {
+        QVERIFY(m_calendar->deleteIncidence(m_calendar->incidence(uid)));
+    }
+    QVERIFY(m_storage->save());
+}
+
+void tst_storage::tst_loadedQueries()
+{
+    const QDate january(2024, 1, 10);
+    const QDate february(2024, 2, 10);
+    const QDate march(2024, 3, 10);
+    QStringList uids;
+    for (const QDate &date : {january, february, march}) {
+        KCalendarCore::Journal::Ptr journal(new KCalendarCore::Journal);
+        journal->setSummary(QStringLiteral("loaded queries"));
+        journal->setDtStart(QDateTime(date, QTime(12, 0)));
+        QVERIFY(m_calendar->addJournal(journal, NotebookId));
+        uids.append(journal->uid());
+    }
+    QVERIFY(m_storage->save());
+
+    reloadDb(QDate(2000, 1, 1), QDate(2000, 1, 2));
+    // A page ends after the first date change once the limit is reached.
+    QDateTime last;
+    QCOMPARE(m_storage->loadJournals(1, &last), 2);
+    QVERIFY(m_calendar->journal(uids[2]));
+    QVERIFY(m_calendar->journal(uids[1]));
+    QVERIFY(!m_calendar->journal(uids[0]));
+    QCOMPARE(last.date(), february);
+
+    // Starting again from the top continues after the pages already loaded.
+    last = QDateTime();
+    QCOMPARE(m_storage->loadJournals(1, &last), 1);
+    QVERIFY(m_calendar->journal(uids[0]));
+    QCOMPARE(last.date(), january);
+
+    last = QDateTime();
+    QCOMPARE(m_storage->loadJournals(1, &last), 0);
+    QCOMPARE(last.date(), january);
+
+    // Everything is loaded, whatever the starting point.
+    last = QDateTime();
+    QCOMPARE(m_storage->loadJournals(1, &last), 0);
+    QVERIFY(!last.isValid());
+    last = QDateTime(february, QTime(12, 0));
+    QCOMPARE(m_storage->loadJournals(1, &last), 0);
+
+    for (const QString &uid : uids) {
+        QVERIFY(m_calendar->deleteIncidence(m_calendar->incidence(uid)));
+    }
+    QVERIFY(m_storage->save());
+}
+
+void tst_storage::tst_evict()
+{
+    const QDate january(2024, 1, 10);
+    const QDate march(2024, 3, 10);
+    const QDate june(2024, 6, 10);
+    QStringList uids;
+    for (const QDate &date : {january, march, june}) {
+        KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+        event->setSummary(QStringLiteral("evict"));
+        event->setDtStart(QDateTime(date, QTime(12, 0)));
+        event->setDtEnd(QDateTime(date, QTime(13, 0)));
+        QVERIFY(m_calendar->addEvent(event, NotebookId));
+        uids.append(event->uid());
+    }
+    QVERIFY(m_storage->save());
+
+    reloadDb(QDate(2024, 1, 1), QDate(2024, 7, 1));
+    QVERIFY(m_calendar->event(uids[0]));
+    QVERIFY(m_calendar->event(uids[1]));
+    QVERIFY(m_calendar->event(uids[2]));
+    QCOMPARE(m_storage->evict(march), 0);
+
+    // Unloading is not reported as a deletion.
+    struct Observer : public KCalendarCore::Calendar::CalendarObserver,
+                      public ExtendedStorageObserver {
+        QStringList deleted;
+        QStringList unloaded;
+        void calendarIncidenceDeleted(const KCalendarCore::Incidence::Ptr &incidence,
+                                      const KCalendarCore::Calendar *calendar)
+        {
+            Q_UNUSED(calendar);
+            deleted.append(incidence->uid());
+        }
+        void storageModified(ExtendedStorage *storage, const QString &info)
+        {
+            Q_UNUSED(storage);
+            Q_UNUSED(info);
+        }
+        void storageProgress(ExtendedStorage *storage, const QString &info)
+        {
+            Q_UNUSED(storage);
+            Q_UNUSED(info);
+        }
+        void storageFinished(ExtendedStorage *storage, bool error, const QString &info)
+        {
+            Q_UNUSED(storage);
+            Q_UNUSED(error);
+            Q_UNUSED(info);
+        }
+        void storageUnloaded(ExtendedStorage *storage,
+                             const KCalendarCore::Incidence::List &incidences)
+        {
+            Q_UNUSED(storage);
+            for (const KCalendarCore::Incidence::Ptr &incidence : incidences) {
+                unloaded.append(incidence->uid());
+            }
+        }
+    } observer;
+    m_calendar->registerObserver(&observer);
+    m_storage->registerObserver(&observer);
+
+    // Keep one month around March, a modified incidence stays.
+    m_calendar->event(uids[2])->setSummary(QStringLiteral("modified"));
+    m_storage->setLoadWindow(1);
+    const int evicted = m_storage->evict(march);
+    m_calendar->unregisterObserver(&observer);
+    m_storage->unregisterObserver(&observer);
+    QCOMPARE(evicted, 1);
+    QVERIFY(!m_calendar->event(uids[0]));
+    QVERIFY(m_calendar->event(uids[1]));
+    QVERIFY(m_calendar->event(uids[2]));
+    QVERIFY(m_calendar->deletedIncidences().isEmpty());
+    QVERIFY(observer.deleted.isEmpty());
+    QCOMPARE(observer.unloaded, QStringList() << uids[0]);
+    QVERIFY(m_storage->save());
+
+    // Unloaded dates are loaded again on demand.
+    QVERIFY(m_storage->load(QDate(2024, 1, 1), QDate(2024, 2, 1)));
+    QVERIFY(m_calendar->event(uids[0]));
+    QVERIFY(!m_storage->load(QDate(2024, 2, 1), QDate(2024, 4, 1)));
+
+    // Least recently used months go first, January was asked for
+    // before March.
+    m_storage->setLoadWindow(0);
+    m_storage->setMaxLoadedIncidences(m_calendar->rawIncidences().count() - 1);
+    QCOMPARE(m_storage->evict(june), 1);
+    QVERIFY(!m_calendar->event(uids[0]));
+    QVERIFY(m_calendar->event(uids[1]));
+    QVERIFY(m_calendar->event(uids[2]));
+    QVERIFY(m_storage->load(QDate(2024, 1, 1), QDate(2024, 2, 1)));
+    QVERIFY(m_calendar->event(uids[0]));
+
+    reloadDb();
+    for (const QString &uid : uids) {
+        QVERIFY(m_calendar->deleteIncidence(m_calendar->incidence(uid)));
+    }
+    QVERIFY(m_storage->save());
+}
+
+void tst_storage::tst_keysetPages()
+{
+    // Journals sharing the same date, paged without duplicates or gaps.
+    const QDateTime date(QDate(2024, 5, 10), QTime(12, 0));
+    QStringList uids;
+    for (int i = 0; i < 5; i++) {
+        KCalendarCore::Journal::Ptr journal(new KCalendarCore::Journal);
+        journal->setSummary(QStringLiteral("keyset pages"));
+        journal->setDtStart(date);
+        journal->setCreated(date);
+        QVERIFY(m_calendar->addJournal(journal, NotebookId));
+        uids.append(journal->uid());
+    }
+    QVERIFY(m_storage->save());
+
+    reloadDb(QDate(2000, 1, 1), QDate(2000, 1, 2));
+    QByteArray token;
+    int rows = 0;
+    int count;
+    do {
+        count = m_storage->loadJournals(2, &token);
+        QVERIFY(count >= 0);
+        QVERIFY(!token.isEmpty());
+        rows += count;
+    } while (count == 2);
+    QCOMPARE(rows, m_calendar->rawJournals().count());
+    for (const QString &uid : uids) {
+        QVERIFY(m_calendar->journal(uid));
+    }
+    QCOMPARE(m_storage->loadJournals(2, &token), 0);
+
+    QByteArray invalid("not a token");
+    QCOMPARE(m_storage->loadJournals(2, &invalid), -1);
+
+    for (const QString &uid : uids) {
+        QVERIFY(m_calendar->deleteIncidence(m_calendar->incidence(uid)));
+    }
+    QVERIFY(m_storage->save());
+}
+
+void tst_storage::tst_pipelinedLoad()
+{
+    // More events than one decoding batch, with details in every
+    // children table, loaded by worker threads.
+    const QDateTime date(QDate(2024, 6, 3), QTime(9, 0), QTimeZone::systemTimeZone());
+    QStringList uids;
+    for (int i = 0; i < 150; i++) {
+        KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+        event->setSummary(QStringLiteral("pipelined %1").arg(i));
+        event->setDtStart(date.addDays(i));
+        event->setDtEnd(date.addDays(i).addSecs(3600));
+        event->setNonKDECustomProperty("X-TEST-INDEX", QString::number(i));
+        event->addAttendee(KCalendarCore::Attendee(QStringLiteral("Alice"),
+                                                   QStringLiteral("alice@example.org")));
+        KCalendarCore::Alarm::Ptr alarm = event->newAlarm();
+        alarm->setType(KCalendarCore::Alarm::Display);
+        alarm->setText(QStringLiteral("reminder"));
+        alarm->setStartOffset(KCalendarCore::Duration(-600));
+        alarm->setEnabled(true);
+        event->recurrence()->setDaily(1);
+        event->recurrence()->setDuration(i + 2);
+        event->recurrence()->addExDateTime(date.addDays(i + 1));
+        QVERIFY(m_calendar->addEvent(event, NotebookId));
+        uids.append(event->uid());
+    }
+    QVERIFY(m_storage->save());
+
+    reloadDb();
+    for (int i = 0; i < uids.count(); i++) {
+        KCalendarCore::Event::Ptr event = m_calendar->event(uids[i]);
+        QVERIFY(event);
+        QCOMPARE(event->summary(), QStringLiteral("pipelined %1").arg(i));
+        QCOMPARE(event->dtStart(), date.addDays(i));
+        QCOMPARE(event->nonKDECustomProperty("X-TEST-INDEX"), QString::number(i));
+        QCOMPARE(event->attendees().count(), 1);
+        QCOMPARE(event->attendees().first().email(), QStringLiteral("alice@example.org"));
+        QCOMPARE(event->alarms().count(), 1);
+        QCOMPARE(event->alarms().first()->text(), QStringLiteral("reminder"));
+        QVERIFY(event->recurs());
+        QCOMPARE(event->recurrence()->duration(), i + 2);
+        QCOMPARE(event->recurrence()->exDateTimes().count(), 1);
+    }
+
+    for (const QString &uid : uids) {
+        QVERIFY(m_calendar->deleteIncidence(m_calendar->incidence(uid)));
+    }
+    QVERIFY(m_storage->save());
+}
+
+void tst_storage::tst_parallelNotebookLoad()
+{
+    // Notebooks read concurrently, each with its own connection.
+    const QDateTime date(QDate(2024, 7, 1), QTime(10, 0), QTimeZone::systemTimeZone());
+    QStringList notebookUids;
+    QStringList uids;
+    for (int i = 0; i < 3; i++) {
+        Notebook::Ptr notebook(new Notebook(QStringLiteral("parallel %1").arg(i), QString()));
+        QVERIFY(m_storage->addNotebook(notebook));
+        notebookUids.append(notebook->uid());
+        for (int j = 0; j < 10; j++) {
+            KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+            event->setSummary(QStringLiteral("parallel %1 %2").arg(i).arg(j));
+            event->setDtStart(date.addDays(j * 30));
+            event->setDtEnd(date.addDays(j * 30).addSecs(3600));
+            event->addAttendee(KCalendarCore::Attendee(QStringLiteral("Bob"),
+                                                       QStringLiteral("bob@example.org")));
+            QVERIFY(m_calendar->addEvent(event, notebook->uid()));
+            uids.append(event->uid());
+        }
+    }
+    QVERIFY(m_storage->save());
+
+    reloadDb(QDate(2000, 1, 1), QDate(2000, 1, 2));
+    QVERIFY(m_storage->loadNotebooksIncidences(notebookUids,
+                                               date.date(), date.date().addDays(65)));
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 10; j++) {
+            KCalendarCore::Event::Ptr event = m_calendar->event(uids[i * 10 + j]);
+            QCOMPARE(bool(event), j < 3);
+            if (event) {
+                QCOMPARE(m_calendar->notebook(event), notebookUids[i]);
+            }
+        }
+    }
+
+    QVERIFY(m_storage->loadNotebooksIncidences(notebookUids));
+    for (int i = 0; i < uids.count(); i++) {
+        KCalendarCore::Event::Ptr event = m_calendar->event(uids[i]);
+        QVERIFY(event);
+        QCOMPARE(event->summary(), QStringLiteral("parallel %1 %2").arg(i / 10).arg(i % 10));
+        QCOMPARE(event->attendees().count(), 1);
+        QCOMPARE(m_calendar->notebook(event), notebookUids[i / 10]);
+    }
+
+    for (const QString &notebookUid : notebookUids) {
+        QVERIFY(m_storage->deleteNotebook(m_storage->notebook(notebookUid)));
+    }
+}
+
+void tst_storage::tst_threadedQueries()
+{
+    KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+    event->setSummary(QStringLiteral("threaded queries"));
+    event->setDtStart(QDateTime(QDate(2024, 8, 1), QTime(8, 0), QTimeZone::systemTimeZone()));
+    QVERIFY(m_calendar->addEvent(event, NotebookId));
+    QVERIFY(m_storage->save());
+
+    const int events = m_storage->eventCount();
+    QVERIFY(events > 0);
+    ExtendedStorage::Ptr storage = m_storage;
+    QList<QFuture<int> > counts;
+    QList<QFuture<bool> > found;
+    for (int i = 0; i < 4; i++) {
+        counts.append(QtConcurrent::run([storage] {
+            return storage->eventCount();
+        }));
+        found.append(QtConcurrent::run([storage, event] () -> bool {
+            KCalendarCore::Incidence::List list;
+            if (!storage->allIncidences(&list, NotebookId)) {
+                return false;
+            }
+            for (const KCalendarCore::Incidence::Ptr &incidence : list) {
+                if (incidence->uid() == event->uid()) {
+                    return true;
+                }
+            }
+            return false;
+        }));
+    }
+    for (QFuture<int> &count : counts) {
+        QCOMPARE(count.result(), events);
+    }
+    for (QFuture<bool> &result : found) {
+        QVERIFY(result.result());
+    }
+
+    // Connections are opened again after being closed.
+    QSharedPointer<SqliteStorage> sqlite = m_storage.staticCast<SqliteStorage>();
+    QCOMPARE(QtConcurrent::run([sqlite] {
+        const int count = sqlite->eventCount();
+        sqlite->closeThreadConnection();
+        return count == sqlite->eventCount() ? count : -1;
+    }).result(), events);
+    QVERIFY(m_storage->close());
+    QVERIFY(m_storage->open());
+    QCOMPARE(QtConcurrent::run([storage] {
+        return storage->eventCount();
+    }).result(), events);
+
+    QVERIFY(m_calendar->deleteIncidence(event));
+    QVERIFY(m_storage->save());
+}
+
+void tst_storage::tst_readOnlyOpen()
+{
+    KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+    event->setSummary(QStringLiteral("read-only open"));
+    event->setDtStart(QDateTime(QDate(2024, 9, 1), QTime(8, 0), QTimeZone::systemTimeZone()));
+    QVERIFY(m_calendar->addEvent(event, NotebookId));
+    QVERIFY(m_storage->save());
+
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(QTimeZone::systemTimeZone()));
+    SqliteStorage::Ptr storage(new SqliteStorage(calendar,
+                                                 m_storage.staticCast<SqliteStorage>()->databaseName()));
+    QVERIFY(storage->openReadOnly());
+    QVERIFY(storage->isReadOnly());
+    QVERIFY(storage->notebook(NotebookId));
+    QVERIFY(storage->load(event->uid()));
+    KCalendarCore::Event::Ptr loaded = calendar->event(event->uid());
+    QVERIFY(loaded);
+    QCOMPARE(loaded->summary(), event->summary());
+    QCOMPARE(storage->eventCount(), m_storage->eventCount());
+
+    // Nothing can be written back.
+    loaded->setSummary(QStringLiteral("modified"));
+    QVERIFY(!storage->save());
+    Notebook::Ptr notebook(new Notebook(QStringLiteral("read-only"), QString()));
+    QVERIFY(!storage->addNotebook(notebook));
+    QVERIFY(!storage->applyChanges(NotebookId, KCalendarCore::Incidence::List() << loaded,
+                                   KCalendarCore::Incidence::List()));
+    QVERIFY(storage->close());
+    QVERIFY(!storage->isReadOnly());
+
+    reloadDb();
+    QCOMPARE(m_calendar->event(event->uid())->summary(), QStringLiteral("read-only open"));
+    QVERIFY(m_calendar->deleteIncidence(m_calendar->event(event->uid())));
+    QVERIFY(m_storage->save());
+}
+
+void tst_storage::tst_readSession()
+{
+    ExtendedCalendar::Ptr calendar(new ExtendedCalendar(QTimeZone::systemTimeZone()));
+    SqliteStorage::Ptr storage(new SqliteStorage(calendar,
+                                                 m_storage.staticCast<SqliteStorage>()->databaseName()));
+    QVERIFY(storage->openReadOnly());
+
+    QVERIFY(storage->beginRead());
+    QVERIFY(storage->beginRead());
+    const int events = storage->eventCount();
+
+    // Saved while the session is running.
+    KCalendarCore::Event::Ptr event(new KCalendarCore::Event);
+    event->setSummary(QStringLiteral("read session"));
+    event->setDtStart(QDateTime(QDate(2024, 10, 1), QTime(8, 0), QTimeZone::systemTimeZone()));
+    QVERIFY(m_calendar->addEvent(event, NotebookId));
+    QVERIFY(m_storage->save());
+    QCOMPARE(m_storage->eventCount(), events + 1);
+
+    // The outer session still sees the storage as it was.
+    QVERIFY(storage->endRead());
+    QCOMPARE(storage->eventCount(), events);
+    QVERIFY(storage->load(event->uid()));
+    QVERIFY(!calendar->event(event->uid()));
+    QVERIFY(storage->endRead());
+    QVERIFY(!storage->endRead());
+
+    QCOMPARE(storage->eventCount(), events + 1);
+    QVERIFY(storage->load(event->uid()));
+    QVERIFY(calendar->event(event->uid()));
+    QVERIFY(storage->close());
+
+    // Nothing is saved during a session.
+    QVERIFY(m_storage->beginRead());
+    QVERIFY(m_storage->load(event->uid()));
+    // Other threads are not blocked by the session.
+    ExtendedStorage::Ptr threaded = m_storage;
+    QFuture<int> count = QtConcurrent::run([threaded] {
+        return threaded->eventCount();
+    });
+    QCOMPARE(count.result(), events + 1);
+    QVERIFY(m_calendar->deleteIncidence(m_calendar->event(event->uid())));
+    QVERIFY(!m_storage->save());
+    QVERIFY(m_storage->endRead());
+    QVERIFY(m_storage->save());
+
+    // Without write ahead log, sessions are plain transactions.
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString path = dir.filePath(QStringLiteral("rollback.db"));
+    ExtendedCalendar::Ptr rollbackCalendar(new ExtendedCalendar(QTimeZone::systemTimeZone()));
+    SqliteStorage::Ptr rollback(new SqliteStorage(rollbackCalendar, path));
+    QVERIFY(rollback->open());
+    QVERIFY(rollback->close());
+    sqlite3 *database = nullptr;
+    QCOMPARE(sqlite3_open(path.toUtf8(), &database), SQLITE_OK);
+    QCOMPARE((sqlite3_exec)(database, "PRAGMA journal_mode = DELETE", NULL, NULL, NULL), SQLITE_OK);
+    sqlite3_close(database);
+    QVERIFY(rollback->openReadOnly());
+    QVERIFY(rollback->beginRead());
+    QCOMPARE(rollback->eventCount(), 0);
+    QVERIFY(rollback->endRead());
+    QVERIFY(rollback->close());
+}
+
 void tst_storage::openDb(bool clear)
 {
     m_calendar = ExtendedCalendar::Ptr(new ExtendedCalendar(QTimeZone::systemTimeZone()));
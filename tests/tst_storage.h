@@ -77,6 +77,32 @@ private slots:
     void tst_color();
     void tst_addIncidence();
     void tst_attachments();
+    void tst_applyChanges();
+    void tst_manifest();
+    void tst_loadHeaderOnly();
+    void tst_headerOnlyAlarms();
+    void tst_largeAttachments();
+    void tst_attachmentStore();
+    void tst_intervalIndex();
+    void tst_occurrenceIterator();
+    void tst_parallelExpansion();
+    void tst_recurrenceTimesCache();
+    void tst_expansionAcrossTransitions();
+    void tst_occurrenceTable();
+    void tst_dayOccupancy();
+    void tst_busyIntervals();
+    void tst_todoBuckets();
+    void tst_geoIndex();
+    void tst_duplicateIndex();
+    void tst_loadedRanges();
+    void tst_loadedQueries();
+    void tst_evict();
+    void tst_keysetPages();
+    void tst_pipelinedLoad();
+    void tst_parallelNotebookLoad();
+    void tst_threadedQueries();
+    void tst_readOnlyOpen();
+    void tst_readSession();
 
 private:
     void openDb(bool clear = false);